@@ -0,0 +1,397 @@
+/*
+ * console_sim.c:
+ *
+ * Host simulation of the kernel's console (see kern/console.h). Processes
+ * write bursts of lines through the kernel's own console code, which feeds a
+ * stand-in for the UART sending at 115200 baud in simulated time (see
+ * uart_host.h); a reader process takes bytes received at random moments. The
+ * simulation steps time forward, letting each process that is not blocked
+ * act.
+ *
+ * Every line names its writer and its number, followed by a pattern derived
+ * from both. Checked:
+ *  - every byte written is sent, and every byte received is read, in order,
+ *  - lines from each writer come out in the order written, and only lines a
+ *    writer had to append in pieces, having filled its ring, can come out
+ *    torn by another's,
+ *  - a process blocked is woken, and rings are given back on exit and can
+ *    then be taken again.
+ *
+ * Reported is the time a write takes, against the time sending its bytes
+ * from the writer would have taken, and how often writers found their ring
+ * full.
+ *
+ *      console_sim [-d simulated ms] [-w writers] [-b lines per burst]
+ *                  [-g mean ms between bursts] [-s seed]
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "console.h"
+#include "palloc.h"
+#include "process.h"
+#include "spawn_host.h"
+#include "sram.h"
+#include "uart_host.h"
+#include "zalloc.h"
+
+#define STACK_SIZE      512
+#define MAX_WRITERS     CONSOLE_N_RINGS
+#define MAX_LINE        120
+#define STEP_US         10
+#define RX_CHUNK_MAX    24
+
+typedef struct {
+    pcb_t      *pcb;
+    uint64_t    next_us;        /* When its next burst starts. */
+    uint32_t    burst_left;     /* Lines of the burst still to write. */
+    char        line[MAX_LINE];
+    uint32_t    len;            /* Of the line being written, or 0. */
+    uint32_t    off;            /* Bytes of it appended. */
+    uint32_t    seq;            /* Number of the line being written. */
+    uint32_t    last_seq;       /* Last intact line seen in the output, plus one. */
+} writer_t;
+
+static uint32_t duration_ms = 2000;
+static uint32_t n_writers = 6;
+static uint32_t burst_lines = 6;
+static uint32_t gap_ms = 40;
+static uint32_t seed = 1;
+
+static writer_t writers[MAX_WRITERS];
+static pcb_t *reader;
+static pcb_t bootstrap_pcb;
+
+static uint32_t rng_state;
+static uint32_t n_violations;
+
+/*
+ * Totals.
+ */
+static uint64_t n_lines, n_split, n_bytes;
+static uint64_t n_writes, write_ns;
+static uint64_t rx_sent, rx_read, rx_latency_max_us;
+static uint64_t rx_sent_at[1 << 16];    /* When each received byte arrived, by number. */
+
+static uint32_t
+rng(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+static void
+violation(const char *what, uint32_t a, uint32_t b)
+{
+    if (n_violations++ < 10) {
+        fprintf(stderr, "console_sim: %s (%u, %u)\n", what, a, b);
+    }
+}
+
+static void
+process_entry(void)
+{
+}
+
+static pcb_t *
+spawn(void)
+{
+    return spawn_host_process("console_sim", SCHED_PRIORITY_DEFAULT, STACK_SIZE, process_entry);
+}
+
+static char
+pattern(uint32_t w, uint32_t seq, uint32_t i)
+{
+    return 'a' + (w * 7 + seq * 3 + i) % 26;
+}
+
+static void
+line_make(writer_t *w)
+{
+    uint32_t id = w - writers;
+    uint32_t payload = rng() % (MAX_LINE - 20);
+    int n = snprintf(w->line, MAX_LINE, "w%u %06u ", id, w->seq);
+    for (uint32_t i = 0; i < payload; i++) {
+        w->line[n + i] = pattern(id, w->seq, i);
+    }
+    w->line[n + payload] = '\n';
+    w->len = n + payload + 1;
+    w->off = 0;
+}
+
+static uint64_t
+host_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/*
+ * Let a writer act, as its system calls would. A writer blocked on its full
+ * ring waits to be woken, then writes again.
+ */
+static void
+writer_step(writer_t *w, uint64_t now_us)
+{
+    if (w->pcb->state != PROC_READY) {
+        return;
+    }
+    if (w->len == 0) {
+        if (w->burst_left == 0) {
+            if (now_us < w->next_us) {
+                return;
+            }
+            w->burst_left = burst_lines;
+        }
+        line_make(w);
+    }
+
+    while (w->off < w->len) {
+        uint64_t start = host_ns();
+        int result = console_write(w->pcb, w->line + w->off, w->len - w->off);
+        write_ns += host_ns() - start;
+        n_writes++;
+        if (result == CONSOLE_BLOCKED) {
+            if (w->pcb->state != PROC_BLOCKED) {
+                violation("writer not blocked on a full ring", w - writers, 0);
+            }
+            return;
+        }
+        if (result <= 0) {
+            violation("write failed", w - writers, (uint32_t)result);
+            w->len = 0;
+            return;
+        }
+        if (w->off == 0 && (uint32_t)result < w->len) {
+            n_split++;
+        }
+        w->off += result;
+    }
+
+    n_lines++;
+    n_bytes += w->len;
+    w->seq++;
+    w->len = 0;
+    if (--w->burst_left == 0) {
+        w->next_us = now_us + rng() % (2 * gap_ms * 1000 + 1);
+    }
+}
+
+/*
+ * Let the reader take what has arrived, checking it is the bytes sent in
+ * order.
+ */
+static void
+reader_step(uint64_t now_us)
+{
+    if (reader->state != PROC_READY) {
+        return;
+    }
+    uint8_t buf[16];
+    int result = console_read(reader, buf, sizeof(buf), 1);
+    if (result == CONSOLE_BLOCKED) {
+        return;
+    }
+    if (result <= 0) {
+        violation("read failed", (uint32_t)result, 0);
+        return;
+    }
+    for (int i = 0; i < result; i++) {
+        if (buf[i] != (uint8_t)rx_read) {
+            violation("byte read out of order", buf[i], (uint32_t)rx_read);
+        }
+        uint64_t latency = now_us - rx_sent_at[rx_read % (1 << 16)];
+        rx_latency_max_us = latency > rx_latency_max_us ? latency : rx_latency_max_us;
+        rx_read++;
+    }
+}
+
+static void
+receive(uint64_t now_us)
+{
+    uint8_t buf[RX_CHUNK_MAX];
+    uint32_t len = 1 + rng() % RX_CHUNK_MAX;
+    for (uint32_t i = 0; i < len; i++) {
+        rx_sent_at[(rx_sent + i) % (1 << 16)] = now_us;
+        buf[i] = (uint8_t)(rx_sent + i);
+    }
+    rx_sent += len;
+    uart_host_receive(buf, len);
+}
+
+/*
+ * Check the output line by line.
+ */
+static uint32_t
+output_check(void)
+{
+    uint32_t n_torn = 0;
+    const char *p = (const char *)uart_host_out;
+    const char *end = p + uart_host_out_len;
+    while (p < end) {
+        const char *nl = memchr(p, '\n', end - p);
+        if (nl == NULL) {
+            violation("output ends in the middle of a line", 0, 0);
+            break;
+        }
+
+        unsigned id, seq;
+        int n;
+        int intact = sscanf(p, "w%u %06u %n", &id, &seq, &n) == 2 && id < n_writers &&
+                     p + n <= nl;
+        for (uint32_t i = 0; intact && p + n + i < nl; i++) {
+            intact = p[n + i] == pattern(id, seq, i);
+        }
+        if (!intact) {
+            n_torn++;
+        } else if (seq < writers[id].last_seq) {
+            violation("line out of order", id, seq);
+        } else {
+            writers[id].last_seq = seq + 1;
+        }
+        p = nl + 1;
+    }
+    return n_torn;
+}
+
+static void
+usage(void)
+{
+    fprintf(stderr, "usage: console_sim [-d simulated ms] [-w writers] [-b lines per burst] "
+                    "[-g mean ms between bursts] [-s seed]\n");
+    exit(2);
+}
+
+int
+main(int argc, char **argv)
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "d:w:b:g:s:h")) != -1) {
+        switch (opt) {
+        case 'd':
+            duration_ms = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'w':
+            n_writers = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'b':
+            burst_lines = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'g':
+            gap_ms = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 's':
+            seed = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        default:
+            usage();
+        }
+    }
+    if (duration_ms == 0 || n_writers == 0 || n_writers >= MAX_WRITERS || burst_lines == 0) {
+        usage();
+    }
+    rng_state = seed ? seed : 1;
+
+    sram_init();
+    sram_reset_heap();
+    zinit();
+    bootstrap_pcb.priority = SCHED_N_PRIORITIES - 1;
+    pcb_active[0] = pcb_active[1] = &bootstrap_pcb;
+    console_init();
+
+    for (uint32_t i = 0; i < n_writers; i++) {
+        writers[i].pcb = spawn();
+        writers[i].next_us = rng() % (gap_ms * 1000 + 1);
+    }
+    reader = spawn();
+
+    uint64_t now_us = 0, next_rx_us = 0;
+    for (; now_us < duration_ms * 1000ull; now_us += STEP_US) {
+        uart_host_run(now_us * 1000);
+        for (uint32_t i = 0; i < n_writers; i++) {
+            writer_step(&writers[i], now_us);
+        }
+        if (now_us >= next_rx_us) {
+            receive(now_us);
+            next_rx_us = now_us + rng() % 20000;
+        }
+        reader_step(now_us);
+    }
+
+    /*
+     * Finish the lines under way, then let the UART drain.
+     */
+    uint64_t stop_us = now_us + 60 * 1000000ull;
+    for (int busy = 1; busy; now_us += STEP_US) {
+        if (now_us >= stop_us) {
+            violation("writers still blocked a minute after the last burst", 0, 0);
+            break;
+        }
+        uart_host_run(now_us * 1000);
+        busy = 0;
+        for (uint32_t i = 0; i < n_writers; i++) {
+            writers[i].burst_left = writers[i].len != 0;
+            writer_step(&writers[i], now_us);
+            busy |= writers[i].len != 0;
+        }
+        reader_step(now_us);
+    }
+    for (; uart_host_out_len < n_bytes && uart_host_out_len < console_stats.n_sent; now_us += STEP_US) {
+        uart_host_run(now_us * 1000);
+    }
+
+    if (uart_host_out_len != n_bytes || console_stats.n_sent != n_bytes) {
+        violation("bytes written and sent differ", (uint32_t)n_bytes, uart_host_out_len);
+    }
+    if (rx_read != rx_sent || console_stats.n_dropped != 0) {
+        violation("bytes received and read differ", (uint32_t)rx_sent, (uint32_t)rx_read);
+    }
+    uint32_t n_torn = output_check();
+    if (n_torn > 2 * n_split) {
+        violation("lines torn that were appended whole", n_torn, (uint32_t)n_split);
+    }
+
+    /*
+     * Exiting gives the rings back, and they can all be taken again.
+     */
+    for (uint32_t i = 0; i < n_writers; i++) {
+        console_release(writers[i].pcb);
+    }
+    console_release(reader);
+    pcb_t *fresh[CONSOLE_N_RINGS + 1];
+    for (uint32_t i = 0; i <= CONSOLE_N_RINGS; i++) {
+        fresh[i] = spawn();
+        int result = console_write(fresh[i], "", 0);
+        if (result != (i < CONSOLE_N_RINGS ? 0 : -1)) {
+            violation("ring not given out as expected", i, (uint32_t)result);
+        }
+    }
+
+    double seconds = now_us / 1e6;
+    printf("%u writers: %llu lines, %llu bytes in %.2f s, UART %.0f%% busy\n", n_writers,
+           (unsigned long long)n_lines, (unsigned long long)n_bytes, seconds,
+           100.0 * n_bytes * uart_host_byte_ns / (now_us * 1000.0));
+    printf("%llu writes, %.0f ns each on the host; sending a line from the writer "
+           "would take %.0f us\n", (unsigned long long)n_writes, (double)write_ns / n_writes,
+           (double)n_bytes / n_lines * uart_host_byte_ns / 1000.0);
+    printf("writers blocked on a full ring %u times; %llu lines appended in pieces, "
+           "%u output lines torn\n", console_stats.n_write_blocked, (unsigned long long)n_split,
+           n_torn);
+    printf("%llu bytes received, reader blocked %u times, worst latency %llu us\n",
+           (unsigned long long)rx_sent, console_stats.n_read_blocked,
+           (unsigned long long)rx_latency_max_us);
+
+    if (n_violations != 0) {
+        printf("FAIL: %u violations, reported above\n", n_violations);
+        return 1;
+    }
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,124 @@
+/*
+ * copy.c:
+ *
+ * Host stand-in for the copy engine (see kern/copy.h and copy_host.h). Jobs
+ * queue as they do for the DMA channel on the target, and are worked through
+ * in simulated time.
+ */
+
+#include "copy.h"
+#include "copy_host.h"
+
+#include <stddef.h>
+#include <string.h>
+
+uint32_t copy_host_copy_rate = 20;      /* Reading XIP flash through its cache. */
+uint32_t copy_host_zero_rate = 500;     /* A word per cycle at 125MHz. */
+
+uint64_t copy_host_ns;
+uint32_t copy_host_jobs;
+uint64_t copy_host_copied;
+uint64_t copy_host_zeroed;
+
+typedef struct {
+    uint8_t        *dst;
+    const uint8_t  *src;
+    uint32_t        len;
+    uint32_t        done_len;       /* Bytes moved so far. */
+    copy_done_t     done;
+    void           *arg;
+} copy_job_t;
+
+static copy_job_t jobs[COPY_MAX_JOBS];
+static uint32_t head;
+static uint32_t n_jobs;
+
+/*
+ * Move up to len more bytes of the job at head.
+ */
+static void
+job_move(copy_job_t *job, uint32_t len)
+{
+    len = len < job->len - job->done_len ? len : job->len - job->done_len;
+    if (job->src != NULL) {
+        memcpy(job->dst + job->done_len, job->src + job->done_len, len);
+        copy_host_copied += len;
+    } else {
+        memset(job->dst + job->done_len, 0, len);
+        copy_host_zeroed += len;
+    }
+    job->done_len += len;
+}
+
+/*
+ * Simulated nanoseconds the job at head needs to finish.
+ */
+static uint64_t
+job_left_ns(const copy_job_t *job)
+{
+    uint32_t rate = job->src != NULL ? copy_host_copy_rate : copy_host_zero_rate;
+    return ((uint64_t)(job->len - job->done_len) * 1000 + rate - 1) / rate;
+}
+
+static void
+job_complete(void)
+{
+    copy_done_t done = jobs[head].done;
+    void *arg = jobs[head].arg;
+    head = (head + 1) % COPY_MAX_JOBS;
+    n_jobs--;
+    if (done != NULL) {
+        done(arg);
+    }
+}
+
+void
+copy_host_run(uint64_t ns)
+{
+    while (n_jobs != 0) {
+        copy_job_t *job = &jobs[head];
+        uint64_t left_ns = job_left_ns(job);
+        if (copy_host_ns + left_ns > ns) {
+            uint32_t rate = job->src != NULL ? copy_host_copy_rate : copy_host_zero_rate;
+            job_move(job, (uint32_t)((ns - copy_host_ns) * rate / 1000));
+            break;
+        }
+        job_move(job, job->len);
+        copy_host_ns += left_ns;
+        job_complete();
+    }
+    copy_host_ns = copy_host_ns > ns ? copy_host_ns : ns;
+}
+
+void
+copy_init(void)
+{
+    head = 0;
+    n_jobs = 0;
+}
+
+void
+copy_submit(
+    void           *dst,
+    const void     *src,
+    uint32_t        len,
+    copy_done_t     done,
+    void           *arg)
+{
+    /*
+     * Waiting for room takes the time the oldest job has left.
+     */
+    while (n_jobs == COPY_MAX_JOBS) {
+        copy_host_run(copy_host_ns + job_left_ns(&jobs[head]));
+    }
+    copy_job_t *job = &jobs[(head + n_jobs) % COPY_MAX_JOBS];
+    *job = (copy_job_t){ dst, src, len, 0, done, arg };
+    n_jobs++;
+    copy_host_jobs++;
+}
+
+uint32_t
+copy_pending(void)
+{
+    return n_jobs;
+}
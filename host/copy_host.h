@@ -0,0 +1,35 @@
+/*
+ * copy_host.h:
+ *
+ * Host stand-in for the kernel's copy engine (see kern/copy.h). Nothing moves
+ * until simulated time is run forward with copy_host_run, and then at the
+ * rates below, so a job left half done shows up as half-copied memory.
+ */
+
+#ifndef __HOST_COPY_HOST_H__
+#define __HOST_COPY_HOST_H__
+
+#include <stdint.h>
+
+/*
+ * Bytes per simulated microsecond that jobs copy, and that they zero.
+ */
+extern uint32_t copy_host_copy_rate;
+extern uint32_t copy_host_zero_rate;
+
+/*
+ * Simulated time, in nanoseconds, and jobs submitted and bytes moved so far.
+ */
+extern uint64_t copy_host_ns;
+extern uint32_t copy_host_jobs;
+extern uint64_t copy_host_copied;
+extern uint64_t copy_host_zeroed;
+
+/*
+ * Run the engine until simulated time reaches ns, completing jobs (and calling
+ * their completion functions) as they finish.
+ */
+void
+copy_host_run(uint64_t ns);
+
+#endif /* __HOST_COPY_HOST_H__ */
@@ -0,0 +1,46 @@
+/*
+ * cores.c:
+ *
+ * State behind the host stand-ins for per-core hardware. Each simulated core
+ * is a thread that sets host_core_num before entering the kernel.
+ */
+
+#include <time.h>
+
+#include "hardware/structs/mpu.h"
+#include "hardware/structs/scb.h"
+#include "hardware/structs/systick.h"
+#include "hardware/sync.h"
+#include "hardware/timer.h"
+#include "pico/platform.h"
+
+_Thread_local unsigned int host_core_num;
+
+spin_lock_t host_spin_locks[32];
+systick_hw_t host_systick[NUM_CORES];
+armv6m_scb_hw_t host_scb[NUM_CORES];
+mpu_hw_t host_mpu[NUM_CORES];
+
+int host_time_simulated;
+uint32_t host_sim_us;
+
+/*
+ * Stand-in for the exit trampoline of kern/context_switch.s, whose address
+ * process_init_context gives every process as its initial lr. Host processes
+ * never run their code, so it is never called.
+ */
+void
+process_return(void)
+{
+}
+
+uint32_t
+time_us_32(void)
+{
+    if (host_time_simulated) {
+        return host_sim_us;
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint32_t)(now.tv_sec * 1000000 + now.tv_nsec / 1000);
+}
@@ -0,0 +1,59 @@
+/*
+ * flash.c:
+ *
+ * Host stand-in for the flash under the page cache (see flash_host.h and
+ * kern/pcache.h). Like NOR flash, programming can only clear bits.
+ */
+
+#include "flash_host.h"
+
+#include <string.h>
+
+uint8_t flash_host_store[PCACHE_STORE_SIZE];
+uint32_t flash_host_erases[PCACHE_STORE_SIZE / PCACHE_SECTOR_SIZE];
+uint64_t flash_host_busy_us;
+uint32_t flash_host_bad_programs;
+
+void
+flash_host_init(void)
+{
+    memset(flash_host_store, 0xff, sizeof(flash_host_store));
+    memset(flash_host_erases, 0, sizeof(flash_host_erases));
+    flash_host_busy_us = 0;
+    flash_host_bad_programs = 0;
+}
+
+void
+pcache_flash_read(
+    uint32_t    offset,
+    void       *buf,
+    uint32_t    len)
+{
+    memcpy(buf, flash_host_store + offset, len);
+}
+
+int
+pcache_flash_program(
+    uint32_t    offset,
+    const void *data,
+    uint32_t    len,
+    int         erase)
+{
+    if (erase) {
+        memset(flash_host_store + offset, 0xff, PCACHE_SECTOR_SIZE);
+        flash_host_erases[offset / PCACHE_SECTOR_SIZE]++;
+        flash_host_busy_us += FLASH_HOST_ERASE_US;
+    }
+
+    const uint8_t *in = data;
+    for (uint32_t page = 0; page < len; page += PCACHE_PAGE_SIZE) {
+        int bad = 0;
+        for (uint32_t i = page; i < page + PCACHE_PAGE_SIZE; i++) {
+            bad |= (in[i] & ~flash_host_store[offset + i]) != 0;
+            flash_host_store[offset + i] &= in[i];
+        }
+        flash_host_bad_programs += bad;
+        flash_host_busy_us += FLASH_HOST_PROGRAM_US;
+    }
+    return 0;
+}
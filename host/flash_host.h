@@ -0,0 +1,43 @@
+/*
+ * flash_host.h:
+ *
+ * Simulated flash under the kernel's page cache (see kern/pcache.h), standing
+ * in for the end of the RP2040's flash that holds the store. It counts the
+ * erases of every sector, and the time the system would spend stalled on
+ * flash, at typical erase and program times of the Pico's W25Q16JV.
+ */
+
+#ifndef __HOST_FLASH_HOST_H__
+#define __HOST_FLASH_HOST_H__
+
+#include <stdint.h>
+
+#include "pcache.h"
+
+#define FLASH_HOST_ERASE_US     45000   /* Per sector. */
+#define FLASH_HOST_PROGRAM_US   400     /* Per page. */
+
+/*
+ * The store, erased to 0xff by flash_host_init.
+ */
+extern uint8_t flash_host_store[PCACHE_STORE_SIZE];
+
+/*
+ * Erases of each sector of the store.
+ */
+extern uint32_t flash_host_erases[PCACHE_STORE_SIZE / PCACHE_SECTOR_SIZE];
+
+/*
+ * Microseconds flash has been busy, and pages programmed over bits that were
+ * not erased, which real flash would have got wrong.
+ */
+extern uint64_t flash_host_busy_us;
+extern uint32_t flash_host_bad_programs;
+
+/*
+ * Erase the whole store and clear the counters.
+ */
+void
+flash_host_init(void);
+
+#endif /* __HOST_FLASH_HOST_H__ */
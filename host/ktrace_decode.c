@@ -0,0 +1,337 @@
+/*
+ * ktrace_decode.c:
+ *
+ * Decodes a dump of the kernel's trace rings (ktrace_rings, see ktrace.h) into
+ * per-process summaries and timelines, and a histogram of switch latency: the
+ * time from schedule_handler being entered to the next process being switched
+ * in.
+ *
+ *      ktrace_decode [-t] [-p pid] dump
+ *
+ *      -t          print each process's timeline of runs, timed from the
+ *                  oldest event in the dump
+ *      -p pid      only print the timeline of pid (implies -t)
+ */
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ktrace.h"
+
+#define MAX_PIDS        65536
+#define N_BUCKETS       16      /* Latency buckets: 0, 1, 2-3, 4-7, ... us. */
+
+typedef struct {
+    ktrace_rec_t    rec;
+    uint32_t        core;
+    uint32_t        seq;        /* Order within its ring. */
+} event_t;
+
+typedef struct {
+    uint32_t        start;
+    uint32_t        length;
+    uint32_t        core;
+} run_t;
+
+typedef struct {
+    int             seen;
+    int             exited;
+    int             overflowed; /* Its stack was found overflowed. */
+    uint32_t        n_runs;
+    uint64_t        run_us;
+    uint32_t        n_palloc;
+    uint32_t        n_pfree;
+    uint32_t        n_failed;
+    int64_t         bytes;      /* Allocated bytes, as far as the trace shows. */
+    int64_t         bytes_peak;
+    run_t          *runs;
+    uint32_t        runs_cap;
+} proc_t;
+
+static proc_t *procs;
+
+static const char *event_names[KTRACE_N_EVENTS] = {
+    [KTRACE_SCHED]      = "sched",
+    [KTRACE_SWITCH]     = "switch",
+    [KTRACE_EXIT]       = "exit",
+    [KTRACE_PALLOC]     = "palloc",
+    [KTRACE_PFREE]      = "pfree",
+    [KTRACE_PFREE_ALL]  = "pfree_all",
+    [KTRACE_ZALLOC]     = "zalloc",
+    [KTRACE_ZFREE]      = "zfree",
+    [KTRACE_STACK]      = "stack",
+    [KTRACE_ZFREE_BAD]  = "zfree-bad",
+};
+
+static int
+event_cmp(const void *a, const void *b)
+{
+    const event_t *x = a, *y = b;
+    int32_t dt = (int32_t)(x->rec.time - y->rec.time);
+    if (dt != 0) {
+        return dt < 0 ? -1 : 1;
+    }
+    if (x->core != y->core) {
+        return x->core < y->core ? -1 : 1;
+    }
+    return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+static void
+add_run(uint32_t pid, uint32_t start, uint32_t end, uint32_t core)
+{
+    proc_t *p = &procs[pid];
+    if (p->n_runs == p->runs_cap) {
+        p->runs_cap = p->runs_cap ? 2 * p->runs_cap : 16;
+        p->runs = realloc(p->runs, p->runs_cap * sizeof(run_t));
+        if (p->runs == NULL) {
+            perror("realloc");
+            exit(2);
+        }
+    }
+    p->runs[p->n_runs++] = (run_t){ start, end - start, core };
+    p->run_us += end - start;
+    p->seen = 1;
+}
+
+static void
+usage(void)
+{
+    fprintf(stderr, "usage: ktrace_decode [-t] [-p pid] dump\n");
+    exit(2);
+}
+
+int
+main(int argc, char **argv)
+{
+    int timelines = 0;
+    long only_pid = -1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "tp:h")) != -1) {
+        switch (opt) {
+        case 't':
+            timelines = 1;
+            break;
+        case 'p':
+            only_pid = strtol(optarg, NULL, 0);
+            timelines = 1;
+            break;
+        default:
+            usage();
+        }
+    }
+    if (optind != argc - 1) {
+        usage();
+    }
+
+    /*
+     * Read every ring in the dump, oldest record first.
+     */
+    FILE *f = fopen(argv[optind], "rb");
+    if (f == NULL) {
+        perror(argv[optind]);
+        return 2;
+    }
+
+    static ktrace_ring_t ring;
+    event_t *events = NULL;
+    uint32_t n_events = 0;
+    uint32_t n_rings = 0;
+    uint64_t n_lost = 0;
+
+    while (fread(&ring, sizeof(ring), 1, f) == 1) {
+        if (ring.magic != KTRACE_MAGIC || ring.n_recs != KTRACE_RING_SIZE) {
+            fprintf(stderr, "%s: ring %u is not a trace ring of %d records\n",
+                    argv[optind], n_rings, KTRACE_RING_SIZE);
+            return 2;
+        }
+        uint32_t n = ring.head < ring.n_recs ? ring.head : ring.n_recs;
+        n_lost += ring.head - n;
+
+        events = realloc(events, (n_events + n) * sizeof(event_t));
+        if (events == NULL && n_events + n > 0) {
+            perror("realloc");
+            return 2;
+        }
+        for (uint32_t i = 0; i < n; i++) {
+            uint32_t seq = ring.head - n + i;
+            events[n_events++] = (event_t){
+                ring.recs[seq % ring.n_recs], ring.core, seq
+            };
+        }
+        n_rings++;
+    }
+    fclose(f);
+    if (n_rings == 0) {
+        fprintf(stderr, "%s: no trace rings\n", argv[optind]);
+        return 2;
+    }
+
+    qsort(events, n_events, sizeof(event_t), event_cmp);
+
+    /*
+     * Replay the events, tracking what each core runs.
+     */
+    procs = calloc(MAX_PIDS, sizeof(proc_t));
+    uint32_t running[SCHED_N_CORES] = { 0 };
+    uint32_t run_start[SCHED_N_CORES] = { 0 };
+    int has_running[SCHED_N_CORES] = { 0 };
+    uint32_t sched_time[SCHED_N_CORES] = { 0 };
+    int in_sched[SCHED_N_CORES] = { 0 };
+    uint64_t latency[N_BUCKETS] = { 0 };
+    uint64_t latency_total = 0, n_latency = 0, n_zalloc = 0, n_zfree = 0;
+    uint32_t latency_max = 0;
+    uint32_t counts[KTRACE_N_EVENTS] = { 0 };
+
+    for (uint32_t i = 0; i < n_events; i++) {
+        ktrace_rec_t *rec = &events[i].rec;
+        uint32_t core = events[i].core % SCHED_N_CORES;
+        proc_t *p = &procs[rec->pid];
+
+        if (rec->event < KTRACE_N_EVENTS) {
+            counts[rec->event]++;
+        }
+        switch (rec->event) {
+        case KTRACE_SCHED:
+            sched_time[core] = rec->time;
+            in_sched[core] = 1;
+            break;
+        case KTRACE_SWITCH:
+            if (in_sched[core]) {
+                uint32_t us = rec->time - sched_time[core];
+                uint32_t bucket = 0;
+                while (bucket < N_BUCKETS - 1 && (us >> bucket) != 0) {
+                    bucket++;
+                }
+                latency[bucket]++;
+                latency_total += us;
+                n_latency++;
+                if (us > latency_max) {
+                    latency_max = us;
+                }
+                in_sched[core] = 0;
+            }
+            if (has_running[core] && running[core] == rec->arg0) {
+                add_run(rec->arg0, run_start[core], rec->time, core);
+            }
+            running[core] = rec->pid;
+            run_start[core] = rec->time;
+            has_running[core] = 1;
+            p->seen = 1;
+            break;
+        case KTRACE_EXIT:
+            /* A process exiting while it runs is switched away from as pid 0. */
+            if (has_running[core] && running[core] == rec->pid) {
+                add_run(rec->pid, run_start[core], rec->time, core);
+                has_running[core] = 0;
+            }
+            p->exited = 1;
+            p->seen = 1;
+            break;
+        case KTRACE_PALLOC:
+            p->seen = 1;
+            if (rec->arg0 == 0) {
+                p->n_failed++;
+                break;
+            }
+            p->n_palloc++;
+            p->bytes += rec->arg1;
+            if (p->bytes > p->bytes_peak) {
+                p->bytes_peak = p->bytes;
+            }
+            break;
+        case KTRACE_PFREE:
+            p->seen = 1;
+            p->n_pfree++;
+            p->bytes -= rec->arg1;
+            break;
+        case KTRACE_PFREE_ALL:
+            p->seen = 1;
+            p->n_pfree += rec->arg1;
+            p->bytes = 0;
+            break;
+        case KTRACE_ZALLOC:
+            n_zalloc++;
+            break;
+        case KTRACE_ZFREE:
+            n_zfree++;
+            break;
+        case KTRACE_STACK:
+            p->seen = 1;
+            p->overflowed = 1;
+            break;
+        default:
+            break;
+        }
+    }
+
+    printf("%u rings, %u events", n_rings, n_events);
+    if (n_events > 0) {
+        printf(" over %" PRIu32 " us", events[n_events - 1].rec.time - events[0].rec.time);
+    }
+    printf(" (%" PRIu64 " older events overwritten)\n", n_lost);
+    for (int e = 0; e < KTRACE_N_EVENTS; e++) {
+        printf("  %-10s %8u\n", event_names[e], counts[e]);
+    }
+    printf("  zones: %" PRIu64 " zalloc, %" PRIu64 " zfree\n\n", n_zalloc, n_zfree);
+
+    printf("%6s %8s %10s %8s %8s %8s %10s  %s\n",
+           "pid", "runs", "run us", "pallocs", "pfrees", "failed", "peak bytes", "state");
+    for (uint32_t pid = 0; pid < MAX_PIDS; pid++) {
+        proc_t *p = &procs[pid];
+        if (!p->seen) {
+            continue;
+        }
+        printf("%6u %8u %10" PRIu64 " %8u %8u %8u %10" PRId64 "  %s\n",
+               pid, p->n_runs, p->run_us, p->n_palloc, p->n_pfree, p->n_failed,
+               p->bytes_peak, p->overflowed ? "STACK OVERFLOW" : p->exited ? "exited" : "");
+    }
+
+    printf("\nswitch latency: %" PRIu64 " switches, avg %.2f us, max %u us\n",
+           n_latency, n_latency ? (double)latency_total / n_latency : 0.0, latency_max);
+    uint64_t most = 1;
+    for (int b = 0; b < N_BUCKETS; b++) {
+        most = latency[b] > most ? latency[b] : most;
+    }
+    for (int b = 0; b < N_BUCKETS; b++) {
+        if (latency[b] == 0) {
+            continue;
+        }
+        char range[32];
+        if (b == 0) {
+            snprintf(range, sizeof(range), "0");
+        } else if (b == 1) {
+            snprintf(range, sizeof(range), "1");
+        } else if (b == N_BUCKETS - 1) {
+            snprintf(range, sizeof(range), "%u+", 1u << (b - 1));
+        } else {
+            snprintf(range, sizeof(range), "%u-%u", 1u << (b - 1), (1u << b) - 1);
+        }
+        printf("  %10s us %8" PRIu64 " ", range, latency[b]);
+        for (uint64_t i = 0; i < latency[b] * 50 / most; i++) {
+            putchar('#');
+        }
+        putchar('\n');
+    }
+
+    if (timelines) {
+        for (uint32_t pid = 0; pid < MAX_PIDS; pid++) {
+            proc_t *p = &procs[pid];
+            if (!p->seen || p->n_runs == 0 || (only_pid >= 0 && pid != only_pid)) {
+                continue;
+            }
+            printf("\npid %u:\n", pid);
+            for (uint32_t r = 0; r < p->n_runs; r++) {
+                printf("  %10u us  core %u  ran %u us\n",
+                       p->runs[r].start - events[0].rec.time, p->runs[r].core,
+                       p->runs[r].length);
+            }
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,342 @@
+/*
+ * load_sim.c:
+ *
+ * Host simulation of loading program images at boot (see kern/loader.h). A
+ * flash full of synthetic position-independent programs is loaded by the
+ * kernel's own loader, whose copying runs on the host stand-in for the copy
+ * engine (copy_host.h) in simulated time. Every program has a relocation
+ * table, and every other one has no global offset table besides. The simulation steps time forward
+ * and watches the ready queues.
+ *
+ * Checked, for every process, as soon as it becomes ready:
+ *  - its stored bytes are the image's, and the rest of its span is zeroed,
+ *  - its global offset table points into its own copy of the span where the
+ *    image's pointed into the span, and is unchanged elsewhere,
+ *  - the words of its relocation table have been moved with the span.
+ * Every process must become ready, and the copy engine be left idle.
+ *
+ * Reported is when each process became ready, against the time a loader
+ * copying every image before starting any process would have taken: the time
+ * the last image was in place.
+ *
+ *      load_sim [-p programs] [-s seed] [-k max KB stored] [-b max KB .bss]
+ *               [-r copy bytes/us] [-z zero bytes/us] [-q step us]
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "copy.h"
+#include "copy_host.h"
+#include "loader.h"
+#include "palloc.h"
+#include "process.h"
+#include "sram.h"
+#include "zalloc.h"
+
+#define LINK_BASE       0x20010000  /* Where the programs were linked; they run anywhere. */
+#define GAP_SIZE        64          /* Between the two segments. */
+#define N_GOT           8
+#define N_RELOCS        16
+#define MAX_PROGRAMS    32
+
+static uint32_t n_programs = 6;
+static uint32_t seed = 1;
+static uint32_t stored_kb = 24;
+static uint32_t bss_kb = 8;
+static uint32_t step_us = 1;
+
+static uint32_t rng_state;
+static uint32_t n_violations;
+
+static uint32_t
+rng(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+static void
+violation(const char *what, uint32_t program, uint32_t offset)
+{
+    if (n_violations++ < 10) {
+        printf("violation: program %u: %s at offset 0x%x\n", program, what, offset);
+    }
+}
+
+/*
+ * A program and the process loaded from it.
+ */
+typedef struct {
+    prog_header_t  *hdr;
+    uint32_t        span_size;      /* hi - lo as the loader computes it. */
+    pcb_t          *pcb;
+    uint64_t        ready_ns;       /* When it was first seen ready, or 0. */
+} program_t;
+
+static program_t programs[MAX_PROGRAMS];
+static uint32_t n_ready;
+
+static int
+is_reloc(const uint32_t *relocs, uint32_t n_relocs, uint32_t addr)
+{
+    for (uint32_t i = 0; i < n_relocs; i++) {
+        if (relocs[i] == addr) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Write a program's image at hdr, returning its size: a segment of stored
+ * bytes holding the global offset table, a gap, a segment of a few stored
+ * bytes followed by .bss, and the relocation table, of words in the first
+ * segment.
+ */
+static uint32_t
+make_image(prog_header_t *hdr, program_t *prog)
+{
+    uint32_t size0 = ((rng() % (stored_kb * KB)) & ~3u) + 4 * N_GOT + 64;
+    uint32_t size1 = 4 * (1 + rng() % 64);
+    uint32_t bss = rng() % (bss_kb * KB + 1);
+    uint32_t addr1 = LINK_BASE + size0 + GAP_SIZE;
+    uint32_t end = addr1 + size1 + bss;
+
+    prog_segment_t *seg = (prog_segment_t *)(hdr + 1);
+    uint32_t offset = sizeof(prog_header_t) + 2 * sizeof(prog_segment_t);
+    uint32_t n_got = (prog - programs) % 2 ? 0 : N_GOT;
+    *hdr = (prog_header_t){
+        .magic = PROG_MAGIC,
+        .size = offset + size0 + size1 + 4 * N_RELOCS,
+        .entry = LINK_BASE + 1,
+        .stack_size = 512,
+        .n_segments = 2,
+        .priority = rng() % 8,
+        .got_addr = LINK_BASE + ((rng() % (size0 - 4 * N_GOT)) & ~3u),
+        .got_entries = n_got,
+        .n_instances = 1,
+        .reloc_offset = offset + size0 + size1,
+        .n_relocs = N_RELOCS,
+    };
+    snprintf(hdr->name, sizeof(hdr->name), "prog%u", (unsigned)(prog - programs));
+    seg[0] = (prog_segment_t){ LINK_BASE, size0, size0, offset };
+    seg[1] = (prog_segment_t){ addr1, size1, size1 + bss, offset + size0 };
+
+    uint8_t *bytes = (uint8_t *)hdr;
+    for (uint32_t i = offset; i < hdr->reloc_offset; i++) {
+        bytes[i] = rng() | 1;
+    }
+    uint32_t *got = (uint32_t *)(bytes + offset + (hdr->got_addr - LINK_BASE));
+    for (uint32_t i = 0; i < n_got; i++) {
+        got[i] = i % 2 ? LINK_BASE + rng() % (end - LINK_BASE) : 0x10000000 + rng() % 0x100000;
+    }
+
+    /*
+     * Relocated words point anywhere in the span, its end included.
+     */
+    uint32_t *relocs = (uint32_t *)(bytes + hdr->reloc_offset);
+    for (uint32_t i = 0; i < N_RELOCS; i++) {
+        uint32_t addr;
+        do {
+            addr = LINK_BASE + ((rng() % size0) & ~3u);
+        } while (addr - hdr->got_addr < 4 * n_got || is_reloc(relocs, i, addr));
+        relocs[i] = addr;
+        uint32_t value = LINK_BASE + rng() % (end - LINK_BASE + 1);
+        memcpy(bytes + offset + (addr - LINK_BASE), &value, 4);
+    }
+
+    prog->hdr = hdr;
+    prog->span_size = ((end + PALLOC_ALIGN - 1) & ~(PALLOC_ALIGN - 1)) - LINK_BASE;
+    return hdr->size;
+}
+
+/*
+ * Check the span of a process that has just become ready against its image.
+ */
+static void
+check_span(program_t *prog, uint32_t index)
+{
+    const prog_header_t *hdr = prog->hdr;
+    const prog_segment_t *seg = prog_segments(hdr);
+
+    uint8_t *span = NULL;
+    for (heap_region_t *region = prog->pcb->allocated; region != NULL; region = region->next) {
+        if (palloc_data(region) != prog->pcb->stack_base) {
+            span = palloc_data(region);
+        }
+    }
+    if (span == NULL) {
+        violation("no span allocated", index, 0);
+        return;
+    }
+
+    uint32_t delta = (uint32_t)(uintptr_t)span - LINK_BASE;
+    uint32_t got_offset = hdr->got_addr - LINK_BASE;
+    uint32_t s = 0;
+    for (uint32_t offset = 0; offset < prog->span_size; offset += 4) {
+        while (s < hdr->n_segments && offset >= seg[s].addr - LINK_BASE + seg[s].mem_size) {
+            s++;
+        }
+        uint32_t expect = 0;
+        if (s < hdr->n_segments && offset >= seg[s].addr - LINK_BASE &&
+            offset < seg[s].addr - LINK_BASE + seg[s].file_size) {
+            memcpy(&expect, (const uint8_t *)hdr + seg[s].offset + (offset - (seg[s].addr - LINK_BASE)), 4);
+        }
+        int reloc = is_reloc(prog_relocs(hdr), hdr->n_relocs, LINK_BASE + offset);
+        if (reloc || (offset >= got_offset && offset < got_offset + 4 * hdr->got_entries &&
+                      expect - LINK_BASE < prog->span_size)) {
+            expect += delta;
+        }
+        uint32_t got;
+        memcpy(&got, span + offset, 4);
+        if (got != expect) {
+            violation(reloc ? "relocated word wrong" :
+                      offset >= got_offset && offset < got_offset + 4 * hdr->got_entries ?
+                      "GOT entry wrong" : "span differs from the image", index, offset);
+            return;
+        }
+    }
+}
+
+/*
+ * Check the processes that have become ready since last time.
+ */
+static void
+watch(void)
+{
+    sched_acct_snapshot_t snap[MAX_PROGRAMS];
+    uint32_t n = sched_acct_snapshot(snap, MAX_PROGRAMS);
+    for (uint32_t j = 0; j < n; j++) {
+        for (uint32_t i = 0; i < n_programs; i++) {
+            if (programs[i].pcb != NULL && programs[i].pcb->pid == snap[j].pid &&
+                snap[j].state == PROC_READY && programs[i].ready_ns == 0) {
+                programs[i].ready_ns = copy_host_ns;
+                check_span(&programs[i], i);
+                n_ready++;
+            }
+        }
+    }
+}
+
+static void
+usage(void)
+{
+    fprintf(stderr, "usage: load_sim [-p programs] [-s seed] [-k max KB stored] "
+            "[-b max KB .bss] [-r copy bytes/us] [-z zero bytes/us] [-q step us]\n");
+    exit(2);
+}
+
+int
+main(int argc, char **argv)
+{
+    int opt;
+
+    while ((opt = getopt(argc, argv, "p:s:k:b:r:z:q:h")) != -1) {
+        switch (opt) {
+        case 'p':
+            n_programs = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 's':
+            seed = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'k':
+            stored_kb = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'b':
+            bss_kb = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'r':
+            copy_host_copy_rate = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'z':
+            copy_host_zero_rate = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'q':
+            step_us = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        default:
+            usage();
+        }
+    }
+    if (n_programs == 0 || n_programs > MAX_PROGRAMS || stored_kb == 0 ||
+        copy_host_copy_rate == 0 || copy_host_zero_rate == 0 || step_us == 0) {
+        usage();
+    }
+    rng_state = seed ? seed : 1;
+
+    /*
+     * SRAM holds garbage at boot; the loader must zero what needs zeroing.
+     */
+    sram_init();
+    memset(sram, 0x5a, SRAM_SIZE);
+    sram_reset_heap();
+    zinit();
+    copy_init();
+
+    /*
+     * Write the images to flash, a sector apart, and load them as boot does.
+     */
+    uint32_t flash_size = n_programs * (((stored_kb + 1) * KB + 256 + PROG_ALIGN - 1) & ~(PROG_ALIGN - 1));
+    uint8_t *flash = aligned_alloc(PROG_ALIGN, flash_size);
+    memset(flash, 0xff, flash_size);
+    uint32_t image_offset = 0;
+    for (uint32_t i = 0; i < n_programs; i++) {
+        uint32_t size = make_image((prog_header_t *)(flash + image_offset), &programs[i]);
+        image_offset = (image_offset + size + PROG_ALIGN - 1) & ~(PROG_ALIGN - 1);
+    }
+    /*
+     * Loading only waits for the copy engine when its queue is full, and
+     * scheduling starts once it returns.
+     */
+    for (uint32_t i = 0; i < n_programs; i++) {
+        programs[i].pcb = loader_load(programs[i].hdr);
+        if (programs[i].pcb == NULL) {
+            fprintf(stderr, "load_sim: loading program %u failed\n", i);
+            return 2;
+        }
+        watch();
+    }
+    uint64_t loaded_ns = copy_host_ns;
+
+    /*
+     * Run the copy engine, watching for processes becoming ready.
+     */
+    while (n_ready < n_programs && n_violations < 10) {
+        copy_host_run(copy_host_ns + step_us * 1000ull);
+        watch();
+        if (copy_pending() == 0 && n_ready < n_programs) {
+            violation("copying finished without the process becoming ready", n_ready, 0);
+            break;
+        }
+    }
+    if (copy_pending() != 0) {
+        violation("copy jobs left over", 0, copy_pending());
+    }
+
+    uint64_t all_ns = copy_host_ns;
+    uint64_t first_ns = UINT64_MAX, total_ns = 0;
+    for (uint32_t i = 0; i < n_programs; i++) {
+        printf("%-8s  prio %u  %6u bytes  ready at %8.1f us\n", programs[i].hdr->name,
+               programs[i].hdr->priority, programs[i].span_size, programs[i].ready_ns / 1000.0);
+        first_ns = programs[i].ready_ns < first_ns ? programs[i].ready_ns : first_ns;
+        total_ns += programs[i].ready_ns;
+    }
+    printf("%u programs, %u copy jobs: %llu bytes copied at %u/us, %llu zeroed at %u/us\n",
+           n_programs, copy_host_jobs, (unsigned long long)copy_host_copied, copy_host_copy_rate,
+           (unsigned long long)copy_host_zeroed, copy_host_zero_rate);
+    printf("loader returned at %.1f us; first process ready at %.1f us, mean %.1f us; "
+           "loading everything first: %.1f us\n", loaded_ns / 1000.0,
+           first_ns / 1000.0, total_ns / 1000.0 / n_programs, all_ns / 1000.0);
+
+    if (n_violations != 0) {
+        printf("FAIL: %u violations, reported above\n", n_violations);
+        return 1;
+    }
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,524 @@
+/*
+ * mkprog.c:
+ *
+ * Makes program images for the kernel's loader (see kern/loader.h) from the
+ * ELF files of user programs. Only the loadable segments are kept, and of
+ * those only the bytes the file actually holds; .bss is recorded by size.
+ *
+ *      mkprog [-a addr] [-d] [-e symbol] [-n instances] [-p priority] [-r]
+ *             [-s stack] -o out.bin prog.elf...
+ *
+ *      -a addr     flash address the output will be written at; needed for
+ *                  programs with segments linked to execute in place
+ *      -d          mark the programs for demand paging (see kern/pager.h);
+ *                  their lowest segment must start on a page boundary
+ *      -n count    processes to start from each program; more than one needs
+ *                  a position-independent program with a .got section, or -r
+ *      -e symbol   start the process at symbol (default: main, or the ELF
+ *                  entry point if there is no such symbol)
+ *      -p priority scheduling priority, 0 being the highest
+ *      -r          add a relocation table, so the loader can place the
+ *                  programs anywhere in SRAM; they must be linked with
+ *                  -Wl,--emit-relocs, and cannot be demand paged
+ *      -s stack    bytes of stack
+ *      -o out      output file
+ *
+ * Several programs can be given; their images are written one after another,
+ * each starting on a flash sector boundary, so the output can be written to
+ * flash in one go anywhere after the kernel:
+ *
+ *      picotool load -n -o 0x10010000 out.bin
+ *
+ * Segments linked at XIP flash addresses are stored at exactly those
+ * addresses, so that they execute in place: the image is started on the last
+ * sector boundary leaving room for its header below the lowest such segment.
+ * Such programs are best linked with their flash segments a little past a
+ * sector boundary, and in the order they are given here.
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "loader.h"
+
+/*
+ * The parts of the 32-bit ELF format the tool reads.
+ */
+#define EI_NIDENT       16
+#define ELFCLASS32      1
+#define ELFDATA2LSB     1
+#define EM_ARM          40
+#define PT_LOAD         1
+#define SHT_SYMTAB      2
+#define SHT_REL         9
+#define SHF_ALLOC       2
+#define R_ARM_ABS32     2
+#define R_ARM_TARGET1   38
+
+typedef struct {
+    uint8_t     e_ident[EI_NIDENT];
+    uint16_t    e_type;
+    uint16_t    e_machine;
+    uint32_t    e_version;
+    uint32_t    e_entry;
+    uint32_t    e_phoff;
+    uint32_t    e_shoff;
+    uint32_t    e_flags;
+    uint16_t    e_ehsize;
+    uint16_t    e_phentsize;
+    uint16_t    e_phnum;
+    uint16_t    e_shentsize;
+    uint16_t    e_shnum;
+    uint16_t    e_shstrndx;
+} elf32_ehdr_t;
+
+typedef struct {
+    uint32_t    p_type;
+    uint32_t    p_offset;
+    uint32_t    p_vaddr;
+    uint32_t    p_paddr;
+    uint32_t    p_filesz;
+    uint32_t    p_memsz;
+    uint32_t    p_flags;
+    uint32_t    p_align;
+} elf32_phdr_t;
+
+typedef struct {
+    uint32_t    sh_name;
+    uint32_t    sh_type;
+    uint32_t    sh_flags;
+    uint32_t    sh_addr;
+    uint32_t    sh_offset;
+    uint32_t    sh_size;
+    uint32_t    sh_link;
+    uint32_t    sh_info;
+    uint32_t    sh_addralign;
+    uint32_t    sh_entsize;
+} elf32_shdr_t;
+
+typedef struct {
+    uint32_t    st_name;
+    uint32_t    st_value;
+    uint32_t    st_size;
+    uint8_t     st_info;
+    uint8_t     st_other;
+    uint16_t    st_shndx;
+} elf32_sym_t;
+
+typedef struct {
+    uint32_t    r_offset;
+    uint32_t    r_info;
+} elf32_rel_t;
+
+static const char *entry_symbol = "main";
+static uint32_t priority = SCHED_PRIORITY_DEFAULT;
+static uint32_t stack_size = 4096;
+static uint8_t flags;
+static uint32_t n_instances = 1;
+static uint32_t flash_addr;
+static int relocatable;
+
+static void
+usage(void)
+{
+    fprintf(stderr, "usage: mkprog [-a addr] [-d] [-e symbol] [-n instances] [-p priority] [-r]\n"
+                    "              [-s stack] -o out.bin prog.elf...\n");
+    exit(2);
+}
+
+static uint8_t *
+read_file(const char *path, uint32_t *size)
+{
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        perror(path);
+        exit(1);
+    }
+    fseek(f, 0, SEEK_END);
+    long n = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *buf = malloc(n > 0 ? n : 1);
+    if (buf == NULL || fread(buf, 1, n, f) != (size_t)n) {
+        fprintf(stderr, "%s: cannot read\n", path);
+        exit(1);
+    }
+    fclose(f);
+    *size = (uint32_t)n;
+    return buf;
+}
+
+/*
+ * Look up a symbol's value in the ELF's symbol table. Returns 0 if absent.
+ */
+static int
+find_symbol(const uint8_t *elf, uint32_t size, const char *name, uint32_t *value)
+{
+    const elf32_ehdr_t *eh = (const elf32_ehdr_t *)elf;
+    if (eh->e_shoff == 0 || eh->e_shoff + (uint64_t)eh->e_shnum * sizeof(elf32_shdr_t) > size) {
+        return 0;
+    }
+    const elf32_shdr_t *sh = (const elf32_shdr_t *)(elf + eh->e_shoff);
+    for (uint32_t i = 0; i < eh->e_shnum; i++) {
+        if (sh[i].sh_type != SHT_SYMTAB || sh[i].sh_link >= eh->e_shnum) {
+            continue;
+        }
+        const elf32_shdr_t *strtab = &sh[sh[i].sh_link];
+        if (sh[i].sh_offset + (uint64_t)sh[i].sh_size > size ||
+            strtab->sh_offset + (uint64_t)strtab->sh_size > size) {
+            return 0;
+        }
+        const elf32_sym_t *sym = (const elf32_sym_t *)(elf + sh[i].sh_offset);
+        const char *names = (const char *)(elf + strtab->sh_offset);
+        for (uint32_t s = 0; s < sh[i].sh_size / sizeof(elf32_sym_t); s++) {
+            if (sym[s].st_name < strtab->sh_size &&
+                strncmp(names + sym[s].st_name, name, strtab->sh_size - sym[s].st_name) == 0) {
+                *value = sym[s].st_value;
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+/*
+ * Look up a section by name. Returns 0 if absent.
+ */
+static int
+find_section(const uint8_t *elf, uint32_t size, const char *name, const elf32_shdr_t **out)
+{
+    const elf32_ehdr_t *eh = (const elf32_ehdr_t *)elf;
+    if (eh->e_shoff == 0 || eh->e_shstrndx >= eh->e_shnum ||
+        eh->e_shoff + (uint64_t)eh->e_shnum * sizeof(elf32_shdr_t) > size) {
+        return 0;
+    }
+    const elf32_shdr_t *sh = (const elf32_shdr_t *)(elf + eh->e_shoff);
+    const elf32_shdr_t *strtab = &sh[eh->e_shstrndx];
+    if (strtab->sh_offset + (uint64_t)strtab->sh_size > size) {
+        return 0;
+    }
+    const char *names = (const char *)(elf + strtab->sh_offset);
+    for (uint32_t i = 0; i < eh->e_shnum; i++) {
+        if (sh[i].sh_name < strtab->sh_size &&
+            strncmp(names + sh[i].sh_name, name, strtab->sh_size - sh[i].sh_name) == 0) {
+            *out = &sh[i];
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Collect the relocation table of a program: the addresses of the words in its
+ * SRAM segments' stored bytes that the linker filled in with absolute
+ * addresses in [lo, hi], the SRAM it was linked to occupy. Words of the global
+ * offset table are left to the loader, which adjusts them anyway. Returns the
+ * number of words, their addresses in *out.
+ */
+static uint32_t
+collect_relocs(
+    const char             *path,
+    const uint8_t          *elf,
+    uint32_t                size,
+    const elf32_phdr_t     *load,
+    const prog_segment_t   *segs,
+    uint32_t                n_load,
+    const elf32_shdr_t     *got,
+    uint32_t                lo,
+    uint32_t                hi,
+    uint32_t              **out)
+{
+    const elf32_ehdr_t *eh = (const elf32_ehdr_t *)elf;
+    const elf32_shdr_t *sh = (const elf32_shdr_t *)(elf + eh->e_shoff);
+    uint32_t n_rel_sections = 0, n = 0;
+
+    *out = NULL;
+    for (uint32_t i = 0; eh->e_shoff != 0 && i < eh->e_shnum; i++) {
+        if (sh[i].sh_type != SHT_REL || sh[i].sh_info >= eh->e_shnum ||
+            !(sh[sh[i].sh_info].sh_flags & SHF_ALLOC)) {
+            continue;
+        }
+        if (sh[i].sh_offset + (uint64_t)sh[i].sh_size > size) {
+            fprintf(stderr, "%s: relocation section %u lies outside the file\n", path, i);
+            exit(1);
+        }
+        n_rel_sections++;
+        const elf32_rel_t *rel = (const elf32_rel_t *)(elf + sh[i].sh_offset);
+        for (uint32_t r = 0; r < sh[i].sh_size / sizeof(elf32_rel_t); r++) {
+            uint32_t type = rel[r].r_info & 0xff, addr = rel[r].r_offset;
+            if (type != R_ARM_ABS32 && type != R_ARM_TARGET1) {
+                continue;
+            }
+            uint32_t s = 0;
+            while (s < n_load && !(addr >= segs[s].addr && addr - segs[s].addr + 4 <= segs[s].file_size)) {
+                s++;
+            }
+            if (s == n_load) {
+                continue;
+            }
+            uint32_t value;
+            memcpy(&value, elf + load[s].p_offset + (addr - segs[s].addr), 4);
+            if (value < lo || value > hi ||
+                (got != NULL && addr - got->sh_addr < got->sh_size)) {
+                continue;
+            }
+            if (prog_segment_xip(&segs[s]) || addr % 4 != 0) {
+                fprintf(stderr, "%s: address of SRAM at 0x%08x cannot be relocated\n", path, addr);
+                exit(1);
+            }
+            if (n % 256 == 0) {
+                *out = realloc(*out, (n + 256) * sizeof(uint32_t));
+                if (*out == NULL) {
+                    perror("realloc");
+                    exit(1);
+                }
+            }
+            (*out)[n++] = addr;
+        }
+    }
+    if (n_rel_sections == 0) {
+        fprintf(stderr, "%s: no relocations; link with -Wl,--emit-relocs\n", path);
+        exit(1);
+    }
+    return n;
+}
+
+static int
+phdr_cmp(const void *a, const void *b)
+{
+    const elf32_phdr_t *x = a, *y = b;
+    return x->p_vaddr < y->p_vaddr ? -1 : x->p_vaddr > y->p_vaddr;
+}
+
+/*
+ * Append the image of one program to out, starting at offset *used, which is
+ * then advanced to the next sector boundary.
+ */
+static void
+make_image(const char *path, uint8_t **out, uint32_t *used)
+{
+    uint32_t size;
+    uint8_t *elf = read_file(path, &size);
+    const elf32_ehdr_t *eh = (const elf32_ehdr_t *)elf;
+    if (size < sizeof(*eh) || memcmp(eh->e_ident, "\177ELF", 4) != 0 ||
+        eh->e_ident[4] != ELFCLASS32 || eh->e_ident[5] != ELFDATA2LSB ||
+        eh->e_machine != EM_ARM || eh->e_phentsize != sizeof(elf32_phdr_t) ||
+        eh->e_phoff + (uint64_t)eh->e_phnum * sizeof(elf32_phdr_t) > size) {
+        fprintf(stderr, "%s: not a 32-bit little-endian ARM ELF file\n", path);
+        exit(1);
+    }
+
+    /*
+     * Collect the loadable segments in address order.
+     */
+    elf32_phdr_t load[PROG_MAX_SEGMENTS];
+    uint32_t n_load = 0;
+    const elf32_phdr_t *ph = (const elf32_phdr_t *)(elf + eh->e_phoff);
+    for (uint32_t i = 0; i < eh->e_phnum; i++) {
+        if (ph[i].p_type != PT_LOAD || ph[i].p_memsz == 0) {
+            continue;
+        }
+        if (n_load == PROG_MAX_SEGMENTS) {
+            fprintf(stderr, "%s: more than %d loadable segments\n", path, PROG_MAX_SEGMENTS);
+            exit(1);
+        }
+        if (ph[i].p_offset + (uint64_t)ph[i].p_filesz > size) {
+            fprintf(stderr, "%s: segment %u lies outside the file\n", path, i);
+            exit(1);
+        }
+        load[n_load++] = ph[i];
+    }
+    if (n_load == 0) {
+        fprintf(stderr, "%s: no loadable segments\n", path);
+        exit(1);
+    }
+    qsort(load, n_load, sizeof(load[0]), phdr_cmp);
+
+    if ((flags & PROG_FLAG_DEMAND_PAGED) && (load[0].p_vaddr & (PROG_PAGE_SIZE - 1)) != 0) {
+        fprintf(stderr, "%s: lowest segment 0x%08x is not on a %u-byte page boundary\n",
+                path, load[0].p_vaddr, PROG_PAGE_SIZE);
+        exit(1);
+    }
+
+    uint32_t entry = eh->e_entry;
+    if (!find_symbol(elf, size, entry_symbol, &entry) && strcmp(entry_symbol, "main") != 0) {
+        fprintf(stderr, "%s: no symbol %s\n", path, entry_symbol);
+        exit(1);
+    }
+
+    const elf32_shdr_t *got = NULL;
+    if (!find_section(elf, size, ".got", &got) || got->sh_size == 0) {
+        got = NULL;
+    }
+    if (n_instances > 1 && got == NULL && !relocatable) {
+        fprintf(stderr, "%s: no .got section or relocations, so only one instance can run\n", path);
+        exit(1);
+    }
+
+    /*
+     * Lay out the header and the segment table, then the stored bytes: those
+     * of XIP segments at the addresses they were linked for, which decides
+     * where the image starts, and after them the others', each word-aligned.
+     */
+    uint32_t header_size = sizeof(prog_header_t) + n_load * sizeof(prog_segment_t);
+    uint32_t image_addr = flash_addr + *used;
+    uint32_t pad = 0;
+    if (load[0].p_vaddr >= PROG_XIP_START && load[0].p_vaddr < PROG_XIP_END) {
+        if (flash_addr == 0) {
+            fprintf(stderr, "%s: segments execute in place, so the flash address (-a) is needed\n", path);
+            exit(1);
+        }
+        if (load[0].p_vaddr < image_addr + header_size) {
+            fprintf(stderr, "%s: flash segment at 0x%08x leaves no room for the image header at 0x%08x\n",
+                    path, load[0].p_vaddr, image_addr);
+            exit(1);
+        }
+        pad = ((load[0].p_vaddr - header_size) & ~(PROG_ALIGN - 1)) - image_addr;
+        image_addr += pad;
+    }
+
+    uint32_t image_size = header_size;
+    prog_segment_t segs[PROG_MAX_SEGMENTS];
+    uint32_t file_bytes = 0, mem_bytes = 0, xip_bytes = 0;
+    for (uint32_t i = 0; i < n_load; i++) {
+        segs[i] = (prog_segment_t){
+            .addr = load[i].p_vaddr,
+            .file_size = load[i].p_filesz,
+            .mem_size = load[i].p_memsz,
+            .offset = image_size,
+        };
+        if (prog_segment_xip(&segs[i])) {
+            if (segs[i].addr < image_addr + image_size || segs[i].file_size != segs[i].mem_size) {
+                fprintf(stderr, "%s: flash segment at 0x%08x overlaps the image or has .bss\n",
+                        path, segs[i].addr);
+                exit(1);
+            }
+            segs[i].offset = segs[i].addr - image_addr;
+            xip_bytes += load[i].p_filesz;
+        }
+        image_size = (segs[i].offset + load[i].p_filesz + 3) & ~3u;
+        file_bytes += load[i].p_filesz;
+        mem_bytes += load[i].p_memsz;
+    }
+
+    /*
+     * The relocation table goes after the stored bytes.
+     */
+    uint32_t *relocs = NULL, n_relocs = 0, reloc_offset = 0;
+    if (relocatable) {
+        uint32_t lo = UINT32_MAX, hi = 0;
+        for (uint32_t i = 0; i < n_load; i++) {
+            if (!prog_segment_xip(&segs[i])) {
+                lo = segs[i].addr < lo ? segs[i].addr : lo;
+                hi = segs[i].addr + segs[i].mem_size;
+            }
+        }
+        n_relocs = collect_relocs(path, elf, size, load, segs, n_load, got, lo, hi, &relocs);
+        reloc_offset = n_relocs != 0 ? image_size : 0;
+        image_size += 4 * n_relocs;
+    }
+
+    prog_header_t hdr = {
+        .magic = PROG_MAGIC,
+        .size = image_size,
+        .entry = entry & ~1u,
+        .stack_size = stack_size,
+        .n_segments = n_load,
+        .priority = priority,
+        .flags = flags,
+        .got_addr = got ? got->sh_addr : 0,
+        .got_entries = got ? got->sh_size / 4 : 0,
+        .n_instances = n_instances,
+        .reloc_offset = reloc_offset,
+        .n_relocs = n_relocs,
+    };
+    const char *name = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+    size_t name_len = strlen(name);
+    memcpy(hdr.name, name, name_len < PROG_NAME_LEN ? name_len : PROG_NAME_LEN);
+
+    uint32_t padded = (image_size + PROG_ALIGN - 1) & ~(PROG_ALIGN - 1);
+    *out = realloc(*out, *used + pad + padded);
+    if (*out == NULL) {
+        perror("realloc");
+        exit(1);
+    }
+    memset(*out + *used, 0xff, pad + padded);   /* As erased flash. */
+    *used += pad;
+    uint8_t *image = *out + *used;
+    memcpy(image, &hdr, sizeof(hdr));
+    memcpy(image + sizeof(hdr), segs, n_load * sizeof(prog_segment_t));
+    for (uint32_t i = 0; i < n_load; i++) {
+        memcpy(image + segs[i].offset, elf + load[i].p_offset, load[i].p_filesz);
+    }
+    if (n_relocs != 0) {
+        memcpy(image + reloc_offset, relocs, 4 * n_relocs);
+    }
+    if (!prog_header_valid((prog_header_t *)image, image_size)) {
+        fprintf(stderr, "%s: segments overlap, stack too small, or .got outside .data\n", path);
+        exit(1);
+    }
+
+    printf("%s: entry 0x%08x, %u segments, %u bytes stored (%u in place), %u in memory, "
+           "%u relocations, %u instances, image at +0x%x\n",
+           path, hdr.entry, n_load, file_bytes, xip_bytes, mem_bytes, n_relocs, n_instances, *used);
+    *used += padded;
+    free(relocs);
+    free(elf);
+}
+
+int
+main(int argc, char **argv)
+{
+    const char *out_path = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "a:de:n:p:rs:o:h")) != -1) {
+        switch (opt) {
+        case 'a':
+            flash_addr = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'n':
+            n_instances = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'd':
+            flags |= PROG_FLAG_DEMAND_PAGED;
+            break;
+        case 'e':
+            entry_symbol = optarg;
+            break;
+        case 'p':
+            priority = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'r':
+            relocatable = 1;
+            break;
+        case 's':
+            stack_size = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'o':
+            out_path = optarg;
+            break;
+        default:
+            usage();
+        }
+    }
+    if (out_path == NULL || optind == argc || priority >= SCHED_N_PRIORITIES ||
+        n_instances == 0 || n_instances > UINT8_MAX || flash_addr % PROG_ALIGN != 0 ||
+        (relocatable && (flags & PROG_FLAG_DEMAND_PAGED))) {
+        usage();
+    }
+
+    uint8_t *out = NULL;
+    uint32_t used = 0;
+    for (int i = optind; i < argc; i++) {
+        make_image(argv[i], &out, &used);
+    }
+
+    FILE *f = fopen(out_path, "wb");
+    if (f == NULL || fwrite(out, 1, used, f) != used || fclose(f) != 0) {
+        perror(out_path);
+        return 1;
+    }
+    return 0;
+}
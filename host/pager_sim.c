@@ -0,0 +1,444 @@
+/*
+ * pager_sim.c:
+ *
+ * Host simulation of demand paging (see kern/pager.h). A synthetic program,
+ * its text made of random Thumb instructions, runs against the kernel's own
+ * pager: every instruction fetch and every load or store is checked against a
+ * model of the MPU regions the pager programmed, and an access the MPU would
+ * refuse is handed to pager_handle as the HardFault handler would, with
+ * registers set so that the faulting instruction decodes to that access.
+ *
+ * Execution loops over a stretch of text for a while before moving to another
+ * of a few hot stretches, each using a couple of hot data pages; a small
+ * fraction of jumps and accesses go anywhere. The run shows how much of the
+ * image demand paging copies compared with loading it whole, and how often
+ * the three MPU windows need refilling. The process is switched away from and
+ * back periodically.
+ *
+ * Checked:
+ *  - pager_decode finds the right bytes for known encodings,
+ *  - every fault the program takes is handled, and the access then succeeds,
+ *  - every byte read is what the image holds, or what the program wrote,
+ *  - the MPU never lets the program reach a page that is not yet filled, nor
+ *    anything outside its span.
+ *
+ *      pager_sim [-n steps] [-s seed] [-t text KB] [-d data KB] [-b bss KB]
+ *                [-w hot stretches] [-c cold per mille]
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "loader.h"
+#include "pager.h"
+#include "palloc.h"
+#include "sram.h"
+
+#define SPAN_BASE       0x20010000
+#define STACK_BASE      0x20030000
+#define STRETCH_SIZE    512         /* Bytes of text in a hot stretch. */
+#define N_HOT_DATA      6           /* Hot data pages. */
+
+static uint32_t n_steps = 1000000;
+static uint32_t seed = 1;
+static uint32_t text_kb = 32;
+static uint32_t data_kb = 4;
+static uint32_t bss_kb = 16;
+static uint32_t n_stretches = 8;
+static uint32_t cold = 1;           /* Per mille of jumps and accesses going anywhere. */
+
+static uint32_t rng_state;
+static uint32_t n_violations;
+
+static uint32_t
+rng(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+static void
+violation(const char *what, uint32_t addr)
+{
+    if (n_violations++ < 10) {
+        printf("violation: %s at 0x%08x\n", what, addr);
+    }
+}
+
+/*
+ * Whether the MPU regions the pager programmed on core 0 let unprivileged code
+ * make an access: the highest-numbered enabled region covering the address,
+ * unless the subregion is disabled, decides; no region means no access.
+ */
+static int
+mpu_allows(uint32_t addr, int write, int exec)
+{
+    for (int n = PAGER_N_REGIONS - 1; n >= 0; n--) {
+        const pager_region_t *region = &pager_mpu[0][n];
+        if (!(region->rasr & 1)) {
+            continue;
+        }
+        uint64_t size = 2ull << ((region->rasr >> 1) & 0x1f);
+        uint32_t base = region->rbar & ~(uint32_t)(size - 1) & ~0xffu;
+        if ((uint64_t)(addr - base) >= size || addr < base) {
+            continue;
+        }
+        if (size >= 256 && ((region->rasr >> 8) >> ((addr - base) / (size / 8)) & 1)) {
+            continue;
+        }
+        uint32_t ap = (region->rasr >> 24) & 7;
+        if (exec && (region->rasr & (1u << 28))) {
+            return 0;
+        }
+        return ap == 3 || (!write && (ap == 2 || ap == 6 || ap == 7));
+    }
+    return 0;
+}
+
+/*
+ * Check pager_decode against instructions assembled by hand.
+ */
+static void
+check_decode(void)
+{
+    static const struct {
+        uint16_t    insn;
+        uint32_t    addr;
+        uint32_t    len;
+        const char *text;
+    } cases[] = {
+        { 0x6848, 0x1004, 4, "ldr r0, [r1, #4]" },
+        { 0x77f5, 0x601f, 1, "strb r5, [r6, #31]" },
+        { 0x885a, 0x3002, 2, "ldrh r2, [r3, #2]" },
+        { 0x5c81, 0x2000, 1, "ldrb r1, [r0, r2]" },
+        { 0x5e88, 0x3000, 2, "ldrsh r0, [r1, r2]" },
+        { 0x9302, 0x20020008, 4, "str r3, [sp, #8]" },
+        { 0x4802, 0x2001010c, 4, "ldr r0, [pc, #8]" },
+        { 0xc006, 0x0000, 8, "stmia r0!, {r1, r2}" },
+        { 0xb5f0, 0x2001ffec, 20, "push {r4-r7, lr}" },
+        { 0xbd10, 0x20020000, 8, "pop {r4, pc}" },
+        { 0x1888, 0, 0, "adds r0, r1, r2" },
+        { 0x4770, 0, 0, "bx lr" },
+    };
+    uint32_t regs[16];
+    for (int r = 0; r < 16; r++) {
+        regs[r] = r * 0x1000;
+    }
+    regs[13] = 0x20020000;
+    regs[15] = 0x20010102;
+
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        uint32_t addr = 0, len = 0;
+        int mem = pager_decode(cases[i].insn, regs, &addr, &len);
+        if (mem != (cases[i].len != 0) || (mem && (addr != cases[i].addr || len != cases[i].len))) {
+            printf("violation: %s (0x%04x) decoded as %u bytes at 0x%08x\n",
+                   cases[i].text, cases[i].insn, mem ? len : 0, addr);
+            n_violations++;
+        }
+    }
+}
+
+/*
+ * A random 16-bit load or store that the model can aim anywhere: not a
+ * PC-relative load, and not a register-offset form adding a register to
+ * itself.
+ */
+static uint16_t
+random_access(void)
+{
+    uint32_t rt = rng() & 7, rn = rng() & 7, rm = (rn + 1 + rng() % 7) & 7;
+    switch (rng() % 7) {
+    case 0:
+        return 0x5000 | (rng() & 7) << 9 | rm << 6 | rn << 3 | rt;
+    case 1:
+        return 0x6000 | (rng() & 0x1fff & ~0x7u) | rn << 3 | rt;
+    case 2:
+        return 0x8000 | (rng() & 0xfff & ~0x7u) | rn << 3 | rt;
+    case 3:
+        return 0x9000 | (rng() & 0xfff);
+    case 4:
+        return 0xc000 | (rng() & 0xf00) | ((rng() & 0xff) | 1);
+    case 5:
+        return 0xb400 | (rng() & 0x1ff) | 1;
+    default:
+        return 0xbc00 | (rng() & 0x1ff) | 1;
+    }
+}
+
+/*
+ * Register holding the base address of a load or store from random_access.
+ */
+static uint32_t
+base_register(uint16_t insn)
+{
+    if ((insn & 0xf000) == 0x9000 || (insn & 0xf600) == 0xb400) {
+        return 13;
+    }
+    if ((insn & 0xf000) == 0xc000) {
+        return (insn >> 8) & 7;
+    }
+    return (insn >> 3) & 7;
+}
+
+static int
+is_load(uint16_t insn)
+{
+    if ((insn & 0xf000) == 0x5000) {
+        return ((insn >> 9) & 7) >= 3;
+    }
+    if ((insn & 0xf600) == 0xb400) {
+        return (insn & 0x0800) != 0;        /* POP */
+    }
+    return (insn & 0x0800) != 0;            /* The L bit of the others. */
+}
+
+static void
+usage(void)
+{
+    fprintf(stderr, "usage: pager_sim [-n steps] [-s seed] [-t text KB] [-d data KB] "
+            "[-b bss KB] [-w hot stretches] [-c cold per mille]\n");
+    exit(2);
+}
+
+int
+main(int argc, char **argv)
+{
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:s:t:d:b:w:c:h")) != -1) {
+        switch (opt) {
+        case 'n':
+            n_steps = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 's':
+            seed = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 't':
+            text_kb = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'd':
+            data_kb = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'b':
+            bss_kb = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'w':
+            n_stretches = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'c':
+            cold = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        default:
+            usage();
+        }
+    }
+    if (text_kb == 0 || data_kb + bss_kb == 0 || n_stretches == 0) {
+        usage();
+    }
+    rng_state = seed ? seed : 1;
+
+    check_decode();
+
+    /*
+     * Lay out the program: text, a gap, then data and .bss in one segment.
+     * The shadow holds what every byte of the span should read as.
+     */
+    uint32_t text_size = text_kb * KB;
+    uint32_t data_addr = SPAN_BASE + text_size + 64;
+    uint32_t data_size = data_kb * KB;
+    uint32_t data_end = data_addr + data_size + bss_kb * KB;
+    uint32_t span_size = (data_end - SPAN_BASE + PAGER_PAGE_SIZE - 1) & ~(PAGER_PAGE_SIZE - 1);
+    uint32_t n_pages = span_size / PAGER_PAGE_SIZE;
+
+    uint8_t *shadow = calloc(1, span_size);
+    uint8_t *mem = malloc(span_size);
+    uint16_t *text = (uint16_t *)shadow;
+    memset(mem, 0x5a, span_size);       /* Whatever SRAM held before. */
+    for (uint32_t i = 0; i < text_size / 2; i++) {
+        uint32_t kind = rng() % 10;
+        if (kind < 6) {
+            text[i] = random_access();
+        } else if (kind < 9 || i + 1 == text_size / 2) {
+            text[i] = 0x1800 | (rng() & 0x1ff);         /* adds */
+        } else {
+            text[i] = 0xf000 | (rng() & 0x7ff);         /* bl */
+            text[++i] = 0xf800 | (rng() & 0x7ff);
+        }
+    }
+    for (uint32_t i = 0; i < data_size; i++) {
+        shadow[data_addr - SPAN_BASE + i] = rng();
+    }
+
+    uint32_t image_size = sizeof(prog_header_t) + 2 * sizeof(prog_segment_t) + text_size + data_size;
+    prog_header_t *hdr = calloc(1, image_size);
+    prog_segment_t *seg = (prog_segment_t *)(hdr + 1);
+    *hdr = (prog_header_t){
+        .magic = PROG_MAGIC,
+        .size = image_size,
+        .entry = SPAN_BASE,
+        .stack_size = 1024,
+        .n_segments = 2,
+        .flags = PROG_FLAG_DEMAND_PAGED,
+        .n_instances = 1,
+    };
+    seg[0] = (prog_segment_t){ SPAN_BASE, text_size, text_size, image_size - text_size - data_size };
+    seg[1] = (prog_segment_t){ data_addr, data_size, data_end - data_addr, image_size - data_size };
+    memcpy((uint8_t *)hdr + seg[0].offset, shadow, text_size);
+    memcpy((uint8_t *)hdr + seg[1].offset, shadow + (data_addr - SPAN_BASE), data_size);
+    if (!prog_header_valid(hdr, image_size)) {
+        fprintf(stderr, "pager_sim: bad image\n");
+        return 2;
+    }
+
+    sram_init();
+    sram_reset_heap();
+    pager_init();
+    static pcb_t pcb, other;
+    if (!pager_create(&pcb, hdr, mem, SPAN_BASE, n_pages, (void *)(uintptr_t)STACK_BASE, 1024)) {
+        fprintf(stderr, "pager_sim: pager_create failed\n");
+        return 2;
+    }
+    pager_space_t *space = pcb.pager;
+    pager_switch(&pcb);
+
+    /*
+     * Hot stretches of text and pages of data.
+     */
+    uint32_t stretches[64], hot_data[N_HOT_DATA];
+    n_stretches = n_stretches < 64 ? n_stretches : 64;
+    for (uint32_t i = 0; i < n_stretches; i++) {
+        stretches[i] = SPAN_BASE + (rng() % (text_size / 2)) * 2;
+    }
+    for (uint32_t i = 0; i < N_HOT_DATA; i++) {
+        hot_data[i] = data_addr + rng() % (data_end - data_addr);
+    }
+
+    uint32_t pc = stretches[0], run = 0, stretch = 0;
+    uint64_t n_fetch_faults = 0, n_data_faults = 0, n_accesses = 0, n_switches = 0;
+
+    for (uint32_t step = 0; step < n_steps && n_violations < 10; step++) {
+        if (run-- == 0 || pc + 4 > SPAN_BASE + text_size) {
+            if (rng() % 1000 < cold) {
+                pc = SPAN_BASE + (rng() % (text_size / 2)) * 2;
+            } else {
+                stretch = rng() % 10 ? stretch : rng() % n_stretches;
+                pc = stretches[stretch];
+            }
+            pc = pc + 4 > SPAN_BASE + text_size ? SPAN_BASE : pc;
+            run = rng() % (STRETCH_SIZE / 2);
+        }
+        if (step % 5000 == 4999) {
+            pager_switch(&other);
+            pager_switch(&pcb);
+            n_switches++;
+        }
+
+        uint16_t insn = text[(pc - SPAN_BASE) / 2];
+        int wide = (insn & 0xf800) >= 0xe800;
+        uint32_t regs[16];
+        for (int r = 0; r < 16; r++) {
+            regs[r] = rng() & 0xffff;
+        }
+        regs[15] = pc;
+
+        /*
+         * Aim a load or store at a data address, aligned to its size, by
+         * moving its base register.
+         */
+        uint32_t addr = 0, len = 0;
+        int access = !wide && pager_decode(insn, regs, &addr, &len);
+        if (access) {
+            uint32_t align = len < 4 ? len : 4;
+            uint32_t target = rng() % 1000 < cold ? data_addr + rng() % (data_end - data_addr) :
+                hot_data[(stretch + rng() % 2) % N_HOT_DATA] + rng() % 64;
+            target = target + len > data_end ? data_end - len : target;
+            target = target < data_addr ? data_addr : target;
+            target = (target + align - 1) & ~(align - 1);
+            if (target + len > data_end) {
+                target -= align;
+            }
+            regs[base_register(insn)] += target - addr;
+            if (!pager_decode(insn, regs, &addr, &len) || addr != target) {
+                violation("model could not aim the access", pc);
+                continue;
+            }
+        }
+
+        /*
+         * Fetch, faulting as the MPU would.
+         */
+        uint32_t fetch_len = wide ? 4 : 2;
+        if (!mpu_allows(pc, 0, 1) || !mpu_allows(pc + fetch_len - 1, 0, 1)) {
+            n_fetch_faults++;
+            if (!pager_handle(space, regs) ||
+                !mpu_allows(pc, 0, 1) || !mpu_allows(pc + fetch_len - 1, 0, 1)) {
+                violation("fetch fault not resolved", pc);
+                continue;
+            }
+        }
+        if (memcmp(mem + (pc - SPAN_BASE), shadow + (pc - SPAN_BASE), fetch_len) != 0) {
+            violation("instruction differs from the image", pc);
+        }
+
+        if (access) {
+            int load = is_load(insn);
+            if (!mpu_allows(addr, !load, 0) || !mpu_allows(addr + len - 1, !load, 0)) {
+                n_data_faults++;
+                if (!pager_handle(space, regs) ||
+                    !mpu_allows(addr, !load, 0) || !mpu_allows(addr + len - 1, !load, 0)) {
+                    violation("data fault not resolved", addr);
+                    continue;
+                }
+            }
+            uint32_t offset = addr - SPAN_BASE;
+            if (load) {
+                if (memcmp(mem + offset, shadow + offset, len) != 0) {
+                    violation("load read the wrong bytes", addr);
+                }
+            } else {
+                for (uint32_t i = 0; i < len; i++) {
+                    mem[offset + i] = shadow[offset + i] = rng();
+                }
+            }
+            n_accesses++;
+        }
+        pc += fetch_len;
+
+        /*
+         * Nothing beyond the filled pages may be reachable.
+         */
+        if (step % 4096 == 0 || step == n_steps - 1) {
+            for (int64_t p = -1; p <= (int64_t)n_pages; p++) {
+                uint32_t page = SPAN_BASE + (uint32_t)(p * PAGER_PAGE_SIZE);
+                int filled = p >= 0 && p < n_pages && ((space->filled[p >> 3] >> (p & 7)) & 1);
+                if (!filled && (mpu_allows(page, 0, 0) || mpu_allows(page + PAGER_PAGE_SIZE - 1, 0, 0))) {
+                    violation("unfilled page reachable", page);
+                }
+            }
+        }
+    }
+
+    uint32_t stored = text_size + data_size;
+    printf("span: %u pages of %u bytes (%u KB); image stores %u bytes\n",
+           n_pages, PAGER_PAGE_SIZE, span_size / KB, stored);
+    printf("steps: %u, data accesses: %llu, switches: %llu\n",
+           n_steps, (unsigned long long)n_accesses, (unsigned long long)n_switches);
+    printf("faults: %u handled (%llu on fetch, %llu on data), %.2f per 1000 steps\n",
+           space->n_faults, (unsigned long long)n_fetch_faults,
+           (unsigned long long)n_data_faults, 1000.0 * space->n_faults / n_steps);
+    printf("pages filled: %u of %u (%.1f%%), windows mapped: %u\n",
+           space->n_fills, n_pages, 100.0 * space->n_fills / n_pages, space->n_maps);
+    printf("bytes written filling pages: %u, loading whole: %u\n",
+           space->n_fills * PAGER_PAGE_SIZE, span_size);
+
+    if (n_violations != 0) {
+        printf("FAIL: %u violations, reported above\n", n_violations);
+        return 1;
+    }
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,592 @@
+/*
+ * palloc_bench.c:
+ *
+ * Host benchmark for the kernel heap and zone allocators. Replays synthetic
+ * workloads and recorded alloc/free traces against the simulated SRAM, and
+ * reports latency, free-list walk lengths and external fragmentation.
+ *
+ * Trace files contain one operation per line:
+ *
+ *      a <id> <size>               palloc(size, ..., PALLOC_FLAGS_ANYWHERE)
+ *      x <id> <size> <offset>      palloc(size, ..., PALLOC_FLAGS_FIXED) with
+ *                                  the data placed offset bytes into SRAM
+ *      f <id>                      pfree the region allocated as id
+ *      e <owner>                   pfree_all every region of owner, where
+ *                                  region id belongs to owner id % 8
+ *
+ * Blank lines and lines starting with '#' are ignored.
+ */
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "palloc.h"
+#include "zalloc.h"
+#include "sram.h"
+
+#define MAX_SLOTS   4096    /* Live regions tracked at once. */
+#define N_OWNERS    8       /* Fake processes regions are charged to. */
+#define FRAG_PERIOD 64      /* Operations between fragmentation samples. */
+
+typedef enum {
+    OP_ALLOC,
+    OP_FIXED,
+    OP_FREE,
+    OP_EXIT,
+} op_kind_t;
+
+typedef struct {
+    op_kind_t   kind;
+    uint32_t    id;
+    uint32_t    size;
+    uint32_t    offset;
+} op_t;
+
+typedef struct {
+    op_t       *ops;
+    uint32_t    n_ops;
+    uint32_t    cap;
+} trace_t;
+
+typedef struct {
+    void       *ptr;
+    pcb_t      *owner;
+} slot_t;
+
+typedef struct {
+    uint64_t    n_alloc;
+    uint64_t    n_free;
+    uint64_t    n_failed;
+    uint64_t    alloc_ns;
+    uint64_t    free_ns;
+    double      frag_peak;
+    double      frag_end;
+    int         leaked;
+    int         corrupt;
+} result_t;
+
+static slot_t slots[MAX_SLOTS];
+static pcb_t owners[N_OWNERS];
+static uint32_t rng_state;
+static int failures;
+
+static uint32_t
+rng(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+static uint32_t
+rng_range(uint32_t lo, uint32_t hi)
+{
+    return lo + rng() % (hi - lo + 1);
+}
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/*
+ * External fragmentation: the fraction of free memory that cannot be handed
+ * out as part of the single largest allocation.
+ */
+static double
+fragmentation(void)
+{
+    palloc_usage_t usage;
+    palloc_usage(&usage);
+    if (usage.free_bytes == 0) {
+        return 0.0;
+    }
+    return 1.0 - (double)usage.largest_free / usage.free_bytes;
+}
+
+static void
+trace_push(trace_t *trace, op_kind_t kind, uint32_t id, uint32_t size, uint32_t offset)
+{
+    if (trace->n_ops == trace->cap) {
+        trace->cap = trace->cap ? trace->cap * 2 : 1024;
+        trace->ops = realloc(trace->ops, trace->cap * sizeof(op_t));
+        if (trace->ops == NULL) {
+            fprintf(stderr, "palloc_bench: out of memory\n");
+            exit(1);
+        }
+    }
+    trace->ops[trace->n_ops++] = (op_t){ kind, id, size, offset };
+}
+
+static int
+trace_load(trace_t *trace, const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        perror(path);
+        return -1;
+    }
+
+    char line[128];
+    int lineno = 0;
+    while (fgets(line, sizeof(line), f)) {
+        lineno++;
+        char kind;
+        uint32_t id, size = 0, offset = 0;
+        if (line[0] == '#' || line[0] == '\n') {
+            continue;
+        }
+        int n = sscanf(line, " %c %" SCNu32 " %" SCNu32 " %" SCNu32, &kind, &id, &size, &offset);
+        int ok = (kind == 'a' && n == 3) || (kind == 'x' && n == 4) ||
+                 (kind == 'f' && n == 2) || (kind == 'e' && n == 2 && id < N_OWNERS);
+        if (!ok || id >= MAX_SLOTS) {
+            fprintf(stderr, "%s:%d: malformed trace operation\n", path, lineno);
+            fclose(f);
+            return -1;
+        }
+        trace_push(trace, kind == 'a' ? OP_ALLOC : kind == 'x' ? OP_FIXED :
+                          kind == 'f' ? OP_FREE : OP_EXIT,
+                   id, size, offset);
+    }
+    fclose(f);
+    return 0;
+}
+
+/*
+ * Replay a trace against a freshly initialized heap, checking the heap's
+ * metadata periodically if check is set. Every region still live at the end
+ * of the trace is freed, after which the heap must once again be a single free
+ * region.
+ */
+static void
+replay(const trace_t *trace, result_t *res, int check)
+{
+    memset(res, 0, sizeof(*res));
+    memset(slots, 0, sizeof(slots));
+    sram_reset_heap();
+    palloc_usage_t initial;
+    palloc_usage(&initial);
+#ifdef PALLOC_STATS
+    memset(&palloc_stats, 0, sizeof(palloc_stats));
+#endif
+
+    for (uint32_t i = 0; i < trace->n_ops; i++) {
+        const op_t *op = &trace->ops[i];
+        slot_t *slot = &slots[op->id];
+        uint64_t start;
+
+        switch (op->kind) {
+        case OP_ALLOC:
+        case OP_FIXED:
+            if (slot->ptr) {
+                break;      /* Traces may reuse ids without freeing. */
+            }
+            slot->owner = &owners[op->id % N_OWNERS];
+            start = now_ns();
+            slot->ptr = op->kind == OP_ALLOC ?
+                palloc(op->size, slot->owner, PALLOC_FLAGS_ANYWHERE, NULL) :
+                palloc(op->size, slot->owner, PALLOC_FLAGS_FIXED, sram + op->offset);
+            res->alloc_ns += now_ns() - start;
+            res->n_alloc++;
+            if (slot->ptr == NULL) {
+                res->n_failed++;
+            }
+            break;
+        case OP_FREE:
+            if (slot->ptr == NULL) {
+                break;
+            }
+            start = now_ns();
+            pfree(slot->ptr, slot->owner);
+            res->free_ns += now_ns() - start;
+            res->n_free++;
+            slot->ptr = NULL;
+            break;
+        case OP_EXIT:
+            start = now_ns();
+            pfree_all(&owners[op->id]);
+            res->free_ns += now_ns() - start;
+            for (uint32_t id = op->id; id < MAX_SLOTS; id += N_OWNERS) {
+                if (slots[id].ptr) {
+                    slots[id].ptr = NULL;
+                    res->n_free++;
+                }
+            }
+            break;
+        }
+
+        if (check && palloc_check() < 0) {
+            res->corrupt = 1;
+        }
+        if (i % FRAG_PERIOD == 0) {
+            double frag = fragmentation();
+            if (frag > res->frag_peak) {
+                res->frag_peak = frag;
+            }
+        }
+    }
+    res->frag_end = fragmentation();
+
+    for (uint32_t id = 0; id < MAX_SLOTS; id++) {
+        if (slots[id].ptr) {
+            pfree(slots[id].ptr, slots[id].owner);
+            slots[id].ptr = NULL;
+        }
+    }
+
+    palloc_usage_t usage;
+    palloc_usage(&usage);
+    res->corrupt |= palloc_check() < 0;
+    res->leaked = usage.n_free != initial.n_free || usage.free_bytes != initial.free_bytes;
+    for (int i = 0; i < N_OWNERS; i++) {
+        res->leaked |= owners[i].allocated != NULL;
+    }
+}
+
+static void
+report(const char *name, const result_t *res)
+{
+    printf("%-16s %8" PRIu64 " %8" PRIu64 " %6" PRIu64 " %10.1f %10.1f",
+           name, res->n_alloc, res->n_free, res->n_failed,
+           res->n_alloc ? (double)res->alloc_ns / res->n_alloc : 0.0,
+           res->n_free ? (double)res->free_ns / res->n_free : 0.0);
+#ifdef PALLOC_STATS
+    uint32_t calls = palloc_stats.n_palloc + palloc_stats.n_failed + palloc_stats.n_pfree;
+    printf(" %8" PRIu32 " %8.1f", palloc_stats.walk_max,
+           calls ? (double)palloc_stats.walk_total / calls : 0.0);
+#else
+    printf(" %8s %8s", "-", "-");
+#endif
+    printf(" %9.3f %9.3f  %s\n", res->frag_peak, res->frag_end,
+           res->corrupt ? "CORRUPT" : res->leaked ? "LEAK" : "ok");
+    failures += res->leaked || res->corrupt;
+}
+
+/*
+ * Synthetic workload: random allocations of sizes in [lo, hi] interleaved with
+ * random frees, keeping at most max_live regions live.
+ */
+static void
+gen_churn(trace_t *trace, uint32_t n_ops, uint32_t max_live, uint32_t lo, uint32_t hi)
+{
+    uint32_t live[MAX_SLOTS];
+    uint32_t n_live = 0;
+    uint32_t next_id = 0;
+    uint32_t free_ids[MAX_SLOTS];
+    uint32_t n_free_ids = 0;
+
+    for (uint32_t i = 0; i < n_ops; i++) {
+        int do_alloc = n_live < max_live && (n_live == 0 || rng() % 8 < 5);
+        if (do_alloc) {
+            uint32_t id = n_free_ids ? free_ids[--n_free_ids] : next_id++;
+            trace_push(trace, OP_ALLOC, id, rng_range(lo, hi), 0);
+            live[n_live++] = id;
+        } else {
+            uint32_t k = rng() % n_live;
+            trace_push(trace, OP_FREE, live[k], 0, 0);
+            free_ids[n_free_ids++] = live[k];
+            live[k] = live[--n_live];
+        }
+    }
+}
+
+/*
+ * Synthetic workload: a mix of 4KB stacks, odd-sized program images and small
+ * regions, in the proportions seen when processes are repeatedly created.
+ */
+static void
+gen_mixed(trace_t *trace, uint32_t n_ops)
+{
+    uint32_t live[MAX_SLOTS];
+    uint32_t n_live = 0;
+    uint32_t n_ids = 0;
+
+    for (uint32_t i = 0; i < n_ops; i++) {
+        if (n_live < 64 && (n_live == 0 || rng() % 2 == 0)) {
+            uint32_t kind = rng() % 8;
+            uint32_t size = kind < 4 ? 4 * KB :
+                            kind < 6 ? rng_range(64, 512) :
+                                       rng_range(1 * KB, 24 * KB);
+            uint32_t id = n_ids++ % MAX_SLOTS;
+            trace_push(trace, OP_ALLOC, id, size, 0);
+            live[n_live++] = id;
+        } else {
+            uint32_t k = rng() % n_live;
+            trace_push(trace, OP_FREE, live[k], 0, 0);
+            live[k] = live[--n_live];
+        }
+    }
+}
+
+/*
+ * Synthetic workload: programs placed at fixed addresses, as at boot, with
+ * their stacks allocated anywhere. The SRAM is divided into 16KB slots and
+ * each round places an image of random size in a random subset of slots.
+ */
+static void
+gen_fixed(trace_t *trace, uint32_t n_rounds)
+{
+    const uint32_t slot_size = 16 * KB;
+    const uint32_t n_slot = SRAM_SIZE / slot_size;
+
+    for (uint32_t r = 0; r < n_rounds; r++) {
+        uint32_t placed[SRAM_SIZE / (16 * KB)];
+        uint32_t n_placed = 0;
+        for (uint32_t s = 1; s < n_slot - 1; s++) {
+            if (rng() % 2) {
+                uint32_t offset = s * slot_size;
+                trace_push(trace, OP_FIXED, s, rng_range(1 * KB, 12 * KB), offset);
+                trace_push(trace, OP_ALLOC, n_slot + s, 4 * KB, 0);
+                placed[n_placed++] = s;
+            }
+        }
+        for (uint32_t i = 0; i < n_placed; i++) {
+            trace_push(trace, OP_FREE, placed[i], 0, 0);
+            trace_push(trace, OP_FREE, n_slot + placed[i], 0, 0);
+        }
+    }
+}
+
+/*
+ * Synthetic workload: every owner repeatedly builds up many interleaved
+ * regions of mixed sizes, and owners then exit one at a time, releasing all of
+ * their regions through pfree_all.
+ */
+static void
+gen_exit(trace_t *trace, uint32_t n_rounds)
+{
+    for (uint32_t r = 0; r < n_rounds; r++) {
+        for (uint32_t id = 0; id < 512; id++) {
+            trace_push(trace, OP_ALLOC, id, rng_range(16, 768), 0);
+        }
+        uint32_t order[N_OWNERS];
+        for (uint32_t i = 0; i < N_OWNERS; i++) {
+            order[i] = i;
+        }
+        for (uint32_t i = N_OWNERS - 1; i > 0; i--) {
+            uint32_t j = rng() % (i + 1);
+            uint32_t tmp = order[i];
+            order[i] = order[j];
+            order[j] = tmp;
+        }
+        for (uint32_t i = 0; i < N_OWNERS; i++) {
+            trace_push(trace, OP_EXIT, order[i], 0, 0);
+        }
+    }
+}
+
+/*
+ * Stress test: many independent random sequences of anywhere and fixed
+ * allocations of widely varying sizes, frees and owner exits, each ending
+ * with every region freed in random order. The heap is checked after every operation, and must return to
+ * a single free region at the end of each sequence.
+ */
+static void
+bench_stress(uint32_t n_rounds)
+{
+    result_t total = { 0 };
+#ifdef PALLOC_STATS
+    palloc_stats_t stats = { 0 };
+#endif
+
+    for (uint32_t r = 0; r < n_rounds; r++) {
+        trace_t trace = { 0 };
+        result_t res;
+        uint32_t live[MAX_SLOTS];
+        uint32_t n_live = 0;
+        uint32_t next_id = 0;
+
+        for (uint32_t i = 0; i < 1000; i++) {
+            uint32_t dice = rng() % 100;
+            if (dice < 45) {
+                trace_push(&trace, OP_ALLOC, next_id, 1u << rng_range(0, 14) | rng() % 64, 0);
+                live[n_live++] = next_id++;
+            } else if (dice < 50) {
+                uint32_t offset = rng_range(1, SRAM_SIZE / 8 - 1) * 8;
+                trace_push(&trace, OP_FIXED, next_id, rng_range(1, 8 * KB), offset);
+                live[n_live++] = next_id++;
+            } else if (dice < 52) {
+                uint32_t owner = rng() % N_OWNERS;
+                trace_push(&trace, OP_EXIT, owner, 0, 0);
+                for (uint32_t k = 0; k < n_live; ) {
+                    if (live[k] % N_OWNERS == owner) {
+                        live[k] = live[--n_live];
+                    } else {
+                        k++;
+                    }
+                }
+            } else if (n_live) {
+                uint32_t k = rng() % n_live;
+                trace_push(&trace, OP_FREE, live[k], 0, 0);
+                live[k] = live[--n_live];
+            }
+        }
+
+        /*
+         * Free the survivors in random order.
+         */
+        while (n_live) {
+            uint32_t k = rng() % n_live;
+            trace_push(&trace, OP_FREE, live[k], 0, 0);
+            live[k] = live[--n_live];
+        }
+
+        replay(&trace, &res, 1);
+        total.n_alloc += res.n_alloc;
+        total.n_free += res.n_free;
+        total.n_failed += res.n_failed;
+        total.alloc_ns += res.alloc_ns;
+        total.free_ns += res.free_ns;
+        total.frag_peak = res.frag_peak > total.frag_peak ? res.frag_peak : total.frag_peak;
+        total.leaked |= res.leaked;
+        total.corrupt |= res.corrupt;
+        free(trace.ops);
+#ifdef PALLOC_STATS
+        stats.n_palloc += palloc_stats.n_palloc;
+        stats.n_failed += palloc_stats.n_failed;
+        stats.n_pfree += palloc_stats.n_pfree;
+        stats.walk_total += palloc_stats.walk_total;
+        if (palloc_stats.walk_max > stats.walk_max) {
+            stats.walk_max = palloc_stats.walk_max;
+        }
+#endif
+    }
+#ifdef PALLOC_STATS
+    palloc_stats = stats;
+#endif
+    report("stress", &total);
+}
+
+/*
+ * Allocate up to 1024 PCBs and free them all, repeatedly. The zone grows from
+ * the heap each round, and gives the slabs back as they empty.
+ */
+static void
+bench_zone(uint32_t n_rounds)
+{
+    static void *elems[1024];
+    uint64_t alloc_ns = 0, free_ns = 0, n = 0;
+    kzone_desc_t *zone = &zone_table[KZONE_PCB];
+    uint32_t grows = zone->n_grows, shrinks = zone->n_shrinks;
+
+    sram_reset_heap();
+
+    for (uint32_t r = 0; r < n_rounds; r++) {
+        uint32_t k = 0;
+        uint64_t start = now_ns();
+        while (k < 1024 && (elems[k] = zalloc(KZONE_PCB)) != NULL) {
+            k++;
+        }
+        alloc_ns += now_ns() - start;
+        start = now_ns();
+        for (uint32_t i = 0; i < k; i++) {
+            zfree(elems[i], KZONE_PCB);
+        }
+        free_ns += now_ns() - start;
+        n += k;
+    }
+    printf("%-16s %8" PRIu64 " %8" PRIu64 " %6d %10.1f %10.1f  %u slabs grown, %u returned\n",
+           "zone-pcb", n, n, 0, n ? (double)alloc_ns / n : 0.0, n ? (double)free_ns / n : 0.0,
+           zone->n_grows - grows, zone->n_shrinks - shrinks);
+}
+
+static void
+usage(void)
+{
+    fprintf(stderr,
+            "usage: palloc_bench [-s seed] [-n ops] [-w workload]... [trace...]\n"
+            "workloads: small, stacks, mixed, fixed, exit, stress, zone (default: all)\n");
+    exit(2);
+}
+
+int
+main(int argc, char **argv)
+{
+    uint32_t seed = 1;
+    uint32_t n_ops = 50000;
+    const char *workloads[16];
+    int n_workloads = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:n:w:h")) != -1) {
+        switch (opt) {
+        case 's':
+            seed = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'n':
+            n_ops = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'w':
+            if (n_workloads == 16) {
+                usage();
+            }
+            workloads[n_workloads++] = optarg;
+            break;
+        default:
+            usage();
+        }
+    }
+    if (n_workloads == 0 && optind == argc) {
+        static const char *all[] = { "small", "stacks", "mixed", "fixed", "exit", "stress", "zone" };
+        memcpy(workloads, all, sizeof(all));
+        n_workloads = sizeof(all) / sizeof(all[0]);
+    }
+
+    sram_init();
+    zinit();
+
+    printf("%-16s %8s %8s %6s %10s %10s %8s %8s %9s %9s  %s\n",
+           "workload", "allocs", "frees", "failed", "alloc ns", "free ns",
+           "walk max", "walk avg", "frag peak", "frag end", "heap");
+
+    for (int i = 0; i < n_workloads; i++) {
+        trace_t trace = { 0 };
+        result_t res;
+
+        rng_state = seed ? seed : 1;
+        if (strcmp(workloads[i], "small") == 0) {
+            gen_churn(&trace, n_ops, 1024, 8, 256);
+        } else if (strcmp(workloads[i], "stacks") == 0) {
+            gen_churn(&trace, n_ops, 48, 4 * KB, 4 * KB);
+        } else if (strcmp(workloads[i], "mixed") == 0) {
+            gen_mixed(&trace, n_ops);
+        } else if (strcmp(workloads[i], "fixed") == 0) {
+            gen_fixed(&trace, n_ops / 32);
+        } else if (strcmp(workloads[i], "exit") == 0) {
+            gen_exit(&trace, n_ops / 512);
+        } else if (strcmp(workloads[i], "stress") == 0) {
+            bench_stress(n_ops / 500);
+            continue;
+        } else if (strcmp(workloads[i], "zone") == 0) {
+            bench_zone(n_ops / 32);
+            continue;
+        } else {
+            usage();
+        }
+        replay(&trace, &res, 0);
+        report(workloads[i], &res);
+        free(trace.ops);
+    }
+
+    for (int i = optind; i < argc; i++) {
+        trace_t trace = { 0 };
+        result_t res;
+        if (trace_load(&trace, argv[i]) < 0) {
+            return 2;
+        }
+        const char *name = strrchr(argv[i], '/');
+        replay(&trace, &res, 1);
+        report(name ? name + 1 : argv[i], &res);
+        free(trace.ops);
+    }
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,248 @@
+/*
+ * pcache_bench.c:
+ *
+ * Host benchmark for the kernel's page cache over the flash store (see
+ * kern/pcache.h), on the simulated flash (flash_host.h). A synthetic
+ * persistent-state workload reads and rewrites records, most of them in a
+ * small hot set, and every so often syncs the store to flash, as a process
+ * keeping its state across resets would.
+ *
+ * Reported are the cache's counters, the erases of the most worn sector and
+ * the time flash would have stalled the system, against writing every record
+ * straight through to flash.
+ *
+ * Checked:
+ *  - every read returns what was last written,
+ *  - after the final sync, flash holds everything written, and nothing is
+ *    left dirty,
+ *  - flash is never programmed over bits that were not erased.
+ *
+ *      pcache_bench [-n ops] [-s seed] [-k working set KB] [-r record bytes]
+ *                   [-w writes per mille] [-t hot per mille] [-y ops per sync]
+ */
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "flash_host.h"
+#include "pcache.h"
+
+static uint32_t n_ops = 200000;
+static uint32_t seed = 1;
+static uint32_t working_kb = 128;
+static uint32_t record_size = 32;
+static uint32_t writes = 500;       /* Per mille of operations that write. */
+static uint32_t hot = 900;          /* Per mille of operations on the hottest tenth of records. */
+static uint32_t sync_period = 20000;
+
+static uint32_t rng_state;
+static uint32_t n_violations;
+
+static uint32_t
+rng(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+static void
+violation(const char *what, uint32_t offset)
+{
+    if (n_violations++ < 10) {
+        printf("violation: %s at offset 0x%x\n", what, offset);
+    }
+}
+
+/*
+ * What the store should read as, and what flash would hold if every write
+ * went straight through to it, with what that would have cost.
+ */
+static uint8_t shadow[PCACHE_STORE_SIZE];
+static uint8_t direct[PCACHE_STORE_SIZE];
+static uint32_t direct_erases[PCACHE_STORE_SIZE / PCACHE_SECTOR_SIZE];
+static uint64_t direct_busy_us;
+
+/*
+ * Write the sectors of [offset, offset + len) of the shadow through to the
+ * direct flash, erasing only where bits must be set.
+ */
+static void
+write_through(uint32_t offset, uint32_t len)
+{
+    uint32_t first = offset / PCACHE_SECTOR_SIZE;
+    uint32_t last = (offset + len - 1) / PCACHE_SECTOR_SIZE;
+    for (uint32_t sector = first; sector <= last; sector++) {
+        uint8_t *old = direct + sector * PCACHE_SECTOR_SIZE;
+        const uint8_t *new = shadow + sector * PCACHE_SECTOR_SIZE;
+        int erase = 0;
+        for (uint32_t i = 0; i < PCACHE_SECTOR_SIZE; i++) {
+            erase |= (new[i] & ~old[i]) != 0;
+        }
+        if (erase) {
+            direct_erases[sector]++;
+            direct_busy_us += FLASH_HOST_ERASE_US + PCACHE_SECTOR_PAGES * FLASH_HOST_PROGRAM_US;
+        } else {
+            direct_busy_us += FLASH_HOST_PROGRAM_US * ((len + PCACHE_PAGE_SIZE - 1) / PCACHE_PAGE_SIZE);
+        }
+        memcpy(old, new, PCACHE_SECTOR_SIZE);
+    }
+}
+
+static uint32_t
+max_erases(const uint32_t *erases, uint64_t *total)
+{
+    uint32_t max = 0;
+    *total = 0;
+    for (uint32_t s = 0; s < PCACHE_STORE_SIZE / PCACHE_SECTOR_SIZE; s++) {
+        max = erases[s] > max ? erases[s] : max;
+        *total += erases[s];
+    }
+    return max;
+}
+
+static void
+usage(void)
+{
+    fprintf(stderr, "usage: pcache_bench [-n ops] [-s seed] [-k working set KB] "
+            "[-r record bytes] [-w writes per mille] [-t hot per mille] [-y ops per sync]\n");
+    exit(2);
+}
+
+int
+main(int argc, char **argv)
+{
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:s:k:r:w:t:y:h")) != -1) {
+        switch (opt) {
+        case 'n':
+            n_ops = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 's':
+            seed = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'k':
+            working_kb = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'r':
+            record_size = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'w':
+            writes = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 't':
+            hot = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'y':
+            sync_period = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        default:
+            usage();
+        }
+    }
+    uint32_t n_records = working_kb * 1024 / (record_size ? record_size : 1);
+    if (working_kb == 0 || working_kb * 1024 > PCACHE_STORE_SIZE || record_size == 0 ||
+        n_records < 10) {
+        usage();
+    }
+    rng_state = seed ? seed : 1;
+
+    flash_host_init();
+    pcache_init();
+    memset(shadow, 0xff, sizeof(shadow));
+    memset(direct, 0xff, sizeof(direct));
+
+    /*
+     * Records are placed at random in the store, so that hot ones share
+     * sectors with cold ones.
+     */
+    uint32_t *records = malloc(n_records * sizeof(uint32_t));
+    uint32_t slots_in_store = PCACHE_STORE_SIZE / record_size;
+    for (uint32_t i = 0; i < n_records; i++) {
+        records[i] = i * (slots_in_store / n_records) * record_size;
+    }
+    for (uint32_t i = n_records - 1; i > 0; i--) {
+        uint32_t j = rng() % (i + 1), t = records[i];
+        records[i] = records[j];
+        records[j] = t;
+    }
+
+    uint8_t buf[4096];
+    record_size = record_size < sizeof(buf) ? record_size : sizeof(buf);
+    uint64_t n_reads = 0, n_writes = 0;
+    for (uint32_t op = 0; op < n_ops && n_violations < 10; op++) {
+        uint32_t r = rng() % 1000 < hot ? rng() % (n_records / 10) : rng() % n_records;
+        uint32_t offset = records[r];
+
+        if (rng() % 1000 < writes) {
+            for (uint32_t i = 0; i < record_size; i++) {
+                buf[i] = rng();
+            }
+            if (pcache_write(offset, buf, record_size) != 0) {
+                violation("write failed", offset);
+                continue;
+            }
+            memcpy(shadow + offset, buf, record_size);
+            write_through(offset, record_size);
+            n_writes++;
+        } else {
+            if (pcache_read(offset, buf, record_size) != 0) {
+                violation("read failed", offset);
+                continue;
+            }
+            if (memcmp(buf, shadow + offset, record_size) != 0) {
+                violation("read returned stale data", offset);
+            }
+            n_reads++;
+        }
+
+        if (sync_period != 0 && op % sync_period == sync_period - 1 && pcache_sync() != 0) {
+            violation("sync failed", 0);
+        }
+    }
+
+    if (pcache_sync() != 0) {
+        violation("final sync failed", 0);
+    }
+    if (pcache_stats.n_dirty != 0) {
+        violation("pages left dirty after sync", pcache_stats.n_dirty);
+    }
+    for (uint32_t offset = 0; offset < PCACHE_STORE_SIZE; offset += PCACHE_PAGE_SIZE) {
+        if (memcmp(flash_host_store + offset, shadow + offset, PCACHE_PAGE_SIZE) != 0) {
+            violation("flash differs from what was written", offset);
+            break;
+        }
+    }
+    if (flash_host_bad_programs != 0) {
+        violation("pages programmed without erasing", flash_host_bad_programs);
+    }
+
+    uint64_t lookups = (uint64_t)pcache_stats.n_hits + pcache_stats.n_misses;
+    uint64_t erases, direct_total;
+    uint32_t max = max_erases(flash_host_erases, &erases);
+    uint32_t direct_max = max_erases(direct_erases, &direct_total);
+    printf("%" PRIu64 " reads, %" PRIu64 " writes of %u bytes over %u records, %u KB cache\n",
+           n_reads, n_writes, record_size, n_records, PCACHE_KB);
+    printf("hits %u  misses %u (%.1f%% hit)  evictions %u\n", pcache_stats.n_hits,
+           pcache_stats.n_misses, lookups ? 100.0 * pcache_stats.n_hits / lookups : 0.0,
+           pcache_stats.n_evictions);
+    printf("write-backs %u  pages written %u  programs %u  failed %u\n",
+           pcache_stats.n_write_backs, pcache_stats.n_pages_written, pcache_stats.n_programs,
+           pcache_stats.n_failed);
+    printf("cached:        %8" PRIu64 " erases, worst sector %6u, flash busy %10.1f ms\n",
+           erases, max, flash_host_busy_us / 1000.0);
+    printf("write-through: %8" PRIu64 " erases, worst sector %6u, flash busy %10.1f ms\n",
+           direct_total, direct_max, direct_busy_us / 1000.0);
+
+    if (n_violations != 0) {
+        printf("FAIL: %u violations, reported above\n", n_violations);
+        return 1;
+    }
+    printf("ok\n");
+    return 0;
+}
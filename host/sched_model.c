@@ -0,0 +1,546 @@
+/*
+ * sched_model.c:
+ *
+ * Host model of the dual-core scheduler. Each core is a thread running the
+ * kernel's own scheduler, allocator and process code against the simulated
+ * SRAM, with the SIO spinlocks as atomic flags. The threads stand in for
+ * schedule_handler: they ask for the next process, "switch" to it, and act on
+ * its behalf, sleeping, exiting and spawning replacements at random, and
+ * passing messages over the kernel's channels (see kern/ipc.h), copied or
+ * moved, with receivers blocking until a message comes. Every process starts
+ * on core 0, so core 1 only runs what it steals.
+ *
+ * Switches following a sleep, exit or yield are made as if from SVCall, so
+ * the scheduler counts them as voluntary, and the per-process accounting
+ * is summarized from sched_acct_snapshot at the end.
+ *
+ * Checked:
+ *  - no process ever runs on both cores at once,
+ *  - every PCB comes out of the zone allocator zeroed, though freed ones
+ *    are only zeroed in idle passes or on demand,
+ *  - every message arrives intact, a moved one in a region now on the
+ *    receiver's allocated list, and every message sent is received or left
+ *    in its channel,
+ *  - no process is lost: at the end, every live process is in exactly one
+ *    ready queue, the sleep queue or a channel's wait queue, and in the
+ *    accounting snapshot,
+ *  - each process was switched away from no more often than it was switched
+ *    to,
+ *  - after every process exits, the channels are drained and the PCB zone is
+ *    trimmed, the heap is consistent and back to its starting free space.
+ *
+ * With -t, the kernel trace rings are written to a file for ktrace_decode.
+ */
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ktrace.h"
+#include "palloc.h"
+#include "pico/platform.h"
+#include "process.h"
+#include "resources.h"
+#include "scheduler.h"
+#include "spawn_host.h"
+#include "sram.h"
+#include "hardware/structs/scb.h"
+#include "ipc.h"
+#include "zalloc.h"
+
+#define STACK_SIZE      (1 * (KB))
+#define MAX_SLEEP_US    200
+#define MAX_MOVED       512     /* Largest region sent. */
+
+/* ICSR VECTACTIVE values of the exceptions that enter the scheduler. */
+#define EXC_NUM_SVCALL  11
+#define EXC_NUM_SYSTICK 15
+
+typedef struct {
+    uint64_t    n_passes;       /* Calls to sched_get_next. */
+    uint64_t    n_switches;     /* Passes that switched process. */
+    uint64_t    n_idle;         /* Passes that chose the idle process. */
+    uint64_t    n_migrated;     /* Switches to a process last run elsewhere. */
+    uint64_t    n_sleeps;
+    uint64_t    n_exits;
+    uint64_t    n_yields;
+    uint64_t    n_sent;         /* Messages sent, copied or moved. */
+    uint64_t    n_moved;        /* Of those, regions. */
+    uint64_t    n_bytes_moved;
+    uint64_t    n_received;
+    uint64_t    n_blocked;      /* Receives that blocked. */
+} core_stats_t;
+
+static uint32_t n_ops = 200000;
+static uint32_t n_procs = 16;
+static uint32_t seed = 1;
+static const char *trace_path;
+
+static pthread_barrier_t barrier;
+static pcb_t bootstrap_pcb[NUM_CORES];
+static core_stats_t core_stats[NUM_CORES];
+
+/*
+ * Model-side state of each process, by pid: the core running it (1 + core, or
+ * 0), and the core that last ran it.
+ */
+static atomic_uint running[65536];
+static uint8_t last_core[65536];
+static atomic_int live;
+static atomic_int violations;
+
+static _Thread_local uint32_t rng_state;
+
+static uint32_t
+rng(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+/*
+ * Slot of a process in the model's state, or -1 for the stand-in PCBs that are
+ * not processes (bootstrap, idle and exited), which have no pid.
+ */
+static int
+pcb_slot(pcb_t *pcb)
+{
+    for (unsigned core = 0; core < NUM_CORES; core++) {
+        if (pcb == idle_pcb[core]) {
+            return -1;
+        }
+    }
+    return pcb->pid != 0 ? pcb->pid : -1;
+}
+
+static void
+process_entry(void)
+{
+}
+
+/*
+ * Messages are a byte pattern starting from their first byte, so that any
+ * corruption or mix-up shows.
+ */
+static void
+message_fill(uint8_t *data, uint32_t len)
+{
+    uint8_t seed = rng();
+    for (uint32_t i = 0; i < len; i++) {
+        data[i] = seed + i;
+    }
+}
+
+static int
+message_intact(const uint8_t *data, uint32_t len)
+{
+    for (uint32_t i = 0; i < len; i++) {
+        if (data[i] != (uint8_t)(data[0] + i)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void
+message_send(pcb_t *pcb, core_stats_t *stats)
+{
+    uint32_t channel = rng() % IPC_N_CHANNELS;
+    if (rng() % 2) {
+        uint8_t buf[IPC_INLINE_MAX];
+        uint32_t len = 1 + rng() % IPC_INLINE_MAX;
+        message_fill(buf, len);
+        stats->n_sent += ipc_send(pcb, channel, buf, len) == 0;
+        return;
+    }
+
+    uint32_t len = 1 + rng() % MAX_MOVED;
+    uint8_t *region = ipc_alloc(pcb, len);
+    if (region == NULL) {
+        return;
+    }
+    message_fill(region, len);
+    if (ipc_send_region(pcb, channel, region, len) != 0) {
+        ipc_free(pcb, region);
+        return;
+    }
+    stats->n_sent++;
+    stats->n_moved++;
+    stats->n_bytes_moved += len;
+}
+
+/*
+ * Receive on behalf of a process, returning non-zero if it blocked.
+ */
+static int
+message_receive(pcb_t *pcb, core_stats_t *stats)
+{
+    uint8_t buf[IPC_INLINE_MAX];
+    void *data;
+    int len = ipc_recv(pcb, rng() % IPC_N_CHANNELS, buf, sizeof(buf), &data, 1);
+    if (len == IPC_BLOCKED) {
+        stats->n_blocked++;
+        return 1;
+    }
+    stats->n_received++;
+    if (len <= 0 || !message_intact(data, len)) {
+        fprintf(stderr, "sched_model: pid %u received a corrupt message\n", pcb->pid);
+        atomic_fetch_add(&violations, 1);
+        return 0;
+    }
+    if (data == buf) {
+        return 0;
+    }
+
+    /*
+     * A region received must now be the receiver's. Half of them are kept
+     * until the process exits.
+     */
+    heap_region_t *region = pcb->allocated;
+    while (region != NULL && palloc_data(region) != data) {
+        region = region->next;
+    }
+    if (region == NULL || region->size < (uint32_t)len) {
+        fprintf(stderr, "sched_model: pid %u received a region it does not own\n", pcb->pid);
+        atomic_fetch_add(&violations, 1);
+        return 0;
+    }
+    if (rng() % 2 && ipc_free(pcb, data) != 0) {
+        fprintf(stderr, "sched_model: pid %u could not free a region received\n", pcb->pid);
+        atomic_fetch_add(&violations, 1);
+    }
+    return 0;
+}
+
+static void
+spawn(void)
+{
+    atomic_fetch_add(&live, 1);
+    spawn_host_process("sched_model", SCHED_PRIORITY_DEFAULT, STACK_SIZE, process_entry);
+}
+
+/*
+ * What context_switch does, as far as the model can tell: the previous
+ * process's registers are saved, then the next one's restored.
+ */
+static void
+model_switch(pcb_t *prev, pcb_t *next, unsigned core)
+{
+    int slot = pcb_slot(prev);
+    if (slot >= 0) {
+        atomic_store(&running[slot], 0);
+    }
+
+    slot = pcb_slot(next);
+    if (slot >= 0) {
+        unsigned other = atomic_exchange(&running[slot], core + 1);
+        if (other != 0) {
+            fprintf(stderr, "sched_model: pid %u runs on cores %u and %u\n",
+                    next->pid, other - 1, core);
+            atomic_fetch_add(&violations, 1);
+        }
+        if (last_core[slot] != core + 1) {
+            core_stats[core].n_migrated += last_core[slot] != 0;
+            last_core[slot] = core + 1;
+        }
+    }
+}
+
+static void *
+core_main(void *arg)
+{
+    unsigned core = (unsigned)(uintptr_t)arg;
+    core_stats_t *stats = &core_stats[core];
+
+    host_core_num = core;
+    rng_state = seed * 2654435761u + core + 1;
+    pcb_active[core] = &bootstrap_pcb[core];
+    sched_init();
+
+    pthread_barrier_wait(&barrier);     /* Idle processes created. */
+    pthread_barrier_wait(&barrier);     /* Processes spawned. */
+
+    int voluntary = 0;
+    for (uint32_t i = 0; i < n_ops; i++) {
+        pcb_t *prev = pcb_active[core];
+        scb_hw->icsr = voluntary ? EXC_NUM_SVCALL : EXC_NUM_SYSTICK;
+        pcb_t *next = sched_get_next();
+        stats->n_passes++;
+        if (next != prev) {
+            pcb_active[core] = next;
+            model_switch(prev, next, core);
+            sched_switch_done();
+            stats->n_switches++;
+        }
+        if (next == idle_pcb[core]) {
+            /* As the idle process would before halting. */
+            process_reap_exited();
+            zscrub();
+            stats->n_idle++;
+            continue;
+        }
+
+        /*
+         * Act on behalf of the running process, as its system calls would.
+         * Anything else is the end of its time slice.
+         */
+        uint32_t r = rng() % 100;
+        voluntary = r < 30;
+        if (r >= 30 && r < 38) {
+            message_send(next, stats);
+        } else if (r >= 38 && r < 44) {
+            voluntary = message_receive(next, stats);
+        } else if (r < 10) {
+            if (sched_sleep(next, rng() % MAX_SLEEP_US) == 0) {
+                stats->n_sleeps++;
+            }
+        } else if (r < 12) {
+            /* Switching away from it saves registers to exited_pcb instead. */
+            atomic_store(&running[pcb_slot(next)], 0);
+            process_exit(next);
+            atomic_fetch_sub(&live, 1);
+            stats->n_exits++;
+            spawn();
+        } else if (r < 30) {
+            stats->n_yields++;
+        }
+    }
+
+    /*
+     * Leave the last process switched away from, so that the final checks
+     * see a quiescent system.
+     */
+    pcb_t *prev = pcb_active[core];
+    pcb_active[core] = idle_pcb[core];
+    model_switch(prev, idle_pcb[core], core);
+    process_reap_exited();
+    if (prev->on_core == core + 1) {
+        prev->on_core = 0;
+    }
+
+    return NULL;
+}
+
+static void
+usage(void)
+{
+    fprintf(stderr, "usage: sched_model [-s seed] [-n passes per core] [-p processes] [-t trace]\n");
+    exit(2);
+}
+
+int
+main(int argc, char **argv)
+{
+    pthread_t threads[NUM_CORES];
+    palloc_usage_t before, after;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:n:p:t:h")) != -1) {
+        switch (opt) {
+        case 's':
+            seed = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'n':
+            n_ops = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'p':
+            n_procs = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 't':
+            trace_path = optarg;
+            break;
+        default:
+            usage();
+        }
+    }
+
+    ktrace_init();
+    sram_init();
+    sram_reset_heap();
+    zinit();
+    ipc_init();
+
+    pthread_barrier_init(&barrier, NULL, NUM_CORES + 1);
+    for (unsigned core = 0; core < NUM_CORES; core++) {
+        pthread_create(&threads[core], NULL, core_main, (void *)(uintptr_t)core);
+    }
+
+    /*
+     * Spawn every process from core 0.
+     */
+    pthread_barrier_wait(&barrier);
+    palloc_usage(&before);
+    host_core_num = 0;
+    for (uint32_t i = 0; i < n_procs; i++) {
+        spawn();
+    }
+    pthread_barrier_wait(&barrier);
+
+    for (unsigned core = 0; core < NUM_CORES; core++) {
+        pthread_join(threads[core], NULL);
+    }
+
+    if (trace_path != NULL) {
+        FILE *f = fopen(trace_path, "wb");
+        if (f == NULL || fwrite(ktrace_rings, sizeof(ktrace_rings), 1, f) != 1) {
+            perror(trace_path);
+            return 2;
+        }
+        fclose(f);
+    }
+
+    /*
+     * Every live process must be queued exactly once.
+     */
+    int queued = 0;
+    for (unsigned core = 0; core < NUM_CORES; core++) {
+        for (int p = 0; p < SCHED_N_PRIORITIES; p++) {
+            for (pcb_t *pcb = ready_queues[core][p]; pcb; pcb = pcb->next) {
+                queued++;
+            }
+        }
+    }
+    queued += sleep_count;
+    int blocked = 0;
+    for (uint32_t c = 0; c < IPC_N_CHANNELS; c++) {
+        for (pcb_t *pcb = ipc_channels[c].waiters; pcb; pcb = pcb->next) {
+            blocked++;
+        }
+    }
+    queued += blocked;
+
+    printf("%-6s %10s %10s %10s %10s %10s %10s %10s\n",
+           "core", "passes", "switches", "idle", "migrated", "sleeps", "exits", "yields");
+    uint64_t n_sent = 0, n_moved = 0, n_bytes_moved = 0, n_received = 0, n_blocked = 0;
+    for (unsigned core = 0; core < NUM_CORES; core++) {
+        core_stats_t *s = &core_stats[core];
+        printf("%-6u %10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %10" PRIu64 "\n",
+               core, s->n_passes, s->n_switches, s->n_idle, s->n_migrated, s->n_sleeps, s->n_exits,
+               s->n_yields);
+        n_sent += s->n_sent;
+        n_moved += s->n_moved;
+        n_bytes_moved += s->n_bytes_moved;
+        n_received += s->n_received;
+        n_blocked += s->n_blocked;
+    }
+    uint32_t n_full = 0, n_left = 0;
+    for (uint32_t c = 0; c < IPC_N_CHANNELS; c++) {
+        n_full += ipc_channels[c].n_full;
+        n_left += ipc_channels[c].count;
+    }
+    printf("\nmessages: %" PRIu64 " sent (%" PRIu64 " regions, %" PRIu64 " bytes moved), %" PRIu64
+           " received, %u left, %u sends to full channels; %" PRIu64 " receives blocked, %d now\n",
+           n_sent, n_moved, n_bytes_moved, n_received, n_left, n_full, n_blocked, blocked);
+
+    int failed = 0;
+
+    /*
+     * Summarize the accounting of the processes still alive.
+     */
+    static sched_acct_snapshot_t snap[1024];
+    uint32_t n_snap = sched_acct_snapshot(snap, sizeof(snap) / sizeof(snap[0]));
+    uint64_t run_us = 0, wait_us = 0, idle_us = 0, n_sched = 0, n_vol = 0, n_pre = 0;
+    uint32_t stack_used = 0;
+    int bad_acct = 0;
+    for (uint32_t i = 0; i < n_snap; i++) {
+        sched_acct_t *a = &snap[i].acct;
+        if (snap[i].idle) {
+            idle_us += a->run_us;
+            continue;
+        }
+        if (snap[i].stack_used > stack_used) {
+            stack_used = snap[i].stack_used;
+        }
+        run_us += a->run_us;
+        wait_us += a->wait_us;
+        n_sched += a->n_scheduled;
+        n_vol += a->n_voluntary;
+        n_pre += a->n_preempted;
+        bad_acct += a->n_voluntary + a->n_preempted > a->n_scheduled;
+    }
+    printf("%u live processes: %" PRIu64 " us run, %" PRIu64 " us ready, %" PRIu64
+           " scheduled, %" PRIu64 " voluntary, %" PRIu64 " preempted; idle %" PRIu64 " us\n",
+           n_snap - NUM_CORES, run_us, wait_us, n_sched, n_vol, n_pre, idle_us);
+    printf("deepest stack: %u of %u bytes\n", stack_used, STACK_SIZE);
+    kzone_desc_t *zone = &zone_table[KZONE_PCB];
+    printf("PCB zone: %u allocs, %u frees, %u failed, %u in use of %u, high water %u, "
+           "%u slabs grown, %u returned\n\n",
+           zone->n_allocs, zone->n_frees, zone->n_failed, zone->n_used, zone->n_elems,
+           zone->high_water, zone->n_grows, zone->n_shrinks);
+    if (n_snap != (uint32_t)atomic_load(&live) + NUM_CORES) {
+        printf("FAIL: %u processes in the accounting snapshot, %d live\n",
+               n_snap - NUM_CORES, atomic_load(&live));
+        failed = 1;
+    }
+    if (n_sent != n_received + n_left) {
+        printf("FAIL: %" PRIu64 " messages sent, %" PRIu64 " received and %u left\n",
+               n_sent, n_received, n_left);
+        failed = 1;
+    }
+    if (bad_acct != 0) {
+        printf("FAIL: %d processes switched away from more often than to\n", bad_acct);
+        failed = 1;
+    }
+
+    if (atomic_load(&violations) != 0) {
+        printf("FAIL: %d violations, reported above\n", atomic_load(&violations));
+        failed = 1;
+    }
+    if (queued != atomic_load(&live)) {
+        printf("FAIL: %d processes queued, %d live\n", queued, atomic_load(&live));
+        failed = 1;
+    }
+    if (core_stats[1].n_switches == 0) {
+        printf("FAIL: core 1 never took work from core 0\n");
+        failed = 1;
+    }
+
+    /*
+     * Exit every remaining process, and receive what is left in the channels
+     * on behalf of nobody; the heap must be as it was before any were
+     * spawned.
+     */
+    while (sleep_count > 0) {
+        process_exit(sleep_heap[0]);
+    }
+    for (uint32_t c = 0; c < IPC_N_CHANNELS; c++) {
+        while (ipc_channels[c].waiters != NULL) {
+            process_exit(ipc_channels[c].waiters);
+        }
+        static pcb_t drain;
+        uint8_t buf[IPC_INLINE_MAX];
+        void *data;
+        while (ipc_recv(&drain, c, buf, sizeof(buf), &data, 0) >= 0) {
+        }
+        pfree_all(&drain);
+    }
+    for (unsigned core = 0; core < NUM_CORES; core++) {
+        while (ready_map[core] != 0) {
+            for (int p = 0; p < SCHED_N_PRIORITIES; p++) {
+                if (ready_queues[core][p] != NULL) {
+                    process_exit(ready_queues[core][p]);
+                    break;
+                }
+            }
+        }
+    }
+    while (zscrub()) {
+    }
+    ztrim();
+    palloc_usage(&after);
+    if (palloc_check() != 0 || after.free_bytes != before.free_bytes ||
+        after.n_free != before.n_free) {
+        printf("FAIL: heap not restored (%u bytes in %u regions free, expected %u in %u)\n",
+               after.free_bytes, after.n_free, before.free_bytes, before.n_free);
+        failed = 1;
+    }
+
+    printf("%s\n", failed ? "FAILED" : "ok");
+    return failed;
+}
@@ -0,0 +1,711 @@
+/*
+ * sched_sim.c:
+ *
+ * Deterministic discrete-event simulator of the scheduler at scale, for
+ * comparing scheduler changes. Both cores are simulated in one thread against
+ * the kernel's own scheduler, process and allocator code, in simulated time
+ * that jumps from one event to the next: a core's SysTick expiring, a process
+ * finishing its burst of computation, a pending reschedule, or a device
+ * completing a request. Idle cores pass through the scheduler at every event,
+ * as the event signalled by sched_enqueue would wake them.
+ *
+ * The workload is hundreds of processes of three classes:
+ *  - cpu-bound: computes forever at the default priority,
+ *  - i/o-bound: computes briefly, then blocks on a device until its request
+ *    completes, the completion waking it from core 0's interrupt handler,
+ *  - sleeper: computes very briefly, then sleeps, at a higher priority still.
+ * With -x, i/o-bound processes and sleepers exit at the end of that percentage
+ * of their rounds (at most half), and are replaced by new ones, churning the
+ * PCB zone and the heap.
+ *
+ * Reported: switches per second of simulated time, the scheduling latency of
+ * each class (from becoming ready, by waking, wake time or preemption, until
+ * switched to), Jain's fairness index over the run time of the cpu-bound
+ * processes, migrations between cores, the memory held by the processes, and
+ * the host time taken per pass through the scheduler. Everything but the host
+ * time is the same from run to run for the same options.
+ *
+ * Checked:
+ *  - no process ever runs on both cores at once,
+ *  - the kernel's accounting of every live process's running and waiting
+ *    time matches the simulator's, to the microsecond,
+ *  - every live process is in exactly one queue at the end,
+ *  - every i/o-bound process and sleeper completes rounds,
+ *  - the fairness index is at least that given with -f (0.9 by default; runs
+ *    too short for every cpu-bound process to have several time slices need
+ *    a lower one),
+ *  - after every process exits and the PCB zone is trimmed, the heap is
+ *    consistent and back to its starting free space.
+ *
+ *      sched_sim [-d simulated ms] [-c cpu-bound] [-i i/o-bound] [-z sleepers]
+ *                [-x churn %] [-f min fairness] [-s seed]
+ */
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "klock.h"
+#include "palloc.h"
+#include "pico/platform.h"
+#include "process.h"
+#include "resources.h"
+#include "scheduler.h"
+#include "spawn_host.h"
+#include "sram.h"
+#include "zalloc.h"
+#include "hardware/clocks.h"
+#include "hardware/structs/scb.h"
+#include "hardware/structs/systick.h"
+#include "hardware/timer.h"
+
+#define STACK_SIZE          256
+#define MAX_PROCS           1000
+
+/* Spinlock guarding the simulated device's wait queues, one the kernel does not use. */
+#define KLOCK_DEVICE        (PICO_SPINLOCK_ID_CLAIM_FREE_FIRST - 1)
+
+/* Bursts and waits of each class, in microseconds. */
+#define IO_BURST_MIN        20
+#define IO_BURST_MAX        80
+#define IO_WAIT_MIN         2000
+#define IO_WAIT_MAX         40000
+#define SLEEP_BURST_MIN     5
+#define SLEEP_BURST_MAX     30
+#define SLEEP_MIN           1000
+#define SLEEP_MAX           10000
+
+/* ICSR VECTACTIVE values of the exceptions that enter the scheduler. */
+#define EXC_NUM_SVCALL      11
+#define EXC_NUM_SYSTICK     15
+
+/* SysTick counting with its interrupt enabled, as tick_program leaves it. */
+#define SYSTICK_CSR_RUN     0x7
+
+#define NO_SLOT             0xffff
+
+enum { CLASS_CPU, CLASS_IO, CLASS_SLEEP, N_CLASSES };
+
+static const char *class_names[N_CLASSES] = { "cpu-bound", "i/o-bound", "sleeper" };
+
+static const uint8_t class_priority[N_CLASSES] = {
+    SCHED_PRIORITY_DEFAULT, SCHED_PRIORITY_DEFAULT - 1, SCHED_PRIORITY_DEFAULT - 2,
+};
+
+/*
+ * A simulated process. Processes that exit are replaced in the same slot, so
+ * the counts of a slot cover every process that occupied it.
+ */
+typedef struct {
+    int         class;
+    pcb_t      *pcb;
+    pcb_t      *waiters;        /* Its device's wait queue. */
+    uint32_t    left;           /* Computation left before its next action, in us. */
+    uint32_t    since;          /* When it was last switched to. */
+    uint32_t    ready_at;       /* When it last became ready. */
+    uint8_t     running;        /* 1 + core running it, or 0. */
+    uint8_t     last_core;      /* 1 + core that last ran it, or 0. */
+
+    sched_acct_t acct;          /* As the kernel should account the process now in the slot. */
+    uint64_t    run_us;
+    uint32_t    n_rounds;
+} proc_t;
+
+/*
+ * Latencies of a class, in microseconds.
+ */
+typedef struct {
+    uint32_t   *us;
+    uint32_t    n;
+    uint32_t    cap;
+} latencies_t;
+
+/*
+ * A device request in progress: a binary min-heap entry ordered by done.
+ */
+typedef struct {
+    uint32_t    done;
+    uint16_t    slot;
+} request_t;
+
+static uint32_t duration_ms = 2000;
+static uint32_t class_count[N_CLASSES] = { 64, 160, 24 };
+static uint32_t churn_pct = 2;
+static double min_fairness = 0.9;
+static uint32_t seed = 1;
+
+static proc_t procs[MAX_PROCS];
+static uint32_t n_procs;
+static uint16_t slot_of[65536];     /* Slot of each live pid. */
+static proc_t *current[NUM_CORES];  /* Process each core is running, or NULL. */
+static latencies_t latencies[N_CLASSES];
+
+static request_t requests[MAX_PROCS];
+static uint32_t n_requests;
+
+static uint64_t n_passes, n_switches, n_migrations, n_exits;
+static uint64_t idle_us[NUM_CORES];
+static uint32_t heap_low;           /* Least free heap seen after a spawn. */
+static uint32_t n_violations;
+
+static uint32_t rng_state;
+
+static uint32_t
+rng(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+static uint32_t
+rng_range(uint32_t min, uint32_t max)
+{
+    return min + rng() % (max - min + 1);
+}
+
+static void
+violation(const char *what, const proc_t *proc)
+{
+    if (n_violations++ < 10) {
+        fprintf(stderr, "sched_sim: %s%s%s at %u us\n", proc != NULL ? class_names[proc->class] : "",
+                proc != NULL ? ": " : "", what, host_sim_us);
+    }
+}
+
+static void
+process_entry(void)
+{
+}
+
+static void
+latency_record(int class, uint32_t us)
+{
+    latencies_t *l = &latencies[class];
+    if (l->n == l->cap) {
+        l->cap = l->cap != 0 ? 2 * l->cap : 4096;
+        l->us = realloc(l->us, l->cap * sizeof(l->us[0]));
+        if (l->us == NULL) {
+            fprintf(stderr, "sched_sim: out of memory\n");
+            exit(2);
+        }
+    }
+    l->us[l->n++] = us;
+}
+
+static void
+request_start(uint16_t slot, uint32_t done)
+{
+    uint32_t i = n_requests++;
+    while (i > 0 && done < requests[(i - 1) / 2].done) {
+        requests[i] = requests[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    requests[i] = (request_t){ done, slot };
+}
+
+static request_t
+request_finish(void)
+{
+    request_t first = requests[0];
+    request_t last = requests[--n_requests];
+    uint32_t i = 0;
+    while (1) {
+        uint32_t child = 2 * i + 1;
+        if (child >= n_requests) {
+            break;
+        }
+        if (child + 1 < n_requests && requests[child + 1].done < requests[child].done) {
+            child++;
+        }
+        if (last.done <= requests[child].done) {
+            break;
+        }
+        requests[i] = requests[child];
+        i = child;
+    }
+    requests[i] = last;
+    return first;
+}
+
+/*
+ * Give a process its next burst of computation.
+ */
+static void
+burst_start(proc_t *proc)
+{
+    switch (proc->class) {
+    case CLASS_CPU:
+        proc->left = UINT32_MAX;
+        break;
+    case CLASS_IO:
+        proc->left = rng_range(IO_BURST_MIN, IO_BURST_MAX);
+        break;
+    case CLASS_SLEEP:
+        proc->left = rng_range(SLEEP_BURST_MIN, SLEEP_BURST_MAX);
+        break;
+    }
+}
+
+/*
+ * Start a process of the given class in a slot, ready on the calling core.
+ */
+static void
+spawn(uint16_t slot, int class)
+{
+    proc_t *proc = &procs[slot];
+    pcb_t *pcb = spawn_host_process("sched_sim", class_priority[class], STACK_SIZE, process_entry);
+    if (slot_of[pcb->pid] != NO_SLOT) {
+        violation("pid reused while its process lives", proc);
+    }
+    slot_of[pcb->pid] = slot;
+    proc->class = class;
+    proc->pcb = pcb;
+    proc->waiters = NULL;
+    proc->running = 0;
+    proc->last_core = 0;
+    proc->ready_at = host_sim_us;
+    memset(&proc->acct, 0, sizeof(proc->acct));
+    burst_start(proc);
+
+    palloc_usage_t usage;
+    palloc_usage(&usage);
+    if (usage.free_bytes < heap_low) {
+        heap_low = usage.free_bytes;
+    }
+}
+
+static proc_t *
+proc_of(pcb_t *pcb)
+{
+    for (unsigned core = 0; core < NUM_CORES; core++) {
+        if (pcb == idle_pcb[core]) {
+            return NULL;
+        }
+    }
+    uint16_t slot = slot_of[pcb->pid];
+    return slot != NO_SLOT ? &procs[slot] : NULL;
+}
+
+/*
+ * The running process on a core has finished its burst: block on its device,
+ * sleep, or exit and be replaced, as its system call would.
+ */
+static void
+act(proc_t *proc, unsigned core)
+{
+    pcb_t *pcb = proc->pcb;
+
+    proc->n_rounds++;
+    if (rng() % 100 < churn_pct) {
+        uint16_t slot = proc - procs;
+        slot_of[pcb->pid] = NO_SLOT;
+        proc->running = 0;
+        current[core] = NULL;
+        process_exit(pcb);
+        n_exits++;
+        spawn(slot, proc->class);
+        return;
+    }
+
+    burst_start(proc);
+    if (proc->class == CLASS_IO) {
+        uint32_t saved = klock(KLOCK_DEVICE);
+        sched_block(pcb, &proc->waiters, KLOCK_DEVICE);
+        kunlock(KLOCK_DEVICE, saved);
+        request_start(proc - procs, host_sim_us + rng_range(IO_WAIT_MIN, IO_WAIT_MAX));
+    } else {
+        if (sched_sleep(pcb, rng_range(SLEEP_MIN, SLEEP_MAX)) != 0) {
+            violation("sleep queue full", proc);
+            return;
+        }
+        proc->ready_at = pcb->wake_time;
+    }
+}
+
+/*
+ * Pass through the scheduler on a core, as schedule_handler would, and follow
+ * the switch it makes.
+ */
+static void
+pass(unsigned core, int voluntary)
+{
+    uint32_t now = host_sim_us;
+    pcb_t *prev = pcb_active[core];
+
+    host_core_num = core;
+    host_scb[core].icsr = voluntary ? EXC_NUM_SVCALL : EXC_NUM_SYSTICK;
+    pcb_t *next = sched_get_next();
+    n_passes++;
+    if (next == prev) {
+        return;
+    }
+    pcb_active[core] = next;
+
+    proc_t *proc = current[core];
+    if (proc != NULL) {
+        proc->run_us += now - proc->since;
+        proc->acct.run_us += now - proc->since;
+        proc->left -= proc->class != CLASS_CPU ? now - proc->since : 0;
+        proc->running = 0;
+        if (proc->pcb->state == PROC_READY) {
+            proc->ready_at = now;
+        }
+    }
+
+    proc = proc_of(next);
+    current[core] = proc;
+    if (proc != NULL) {
+        if (proc->running != 0) {
+            violation("runs on both cores", proc);
+        }
+        proc->running = core + 1;
+        if (proc->last_core != 0 && proc->last_core != core + 1) {
+            n_migrations++;
+        }
+        proc->last_core = core + 1;
+        proc->since = now;
+        proc->acct.wait_us += now - proc->ready_at;
+        proc->acct.n_scheduled++;
+        latency_record(proc->class, now - proc->ready_at);
+    }
+    sched_switch_done();
+    n_switches++;
+
+    if (next == idle_pcb[core]) {
+        /* As the idle process would before halting. */
+        process_reap_exited();
+    }
+}
+
+static void
+run(void)
+{
+    uint32_t ticks_per_us = clock_get_hz(clk_sys) / 1000000;
+    uint32_t end = duration_ms * 1000;
+    uint32_t deadline[NUM_CORES] = { 0 };
+    int armed[NUM_CORES] = { 0 };
+    int voluntary[NUM_CORES] = { 0 };
+    uint32_t now = 0;
+
+    while (1) {
+        host_sim_us = now;
+
+        /*
+         * Requests complete on core 0, whose interrupt handler wakes the
+         * process waiting for each.
+         */
+        host_core_num = 0;
+        while (n_requests > 0 && requests[0].done <= now) {
+            proc_t *proc = &procs[request_finish().slot];
+            uint32_t saved = klock(KLOCK_DEVICE);
+            if (sched_wake(&proc->waiters) != proc->pcb) {
+                violation("woken process is not the one waiting", proc);
+            }
+            kunlock(KLOCK_DEVICE, saved);
+            proc->ready_at = now;
+        }
+
+        for (unsigned core = 0; core < NUM_CORES; core++) {
+            proc_t *proc = current[core];
+            if (proc != NULL && proc->class != CLASS_CPU && now - proc->since >= proc->left) {
+                proc->run_us += now - proc->since;
+                proc->acct.run_us += now - proc->since;
+                proc->since = now;
+                proc->left = 0;
+                host_core_num = core;
+                act(proc, core);
+                voluntary[core] = 1;
+            }
+        }
+
+        /*
+         * A core passes at most twice per event, the second time only if it
+         * is idle and may find something the other core's pass made ready.
+         */
+        for (int round = 0; round < 2; round++) {
+            for (unsigned core = 0; core < NUM_CORES; core++) {
+                int idle = pcb_active[core] == idle_pcb[core];
+                if (!(host_scb[core].icsr & M0PLUS_ICSR_PENDSTSET_BITS) && !voluntary[core] &&
+                    !(armed[core] && now >= deadline[core]) &&
+                    !(idle && (round == 0 || (ready_map[0] | ready_map[1]) != 0))) {
+                    continue;
+                }
+                pass(core, voluntary[core]);
+                voluntary[core] = 0;
+                armed[core] = host_systick[core].csr == SYSTICK_CSR_RUN;
+                deadline[core] = now + (host_systick[core].rvr + ticks_per_us) / ticks_per_us;
+            }
+        }
+
+        /*
+         * Jump to the next event.
+         */
+        uint32_t next = end;
+        for (unsigned core = 0; core < NUM_CORES; core++) {
+            proc_t *proc = current[core];
+            if (armed[core] && deadline[core] < next) {
+                next = deadline[core];
+            }
+            if (proc != NULL && proc->class != CLASS_CPU && proc->since + proc->left < next) {
+                next = proc->since + proc->left;
+            }
+        }
+        if (n_requests > 0 && requests[0].done < next) {
+            next = requests[0].done;
+        }
+        for (unsigned core = 0; core < NUM_CORES; core++) {
+            if (pcb_active[core] == idle_pcb[core]) {
+                idle_us[core] += next - now;
+            }
+        }
+        if (next >= end) {
+            break;
+        }
+        now = next;
+    }
+    host_sim_us = end;
+    for (unsigned core = 0; core < NUM_CORES; core++) {
+        if (current[core] != NULL) {
+            current[core]->run_us += end - current[core]->since;
+            current[core]->acct.run_us += end - current[core]->since;
+        }
+    }
+}
+
+static int
+compare_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static uint32_t
+percentile(const latencies_t *l, double p)
+{
+    if (l->n == 0) {
+        return 0;
+    }
+    uint32_t i = (uint32_t)(p * l->n);
+    return l->us[i < l->n ? i : l->n - 1];
+}
+
+static void
+usage(void)
+{
+    fprintf(stderr, "usage: sched_sim [-d simulated ms] [-c cpu-bound] [-i i/o-bound] "
+            "[-z sleepers] [-x churn %%] [-f min fairness] [-s seed]\n");
+    exit(2);
+}
+
+int
+main(int argc, char **argv)
+{
+    palloc_usage_t before, after;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "d:c:i:z:x:f:s:h")) != -1) {
+        switch (opt) {
+        case 'd':
+            duration_ms = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'c':
+            class_count[CLASS_CPU] = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'i':
+            class_count[CLASS_IO] = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'z':
+            class_count[CLASS_SLEEP] = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'x':
+            churn_pct = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'f':
+            min_fairness = strtod(optarg, NULL);
+            break;
+        case 's':
+            seed = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        default:
+            usage();
+        }
+    }
+    n_procs = class_count[CLASS_CPU] + class_count[CLASS_IO] + class_count[CLASS_SLEEP];
+    if (duration_ms == 0 || duration_ms > 3600 * 1000 || n_procs == 0 || n_procs > MAX_PROCS ||
+        class_count[CLASS_SLEEP] > SCHED_MAX_SLEEPERS || churn_pct > 50) {
+        usage();
+    }
+
+    host_time_simulated = 1;
+    rng_state = seed * 2654435761u + 1;
+    memset(slot_of, 0xff, sizeof(slot_of));
+    sram_init();
+    sram_reset_heap();
+    zinit();
+    for (unsigned core = 0; core < NUM_CORES; core++) {
+        host_core_num = core;
+        sched_init();
+        pcb_active[core] = idle_pcb[core];
+    }
+
+    /*
+     * Every process starts on core 0, as those loaded at boot do.
+     */
+    host_core_num = 0;
+    palloc_usage(&before);
+    heap_low = before.free_bytes;
+    uint16_t slot = 0;
+    for (int class = 0; class < N_CLASSES; class++) {
+        for (uint32_t i = 0; i < class_count[class]; i++) {
+            spawn(slot++, class);
+        }
+    }
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    run();
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double host_ns = (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+    double seconds = duration_ms / 1000.0;
+
+    printf("%u cpu-bound, %u i/o-bound, %u sleepers, %u%% churn, seed %u: %u ms simulated\n\n",
+           class_count[CLASS_CPU], class_count[CLASS_IO], class_count[CLASS_SLEEP], churn_pct,
+           seed, duration_ms);
+    printf("%-10s %6s %9s %8s %10s   %-36s\n", "class", "procs", "rounds", "cpu %", "switches",
+           "latency us: p50      p99    p99.9      max");
+    for (int class = 0; class < N_CLASSES; class++) {
+        latencies_t *l = &latencies[class];
+        uint64_t rounds = 0, run_us = 0;
+        for (uint32_t i = 0; i < n_procs; i++) {
+            if (procs[i].class == class) {
+                rounds += procs[i].n_rounds;
+                run_us += procs[i].run_us;
+            }
+        }
+        qsort(l->us, l->n, sizeof(l->us[0]), compare_u32);
+        printf("%-10s %6u %9" PRIu64 " %7.1f%% %10u   %14u %8u %8u %8u\n", class_names[class],
+               class_count[class], rounds, 100.0 * run_us / (NUM_CORES * duration_ms * 1000.0),
+               l->n, percentile(l, 0.5), percentile(l, 0.99), percentile(l, 0.999),
+               l->n != 0 ? l->us[l->n - 1] : 0);
+        if (class != CLASS_CPU && class_count[class] != 0 && rounds == 0) {
+            violation("no process completed a round", NULL);
+        }
+    }
+
+    /*
+     * Jain's index over the cpu-bound processes' run time: 1 if they all ran
+     * equally long, 1/n if one ran alone.
+     */
+    double sum = 0, sum_sq = 0;
+    uint64_t least = UINT64_MAX, most = 0;
+    for (uint32_t i = 0; i < class_count[CLASS_CPU]; i++) {
+        uint64_t x = procs[i].run_us;
+        sum += x;
+        sum_sq += (double)x * x;
+        least = x < least ? x : least;
+        most = x > most ? x : most;
+    }
+    if (class_count[CLASS_CPU] != 0) {
+        double fairness = sum_sq != 0 ? sum * sum / (class_count[CLASS_CPU] * sum_sq) : 1.0;
+        printf("\nfairness: %.3f over cpu-bound run time, %" PRIu64 " to %" PRIu64 " us each\n",
+               fairness, least, most);
+        if (fairness < min_fairness) {
+            violation("cpu-bound processes shared the cores unfairly", NULL);
+        }
+    }
+    printf("switches: %.0f/s, %" PRIu64 " migrations, %" PRIu64 " exits; idle %.1f%% and %.1f%%\n",
+           n_switches / seconds, n_migrations, n_exits, 100.0 * idle_us[0] / (duration_ms * 1000.0),
+           100.0 * idle_us[1] / (duration_ms * 1000.0));
+
+    kzone_desc_t *zone = &zone_table[KZONE_PCB];
+    palloc_usage_t end;
+    palloc_usage(&end);
+    printf("memory: %u bytes held by %u processes (%u each), at most %u; "
+           "%u bytes free in %u regions, largest %u;\n"
+           "        PCB zone high water %u, %u slabs grown, %u returned\n",
+           before.free_bytes - end.free_bytes, n_procs, (before.free_bytes - end.free_bytes) / n_procs,
+           before.free_bytes - heap_low, end.free_bytes, end.n_free, end.largest_free,
+           zone->high_water, zone->n_grows, zone->n_shrinks);
+    printf("host: %.0f ns per pass, %" PRIu64 " passes\n\n", host_ns / n_passes, n_passes);
+
+    /*
+     * The kernel's accounting of every live process must agree with the
+     * simulator's, counting the wait in progress of those ready but not
+     * running.
+     */
+    static sched_acct_snapshot_t snap[MAX_PROCS + NUM_CORES];
+    uint32_t n_snap = sched_acct_snapshot(snap, sizeof(snap) / sizeof(snap[0]));
+    for (uint32_t i = 0; i < n_snap; i++) {
+        if (snap[i].idle) {
+            continue;
+        }
+        proc_t *proc = &procs[slot_of[snap[i].pid]];
+        uint64_t wait_us = proc->acct.wait_us;
+        if (snap[i].state == PROC_READY && proc->running == 0) {
+            wait_us += host_sim_us - proc->ready_at;
+        }
+        if (snap[i].acct.run_us != proc->acct.run_us || snap[i].acct.wait_us != wait_us ||
+            snap[i].acct.n_scheduled != proc->acct.n_scheduled) {
+            violation("kernel accounting disagrees", proc);
+        }
+    }
+
+    /*
+     * Leave every core idle, then check that every live process is queued
+     * exactly once.
+     */
+    for (unsigned core = 0; core < NUM_CORES; core++) {
+        host_core_num = core;
+        pcb_t *prev = pcb_active[core];
+        pcb_active[core] = idle_pcb[core];
+        process_reap_exited();
+        if (prev->on_core == core + 1) {
+            prev->on_core = 0;
+        }
+    }
+    host_core_num = 0;
+    uint32_t queued = sleep_count;
+    for (unsigned core = 0; core < NUM_CORES; core++) {
+        for (int p = 0; p < SCHED_N_PRIORITIES; p++) {
+            for (pcb_t *pcb = ready_queues[core][p]; pcb; pcb = pcb->next) {
+                queued++;
+            }
+        }
+    }
+    for (uint32_t i = 0; i < n_procs; i++) {
+        for (pcb_t *pcb = procs[i].waiters; pcb; pcb = pcb->next) {
+            queued++;
+        }
+    }
+    if (queued != n_procs) {
+        printf("FAIL: %u processes queued, %u live\n", queued, n_procs);
+        n_violations++;
+    }
+
+    /*
+     * Exit every process; the heap must be as it was before any were spawned.
+     */
+    for (uint32_t i = 0; i < n_procs; i++) {
+        process_exit(procs[i].pcb);
+    }
+    ztrim();
+    palloc_usage(&after);
+    if (palloc_check() != 0 || after.free_bytes != before.free_bytes ||
+        after.n_free != before.n_free) {
+        printf("FAIL: heap not restored (%u bytes in %u regions free, expected %u in %u)\n",
+               after.free_bytes, after.n_free, before.free_bytes, before.n_free);
+        n_violations++;
+    }
+
+    if (n_violations != 0) {
+        printf("FAIL: %u violations\n", n_violations);
+        return 1;
+    }
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,24 @@
+/*
+ * hardware/clocks.h:
+ *
+ * Host stand-in for the Pico SDK header of the same name. The system clock
+ * runs at the RP2040's default 125MHz.
+ */
+
+#ifndef __HOST_HARDWARE_CLOCKS_H__
+#define __HOST_HARDWARE_CLOCKS_H__
+
+#include <stdint.h>
+
+enum clock_index {
+    clk_sys = 5,
+};
+
+static inline uint32_t
+clock_get_hz(enum clock_index clk_index)
+{
+    (void)clk_index;
+    return 125000000;
+}
+
+#endif /* __HOST_HARDWARE_CLOCKS_H__ */
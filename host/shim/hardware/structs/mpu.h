@@ -0,0 +1,28 @@
+/*
+ * hardware/structs/mpu.h:
+ *
+ * Host stand-in for the Pico SDK header of the same name. Each simulated core
+ * has its own MPU; writes to it have no effect. The pager keeps its own copy
+ * of what it programs (pager_mpu in pager.h), which is what host tools check.
+ */
+
+#ifndef __HOST_HARDWARE_STRUCTS_MPU_H__
+#define __HOST_HARDWARE_STRUCTS_MPU_H__
+
+#include <stdint.h>
+
+#include "pico/platform.h"
+
+typedef struct {
+    volatile uint32_t type;
+    volatile uint32_t ctrl;
+    volatile uint32_t rnr;
+    volatile uint32_t rbar;
+    volatile uint32_t rasr;
+} mpu_hw_t;
+
+extern mpu_hw_t host_mpu[NUM_CORES];
+
+#define mpu_hw (&host_mpu[get_core_num()])
+
+#endif /* __HOST_HARDWARE_STRUCTS_MPU_H__ */
@@ -0,0 +1,29 @@
+/*
+ * hardware/structs/scb.h:
+ *
+ * Host stand-in for the Pico SDK header of the same name. Each simulated core
+ * has its own system control block; writes to it have no effect.
+ */
+
+#ifndef __HOST_HARDWARE_STRUCTS_SCB_H__
+#define __HOST_HARDWARE_STRUCTS_SCB_H__
+
+#include <stdint.h>
+
+#include "pico/platform.h"
+
+#define M0PLUS_ICSR_PENDSTSET_BITS 0x04000000
+#define M0PLUS_ICSR_PENDSTCLR_BITS 0x02000000
+#define M0PLUS_ICSR_VECTACTIVE_BITS 0x000001ff
+
+typedef struct {
+    volatile uint32_t cpuid;
+    volatile uint32_t icsr;
+    volatile uint32_t vtor;
+} armv6m_scb_hw_t;
+
+extern armv6m_scb_hw_t host_scb[NUM_CORES];
+
+#define scb_hw (&host_scb[get_core_num()])
+
+#endif /* __HOST_HARDWARE_STRUCTS_SCB_H__ */
@@ -0,0 +1,26 @@
+/*
+ * hardware/structs/systick.h:
+ *
+ * Host stand-in for the Pico SDK header of the same name. Each simulated core
+ * has its own SysTick registers, which nothing counts down.
+ */
+
+#ifndef __HOST_HARDWARE_STRUCTS_SYSTICK_H__
+#define __HOST_HARDWARE_STRUCTS_SYSTICK_H__
+
+#include <stdint.h>
+
+#include "pico/platform.h"
+
+typedef struct {
+    volatile uint32_t csr;
+    volatile uint32_t rvr;
+    volatile uint32_t cvr;
+    volatile uint32_t calib;
+} systick_hw_t;
+
+extern systick_hw_t host_systick[NUM_CORES];
+
+#define systick_hw (&host_systick[get_core_num()])
+
+#endif /* __HOST_HARDWARE_STRUCTS_SYSTICK_H__ */
@@ -0,0 +1,73 @@
+/*
+ * hardware/sync.h:
+ *
+ * Host stand-in for the Pico SDK header of the same name. SIO spinlocks are
+ * atomic flags shared by the threads simulating the cores, and the event and
+ * interrupt hint instructions, like interrupt masking, do nothing.
+ */
+
+#ifndef __HOST_HARDWARE_SYNC_H__
+#define __HOST_HARDWARE_SYNC_H__
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#define PICO_SPINLOCK_ID_OS1                14
+#define PICO_SPINLOCK_ID_OS2                15
+#define PICO_SPINLOCK_ID_CLAIM_FREE_FIRST   24
+
+typedef atomic_flag spin_lock_t;
+
+extern spin_lock_t host_spin_locks[32];
+
+static inline spin_lock_t *
+spin_lock_instance(unsigned int lock_num)
+{
+    return &host_spin_locks[lock_num];
+}
+
+static inline void
+spin_lock_claim(unsigned int lock_num)
+{
+    (void)lock_num;
+}
+
+static inline uint32_t
+spin_lock_blocking(spin_lock_t *lock)
+{
+    while (atomic_flag_test_and_set_explicit(lock, memory_order_acquire)) {
+    }
+    return 0;
+}
+
+static inline void
+spin_unlock(spin_lock_t *lock, uint32_t saved_irq)
+{
+    (void)saved_irq;
+    atomic_flag_clear_explicit(lock, memory_order_release);
+}
+
+/*
+ * Kernel code on a simulated core is never interrupted, so there is nothing
+ * to mask.
+ */
+static inline uint32_t
+save_and_disable_interrupts(void)
+{
+    return 0;
+}
+
+static inline void
+restore_interrupts(uint32_t status)
+{
+    (void)status;
+}
+
+static inline void __dmb(void) { atomic_thread_fence(memory_order_seq_cst); }
+static inline void __dsb(void) { atomic_thread_fence(memory_order_seq_cst); }
+static inline void __isb(void) {}
+static inline void __sev(void) {}
+static inline void __wfe(void) {}
+static inline void __wfi(void) {}
+
+#endif /* __HOST_HARDWARE_SYNC_H__ */
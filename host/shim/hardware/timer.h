@@ -0,0 +1,20 @@
+/*
+ * hardware/timer.h:
+ *
+ * Host stand-in for the Pico SDK header of the same name, counting
+ * microseconds of the host's monotonic clock, or, for simulations that step
+ * time themselves, returning host_sim_us while host_time_simulated is set.
+ */
+
+#ifndef __HOST_HARDWARE_TIMER_H__
+#define __HOST_HARDWARE_TIMER_H__
+
+#include <stdint.h>
+
+extern int host_time_simulated;
+extern uint32_t host_sim_us;
+
+uint32_t
+time_us_32(void);
+
+#endif /* __HOST_HARDWARE_TIMER_H__ */
@@ -0,0 +1,31 @@
+/*
+ * pico/platform.h:
+ *
+ * Host stand-in for the Pico SDK header of the same name. Code and data
+ * placement has no meaning natively, so the section macros expand to nothing.
+ * Cores are simulated by threads (see cores.c).
+ */
+
+#ifndef __HOST_PICO_PLATFORM_H__
+#define __HOST_PICO_PLATFORM_H__
+
+#define __scratch_x(group)
+#define __scratch_y(group)
+#define __not_in_flash(group)
+#define __not_in_flash_func(func_name) func_name
+#define __time_critical_func(func_name) func_name
+
+#define NUM_CORES 2
+
+/*
+ * Each simulated core is a thread, which sets its own core number.
+ */
+extern _Thread_local unsigned int host_core_num;
+
+static inline unsigned int
+get_core_num(void)
+{
+    return host_core_num;
+}
+
+#endif /* __HOST_PICO_PLATFORM_H__ */
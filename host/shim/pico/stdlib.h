@@ -0,0 +1,17 @@
+/*
+ * pico/stdlib.h:
+ *
+ * Host stand-in for the Pico SDK header of the same name, providing only what
+ * the kernel sources need to compile natively.
+ */
+
+#ifndef __HOST_PICO_STDLIB_H__
+#define __HOST_PICO_STDLIB_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "pico/platform.h"
+
+#endif /* __HOST_PICO_STDLIB_H__ */
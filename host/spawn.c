@@ -0,0 +1,42 @@
+/*
+ * spawn.c:
+ *
+ * Process creation shared by the host tools (see spawn_host.h).
+ */
+
+#include "spawn_host.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "palloc.h"
+#include "process.h"
+#include "zalloc.h"
+
+pcb_t *
+spawn_host_process(const char *tool, uint8_t priority, uint32_t stack_size, void (*entry)(void))
+{
+    static const pcb_t zero;
+
+    pcb_t *pcb = zalloc(KZONE_PCB);
+    if (pcb == NULL) {
+        fprintf(stderr, "%s: PCB zone and heap exhausted\n", tool);
+        exit(2);
+    }
+    if (memcmp(pcb, &zero, sizeof(zero)) != 0) {
+        fprintf(stderr, "%s: zalloc returned a PCB that is not zeroed\n", tool);
+        exit(2);
+    }
+    pcb->allocated = NULL;
+    pcb->priority = priority;
+
+    uint8_t *stack = palloc(stack_size, pcb, PALLOC_FLAGS_ANYWHERE, NULL);
+    if (stack == NULL) {
+        fprintf(stderr, "%s: heap exhausted\n", tool);
+        exit(2);
+    }
+    process_init_context(pcb, stack, stack_size, entry);
+    sched_enqueue(pcb);
+    return pcb;
+}
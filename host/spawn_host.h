@@ -0,0 +1,24 @@
+/*
+ * spawn_host.h:
+ *
+ * Process creation for the host tools, as the kernel's loader would do it,
+ * but starting a host function instead of a program image.
+ */
+
+#ifndef __HOST_SPAWN_HOST_H__
+#define __HOST_SPAWN_HOST_H__
+
+#include <stdint.h>
+
+#include "scheduler.h"
+
+/*
+ * Create a process of the given priority that starts at entry on a stack of
+ * stack_size bytes, and make it ready on the calling core. The PCB is checked
+ * to come from its zone zeroed. On failure, prints an error naming tool and
+ * exits.
+ */
+pcb_t *
+spawn_host_process(const char *tool, uint8_t priority, uint32_t stack_size, void (*entry)(void));
+
+#endif /* __HOST_SPAWN_HOST_H__ */
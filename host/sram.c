@@ -0,0 +1,28 @@
+#include "sram.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "palloc.h"
+
+uint8_t *sram;
+
+void
+sram_init(void)
+{
+    /*
+     * The RP2040's SRAM starts at 0x20000000, so it is aligned to its own
+     * size; the buddy backend's block alignment depends on this.
+     */
+    sram = aligned_alloc(SRAM_SIZE, SRAM_SIZE);
+    if (sram == NULL) {
+        fprintf(stderr, "sram: failed to allocate %d bytes\n", SRAM_SIZE);
+        exit(1);
+    }
+}
+
+void
+sram_reset_heap(void)
+{
+    pinit(sram, SRAM_SIZE);
+}
@@ -0,0 +1,34 @@
+/*
+ * sram.h:
+ *
+ * Simulated SRAM arena used in place of the RP2040's striped SRAM when the
+ * kernel's allocators are built for the host.
+ */
+
+#ifndef __HOST_SRAM_H__
+#define __HOST_SRAM_H__
+
+#include <stdint.h>
+
+#define KB 1024
+#define SRAM_SIZE (256 * (KB))
+
+/*
+ * Start of the simulated SRAM, aligned to SRAM_SIZE. Valid after sram_init().
+ */
+extern uint8_t *sram;
+
+/*
+ * Allocate the simulated SRAM. Exits the process on failure.
+ */
+void
+sram_init(void);
+
+/*
+ * Reinitialize the heap so that it covers the whole simulated SRAM as a single
+ * free region.
+ */
+void
+sram_reset_heap(void);
+
+#endif /* __HOST_SRAM_H__ */
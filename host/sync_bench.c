@@ -0,0 +1,476 @@
+/*
+ * sync_bench.c:
+ *
+ * Host benchmark of a contended lock, held by processes under the kernel's own
+ * scheduler. Both cores are simulated in one thread, in steps of a microsecond
+ * of simulated time: each step, a core whose SysTick has expired, or that has
+ * a reschedule pending, or that is idle, passes through sched_get_next, and
+ * then runs its process for the microsecond.
+ *
+ * The lock is taken three ways:
+ *  - spin: a flag in shared memory, as processes without kernel support would
+ *    use, spinning for up to SPIN_LIMIT_US, then sleeping SPIN_BACKOFF_US
+ *    before trying again (spinning on forever livelocks a core once a
+ *    higher-priority process spins for a lock its holder cannot run to
+ *    release),
+ *  - block: a kernel mutex (see kern/ksync.h), whose waiters block,
+ *  - inherit: a kernel mutex with priority inheritance.
+ *
+ * The workload is a handful of lock users at the default priority, which work,
+ * then hold the lock; an urgent process of higher priority, which sleeps,
+ * then holds the lock; and hogs of intermediate priority, which compute and
+ * sleep, never touching the lock, but take the CPU from its holder.
+ *
+ * Reported for each way: critical sections completed per second, the share of
+ * CPU time spent spinning, the wait for the lock of the lock users and the
+ * urgent process, mean and worst, and the switches made.
+ *
+ * Checked:
+ *  - at most one process is in a critical section at a time,
+ *  - a process woken from a mutex's wait queue holds it, and the holder
+ *    is the mutex's owner throughout its section,
+ *  - a process gets its own priority back once it releases the mutex,
+ *  - the mutex counts one take per section, and every process makes progress,
+ *  - once the hogs keep a blocked-on holder from running long enough that the
+ *    urgent process waits more than a section, inheritance cuts its worst
+ *    wait.
+ *
+ * The default hogs keep both cores busy, so that the holder is starved.
+ *
+ *      sync_bench [-d simulated ms] [-u lock users] [-g hogs]
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ksync.h"
+#include "palloc.h"
+#include "pico/platform.h"
+#include "process.h"
+#include "resources.h"
+#include "scheduler.h"
+#include "spawn_host.h"
+#include "sram.h"
+#include "zalloc.h"
+#include "hardware/clocks.h"
+#include "hardware/structs/scb.h"
+#include "hardware/structs/systick.h"
+#include "hardware/timer.h"
+
+#define STACK_SIZE          512
+#define MAX_TASKS           16
+
+#define SECTION_US          100     /* Lock held by each user and the urgent process. */
+
+#define SPIN_LIMIT_US       20
+#define SPIN_BACKOFF_US     50
+
+/* ICSR VECTACTIVE values of the exceptions that enter the scheduler. */
+#define EXC_NUM_SVCALL      11
+#define EXC_NUM_SYSTICK     15
+
+/* SysTick counting with its interrupt enabled, as tick_program leaves it. */
+#define SYSTICK_CSR_RUN     0x7
+
+enum { MODE_SPIN, MODE_BLOCK, MODE_INHERIT, N_MODES };
+
+static const char *mode_names[N_MODES] = { "spin", "block", "inherit" };
+
+/*
+ * What a process is doing.
+ */
+enum {
+    P_WORK,         /* Computing, left us to go. */
+    P_ACQUIRE,      /* Trying to take the lock. */
+    P_WAITING,      /* Blocked on the mutex, or backing off from the spinlock. */
+    P_HOLD,         /* In its critical section, left us to go. */
+};
+
+typedef struct {
+    const char *name;
+    uint8_t     priority;
+    uint32_t    work_us;        /* Computing before taking the lock, or in all. */
+    uint32_t    hold_us;        /* Holding the lock, or 0 if it never takes it. */
+    uint32_t    sleep_us;       /* Sleeping at the end of each round, or 0. */
+
+    pcb_t      *pcb;
+    int         phase;
+    uint32_t    left;
+    uint32_t    spun;           /* Microseconds spun since it last backed off. */
+    uint32_t    asked_at;       /* When it first tried to take the lock this round. */
+
+    uint64_t    n_rounds;
+    uint64_t    n_sections;
+    uint64_t    wait_total;
+    uint32_t    wait_max;
+    uint64_t    spin_us;
+} task_t;
+
+static uint32_t duration_ms = 1000;
+static uint32_t n_users = 6;
+static uint32_t n_hogs = 6;
+
+static task_t tasks[MAX_TASKS];
+static uint32_t n_tasks;
+
+static int mode;
+static int mutex;               /* Handle of the kernel mutex. */
+static task_t *spin_owner;      /* Holder of the spinlock. */
+static uint32_t in_section;
+static uint32_t n_violations;
+
+static uint32_t violations_reported;
+
+/* The urgent process's worst wait for the lock, by mode. */
+static uint32_t urgent_wait_max[N_MODES];
+
+static void
+violation(const char *what, const task_t *task)
+{
+    n_violations++;
+    if (violations_reported++ < 10) {
+        fprintf(stderr, "sync_bench: %s: %s%s%s at %u us\n", mode_names[mode],
+                task != NULL ? task->name : "", task != NULL ? ": " : "", what, host_sim_us);
+    }
+}
+
+static void
+process_entry(void)
+{
+}
+
+static void
+task_add(const char *name, uint8_t priority, uint32_t work_us, uint32_t hold_us,
+         uint32_t sleep_us)
+{
+    task_t *task = &tasks[n_tasks++];
+    task->name = name;
+    task->priority = priority;
+    task->work_us = work_us;
+    task->hold_us = hold_us;
+    task->sleep_us = sleep_us;
+}
+
+/*
+ * Start a round: work, if there is any, else go for the lock.
+ */
+static void
+round_start(task_t *task)
+{
+    task->phase = task->work_us != 0 ? P_WORK : P_ACQUIRE;
+    task->left = task->work_us;
+    task->asked_at = host_sim_us;
+}
+
+/*
+ * Finish a round, sleeping if the process does. Returns non-zero if it left
+ * the CPU.
+ */
+static int
+round_end(task_t *task)
+{
+    task->n_rounds++;
+    round_start(task);
+    if (task->sleep_us != 0) {
+        if (sched_sleep(task->pcb, task->sleep_us) != 0) {
+            violation("sleep queue full", task);
+        }
+        task->asked_at = host_sim_us + task->sleep_us;
+        return 1;
+    }
+    return 0;
+}
+
+static void
+section_enter(task_t *task)
+{
+    uint32_t wait = host_sim_us - task->asked_at;
+    task->wait_total += wait;
+    if (wait > task->wait_max) {
+        task->wait_max = wait;
+    }
+    if (++in_section != 1) {
+        violation("two processes in the critical section", task);
+    }
+    task->phase = P_HOLD;
+    task->left = task->hold_us;
+}
+
+/*
+ * Run a process for a microsecond. Returns non-zero if it left the CPU, as if
+ * by a system call.
+ */
+static int
+step(task_t *task)
+{
+    pcb_t *pcb = task->pcb;
+
+    switch (task->phase) {
+    case P_WORK:
+        if (--task->left != 0) {
+            return 0;
+        }
+        if (task->hold_us == 0) {
+            return round_end(task);
+        }
+        task->phase = P_ACQUIRE;
+        task->asked_at = host_sim_us + 1;
+        return 0;
+
+    case P_ACQUIRE:
+        if (mode == MODE_SPIN) {
+            if (spin_owner != NULL) {
+                task->spin_us++;
+                if (++task->spun < SPIN_LIMIT_US) {
+                    return 0;
+                }
+                task->spun = 0;
+                task->phase = P_WAITING;
+                if (sched_sleep(pcb, SPIN_BACKOFF_US) != 0) {
+                    violation("sleep queue full", task);
+                }
+                return 1;
+            }
+            task->spun = 0;
+            spin_owner = task;
+        } else {
+            int result = ksync_lock(pcb, mutex);
+            if (result == KSYNC_BLOCKED) {
+                task->phase = P_WAITING;
+                return 1;
+            }
+            if (result != 0) {
+                violation("ksync_lock failed", task);
+                return 0;
+            }
+        }
+        section_enter(task);
+        return 0;
+
+    case P_WAITING:
+        if (mode == MODE_SPIN) {
+            task->phase = P_ACQUIRE;
+            return step(task);
+        }
+        /* Handed the mutex before it was woken. */
+        if (ksync_get(mutex)->owner != pcb) {
+            violation("woken without the mutex", task);
+        }
+        section_enter(task);
+        return 0;
+
+    case P_HOLD:
+        if (mode != MODE_SPIN && ksync_get(mutex)->owner != pcb) {
+            violation("section held without the mutex", task);
+        }
+        if (--task->left != 0) {
+            return 0;
+        }
+        in_section--;
+        task->n_sections++;
+        if (mode == MODE_SPIN) {
+            spin_owner = NULL;
+        } else {
+            if (ksync_unlock(pcb, mutex) != 0) {
+                violation("ksync_unlock failed", task);
+            }
+            if (pcb->priority != task->priority) {
+                violation("priority not restored on release", task);
+            }
+        }
+        return round_end(task);
+    }
+    return 0;
+}
+
+static task_t *
+task_of(pcb_t *pcb)
+{
+    for (uint32_t i = 0; i < n_tasks; i++) {
+        if (tasks[i].pcb == pcb) {
+            return &tasks[i];
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Start the kernel afresh, with the workload's processes ready on core 0.
+ */
+static void
+reset(void)
+{
+    memset(ready_queues, 0, sizeof(ready_queues));
+    memset(ready_map, 0, sizeof(ready_map));
+    memset(ready_count, 0, sizeof(ready_count));
+    live_pcbs = NULL;
+    sleep_count = 0;
+    memset(host_scb, 0, sizeof(host_scb));
+    memset(host_systick, 0, sizeof(host_systick));
+    host_sim_us = 0;
+
+    sram_reset_heap();
+    zinit();
+    ksync_init();
+    for (unsigned core = 0; core < NUM_CORES; core++) {
+        host_core_num = core;
+        sched_init();
+        pcb_active[core] = idle_pcb[core];
+    }
+    host_core_num = 0;
+
+    mutex = mode == MODE_SPIN ? -1 : ksync_mutex_create(mode == MODE_INHERIT ? KSYNC_INHERIT : 0);
+    spin_owner = NULL;
+    in_section = 0;
+
+    for (uint32_t i = 0; i < n_tasks; i++) {
+        task_t *task = &tasks[i];
+        task->pcb = spawn_host_process("sync_bench", task->priority, STACK_SIZE, process_entry);
+        task->n_rounds = task->n_sections = task->wait_total = task->spin_us = 0;
+        task->wait_max = 0;
+        task->spun = 0;
+        round_start(task);
+    }
+}
+
+static void
+run(void)
+{
+    uint32_t ticks_per_us = clock_get_hz(clk_sys) / 1000000;
+    uint32_t deadline[NUM_CORES] = { 0 };
+    int armed[NUM_CORES] = { 0 };
+    int voluntary[NUM_CORES] = { 0 };
+    uint64_t n_switches = 0, idle_us = 0;
+
+    reset();
+    for (uint32_t now = 0; now < duration_ms * 1000; now++) {
+        host_sim_us = now;
+        for (unsigned core = 0; core < NUM_CORES; core++) {
+            host_core_num = core;
+            pcb_t *prev = pcb_active[core];
+            if ((host_scb[core].icsr & M0PLUS_ICSR_PENDSTSET_BITS) || prev == idle_pcb[core] ||
+                voluntary[core] || (armed[core] && now >= deadline[core])) {
+                host_scb[core].icsr = voluntary[core] ? EXC_NUM_SVCALL : EXC_NUM_SYSTICK;
+                voluntary[core] = 0;
+                pcb_t *next = sched_get_next();
+                if (next != prev) {
+                    pcb_active[core] = next;
+                    sched_switch_done();
+                    n_switches++;
+                }
+                armed[core] = host_systick[core].csr == SYSTICK_CSR_RUN;
+                deadline[core] = now + (host_systick[core].rvr + ticks_per_us) / ticks_per_us;
+            }
+
+            pcb_t *pcb = pcb_active[core];
+            if (pcb == idle_pcb[core]) {
+                idle_us++;
+                continue;
+            }
+            voluntary[core] = step(task_of(pcb));
+        }
+    }
+    host_core_num = 0;
+
+    /*
+     * Every section taken through the mutex was counted once, besides the
+     * one in progress.
+     */
+    uint64_t sections = 0, spin_us = 0, user_waits = 0, user_wait_total = 0;
+    uint32_t user_wait_max = 0;
+    for (uint32_t i = 0; i < n_tasks; i++) {
+        task_t *task = &tasks[i];
+        sections += task->n_sections;
+        spin_us += task->spin_us;
+        if (task->n_rounds == 0) {
+            violation("a process made no progress", task);
+        }
+        if (task->hold_us != 0 && i != 0) {
+            user_waits += task->n_sections;
+            user_wait_total += task->wait_total;
+            user_wait_max = task->wait_max > user_wait_max ? task->wait_max : user_wait_max;
+        }
+    }
+    if (mode != MODE_SPIN) {
+        ksync_t *m = ksync_get(mutex);
+        if (m->n_taken != sections + (m->owner != NULL)) {
+            violation("mutex taken a different number of times than sections were held", NULL);
+        }
+    }
+
+    task_t *urgent = &tasks[0];
+    urgent_wait_max[mode] = urgent->wait_max;
+    double seconds = duration_ms / 1000.0;
+    printf("%-8s %8.0f sections/s  %5.1f%% spinning  %5.1f%% idle  "
+           "users wait %7.1f us, worst %6u  urgent wait %7.1f us, worst %6u  %8.0f switches/s\n",
+           mode_names[mode], sections / seconds, 100.0 * spin_us / (NUM_CORES * duration_ms * 1000.0),
+           100.0 * idle_us / (NUM_CORES * duration_ms * 1000.0),
+           user_waits ? (double)user_wait_total / user_waits : 0.0, user_wait_max,
+           urgent->n_sections ? (double)urgent->wait_total / urgent->n_sections : 0.0,
+           urgent->wait_max, n_switches / seconds);
+}
+
+static void
+usage(void)
+{
+    fprintf(stderr, "usage: sync_bench [-d simulated ms] [-u lock users] [-g hogs]\n");
+    exit(2);
+}
+
+int
+main(int argc, char **argv)
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "d:u:g:h")) != -1) {
+        switch (opt) {
+        case 'd':
+            duration_ms = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'u':
+            n_users = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'g':
+            n_hogs = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        default:
+            usage();
+        }
+    }
+    if (duration_ms == 0 || n_users == 0 || 1 + n_users + n_hogs > MAX_TASKS) {
+        usage();
+    }
+
+    task_add("urgent", SCHED_PRIORITY_DEFAULT - 2, 0, SECTION_US, 2000);
+    for (uint32_t i = 0; i < n_users; i++) {
+        task_add("user", SCHED_PRIORITY_DEFAULT, 50, SECTION_US, 0);
+    }
+    for (uint32_t i = 0; i < n_hogs; i++) {
+        task_add("hog", SCHED_PRIORITY_DEFAULT - 1, 300, 0, 700);
+    }
+
+    host_time_simulated = 1;
+    sram_init();
+    for (mode = 0; mode < N_MODES; mode++) {
+        run();
+    }
+
+    /*
+     * Without inheritance, the urgent process waits longer than a section
+     * (and the step in which it is woken) only while a hog keeps the holder
+     * from running. Inheritance is there to cut exactly that wait.
+     */
+    mode = MODE_INHERIT;
+    if (urgent_wait_max[MODE_BLOCK] > SECTION_US + 1 &&
+        urgent_wait_max[MODE_INHERIT] >= urgent_wait_max[MODE_BLOCK]) {
+        violation("the urgent process's worst wait was no shorter than without inheritance", NULL);
+    }
+
+    if (n_violations != 0) {
+        printf("FAIL: %u violations, reported above\n", n_violations);
+        return 1;
+    }
+    printf("ok\n");
+    return 0;
+}
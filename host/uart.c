@@ -0,0 +1,85 @@
+/*
+ * uart.c:
+ *
+ * Host stand-in for the console's UART (see kern/console.h and uart_host.h).
+ * The kernel's console code feeds it as it would the RP2040's UART, and it
+ * sends in simulated time.
+ */
+
+#include "console.h"
+#include "uart_host.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define OUT_MAX     (16u << 20)
+
+uint32_t uart_host_byte_ns = 86806;
+
+uint64_t uart_host_ns;
+uint8_t *uart_host_out;
+uint32_t uart_host_out_len;
+
+static uint8_t fifo[UART_HOST_FIFO];
+static uint32_t fifo_head;
+static uint32_t fifo_count;
+static int tx_irq;
+static uint64_t byte_done_ns;   /* When the byte at the head of the FIFO is sent. */
+
+void
+uart_host_run(uint64_t ns)
+{
+    while (fifo_count != 0 && byte_done_ns <= ns) {
+        uart_host_ns = byte_done_ns;
+        if (uart_host_out_len < OUT_MAX) {
+            uart_host_out[uart_host_out_len++] = fifo[fifo_head];
+        }
+        fifo_head = (fifo_head + 1) % UART_HOST_FIFO;
+        fifo_count--;
+        byte_done_ns += uart_host_byte_ns;
+        if (tx_irq && fifo_count <= UART_HOST_FIFO / 2) {
+            console_tx_fill();
+        }
+    }
+    uart_host_ns = uart_host_ns > ns ? uart_host_ns : ns;
+}
+
+void
+uart_host_receive(const uint8_t *buf, uint32_t len)
+{
+    console_rx_push(buf, len);
+}
+
+void
+console_hw_init(void)
+{
+    if (uart_host_out == NULL && (uart_host_out = malloc(OUT_MAX)) == NULL) {
+        perror("uart_host");
+        exit(2);
+    }
+    uart_host_out_len = 0;
+    uart_host_ns = 0;
+    fifo_head = fifo_count = 0;
+    tx_irq = 0;
+}
+
+int
+console_hw_writable(void)
+{
+    return fifo_count < UART_HOST_FIFO;
+}
+
+void
+console_hw_putc(uint8_t c)
+{
+    if (fifo_count == 0) {
+        byte_done_ns = uart_host_ns + uart_host_byte_ns;
+    }
+    fifo[(fifo_head + fifo_count++) % UART_HOST_FIFO] = c;
+}
+
+void
+console_hw_tx_irq(int enable)
+{
+    tx_irq = enable;
+}
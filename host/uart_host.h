@@ -0,0 +1,43 @@
+/*
+ * uart_host.h:
+ *
+ * Host stand-in for the UART behind the kernel's console (see
+ * kern/console.h). It has the RP2040 UART's 32-byte transmit FIFO, which sends
+ * a byte every uart_host_byte_ns of simulated time, and raises the transmit
+ * interrupt, while enabled, once the FIFO drains to half full, the UART's
+ * default trigger level. Bytes sent are kept for the caller to check.
+ */
+
+#ifndef __HOST_UART_HOST_H__
+#define __HOST_UART_HOST_H__
+
+#include <stdint.h>
+
+#define UART_HOST_FIFO      32
+
+/*
+ * Simulated nanoseconds to send a byte: ten bits at 115200 baud.
+ */
+extern uint32_t uart_host_byte_ns;
+
+/*
+ * Simulated time, in nanoseconds, and every byte sent so far.
+ */
+extern uint64_t uart_host_ns;
+extern uint8_t *uart_host_out;
+extern uint32_t uart_host_out_len;
+
+/*
+ * Run the UART until simulated time reaches ns, sending bytes and taking
+ * transmit interrupts as they come.
+ */
+void
+uart_host_run(uint64_t ns);
+
+/*
+ * Receive bytes, as the UART's interrupt handler would pass them on.
+ */
+void
+uart_host_receive(const uint8_t *buf, uint32_t len);
+
+#endif /* __HOST_UART_HOST_H__ */
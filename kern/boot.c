@@ -4,8 +4,13 @@
 #include <stdio.h>
 
 #include "pico/stdlib.h"
+#include "pico/multicore.h"
+#ifdef PCACHE
+#include "pico/flash.h"
+#endif
 #include "hardware/exception.h"
-#include "hardware/structs/systick.h"
+#include "hardware/irq.h"
+#include "hardware/sync.h"
 #include "hardware/structs/mpu.h"
 
 #include "boot.h"
@@ -14,6 +19,16 @@
 #include "palloc.h"
 #include "zalloc.h"
 #include "context_switch.h"
+#include "console.h"
+#include "copy.h"
+#include "ipc.h"
+#include "ksync.h"
+#include "klock.h"
+#include "ktrace.h"
+#include "loader.h"
+#include "pager.h"
+#include "pcache.h"
+#include "process.h"
 #include "scheduler.h"
 
 
@@ -21,8 +36,6 @@
 #define SRAM_SIZE 256 * (KB)
 #define SRAM_START 0x20000000
 
-#define STACK_SIZE 4 * (KB)
-
 /* Byte granularity at which the MPU can protect a region of memory. */
 #define MPU_REGION_GRANULARITY_BITS 8
 #define MPU_REGION_GRANULARITY 1 << (MPU_REGION_GRANULARITY_BITS)
@@ -33,74 +46,66 @@
 extern char __data_start__;
 extern char __bss_end__;
 
-void
-create_system_resources(
-    void       *load_from,  /* Start of the binary in FLASH. */
-    void       *load_to,    /* Start of the binary in SRAM. */
-    void       *exec_from,  /* Entrypoint of binary in SRAM. */
-    uint32_t    load_size)  /* Number of bytes to copy from flash. */
-{
-    /* TODO do we need extra space allocated for .bss (not in .bin) in SRAM? */
-
-    pcb_t *pcb = (pcb_t *)zalloc(KZONE_PCB);
-    assert(pcb != NULL);
-
-    /*
-     * The PCB starts with no allocated memory.
-     */
-    pcb->allocated = NULL;
+/*
+ * End of the kernel's image in flash, defined by the linker script. Program
+ * images follow it.
+ */
+extern char __flash_binary_end;
 
-    /*
-     * Allocate a stack.
-     */
-    void *stack = palloc(STACK_SIZE, pcb, PALLOC_FLAGS_ANYWHERE, NULL);
-    assert(stack != NULL);
-    pcb->saved_sp = ((uint32_t)stack + STACK_SIZE) & ~(0b111);   /* Start at TOP of the stack. */
+/*
+ * Give this core's SysTick and SVCall the lowest priority, below every device
+ * interrupt. A reschedule requested from an interrupt handler (a process made
+ * ready by a DMA or UART interrupt, say) is then only taken once the handler
+ * has returned, so the switch always interrupts a process (see
+ * schedule_handler). The priorities are per core, so each core sets its own
+ * before enabling any interrupt.
+ */
+static void
+exception_priority_init(void)
+{
+    exception_set_priority(SYSTICK_EXCEPTION, PICO_LOWEST_IRQ_PRIORITY);
+    exception_set_priority(SVCALL_EXCEPTION, PICO_LOWEST_IRQ_PRIORITY);
+}
 
-    /*
-     * Allocate space for the program's execution state ("binary") in memory.
-     */
-    void *out = palloc(load_size, pcb, PALLOC_FLAGS_FIXED, load_to);
-    assert(out == load_to);
-    memcpy(load_to, load_from, load_size);
+/*
+ * Entry point of core 1, once core 0 has set up the kernel. Core 1 starts with
+ * empty ready queues, and takes processes from core 0 as soon as it is idle.
+ */
+static void
+core1_main(void)
+{
+    exception_priority_init();
 
     /*
-     * Align stack pointer correctly to pop our initial saved registers.
+     * Create a "dummy" one-time-use PCB to jumpstart scheduling.
      */
-    pcb->saved_sp -= sizeof(stack_registers_t);
-
+    pcb_active[1] = zalloc(KZONE_PCB);
+    assert(pcb_active[1] != NULL);
+#ifdef DEMAND_PAGING
+    pager_init();
+#endif
+#ifdef PCACHE
     /*
-     * Resume execution at the beginning of the binary.
+     * Let core 0 park this core while it writes the store to flash (see
+     * pcache_flash.c), as core 0 lets this one.
      */
+    flash_safe_execute_core_init();
+#endif
 
-    stack_registers_t *stack_registers = (stack_registers_t *)pcb->saved_sp;
-
-    /* Set some stack register values for easy recognition. */
-    memset(stack_registers, 0xeeeeeeee, sizeof(stack_registers_t));
-    stack_registers->r8 = (register_t)(0x88888888);
-    stack_registers->r5 = (register_t)(0x55555555);
-
-    stack_registers->pc = (register_t)(exec_from)| 1;
-    stack_registers->r0 = 0x00000000;
-    stack_registers->r1 = 0x11111111;
-    stack_registers->r2 = 0x22222222;
-    stack_registers->r3 = 0x33333333;
-
-    stack_registers->r12 = 0x12121212;
-    stack_registers->lr = 0xdeadbeef;
-
-    /* TODO: figure out a (more) correct value for PSR for userprograms. */
-    stack_registers->psr = 0x61000000;
-
-    /*
-     * Make this PCB schedulable.
-     */
-    DLL_PUSH(ready_queue, pcb, next, prev);
+    /* Unify our stack pointers */
+    asm("mrs r0, msp");
+    asm("msr psp, r0");
+    asm("isb");
 
     /*
-     * At this point this process should be ready-to-run when the scheduler
-     * selects this process control block to run.
+     * Create this core's idle process. Only then does a process made ready
+     * here request a reschedule (see sched_enqueue).
      */
+    sched_init();
+    sched_reschedule();
+    while (1) {
+        __wfi();
+    }
 }
 
 /*
@@ -109,6 +114,16 @@ create_system_resources(
 int
 main(void)
 {
+    exception_priority_init();
+
+    /*
+     * Reserve the spinlocks guarding state shared with core 1.
+     */
+    klock_init();
+#ifdef KTRACE
+    ktrace_init();
+#endif
+
     /*
      * Initialize the zone allocator.
      */
@@ -119,7 +134,7 @@ main(void)
      */
     kzone_pcb = zalloc(KZONE_PCB);
     assert(kzone_pcb != NULL);
-    pcb_active = kzone_pcb;
+    pcb_active[0] = kzone_pcb;
 
     /* TODO: possibly make a "phony" kernel PCB for as the active PCB to
      * bootstrap scheduler.
@@ -130,20 +145,51 @@ main(void)
      * the kernel private state section ends. The heaps begins as a singleton
      * free element.
      */
-    heap_start = &__bss_end__ + ((MPU_REGION_GRANULARITY) -
+    void *heap_base = &__bss_end__ + ((MPU_REGION_GRANULARITY) -
         (uint32_t)&__bss_end__ % (MPU_REGION_GRANULARITY));
-    heap_free_list = (heap_region_t *)heap_start;
-    heap_free_list->next = NULL;
-    heap_free_list->prev = NULL;
-    heap_free_list->size = (SRAM_START + SRAM_SIZE) - (uint32_t)heap_start - sizeof(heap_region_t);
+    pinit(heap_base, (SRAM_START + SRAM_SIZE) - (uint32_t)heap_base);
 
-    /* Create resources for two pre-loaded programs, already present in flash
-     * at addresses 0x10020000 and 0x10010000 respectively. Each has a different
-     * entrypoint, discovered by reading the symbol tables in their .elf files.
-     * Each program is given 60KB of space (more than enough).
+    /*
+     * Empty the message channels between processes (see ipc.h).
      */
-    create_system_resources((void *)0x10020000, (void *)0x20020000, (void *)0x20020298, (60 * 1024));
-    create_system_resources((void *)0x10010000, (void *)0x20010000, (void *)0x20010298, (60 * 1024));
+    ipc_init();
+
+    /*
+     * Forget every mutex and semaphore (see ksync.h).
+     */
+    ksync_init();
+
+    /*
+     * Take over the UART as the console shared by every process (see
+     * console.h). Its interrupts are taken on this core.
+     */
+    console_init();
+
+    /*
+     * Load every program image stored in flash after the kernel (see
+     * loader.h). The images are copied by DMA in the background; each process
+     * joins the ready queue when its own copy completes, so scheduling can
+     * start straight away rather than after the last image.
+     */
+    copy_init();
+#ifdef PCACHE
+    /*
+     * The end of flash is the store of persistent state, behind a page cache
+     * (see pcache.h), so holds no images.
+     */
+    pcache_init();
+    /*
+     * Processes move between the cores, so either may write the store: let
+     * core 1 park this core while it does, as core 1 lets this one (see
+     * core1_main). Launching core 1 keeps the lockout interrupt off while it
+     * talks to core 1 over the FIFO.
+     */
+    flash_safe_execute_core_init();
+    loader_load_all(&__flash_binary_end,
+                    (void *)(XIP_BASE + PICO_FLASH_SIZE_BYTES - PCACHE_STORE_SIZE));
+#else
+    loader_load_all(&__flash_binary_end, (void *)(XIP_BASE + PICO_FLASH_SIZE_BYTES));
+#endif
 
     /* Unify our stack pointers */
     asm("mrs r0, msp");
@@ -151,20 +197,42 @@ main(void)
     asm("isb");
 
 
-    /* Register the schedule_handler as the timer interrupt handler. A voluntary
-     * "yield" call could be implemented by using the `svc` instruction and
-     * registering the schedule_handler as the SVCALL exception handler:
-     * 
-     *      exception_set_exclusive_handler(SVCALL_EXCEPTION, schedule_handler);
+    /* Register the schedule_handler as the timer interrupt handler, and the
+     * svc_handler as the entry point for system calls (see syscall.h).
      */
     exception_set_exclusive_handler(SYSTICK_EXCEPTION, schedule_handler);
+    exception_set_exclusive_handler(SVCALL_EXCEPTION, svc_handler);
+#ifdef DEMAND_PAGING
+    /*
+     * Protect memory with the MPU, and handle the faults of processes
+     * touching pages not yet filled (see pager.h).
+     */
+    exception_set_exclusive_handler(HARDFAULT_EXCEPTION, hardfault_handler);
+    pager_init();
+#endif
 
-    /* Set SYST_RVR timer reset value */
-    systick_hw->rvr = 0xffff;  /* TODO: configure this value */
+    /*
+     * Start scheduling on core 1 too. It shares the vector table, so the
+     * handlers above apply to its own SysTick and SVCall as well.
+     */
+    multicore_launch_core1(core1_main);
 
-    /* Configure and enable SysTick counter */
-    systick_hw->csr = 0x7;
+    /*
+     * Create core 0's idle process, which runs whenever nothing else is ready.
+     * This is left until every handler is in place and core 1 is started: from
+     * here on, a process made ready on this core (by the loader's DMA
+     * interrupt, say) can request a reschedule (see sched_enqueue).
+     */
+    sched_init();
+
+    /*
+     * Enter the scheduler. It programs SysTick itself for the next time slice
+     * or wakeup, so the timer is left stopped here.
+     */
+    sched_reschedule();
 
-    /* Timer interrupt will deschedule this process and never reschedule it. */
-    while (1) {}
+    /* The pended SysTick will deschedule this process and never reschedule it. */
+    while (1) {
+        __wfi();
+    }
 }
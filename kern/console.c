@@ -0,0 +1,246 @@
+#include "console.h"
+#include "klock.h"
+#include <stddef.h>
+#include <string.h>
+
+#include "hardware/sync.h"
+
+console_stats_t console_stats;
+
+static console_ring_t rings[CONSOLE_N_RINGS];
+
+/*
+ * Writers blocked on a full ring, by ring. A ring has one writer, so each
+ * queue holds at most one process.
+ */
+static pcb_t *writers[CONSOLE_N_RINGS];
+
+/*
+ * The sending side, guarded by KLOCK_CONSOLE.
+ */
+static uint32_t current;            /* Ring being sent from. */
+static uint8_t mid_line;            /* The last byte sent from it was not a newline. */
+static uint8_t tx_active;           /* The UART will interrupt when it can take more. */
+
+/*
+ * Bytes received. rx_head is advanced by the UART's interrupt handler only,
+ * rx_tail by readers, under KLOCK_CONSOLE.
+ */
+static uint8_t rx_data[CONSOLE_RX_SIZE];
+static volatile uint32_t rx_head;
+static volatile uint32_t rx_tail;
+static pcb_t *readers;              /* Readers blocked until bytes arrive. */
+
+/*
+ * Return the ring to send from next: the current one until the end of its
+ * line, else the next with bytes waiting, or NULL if none has. Called with the
+ * lock held.
+ */
+static console_ring_t *
+ring_next(void)
+{
+    if (mid_line && rings[current].head != rings[current].tail) {
+        return &rings[current];
+    }
+    for (uint32_t i = 1; i <= CONSOLE_N_RINGS; i++) {
+        uint32_t r = (current + i) % CONSOLE_N_RINGS;
+        if (rings[r].head != rings[r].tail) {
+            current = r;
+            mid_line = 0;
+            return &rings[r];
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Hand the UART bytes while it takes them, leaving its interrupt enabled if
+ * bytes are left over. A writer blocked on a ring is woken once the ring is
+ * half empty. Called with the lock held.
+ */
+static void
+fill(void)
+{
+    console_ring_t *ring;
+    while ((ring = ring_next()) != NULL && console_hw_writable()) {
+        uint32_t tail = ring->tail;
+        __dmb();    /* Read the byte only after seeing head pass it. */
+        uint8_t c = ring->data[tail % CONSOLE_RING_SIZE];
+        __dmb();    /* Read it before giving its slot back. */
+        ring->tail = tail + 1;
+        console_hw_putc(c);
+        mid_line = c != '\n';
+        console_stats.n_sent++;
+
+        uint32_t r = ring - rings;
+        if (writers[r] != NULL && ring->head - ring->tail <= CONSOLE_RING_SIZE / 2) {
+            sched_wake(&writers[r]);
+        }
+    }
+    tx_active = ring != NULL;
+    console_hw_tx_irq(tx_active);
+}
+
+void
+console_init(void)
+{
+    memset(rings, 0, sizeof(rings));
+    memset(writers, 0, sizeof(writers));
+    memset(&console_stats, 0, sizeof(console_stats));
+    current = 0;
+    mid_line = 0;
+    tx_active = 0;
+    rx_head = rx_tail = 0;
+    readers = NULL;
+    console_hw_init();
+}
+
+/*
+ * Give a process a ring that nobody owns and that has nothing left to send.
+ */
+static console_ring_t *
+ring_attach(pcb_t *pcb)
+{
+    uint32_t saved = klock(KLOCK_CONSOLE);
+    for (uint32_t r = 0; r < CONSOLE_N_RINGS; r++) {
+        if (rings[r].owner == NULL && rings[r].head == rings[r].tail) {
+            rings[r].owner = pcb;
+            pcb->console = &rings[r];
+            kunlock(KLOCK_CONSOLE, saved);
+            return &rings[r];
+        }
+    }
+    console_stats.n_no_ring++;
+    kunlock(KLOCK_CONSOLE, saved);
+    return NULL;
+}
+
+int
+console_write(
+    pcb_t      *pcb,
+    const void *buf,
+    uint32_t    len)
+{
+    console_ring_t *ring = pcb->console;
+    if (ring == NULL && (ring = ring_attach(pcb)) == NULL) {
+        return -1;
+    }
+    if (len == 0) {
+        return 0;
+    }
+
+    /*
+     * Only this process moves head, so no lock is needed to append, unless the
+     * ring is full, in which case the UART's side must see the process block
+     * before it makes room.
+     */
+    uint32_t head = ring->head;
+    uint32_t room = CONSOLE_RING_SIZE - (head - ring->tail);
+    if (room == 0) {
+        uint32_t saved = klock(KLOCK_CONSOLE);
+        if (ring->head - ring->tail == CONSOLE_RING_SIZE) {
+            sched_block(pcb, &writers[ring - rings], KLOCK_CONSOLE);
+            console_stats.n_write_blocked++;
+            kunlock(KLOCK_CONSOLE, saved);
+            return CONSOLE_BLOCKED;
+        }
+        kunlock(KLOCK_CONSOLE, saved);
+        room = CONSOLE_RING_SIZE - (head - ring->tail);
+    }
+
+    uint32_t n = len < room ? len : room;
+    uint32_t at = head % CONSOLE_RING_SIZE;
+    uint32_t first = n < CONSOLE_RING_SIZE - at ? n : CONSOLE_RING_SIZE - at;
+    memcpy(&ring->data[at], buf, first);
+    memcpy(&ring->data[0], (const uint8_t *)buf + first, n - first);
+    __dmb();        /* The bytes are in place before head covers them. */
+    ring->head = head + n;
+
+    /*
+     * Start the UART if it has run out of bytes to send.
+     */
+    uint32_t saved = klock(KLOCK_CONSOLE);
+    if (!tx_active) {
+        fill();
+    }
+    kunlock(KLOCK_CONSOLE, saved);
+    return (int)n;
+}
+
+int
+console_read(
+    pcb_t      *pcb,
+    void       *buf,
+    uint32_t    size,
+    int         wait)
+{
+    uint32_t saved = klock(KLOCK_CONSOLE);
+    uint32_t tail = rx_tail;
+    uint32_t n = rx_head - tail;
+    if (n == 0) {
+        if (wait) {
+            sched_block(pcb, &readers, KLOCK_CONSOLE);
+            console_stats.n_read_blocked++;
+        }
+        kunlock(KLOCK_CONSOLE, saved);
+        return wait ? CONSOLE_BLOCKED : 0;
+    }
+
+    __dmb();        /* Read the bytes only after seeing rx_head pass them. */
+    n = n < size ? n : size;
+    for (uint32_t i = 0; i < n; i++) {
+        ((uint8_t *)buf)[i] = rx_data[(tail + i) % CONSOLE_RX_SIZE];
+    }
+    __dmb();
+    rx_tail = tail + n;
+
+    /* Pass what is left on to the next reader. */
+    if (rx_head != rx_tail) {
+        sched_wake(&readers);
+    }
+    kunlock(KLOCK_CONSOLE, saved);
+    return (int)n;
+}
+
+void
+console_release(pcb_t *pcb)
+{
+    uint32_t saved = klock(KLOCK_CONSOLE);
+    if (pcb->console != NULL) {
+        pcb->console->owner = NULL;
+        pcb->console = NULL;
+    }
+    kunlock(KLOCK_CONSOLE, saved);
+}
+
+void
+console_tx_fill(void)
+{
+    uint32_t saved = klock(KLOCK_CONSOLE);
+    fill();
+    kunlock(KLOCK_CONSOLE, saved);
+}
+
+void
+console_rx_push(
+    const uint8_t  *buf,
+    uint32_t        len)
+{
+    uint32_t head = rx_head;
+    uint32_t n = CONSOLE_RX_SIZE - (head - rx_tail);
+    n = len < n ? len : n;
+    for (uint32_t i = 0; i < n; i++) {
+        rx_data[(head + i) % CONSOLE_RX_SIZE] = buf[i];
+    }
+    console_stats.n_received += n;
+    console_stats.n_dropped += len - n;
+    if (n == 0) {
+        return;
+    }
+    __dmb();        /* The bytes are in place before rx_head covers them. */
+    rx_head = head + n;
+
+    uint32_t saved = klock(KLOCK_CONSOLE);
+    sched_wake(&readers);
+    kunlock(KLOCK_CONSOLE, saved);
+}
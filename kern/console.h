@@ -0,0 +1,127 @@
+/*
+ * console.h:
+ *
+ * The console: the kernel's UART, shared by every process through system
+ * calls, so that no process drives the UART itself, spinning on its FIFO.
+ *
+ * Each process writing to the console is given an output ring of its own.
+ * A write appends to the ring and returns, however slowly the UART sends; the
+ * process is the ring's only producer, and the UART's interrupt handler its
+ * only consumer, so appending takes no lock. A process whose ring is full
+ * blocks until the UART has made room. The UART takes a line at a time from
+ * each ring in turn, so lines from different processes do not interleave,
+ * unless a writer pauses in the middle of a line.
+ *
+ * Bytes received are held in one ring shared by every reader. A process
+ * reading from an empty console can block until bytes arrive; blocked
+ * readers are woken by priority, one at a time, and read again when they next
+ * run. Bytes that arrive while the ring is full are dropped.
+ *
+ * The UART is driven by console_uart.c on the RP2040; the host build has a
+ * stand-in that sends at the line rate in simulated time (host/uart.c).
+ */
+
+#ifndef __CONSOLE_H__
+#define __CONSOLE_H__
+
+#include <stdint.h>
+
+#include "scheduler.h"
+
+#define CONSOLE_N_RINGS     8       /* Processes writing at once. */
+#define CONSOLE_RING_SIZE   256     /* Bytes of each output ring; a power of two. */
+#define CONSOLE_RX_SIZE     128     /* Bytes of the receive ring; a power of two. */
+
+/*
+ * Returned by console_write and console_read when the caller has been
+ * blocked.
+ */
+#define CONSOLE_BLOCKED     (-2)
+
+/*
+ * An output ring. head is advanced by its process only, tail by the UART only;
+ * both run freely, and head - tail bytes are waiting.
+ */
+typedef struct console_ring {
+    volatile uint32_t   head;           /* Bytes ever appended. */
+    volatile uint32_t   tail;           /* Bytes ever sent. */
+    pcb_t              *owner;          /* Process writing to it, or NULL. */
+    uint8_t             data[CONSOLE_RING_SIZE];
+} console_ring_t;
+
+typedef struct {
+    uint32_t    n_written;          /* Bytes appended to output rings. */
+    uint32_t    n_sent;             /* Bytes handed to the UART. */
+    uint32_t    n_received;         /* Bytes received and kept. */
+    uint32_t    n_dropped;          /* Bytes received while the receive ring was full. */
+    uint32_t    n_write_blocked;    /* Writes that found their ring full. */
+    uint32_t    n_read_blocked;     /* Reads that found nothing to read. */
+    uint32_t    n_no_ring;          /* Writes refused for want of a ring. */
+} console_stats_t;
+
+extern console_stats_t console_stats;
+
+/*
+ * Empty every ring and start the UART. Called once at boot, on the core that
+ * is to take the UART's interrupts.
+ */
+void
+console_init(void);
+
+/*
+ * Append up to len bytes at buf to the process's output ring, giving it one if
+ * it has none. Returns the number appended, which is less than len if the ring
+ * filled; if it was full, blocks the process and returns CONSOLE_BLOCKED, and
+ * the call should be made again once the process runs. Returns -1 if every
+ * ring belongs to another process.
+ */
+int
+console_write(pcb_t *pcb, const void *buf, uint32_t len);
+
+/*
+ * Take up to size bytes received into buf. Returns the number taken. If none
+ * have arrived, returns 0, or if wait is set, blocks the process and returns
+ * CONSOLE_BLOCKED; the call should then be made again once it runs.
+ */
+int
+console_read(pcb_t *pcb, void *buf, uint32_t size, int wait);
+
+/*
+ * Give up an exiting process's output ring. What it holds is still sent,
+ * before the ring is given to another process.
+ */
+void
+console_release(pcb_t *pcb);
+
+/*
+ * Called by the UART's interrupt handler: hand the UART bytes to send for as
+ * long as it takes them, then wake writers waiting for room.
+ */
+void
+console_tx_fill(void);
+
+/*
+ * Called by the UART's interrupt handler: keep len bytes received, dropping
+ * what the receive ring has no room for, and wake a reader.
+ */
+void
+console_rx_push(const uint8_t *buf, uint32_t len);
+
+/*
+ * The UART, as console.c drives it: start it, tell whether it can take another
+ * byte to send, send one, and enable or disable the interrupt raised when it
+ * can take more.
+ */
+void
+console_hw_init(void);
+
+int
+console_hw_writable(void);
+
+void
+console_hw_putc(uint8_t c);
+
+void
+console_hw_tx_irq(int enable);
+
+#endif /* __CONSOLE_H__ */
@@ -0,0 +1,79 @@
+#include "console.h"
+#include <stdint.h>
+
+#include "hardware/gpio.h"
+#include "hardware/irq.h"
+#include "hardware/sync.h"
+#include "hardware/uart.h"
+
+/*
+ * The board's default UART and pins, as the SDK's stdio would have used.
+ */
+#define CONSOLE_UART        uart_get_instance(PICO_DEFAULT_UART)
+#define CONSOLE_UART_IRQ    (PICO_DEFAULT_UART == 0 ? UART0_IRQ : UART1_IRQ)
+#define CONSOLE_BAUD        115200
+
+/*
+ * Raised when the receive FIFO reaches its trigger level or has held bytes for
+ * a while, and, while enabled, when the transmit FIFO drains to its trigger
+ * level. Runs on the core that called console_init. A reader or writer it
+ * wakes pends a reschedule, which waits for it to return: it runs above
+ * SysTick (see exception_priority_init in boot.c).
+ */
+static void
+console_irq(void)
+{
+    uint8_t buf[32];
+    uint32_t n;
+    do {
+        n = 0;
+        while (n < sizeof(buf) && uart_is_readable(CONSOLE_UART)) {
+            buf[n++] = (uint8_t)uart_get_hw(CONSOLE_UART)->dr;
+        }
+        if (n != 0) {
+            console_rx_push(buf, n);
+        }
+    } while (n == sizeof(buf));
+
+    if (uart_get_hw(CONSOLE_UART)->mis & UART_UARTMIS_TXMIS_BITS) {
+        console_tx_fill();
+    }
+}
+
+void
+console_hw_init(void)
+{
+    uart_init(CONSOLE_UART, CONSOLE_BAUD);
+    gpio_set_function(PICO_DEFAULT_UART_TX_PIN, GPIO_FUNC_UART);
+    gpio_set_function(PICO_DEFAULT_UART_RX_PIN, GPIO_FUNC_UART);
+    irq_set_exclusive_handler(CONSOLE_UART_IRQ, console_irq);
+    irq_set_priority(CONSOLE_UART_IRQ, PICO_DEFAULT_IRQ_PRIORITY);
+    irq_set_enabled(CONSOLE_UART_IRQ, true);
+    uart_set_irq_enables(CONSOLE_UART, true, false);
+}
+
+int
+console_hw_writable(void)
+{
+    return uart_is_writable(CONSOLE_UART);
+}
+
+void
+console_hw_putc(uint8_t c)
+{
+    uart_get_hw(CONSOLE_UART)->dr = c;
+}
+
+/*
+ * Called on either core, so the enable bit is set and cleared through the
+ * atomic register aliases.
+ */
+void
+console_hw_tx_irq(int enable)
+{
+    if (enable) {
+        hw_set_bits(&uart_get_hw(CONSOLE_UART)->imsc, UART_UARTIMSC_TXIM_BITS);
+    } else {
+        hw_clear_bits(&uart_get_hw(CONSOLE_UART)->imsc, UART_UARTIMSC_TXIM_BITS);
+    }
+}
@@ -4,5 +4,8 @@
 #include "scheduler.h"
 
 extern void schedule_handler(void);
+extern void svc_handler(void);
+extern void hardfault_handler(void);
+extern void process_return(void);
 
 #endif /* __CONTEXT_SWITCH_H__ */
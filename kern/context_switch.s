@@ -44,24 +44,115 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+/*
+ * The whole switch path runs from SRAM rather than XIP flash, so that its
+ * timing does not depend on the flash cache. Building with SCHED_SWITCH_STATS
+ * defined (as an assembler symbol) times each switch; see scheduler.h.
+ */
+.section .time_critical.context_switch, "ax", %progbits
+
 .thumb_func
 .global schedule_handler
 .align 4
 schedule_handler:
     push    {r3, lr}                @ Save r0-r3, and lr (the saved PC) to the to-be-descheduled process
-    bl      sched_get_next          @ Get the next process to load -- TODO define me
+    mov     r0, lr                  @ EXC_RETURN
+    add     r0, #3                  @ 0xfffffffd (thread mode, PSP) + 3 == 0
+    bne     schedule_handler_defer  @ Interrupted a handler, not a process: do not switch
+schedule_handler_switch:
+.ifdef SCHED_SWITCH_STATS
+    bl      sched_switch_begin      @ Sample SysTick before choosing the next process
+.endif
+    bl      sched_get_next          @ Get the next process to load
+    ldr     r2, =0xd0000000         @ SIO CPUID register: index of this core
+    ldr     r2, [r2]                @ ...
+    lsl     r2, #2                  @ Scale to an offset into pcb_active[]
     ldr     r3, =pcb_active         @ Get the current process
-    ldr     r1, [r3]                @ Dereference pcb_active
-    cmp     r0, r1                  @ Check if next to schedule == pcb_active
+    add     r3, r2                  @ &pcb_active[core]
+    ldr     r1, [r3]                @ Dereference pcb_active[core]
+    cmp     r0, r1                  @ Check if next to schedule == pcb_active[core]
     beq     schedule_handler_return @ If we're scheduling the active process then this is a no-op
-    str     r0, [r3]                @ Store the new next to schedule process at pcb_active
+    str     r0, [r3]                @ Store the new next to schedule process at pcb_active[core]
     bl      context_switch
+    bl      sched_switch_done       @ Let other cores run the previous process; r4-r11 are callee-saved
 
 .thumb_func
 .align 4
 schedule_handler_return:
     pop     {r3, pc}                @ Load r0-r3 and and the lr (into the PC) for the to-be-scheduled process
 
+/*
+ * SysTick has the lowest priority (see boot.c), so it never preempts another
+ * handler; should it ever, switching would save the handler's registers as the
+ * process's and drop its frame. Pend SysTick again instead, to be taken once
+ * that handler returns.
+ */
+schedule_handler_defer:
+    ldr     r0, =0xe000ed04         @ ICSR
+    ldr     r1, =0x04000000         @ PENDSTSET
+    str     r1, [r0]
+    b       schedule_handler_return
+
+/*
+ * SVCall handler. The system call is dispatched with the caller's stacked
+ * registers; if it gives up the CPU (yield, sleep, exit), the switch continues
+ * directly in schedule_handler from the same kernel stack layout, rather than
+ * pending SysTick and taking a second exception.
+ */
+.thumb_func
+.global svc_handler
+.align 4
+svc_handler:
+    push    {r3, lr}                @ Same kernel stack layout as schedule_handler, so context_switch can fix up lr
+    mrs     r0, psp                 @ Pass the caller's SP, which points at its stacked r0-r3
+    bl      syscall_dispatch        @ Returns non-zero if the caller should be descheduled
+    cmp     r0, #0
+    beq     schedule_handler_return @ Return to the caller with its results in the stacked r0-r3
+    b       schedule_handler_switch @ Choose the next process and switch to it
+
+/*
+ * Where a process goes when its entry point returns: process_init_context
+ * makes this its initial lr, so that returning from main exits the process as
+ * if it had made the system call itself. It runs in the process's own thread
+ * mode, so it is placed in flash with the rest of the kernel's text, which
+ * processes may execute.
+ */
+.section .text.process_return, "ax", %progbits
+.thumb_func
+.global process_return
+.align 2
+process_return:
+    svc     #3                      @ SYS_EXIT (see syscall.h); does not return
+1:  b       1b                      @ ...but never fall through
+
+.section .time_critical.context_switch, "ax", %progbits
+
+/*
+ * HardFault handler. A fault in a process (thread mode, on the process stack)
+ * is passed to pager_fault with the stacked registers and r4-r7, which the
+ * hardware does not stack; it returns once the faulting instruction can be
+ * retried or the process is killed. A fault in the kernel itself is fatal.
+ * Only built with DEMAND_PAGING defined (as an assembler symbol).
+ */
+.ifdef DEMAND_PAGING
+.thumb_func
+.global hardfault_handler
+.align 4
+hardfault_handler:
+    mov     r0, lr                  @ EXC_RETURN
+    add     r0, #3                  @ 0xfffffffd (thread mode, PSP) + 3 == 0
+    bne     hardfault_kernel        @ The kernel faulted
+    push    {r3-r7, lr}             @ r3 keeps the kernel stack 8-byte aligned
+    mrs     r0, psp                 @ Pass the process's stacked r0-r3, r12, lr, pc, xPSR
+    add     r1, sp, #4              @ ...and its r4-r7
+    bl      pager_fault
+    pop     {r3-r7, pc}             @ Return to the process, or to the reschedule its death requested
+
+.thumb_func
+hardfault_kernel:
+    b       hardfault_kernel        @ Hang, for a debugger to inspect
+.endif
+
 .thumb_func
 .align 4
 context_switch:
@@ -0,0 +1,55 @@
+/*
+ * copy.h:
+ *
+ * Copy engine: moves bytes in the background while the CPU gets on with
+ * something else. The loader streams program images from flash through it,
+ * so that boot does not wait in a copy loop, and each process can be started
+ * as soon as its own image is in place.
+ *
+ * On the RP2040 the engine is a DMA channel (copy_dma.c); the host build has
+ * a stand-in that models the transfer time (host/copy.c).
+ *
+ * Jobs run one at a time, in the order they were submitted, so a job's
+ * completion means that every job submitted before it has completed too.
+ */
+
+#ifndef __COPY_H__
+#define __COPY_H__
+
+#include <stdint.h>
+
+/*
+ * Most jobs queued at once. Loading a program takes a few, so this is enough
+ * for a dozen or so programs before the loader has to wait.
+ */
+#define COPY_MAX_JOBS       64
+
+/*
+ * Called when a job completes, with the argument it was submitted with. Runs
+ * in the engine's interrupt handler on the target, so must not block.
+ */
+typedef void (*copy_done_t)(void *arg);
+
+/*
+ * Set up the engine. Called once at boot, on the core that will submit jobs
+ * and take their completions.
+ */
+void
+copy_init(void);
+
+/*
+ * Queue a job copying len bytes from src to dst, or zeroing them if src is
+ * NULL, then calling done(arg) unless done is NULL. Words are moved at a time
+ * when dst, src and len are all multiples of 4. If the queue is full, waits
+ * for the oldest job to complete.
+ */
+void
+copy_submit(void *dst, const void *src, uint32_t len, copy_done_t done, void *arg);
+
+/*
+ * Return the number of jobs not yet completed.
+ */
+uint32_t
+copy_pending(void);
+
+#endif /* __COPY_H__ */
@@ -0,0 +1,130 @@
+#include "copy.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#include "hardware/dma.h"
+#include "hardware/irq.h"
+#include "hardware/sync.h"
+
+/*
+ * A queued job.
+ */
+typedef struct {
+    void           *dst;
+    const void     *src;            /* NULL to zero dst. */
+    uint32_t        len;
+    copy_done_t     done;
+    void           *arg;
+} copy_job_t;
+
+/*
+ * Ring of jobs, the oldest at head being the one the channel is running. Only
+ * touched on the core that called copy_init, with interrupts disabled.
+ */
+static copy_job_t jobs[COPY_MAX_JOBS];
+static uint32_t head;
+static volatile uint32_t n_jobs;
+
+static uint32_t channel;
+
+/*
+ * Read, without incrementing, by jobs that zero memory.
+ */
+static const uint32_t zero;
+
+/*
+ * Start the channel on a job. Returns zero, leaving the channel idle, if the
+ * job has nothing to move.
+ */
+static int
+job_start(const copy_job_t *job)
+{
+    if (job->len == 0) {
+        return 0;
+    }
+    int words = (((uintptr_t)job->dst | (uintptr_t)job->src | job->len) & 3) == 0;
+
+    dma_channel_config config = dma_channel_get_default_config(channel);
+    channel_config_set_transfer_data_size(&config, words ? DMA_SIZE_32 : DMA_SIZE_8);
+    channel_config_set_read_increment(&config, job->src != NULL);
+    channel_config_set_write_increment(&config, true);
+    dma_channel_configure(channel, &config, job->dst, job->src != NULL ? job->src : &zero,
+                          words ? job->len / 4 : job->len, true);
+    return 1;
+}
+
+/*
+ * Retire the job at head, and any that follow with nothing to move, calling
+ * their completion functions, then start the next. Called with interrupts
+ * disabled.
+ */
+static void
+job_complete(void)
+{
+    do {
+        copy_done_t done = jobs[head].done;
+        void *arg = jobs[head].arg;
+        head = (head + 1) % COPY_MAX_JOBS;
+        n_jobs--;
+        if (done != NULL) {
+            done(arg);
+        }
+    } while (n_jobs != 0 && !job_start(&jobs[head]));
+}
+
+static void
+copy_irq(void)
+{
+    dma_channel_acknowledge_irq0(channel);
+    job_complete();
+}
+
+void
+copy_init(void)
+{
+    channel = dma_claim_unused_channel(true);
+    dma_channel_set_irq0_enabled(channel, true);
+    irq_set_exclusive_handler(DMA_IRQ_0, copy_irq);
+    irq_set_enabled(DMA_IRQ_0, true);
+}
+
+void
+copy_submit(
+    void           *dst,
+    const void     *src,
+    uint32_t        len,
+    copy_done_t     done,
+    void           *arg)
+{
+    uint32_t saved = save_and_disable_interrupts();
+
+    /*
+     * Wait for room. The channel's interrupt still ends the WFI while
+     * interrupts are disabled, and is taken once they are restored.
+     */
+    while (n_jobs == COPY_MAX_JOBS) {
+        __wfi();
+        restore_interrupts(saved);
+        saved = save_and_disable_interrupts();
+    }
+
+    copy_job_t *job = &jobs[(head + n_jobs) % COPY_MAX_JOBS];
+    job->dst = dst;
+    job->src = src;
+    job->len = len;
+    job->done = done;
+    job->arg = arg;
+    n_jobs++;
+
+    /* An idle channel starts on the job straight away. */
+    if (n_jobs == 1 && !job_start(job)) {
+        job_complete();
+    }
+    restore_interrupts(saved);
+}
+
+uint32_t
+copy_pending(void)
+{
+    return n_jobs;
+}
@@ -0,0 +1,199 @@
+#include "ipc.h"
+#include "klock.h"
+#include "palloc.h"
+#include "pager.h"
+#include "utils/list.h"
+#include <stddef.h>
+#include <string.h>
+
+ipc_channel_t ipc_channels[IPC_N_CHANNELS];
+
+/*
+ * Find the region of the owner's that starts at data, if the owner may give
+ * it up: it holds neither the owner's stack nor its program. Called with the
+ * heap lock held, under which allocated lists change.
+ */
+static heap_region_t *
+region_find(
+    pcb_t  *owner,
+    void   *data)
+{
+    for (heap_region_t *region = owner->allocated; region != NULL; region = region->next) {
+        uint8_t *start = palloc_data(region);
+        if (start == data) {
+            if ((uint32_t)(owner->stack_base - start) < region->size || start == owner->span) {
+                return NULL;
+            }
+            return region;
+        }
+    }
+    return NULL;
+}
+
+void
+ipc_init(void)
+{
+    memset(ipc_channels, 0, sizeof(ipc_channels));
+}
+
+void *
+ipc_alloc(
+    pcb_t      *owner,
+    uint32_t    size)
+{
+#ifdef DEMAND_PAGING
+    if (owner->pager != NULL) {
+        return NULL;
+    }
+#endif
+    return size != 0 ? palloc(size, owner, PALLOC_FLAGS_ANYWHERE, NULL) : NULL;
+}
+
+int
+ipc_free(
+    pcb_t  *owner,
+    void   *data)
+{
+    uint32_t saved = klock(KLOCK_HEAP);
+    heap_region_t *region = region_find(owner, data);
+    kunlock(KLOCK_HEAP, saved);
+    if (region == NULL) {
+        return -1;
+    }
+    pfree(data, owner);
+    return 0;
+}
+
+/*
+ * Append a message to a channel, which has room for it, and wake the first
+ * receiver waiting. Called with the channel lock held.
+ */
+static ipc_message_t *
+channel_push(ipc_channel_t *ch)
+{
+    ipc_message_t *msg = &ch->queue[(ch->head + ch->count) % IPC_QUEUE_LEN];
+    ch->count++;
+    sched_wake(&ch->waiters);
+    return msg;
+}
+
+int
+ipc_send(
+    pcb_t      *sender,
+    uint32_t    channel,
+    const void *buf,
+    uint32_t    len)
+{
+    (void)sender;
+    if (channel >= IPC_N_CHANNELS || len > IPC_INLINE_MAX) {
+        return -1;
+    }
+    ipc_channel_t *ch = &ipc_channels[channel];
+
+    uint32_t saved = klock(KLOCK_IPC);
+    if (ch->count == IPC_QUEUE_LEN) {
+        ch->n_full++;
+        kunlock(KLOCK_IPC, saved);
+        return -1;
+    }
+    ipc_message_t *msg = channel_push(ch);
+    msg->region = NULL;
+    msg->len = len;
+    memcpy(msg->data, buf, len);
+    ch->n_copied++;
+    kunlock(KLOCK_IPC, saved);
+    return 0;
+}
+
+int
+ipc_send_region(
+    pcb_t      *sender,
+    uint32_t    channel,
+    void       *data,
+    uint32_t    len)
+{
+    if (channel >= IPC_N_CHANNELS) {
+        return -1;
+    }
+    ipc_channel_t *ch = &ipc_channels[channel];
+
+    uint32_t saved = klock(KLOCK_IPC);
+    if (ch->count == IPC_QUEUE_LEN) {
+        ch->n_full++;
+        kunlock(KLOCK_IPC, saved);
+        return -1;
+    }
+
+    /*
+     * The region leaves the sender's list, and is on nobody's until received.
+     */
+    uint32_t heap_saved = klock(KLOCK_HEAP);
+    heap_region_t *region = region_find(sender, data);
+    if (region == NULL || len > region->size) {
+        kunlock(KLOCK_HEAP, heap_saved);
+        kunlock(KLOCK_IPC, saved);
+        return -1;
+    }
+    DLL_REMOVE(sender->allocated, region, next, prev);
+    kunlock(KLOCK_HEAP, heap_saved);
+
+    ipc_message_t *msg = channel_push(ch);
+    msg->region = region;
+    msg->len = len;
+    ch->n_moved++;
+    kunlock(KLOCK_IPC, saved);
+    return 0;
+}
+
+int
+ipc_recv(
+    pcb_t      *receiver,
+    uint32_t    channel,
+    void       *buf,
+    uint32_t    size,
+    void      **data,
+    int         wait)
+{
+    if (channel >= IPC_N_CHANNELS) {
+        return -1;
+    }
+    ipc_channel_t *ch = &ipc_channels[channel];
+
+    uint32_t saved = klock(KLOCK_IPC);
+    if (ch->count == 0) {
+        if (!wait) {
+            kunlock(KLOCK_IPC, saved);
+            return -1;
+        }
+        sched_block(receiver, &ch->waiters, KLOCK_IPC);
+        ch->n_blocked++;
+        kunlock(KLOCK_IPC, saved);
+        return IPC_BLOCKED;
+    }
+
+    ipc_message_t *msg = &ch->queue[ch->head];
+    ch->head = (ch->head + 1) % IPC_QUEUE_LEN;
+    ch->count--;
+    ch->n_received++;
+    heap_region_t *region = msg->region;
+    uint32_t len = msg->len;
+    if (region == NULL) {
+        memcpy(buf, msg->data, len < size ? len : size);
+        *data = buf;
+    } else {
+        uint32_t heap_saved = klock(KLOCK_HEAP);
+        DLL_PUSH(receiver->allocated, region, next, prev);
+        kunlock(KLOCK_HEAP, heap_saved);
+        *data = palloc_data(region);
+    }
+    kunlock(KLOCK_IPC, saved);
+
+#ifdef DEMAND_PAGING
+    if (region != NULL && receiver->pager != NULL) {
+        memcpy(buf, palloc_data(region), len < size ? len : size);
+        pfree(palloc_data(region), receiver);
+        *data = buf;
+    }
+#endif
+    return (int)len;
+}
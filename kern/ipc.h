@@ -0,0 +1,122 @@
+/*
+ * ipc.h:
+ *
+ * Message passing between processes, over a fixed set of channels that any
+ * process can send to and receive from by number.
+ *
+ * A message is either copied or moved. A copied message is at most
+ * IPC_INLINE_MAX bytes, held in the channel itself. A moved message is a heap
+ * region the sender was given for the purpose (see ipc_alloc): sending it
+ * takes the region off the sender's allocated list, and receiving it puts it
+ * on the receiver's, so its bytes are never touched however large it is. In
+ * between, the region belongs to the channel, and is lost with it if never
+ * received. A channel holds at most IPC_QUEUE_LEN messages of either kind, in
+ * the order they were sent; sending to a full channel fails.
+ *
+ * A process receiving from an empty channel can block until a message is
+ * sent to it. Blocked receivers are woken by priority, first come first
+ * served among equals, one per message, and receive again when they next run,
+ * so a receiver that did not block may take the message first, in which case
+ * the woken one blocks again.
+ *
+ * Demand-paged processes can reach only their span and stack (see pager.h),
+ * so cannot be given regions: they are sent copies, and a region sent to them
+ * is copied into their buffer and freed.
+ */
+
+#ifndef __IPC_H__
+#define __IPC_H__
+
+#include <stdint.h>
+
+#include "scheduler.h"
+
+#define IPC_N_CHANNELS      8
+#define IPC_QUEUE_LEN       8       /* Messages held by a channel. */
+#define IPC_INLINE_MAX      24      /* Largest message that is copied. */
+
+/*
+ * Returned by ipc_recv when the receiver has been blocked.
+ */
+#define IPC_BLOCKED         (-2)
+
+/*
+ * A message waiting in a channel.
+ */
+typedef struct {
+    heap_region_t  *region;                 /* Region moved, or NULL if copied. */
+    uint32_t        len;                    /* Bytes of the message. */
+    uint8_t         data[IPC_INLINE_MAX];   /* The bytes, if copied. */
+} ipc_message_t;
+
+/*
+ * A channel: a ring of messages, and the processes waiting for one. Guarded
+ * by KLOCK_IPC.
+ */
+typedef struct {
+    ipc_message_t   queue[IPC_QUEUE_LEN];
+    uint8_t         head;           /* Slot of the oldest message. */
+    uint8_t         count;          /* Messages held. */
+    pcb_t          *waiters;        /* Receivers blocked until a message comes. */
+
+    /*
+     * Usage counters.
+     */
+    uint32_t        n_copied;       /* Copied messages sent. */
+    uint32_t        n_moved;        /* Regions sent. */
+    uint32_t        n_received;     /* Messages received. */
+    uint32_t        n_full;         /* Sends that found the channel full. */
+    uint32_t        n_blocked;      /* Receives that blocked. */
+} ipc_channel_t;
+
+extern ipc_channel_t ipc_channels[IPC_N_CHANNELS];
+
+/*
+ * Empty every channel. Called once at boot.
+ */
+void
+ipc_init(void);
+
+/*
+ * Allocate a region of size bytes to a process, to fill and send as a message.
+ * Returns its data, or NULL if the heap is exhausted or the process is
+ * demand-paged.
+ */
+void *
+ipc_alloc(pcb_t *owner, uint32_t size);
+
+/*
+ * Free a region given by ipc_alloc, or received. Returns 0, or -1 if data is
+ * not the start of such a region of the owner's.
+ */
+int
+ipc_free(pcb_t *owner, void *data);
+
+/*
+ * Send a copy of len bytes at buf, at most IPC_INLINE_MAX. Returns 0, or -1 if
+ * the channel does not exist or is full, or len is too long.
+ */
+int
+ipc_send(pcb_t *sender, uint32_t channel, const void *buf, uint32_t len);
+
+/*
+ * Send the region starting at data, whose first len bytes are the message,
+ * giving it up. Returns 0, or -1 if the channel does not exist or is full, or
+ * data is not the start of a region of the sender's that ipc_free would take,
+ * at least len bytes long.
+ */
+int
+ipc_send_region(pcb_t *sender, uint32_t channel, void *data, uint32_t len);
+
+/*
+ * Receive the oldest message of a channel. A copied message is copied to buf,
+ * as much of it as size bytes hold, and *data set to buf; for a region, *data
+ * is set to its data, and the region is the receiver's. Returns the length of
+ * the message. If the channel is empty, returns -1, or if wait is set, blocks
+ * the receiver and returns IPC_BLOCKED; the call should then be made again
+ * once the receiver runs.
+ */
+int
+ipc_recv(pcb_t *receiver, uint32_t channel, void *buf, uint32_t size, void **data, int wait);
+
+#endif /* __IPC_H__ */
@@ -0,0 +1,71 @@
+/*
+ * klock.h:
+ *
+ * Kernel state shared between the two cores is guarded by RP2040 SIO hardware
+ * spinlocks. Taking a lock also disables interrupts on the calling core, so a
+ * lock is never held across a context switch, and never for longer than a
+ * handful of list operations.
+ *
+ * Lock ordering: a ready queue lock may be taken while holding the sleep queue
+ * lock or the lock of a wait queue (the message channels', the mutexes' and
+ * semaphores', or the console's), but two ready queue locks are never held at
+ * once. The process list lock is taken before a ready queue lock. The heap
+ * lock may be taken while holding the channels' lock. The heap, zone and page
+ * cache locks are leaves.
+ */
+
+#ifndef __KLOCK_H__
+#define __KLOCK_H__
+
+#include <stdint.h>
+
+#include "hardware/sync.h"
+
+#include "scheduler.h"
+
+#define KLOCK_HEAP          PICO_SPINLOCK_ID_OS1    /* palloc's heap. */
+#define KLOCK_ZONES         PICO_SPINLOCK_ID_OS2    /* zalloc's zones. */
+#define KLOCK_SLEEP         (PICO_SPINLOCK_ID_CLAIM_FREE_FIRST)         /* Sleep queue. */
+#define KLOCK_READY(core)   (PICO_SPINLOCK_ID_CLAIM_FREE_FIRST + 1 + (core)) /* A core's ready queues. */
+#define KLOCK_PCACHE        (PICO_SPINLOCK_ID_CLAIM_FREE_FIRST + 1 + SCHED_N_CORES) /* Page cache ownership. */
+#define KLOCK_IPC           (PICO_SPINLOCK_ID_CLAIM_FREE_FIRST + 2 + SCHED_N_CORES) /* Message channels. */
+#define KLOCK_SYNC          (PICO_SPINLOCK_ID_CLAIM_FREE_FIRST + 3 + SCHED_N_CORES) /* Mutexes and semaphores. */
+#define KLOCK_CONSOLE       (PICO_SPINLOCK_ID_CLAIM_FREE_FIRST + 4 + SCHED_N_CORES) /* Console rings' UART side. */
+#define KLOCK_PROCS         (PICO_SPINLOCK_ID_CLAIM_FREE_FIRST + 5 + SCHED_N_CORES) /* List of live processes. */
+
+/*
+ * Reserve the kernel's spinlocks. Called once at boot, before either core
+ * takes any of them.
+ */
+static inline void
+klock_init(void)
+{
+    spin_lock_claim(KLOCK_HEAP);
+    spin_lock_claim(KLOCK_ZONES);
+    spin_lock_claim(KLOCK_SLEEP);
+    for (uint32_t core = 0; core < SCHED_N_CORES; core++) {
+        spin_lock_claim(KLOCK_READY(core));
+    }
+    spin_lock_claim(KLOCK_PCACHE);
+    spin_lock_claim(KLOCK_IPC);
+    spin_lock_claim(KLOCK_SYNC);
+    spin_lock_claim(KLOCK_CONSOLE);
+    spin_lock_claim(KLOCK_PROCS);
+}
+
+/*
+ * Take a lock, returning the interrupt state to restore when releasing it.
+ */
+static inline uint32_t
+klock(uint32_t id)
+{
+    return spin_lock_blocking(spin_lock_instance(id));
+}
+
+static inline void
+kunlock(uint32_t id, uint32_t saved)
+{
+    spin_unlock(spin_lock_instance(id), saved);
+}
+
+#endif /* __KLOCK_H__ */
@@ -0,0 +1,259 @@
+#include "ksync.h"
+#include "klock.h"
+#include "zalloc.h"
+#include "utils/list.h"
+#include <stddef.h>
+
+/*
+ * Objects by handle.
+ */
+static ksync_t *objects[KSYNC_MAX];
+
+/*
+ * Return the object with a handle if it is of the given type. Called with the
+ * lock held.
+ */
+static ksync_t *
+lookup(
+    uint32_t    handle,
+    uint8_t     type)
+{
+    if (handle >= KSYNC_MAX || objects[handle] == NULL || objects[handle]->type != type) {
+        return NULL;
+    }
+    return objects[handle];
+}
+
+/*
+ * Make pcb the holder of a mutex. Every mutex it holds records the priority it
+ * had before holding any.
+ */
+static void
+mutex_take(
+    ksync_t    *mutex,
+    pcb_t      *pcb)
+{
+    mutex->owner = pcb;
+    mutex->base_priority = pcb->held != NULL ? pcb->held->base_priority : pcb->priority;
+    mutex->held_next = pcb->held;
+    pcb->held = mutex;
+    mutex->n_taken++;
+}
+
+/*
+ * Lend the holder of a mutex the priority of its first waiter, if higher than
+ * its own or one already lent. A holder that is asleep or blocked takes it up
+ * when it wakes (see sched_set_priority).
+ */
+static void
+mutex_boost(ksync_t *mutex)
+{
+    if (!(mutex->flags & KSYNC_INHERIT) || mutex->waiters == NULL) {
+        return;
+    }
+
+    pcb_t *owner = mutex->owner;
+    uint8_t lent = owner->lent;
+    uint8_t priority = lent != 0 ? lent - 1 : owner->priority;
+    if (mutex->waiters->priority < priority) {
+        sched_set_priority(owner, mutex->waiters->priority);
+        mutex->n_boosted++;
+    }
+}
+
+/*
+ * Take a mutex from its holder, and hand it to its first waiter, if any. The
+ * holder gets back its own priority, or the highest lent by the waiters on
+ * the mutexes it still holds.
+ */
+static void
+mutex_release(ksync_t *mutex)
+{
+    pcb_t *pcb = mutex->owner;
+    ksync_t **link = &pcb->held;
+    while (*link != mutex) {
+        link = &(*link)->held_next;
+    }
+    *link = mutex->held_next;
+
+    uint8_t priority = mutex->base_priority;
+    for (ksync_t *held = pcb->held; held != NULL; held = held->held_next) {
+        if ((held->flags & KSYNC_INHERIT) && held->waiters != NULL &&
+            held->waiters->priority < priority) {
+            priority = held->waiters->priority;
+        }
+    }
+    if (priority != pcb->priority) {
+        sched_set_priority(pcb, priority);
+    }
+
+    pcb_t *next = sched_wake(&mutex->waiters);
+    mutex->owner = NULL;
+    if (next != NULL) {
+        mutex_take(mutex, next);
+        mutex_boost(mutex);
+    }
+}
+
+void
+ksync_init(void)
+{
+    for (uint32_t i = 0; i < KSYNC_MAX; i++) {
+        objects[i] = NULL;
+    }
+}
+
+/*
+ * Give a new object a handle. Returns the handle, or -1.
+ */
+static int
+create(
+    uint8_t     type,
+    uint8_t     flags,
+    uint32_t    count)
+{
+    ksync_t *object = zalloc(KZONE_SYNC);
+    if (object == NULL) {
+        return -1;
+    }
+    object->type = type;
+    object->flags = flags;
+    object->count = count;
+
+    uint32_t saved = klock(KLOCK_SYNC);
+    for (uint32_t handle = 0; handle < KSYNC_MAX; handle++) {
+        if (objects[handle] == NULL) {
+            objects[handle] = object;
+            kunlock(KLOCK_SYNC, saved);
+            return (int)handle;
+        }
+    }
+    kunlock(KLOCK_SYNC, saved);
+    zfree(object, KZONE_SYNC);
+    return -1;
+}
+
+int
+ksync_mutex_create(uint32_t flags)
+{
+    return create(KSYNC_MUTEX, flags & KSYNC_INHERIT, 0);
+}
+
+int
+ksync_sem_create(uint32_t count)
+{
+    return create(KSYNC_SEMAPHORE, 0, count);
+}
+
+int
+ksync_destroy(uint32_t handle)
+{
+    uint32_t saved = klock(KLOCK_SYNC);
+    ksync_t *object = handle < KSYNC_MAX ? objects[handle] : NULL;
+    if (object == NULL || object->owner != NULL || object->waiters != NULL) {
+        kunlock(KLOCK_SYNC, saved);
+        return -1;
+    }
+    objects[handle] = NULL;
+    kunlock(KLOCK_SYNC, saved);
+    zfree(object, KZONE_SYNC);
+    return 0;
+}
+
+int
+ksync_lock(
+    pcb_t      *pcb,
+    uint32_t    handle)
+{
+    uint32_t saved = klock(KLOCK_SYNC);
+    ksync_t *mutex = lookup(handle, KSYNC_MUTEX);
+    if (mutex == NULL || mutex->owner == pcb) {
+        kunlock(KLOCK_SYNC, saved);
+        return -1;
+    }
+    if (mutex->owner == NULL) {
+        mutex_take(mutex, pcb);
+        kunlock(KLOCK_SYNC, saved);
+        return 0;
+    }
+
+    sched_block(pcb, &mutex->waiters, KLOCK_SYNC);
+    mutex->n_blocked++;
+    mutex_boost(mutex);
+    kunlock(KLOCK_SYNC, saved);
+    return KSYNC_BLOCKED;
+}
+
+int
+ksync_unlock(
+    pcb_t      *pcb,
+    uint32_t    handle)
+{
+    uint32_t saved = klock(KLOCK_SYNC);
+    ksync_t *mutex = lookup(handle, KSYNC_MUTEX);
+    if (mutex == NULL || mutex->owner != pcb) {
+        kunlock(KLOCK_SYNC, saved);
+        return -1;
+    }
+    mutex_release(mutex);
+    kunlock(KLOCK_SYNC, saved);
+    return 0;
+}
+
+int
+ksync_wait(
+    pcb_t      *pcb,
+    uint32_t    handle)
+{
+    uint32_t saved = klock(KLOCK_SYNC);
+    ksync_t *sem = lookup(handle, KSYNC_SEMAPHORE);
+    if (sem == NULL) {
+        kunlock(KLOCK_SYNC, saved);
+        return -1;
+    }
+    if (sem->count != 0) {
+        sem->count--;
+        sem->n_taken++;
+        kunlock(KLOCK_SYNC, saved);
+        return 0;
+    }
+
+    sched_block(pcb, &sem->waiters, KLOCK_SYNC);
+    sem->n_blocked++;
+    kunlock(KLOCK_SYNC, saved);
+    return KSYNC_BLOCKED;
+}
+
+int
+ksync_post(uint32_t handle)
+{
+    uint32_t saved = klock(KLOCK_SYNC);
+    ksync_t *sem = lookup(handle, KSYNC_SEMAPHORE);
+    if (sem == NULL) {
+        kunlock(KLOCK_SYNC, saved);
+        return -1;
+    }
+    if (sched_wake(&sem->waiters) != NULL) {
+        sem->n_taken++;
+    } else {
+        sem->count++;
+    }
+    kunlock(KLOCK_SYNC, saved);
+    return 0;
+}
+
+void
+ksync_abandon(pcb_t *pcb)
+{
+    uint32_t saved = klock(KLOCK_SYNC);
+    while (pcb->held != NULL) {
+        mutex_release(pcb->held);
+    }
+    kunlock(KLOCK_SYNC, saved);
+}
+
+ksync_t *
+ksync_get(uint32_t handle)
+{
+    return handle < KSYNC_MAX ? objects[handle] : NULL;
+}
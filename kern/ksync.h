@@ -0,0 +1,129 @@
+/*
+ * ksync.h:
+ *
+ * Mutexes and counting semaphores for processes. A process that cannot take
+ * one blocks: it leaves the ready queues for the object's wait queue, costing
+ * no CPU time, instead of spinning until the holder is next scheduled.
+ *
+ * Waiters are queued by priority, first come first served among equals. A
+ * release hands the mutex, or the semaphore's unit, straight to the first
+ * waiter before waking it, so the waiter returns holding it and no process
+ * can take it in between.
+ *
+ * A mutex created with KSYNC_INHERIT lends its holder the priority of its
+ * highest-priority waiter, so that processes of intermediate priority cannot
+ * keep the holder, and with it the waiter, from running. Inheritance is one
+ * level deep: a holder blocked on another mutex does not pass the priority
+ * on. The holder gets back, on release, the priority it had before it held
+ * any mutex, or what waiters on the mutexes it still holds lend it.
+ *
+ * Objects come from the KZONE_SYNC zone, and are named by a handle: any
+ * process can use any object whose handle it knows. Mutexes still held by a
+ * process when it exits are released.
+ */
+
+#ifndef __KSYNC_H__
+#define __KSYNC_H__
+
+#include <stdint.h>
+
+#include "scheduler.h"
+
+#define KSYNC_MAX           32      /* Objects in existence at once. */
+
+#define KSYNC_MUTEX         0
+#define KSYNC_SEMAPHORE     1
+
+#define KSYNC_INHERIT       1       /* Mutex flag: priority inheritance. */
+
+/*
+ * Returned when the caller has been blocked. It holds the object once it
+ * runs again.
+ */
+#define KSYNC_BLOCKED       (-2)
+
+/*
+ * A mutex or semaphore. Guarded by KLOCK_SYNC.
+ */
+typedef struct ksync {
+    uint8_t         type;           /* KSYNC_MUTEX or KSYNC_SEMAPHORE. */
+    uint8_t         flags;          /* KSYNC_INHERIT, for a mutex. */
+    uint8_t         base_priority;  /* Priority of the holder before it held any mutex. */
+    uint32_t        count;          /* Units of a semaphore available. */
+    pcb_t          *owner;          /* Holder of a mutex, or NULL. */
+    struct ksync   *held_next;      /* Next mutex the holder holds. */
+    pcb_t          *waiters;        /* Processes blocked taking it. */
+
+    /*
+     * Usage counters.
+     */
+    uint32_t        n_taken;        /* Times taken, at once or after blocking. */
+    uint32_t        n_blocked;      /* Times a process had to block. */
+    uint32_t        n_boosted;      /* Times the holder was lent a waiter's priority. */
+} ksync_t;
+
+/*
+ * Forget every object. Called once at boot.
+ */
+void
+ksync_init(void);
+
+/*
+ * Create a mutex with the given KSYNC_* flags, or a semaphore with count units.
+ * Return its handle, or -1 if there are KSYNC_MAX already or no memory.
+ */
+int
+ksync_mutex_create(uint32_t flags);
+
+int
+ksync_sem_create(uint32_t count);
+
+/*
+ * Destroy an object. Returns 0, or -1 if there is no such object, or it is a
+ * mutex that is held, or processes are waiting on it.
+ */
+int
+ksync_destroy(uint32_t handle);
+
+/*
+ * Take a mutex. Returns 0, KSYNC_BLOCKED, or -1 if there is no such mutex or
+ * pcb holds it already.
+ */
+int
+ksync_lock(pcb_t *pcb, uint32_t handle);
+
+/*
+ * Release a mutex pcb holds, handing it to the first waiter. Returns 0, or -1
+ * if there is no such mutex or pcb does not hold it.
+ */
+int
+ksync_unlock(pcb_t *pcb, uint32_t handle);
+
+/*
+ * Take a unit of a semaphore. Returns 0, KSYNC_BLOCKED, or -1 if there is no
+ * such semaphore.
+ */
+int
+ksync_wait(pcb_t *pcb, uint32_t handle);
+
+/*
+ * Give a unit of a semaphore, to the first waiter if there is one. Returns 0,
+ * or -1 if there is no such semaphore.
+ */
+int
+ksync_post(uint32_t handle);
+
+/*
+ * Release every mutex an exiting process holds.
+ */
+void
+ksync_abandon(pcb_t *pcb);
+
+/*
+ * Return the object with a handle, or NULL. For diagnostics; the object may
+ * change once returned.
+ */
+ksync_t *
+ksync_get(uint32_t handle);
+
+#endif /* __KSYNC_H__ */
@@ -0,0 +1,18 @@
+#include "ktrace.h"
+
+#ifdef KTRACE
+#include <string.h>
+
+ktrace_ring_t ktrace_rings[SCHED_N_CORES];
+
+void
+ktrace_init(void)
+{
+    memset(ktrace_rings, 0, sizeof(ktrace_rings));
+    for (uint32_t core = 0; core < SCHED_N_CORES; core++) {
+        ktrace_rings[core].magic = KTRACE_MAGIC;
+        ktrace_rings[core].core = core;
+        ktrace_rings[core].n_recs = KTRACE_RING_SIZE;
+    }
+}
+#endif /* KTRACE */
@@ -0,0 +1,99 @@
+/*
+ * ktrace.h:
+ *
+ * Binary event trace of the kernel, kept in a fixed-size ring per core that
+ * overwrites its oldest records. Each core writes only its own ring, so
+ * recording takes no lock, but records are made from thread mode too (by
+ * palloc and pfree once the heap lock is released, and by the idle process),
+ * so a core claims the next slot and fills in its four words with interrupts
+ * disabled.
+ *
+ * Built only with KTRACE defined; otherwise KTRACE_RECORD compiles to nothing.
+ * To read a trace, dump the rings from a debugger and decode them on the host:
+ *
+ *      (gdb) dump binary value ktrace.bin ktrace_rings
+ *      $ ./build-host/ktrace_decode ktrace.bin
+ */
+
+#ifndef __KTRACE_H__
+#define __KTRACE_H__
+
+#include <stdint.h>
+
+#include "scheduler.h"
+
+#define KTRACE_RING_SIZE    256             /* Records per core; a power of two. */
+#define KTRACE_MAGIC        0x4b545243      /* "KTRC" */
+
+/*
+ * Traced events, and the meaning of each record's fields for them.
+ */
+typedef enum {
+    KTRACE_SCHED,       /* schedule_handler entered; pid: running process. */
+    KTRACE_SWITCH,      /* Switched; pid: next process, arg0: previous pid. */
+    KTRACE_EXIT,        /* pid: exited process. */
+    KTRACE_PALLOC,      /* pid: owner, arg0: address (0 on failure), arg1: size. */
+    KTRACE_PFREE,       /* pid: owner, arg0: address, arg1: size. */
+    KTRACE_PFREE_ALL,   /* pid: owner, arg1: number of regions freed. */
+    KTRACE_ZALLOC,      /* arg0: address (0 on failure), arg1: zone. */
+    KTRACE_ZFREE,       /* arg0: address, arg1: zone. */
+    KTRACE_STACK,       /* Stack overflow found; pid: process, arg0: saved SP, arg1: stack base. */
+    KTRACE_ZFREE_BAD,   /* zfree of no element of the zone; arg0: address, arg1: zone. */
+    KTRACE_N_EVENTS
+} ktrace_event_t;
+
+typedef struct {
+    uint32_t    time;       /* time_us_32() when recorded. */
+    uint16_t    event;      /* ktrace_event_t. */
+    uint16_t    pid;
+    uint32_t    arg0;
+    uint32_t    arg1;
+} ktrace_rec_t;
+
+typedef struct {
+    uint32_t        magic;      /* KTRACE_MAGIC once initialized. */
+    uint16_t        core;       /* Core writing this ring. */
+    uint16_t        n_recs;     /* KTRACE_RING_SIZE. */
+    uint32_t        head;       /* Records ever written; the next goes at head % n_recs. */
+    uint32_t        reserved;
+    ktrace_rec_t    recs[KTRACE_RING_SIZE];
+} ktrace_ring_t;
+
+#ifdef KTRACE
+#include "pico/platform.h"
+#include "hardware/sync.h"
+#include "hardware/timer.h"
+
+extern ktrace_ring_t ktrace_rings[SCHED_N_CORES];
+
+/*
+ * Reset the rings. Called once at boot, before anything is recorded.
+ */
+void
+ktrace_init(void);
+
+static inline void
+ktrace_record(
+    uint32_t    event,
+    uint32_t    pid,
+    uint32_t    arg0,
+    uint32_t    arg1)
+{
+    ktrace_ring_t *ring = &ktrace_rings[get_core_num()];
+    uint32_t saved = save_and_disable_interrupts();
+    ktrace_rec_t *rec = &ring->recs[ring->head++ & (KTRACE_RING_SIZE - 1)];
+    rec->time = time_us_32();
+    rec->event = event;
+    rec->pid = pid;
+    rec->arg0 = arg0;
+    rec->arg1 = arg1;
+    restore_interrupts(saved);
+}
+
+#define KTRACE_RECORD(event, pid, arg0, arg1) \
+    ktrace_record((event), (pid), (uint32_t)(uintptr_t)(arg0), (uint32_t)(uintptr_t)(arg1))
+#else
+#define KTRACE_RECORD(event, pid, arg0, arg1) do { } while (0)
+#endif /* KTRACE */
+
+#endif /* __KTRACE_H__ */
@@ -0,0 +1,258 @@
+#include "loader.h"
+#include "copy.h"
+#include "pager.h"
+#include "palloc.h"
+#include "process.h"
+#include "zalloc.h"
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * Queue a copy of len bytes of an image into a span, or zeroing of them if src
+ * is NULL, unless there are none.
+ */
+static void
+stream(
+    uint8_t        *dst,
+    const uint8_t  *src,
+    uint32_t        len)
+{
+    if (len != 0) {
+        copy_submit(dst, src, len, NULL, NULL);
+    }
+}
+
+/*
+ * Copy a global offset table of n entries from src to dst, moving the entries
+ * that point into the span linked at lo to hi by delta.
+ */
+static void
+rebase(
+    uint8_t        *dst,
+    const uint32_t *src,
+    uint32_t        n,
+    uint32_t        lo,
+    uint32_t        hi,
+    uint32_t        delta)
+{
+    uint32_t *got = (uint32_t *)dst;
+    for (uint32_t i = 0; i < n; i++) {
+        got[i] = src[i] - lo < hi - lo ? src[i] + delta : src[i];
+    }
+}
+
+/*
+ * Find the span of SRAM an image's segments occupy, from the lowest to the end
+ * of the highest, rounded out to PALLOC_ALIGN: [*lo, *hi), or empty at 0 if
+ * all of its segments execute in place.
+ */
+static void
+image_span(
+    const prog_header_t    *hdr,
+    uint32_t               *lo,
+    uint32_t               *hi)
+{
+    const prog_segment_t *seg = prog_segments(hdr);
+    *lo = UINT32_MAX;
+    *hi = 0;
+    for (uint32_t i = 0; i < hdr->n_segments; i++) {
+        if (!prog_segment_xip(&seg[i])) {
+            *lo = seg[i].addr < *lo ? seg[i].addr : *lo;
+            *hi = seg[i].addr + seg[i].mem_size;
+        }
+    }
+    *lo = *lo < *hi ? *lo & ~(PALLOC_ALIGN - 1) : 0;
+    *hi = (*hi + PALLOC_ALIGN - 1) & ~(PALLOC_ALIGN - 1);
+}
+
+/*
+ * Completion of the last copy job of a process's image: move the words of the
+ * relocation table by as far as the span was moved from where it was linked,
+ * then let the process run.
+ */
+static void
+load_done(void *arg)
+{
+    pcb_t *pcb = (pcb_t *)arg;
+    const prog_header_t *hdr = pcb->image;
+    uint32_t lo, hi;
+
+    image_span(hdr, &lo, &hi);
+    uint32_t delta = (uint32_t)(uintptr_t)pcb->span - lo;
+    for (uint32_t i = 0; delta != 0 && i < hdr->n_relocs; i++) {
+        *(uint32_t *)(pcb->span + (prog_relocs(hdr)[i] - lo)) += delta;
+    }
+    sched_enqueue(pcb);
+}
+
+#ifdef DEMAND_PAGING
+/*
+ * Load a demand-paged program: reserve its span, rounded out to whole pages so
+ * that no page is shared with other memory, but copy nothing into it. Its
+ * stack is one MPU region, so is a power of two aligned to its size, which
+ * takes allocating up to twice as much.
+ */
+static pcb_t *
+load_paged(
+    const prog_header_t    *hdr,
+    pcb_t                  *pcb,
+    uint32_t                lo,
+    uint32_t                hi)
+{
+    hi = (hi + PAGER_PAGE_SIZE - 1) & ~(PAGER_PAGE_SIZE - 1);
+
+    uint32_t stack_size = PAGER_MIN_STACK;
+    while (stack_size < hdr->stack_size + PROCESS_STACK_GUARD) {
+        stack_size <<= 1;
+    }
+    uint8_t *stack = palloc(2 * stack_size - PALLOC_ALIGN, pcb, PALLOC_FLAGS_ANYWHERE, NULL);
+    uint8_t *span = palloc(hi - lo, pcb, PALLOC_FLAGS_FIXED, (void *)(uintptr_t)lo);
+    if (stack == NULL || span != (uint8_t *)(uintptr_t)lo) {
+        process_release(pcb);
+        return NULL;
+    }
+    stack = (uint8_t *)(((uintptr_t)stack + stack_size - 1) & ~(uintptr_t)(stack_size - 1));
+
+    if (!pager_create(pcb, hdr, span, lo, (hi - lo) >> PAGER_PAGE_SHIFT, stack, stack_size)) {
+        process_release(pcb);
+        return NULL;
+    }
+    process_init_context(pcb, stack, stack_size, (void *)(uintptr_t)hdr->entry);
+    sched_enqueue(pcb);
+    return pcb;
+}
+#endif /* DEMAND_PAGING */
+
+pcb_t *
+loader_load(const prog_header_t *hdr)
+{
+    if (!prog_header_valid(hdr, hdr->size)) {
+        return NULL;
+    }
+    const prog_segment_t *seg = prog_segments(hdr);
+    const uint8_t *image = (const uint8_t *)hdr;
+
+    pcb_t *pcb = (pcb_t *)zalloc(KZONE_PCB);
+    if (pcb == NULL) {
+        return NULL;
+    }
+    pcb->allocated = NULL;
+    pcb->priority = hdr->priority < SCHED_N_PRIORITIES ? hdr->priority : SCHED_N_PRIORITIES - 1;
+    pcb->image = hdr;
+    pcb->span = NULL;
+
+    /*
+     * XIP segments run from the image itself, so must be stored at the
+     * addresses they were linked for. The others make up the span.
+     */
+    for (uint32_t i = 0; i < hdr->n_segments; i++) {
+        if (prog_segment_xip(&seg[i]) &&
+            image + seg[i].offset != (const uint8_t *)(uintptr_t)seg[i].addr) {
+            process_release(pcb);
+            return NULL;
+        }
+    }
+    uint32_t lo, hi;
+    image_span(hdr, &lo, &hi);
+
+#ifdef DEMAND_PAGING
+    if ((hdr->flags & PROG_FLAG_DEMAND_PAGED) && !prog_relocatable(hdr) && lo < hi &&
+        (lo & (PAGER_PAGE_SIZE - 1)) == 0) {
+        return load_paged(hdr, pcb, lo, hi);
+    }
+#endif
+
+    /*
+     * Allocate a stack, with its red zone below what the program asked for
+     * (see process.h), and the span: where the program was linked to run,
+     * unless it can be moved by adjusting its global offset table or
+     * relocation table.
+     */
+    uint32_t stack_size = hdr->stack_size + PROCESS_STACK_GUARD;
+    void *stack = palloc(stack_size, pcb, PALLOC_FLAGS_ANYWHERE, NULL);
+    uint8_t *span = NULL;
+    if (lo < hi) {
+        span = prog_relocatable(hdr) ?
+            palloc(hi - lo, pcb, PALLOC_FLAGS_ANYWHERE, NULL) :
+            palloc(hi - lo, pcb, PALLOC_FLAGS_FIXED, (void *)(uintptr_t)lo);
+    }
+    if (stack == NULL || (lo < hi && span == NULL) ||
+        (!prog_relocatable(hdr) && span != (uint8_t *)(uintptr_t)lo)) {
+        process_release(pcb);
+        return NULL;
+    }
+    pcb->span = span;
+    uint32_t delta = (uint32_t)(uintptr_t)span - lo;
+
+    /*
+     * Set the process up to start at the image's entry point, on a fresh
+     * stack, once scheduled.
+     */
+    uint32_t entry = hdr->entry - lo < hi - lo ? hdr->entry + delta : hdr->entry;
+    process_init_context(pcb, stack, stack_size, (void *)(uintptr_t)entry);
+    if (hdr->got_entries != 0) {
+        process_init_static_base(pcb, hdr->got_addr + delta);
+    }
+    if (span == NULL) {
+        sched_enqueue(pcb);
+        return pcb;
+    }
+
+    /*
+     * Stream each SRAM segment's stored bytes into the span through the copy
+     * engine, and zero everything else in it, writing each byte once. The
+     * global offset table is copied here instead, with its entries for the
+     * span pointed at this copy; those for XIP segments are left alone. The
+     * words of the relocation table are moved once the last job has
+     * completed, and the process becomes runnable then, while later images
+     * are still being copied.
+     */
+    uint32_t got_len = 4 * hdr->got_entries;
+    uint8_t *zero_from = span;
+    for (uint32_t i = 0; i < hdr->n_segments; i++) {
+        if (prog_segment_xip(&seg[i]) || seg[i].file_size == 0) {
+            continue;
+        }
+        uint8_t *addr = span + (seg[i].addr - lo);
+        const uint8_t *src = image + seg[i].offset;
+        stream(zero_from, NULL, addr - zero_from);
+
+        uint32_t before = hdr->got_addr - seg[i].addr;
+        if (got_len != 0 && before < seg[i].file_size) {
+            rebase(addr + before, (const uint32_t *)(src + before), hdr->got_entries, lo, hi, delta);
+            stream(addr, src, before);
+            stream(addr + before + got_len, src + before + got_len,
+                   seg[i].file_size - before - got_len);
+        } else {
+            stream(addr, src, seg[i].file_size);
+        }
+        zero_from = addr + seg[i].file_size;
+    }
+    copy_submit(zero_from, NULL, span + (hi - lo) - zero_from, load_done, pcb);
+    return pcb;
+}
+
+uint32_t
+loader_load_all(
+    const void *start,
+    const void *end)
+{
+    uint32_t n_loaded = 0;
+    uintptr_t addr = ((uintptr_t)start + PROG_ALIGN - 1) & ~(uintptr_t)(PROG_ALIGN - 1);
+
+    while (addr + sizeof(prog_header_t) <= (uintptr_t)end) {
+        const prog_header_t *hdr = (const prog_header_t *)addr;
+        if (!prog_header_valid(hdr, (uintptr_t)end - addr)) {
+            addr += PROG_ALIGN;
+            continue;
+        }
+
+        for (uint32_t i = 0; i < hdr->n_instances; i++) {
+            if (loader_load(hdr) != NULL) {
+                n_loaded++;
+            }
+        }
+        addr = (addr + hdr->size + PROG_ALIGN - 1) & ~(uintptr_t)(PROG_ALIGN - 1);
+    }
+    return n_loaded;
+}
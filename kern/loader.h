@@ -0,0 +1,215 @@
+/*
+ * loader.h:
+ *
+ * Program loader. Programs are stored in flash as images, each starting on a
+ * flash sector boundary after the kernel: a prog_header_t, then a table of
+ * n_segments prog_segment_t, then the initialized bytes of each segment.
+ * Images are made from a program's ELF file by host/mkprog.
+ *
+ * Loading a program allocates the span of SRAM its segments occupy, copies
+ * only the bytes stored in the image (.text, .data), zeroes the rest (.bss),
+ * and starts the process at the entry point recorded in the image. The
+ * copying and zeroing are queued on the copy engine (see copy.h), and each
+ * process becomes runnable as soon as its own image is in place, while the
+ * images after it are still being copied. Kernels
+ * built with DEMAND_PAGING leave the copying of images flagged
+ * PROG_FLAG_DEMAND_PAGED to the pager, page by page, as the process runs.
+ *
+ * Segments linked at XIP flash addresses (.text, .rodata) are not copied at
+ * all: mkprog stores their bytes at the flash address they were linked for,
+ * and the process executes them in place. An image may start several
+ * processes (n_instances), which share those segments and each get a private
+ * copy of the SRAM ones. Only one instance can have its SRAM segments where
+ * they were linked, so images of more than one instance must be of
+ * position-independent programs that reach their data through a global offset
+ * table based at r9 (gcc -fpic -msingle-pic-base -mpic-register=r9
+ * -mno-pic-data-is-text-relative). The loader places each instance's SRAM
+ * anywhere, adjusts the table entries that point into it, and starts the
+ * process with r9 at its own copy of the table.
+ *
+ * Programs whose code addresses SRAM directly can be placed anywhere too, if
+ * the image carries a relocation table (mkprog -r, from an ELF file linked
+ * with --emit-relocs): the link-time addresses of the words in SRAM segments
+ * that hold addresses in them. Once its image is copied, the loader adds the
+ * distance the process was moved by to each. Such programs can therefore all
+ * be linked for the same addresses and packed wherever the heap has room.
+ */
+
+#ifndef __LOADER_H__
+#define __LOADER_H__
+
+#include <stdint.h>
+
+#include "scheduler.h"
+
+#define PROG_MAGIC          0x474f5250      /* "PROG" */
+#define PROG_ALIGN          4096            /* Images start on a flash sector boundary. */
+#define PROG_MAX_SEGMENTS   8
+#define PROG_NAME_LEN       16
+
+/*
+ * XIP flash, where segments execute in place.
+ */
+#define PROG_XIP_START      0x10000000
+#define PROG_XIP_END        0x11000000
+
+/*
+ * Image flags.
+ */
+#define PROG_FLAG_DEMAND_PAGED  0x01    /* Fill pages as they are touched (see pager.h). */
+
+/*
+ * The lowest segment of a demand-paged program starts on a page boundary, of
+ * the pager's page size (PAGER_PAGE_SIZE).
+ */
+#define PROG_PAGE_SIZE          256
+
+/*
+ * Header at the start of a program image.
+ */
+typedef struct prog_header {
+    uint32_t    magic;              /* PROG_MAGIC. */
+    uint32_t    size;               /* Bytes in the whole image, this header included. */
+    uint32_t    entry;              /* Address at which the process starts. */
+    uint32_t    stack_size;         /* Bytes of stack to give the process, above its red zone (see process.h). */
+    uint16_t    n_segments;         /* Entries in the segment table that follows. */
+    uint8_t     priority;           /* Scheduling priority, 0 being the highest. */
+    uint8_t     flags;              /* PROG_FLAG_*. */
+    char        name[PROG_NAME_LEN]; /* NUL-padded, for diagnostics only. */
+    uint32_t    got_addr;           /* Global offset table, in an SRAM segment's stored bytes. */
+    uint16_t    got_entries;        /* Words in it; 0 if the program must run where linked. */
+    uint8_t     n_instances;        /* Processes to start from the image. */
+    uint8_t     reserved;
+    uint32_t    reloc_offset;       /* Offset of the relocation table from the start of the image. */
+    uint32_t    n_relocs;           /* Words in it. */
+} prog_header_t;
+
+/*
+ * A contiguous range of the program's memory.
+ */
+typedef struct {
+    uint32_t    addr;               /* Address in SRAM. */
+    uint32_t    file_size;          /* Bytes stored in the image, copied to addr. */
+    uint32_t    mem_size;           /* Bytes in memory; those past file_size are zeroed. */
+    uint32_t    offset;             /* Offset of the stored bytes from the start of the image. */
+} prog_segment_t;
+
+static inline const prog_segment_t *
+prog_segments(const prog_header_t *hdr)
+{
+    return (const prog_segment_t *)(hdr + 1);
+}
+
+/*
+ * Return non-zero if a segment executes in place from flash.
+ */
+static inline int
+prog_segment_xip(const prog_segment_t *seg)
+{
+    return seg->addr >= PROG_XIP_START && seg->addr < PROG_XIP_END;
+}
+
+/*
+ * Return non-zero if the program can be placed anywhere in SRAM, rather than
+ * only where it was linked.
+ */
+static inline int
+prog_relocatable(const prog_header_t *hdr)
+{
+    return hdr->got_entries != 0 || hdr->n_relocs != 0;
+}
+
+static inline const uint32_t *
+prog_relocs(const prog_header_t *hdr)
+{
+    return (const uint32_t *)((const uint8_t *)hdr + hdr->reloc_offset);
+}
+
+/*
+ * Return non-zero if a relocation is of a word in the stored bytes of an SRAM
+ * segment, outside the global offset table (whose entries the loader adjusts
+ * anyway).
+ */
+static inline int
+prog_reloc_valid(const prog_header_t *hdr, uint32_t addr)
+{
+    const prog_segment_t *seg = prog_segments(hdr);
+    if (addr % 4 != 0 || addr - hdr->got_addr < 4 * hdr->got_entries) {
+        return 0;
+    }
+    for (uint32_t i = 0; i < hdr->n_segments; i++) {
+        if (!prog_segment_xip(&seg[i]) && addr >= seg[i].addr &&
+            addr - seg[i].addr + 4 <= seg[i].file_size) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Return non-zero if hdr starts a well-formed image that fits in avail bytes:
+ * the stack can hold at least the initial registers, the segment table and
+ * every segment's stored bytes lie within the image, no
+ * segment is larger in the image than in memory, and the segments are in
+ * address order without overlapping. XIP segments are wholly stored, a global
+ * offset table lies within the stored bytes of an SRAM segment, and so does
+ * every word of the relocation table, which lies within the image.
+ */
+static inline int
+prog_header_valid(const prog_header_t *hdr, uint32_t avail)
+{
+    if (hdr->magic != PROG_MAGIC || hdr->size > avail || hdr->n_instances == 0 ||
+        hdr->n_segments == 0 || hdr->n_segments > PROG_MAX_SEGMENTS ||
+        hdr->stack_size < sizeof(stack_registers_t) + sizeof(uint32_t) ||
+        hdr->size < sizeof(prog_header_t) + hdr->n_segments * sizeof(prog_segment_t)) {
+        return 0;
+    }
+    const prog_segment_t *seg = prog_segments(hdr);
+    uint32_t next_addr = 0;
+    int got_found = hdr->got_entries == 0;
+    for (uint32_t i = 0; i < hdr->n_segments; i++) {
+        if (seg[i].file_size > seg[i].mem_size || seg[i].offset > hdr->size ||
+            seg[i].file_size > hdr->size - seg[i].offset ||
+            seg[i].addr < next_addr || seg[i].mem_size > UINT32_MAX - seg[i].addr ||
+            (prog_segment_xip(&seg[i]) && seg[i].file_size != seg[i].mem_size)) {
+            return 0;
+        }
+        if (!prog_segment_xip(&seg[i]) && hdr->got_addr % 4 == 0 &&
+            hdr->got_addr >= seg[i].addr &&
+            hdr->got_addr - seg[i].addr + 4 * hdr->got_entries <= seg[i].file_size) {
+            got_found = 1;
+        }
+        next_addr = seg[i].addr + seg[i].mem_size;
+    }
+    if (hdr->n_relocs != 0 &&
+        (hdr->reloc_offset % 4 != 0 || hdr->reloc_offset > hdr->size ||
+         hdr->n_relocs > (hdr->size - hdr->reloc_offset) / 4)) {
+        return 0;
+    }
+    for (uint32_t i = 0; i < hdr->n_relocs; i++) {
+        if (!prog_reloc_valid(hdr, prog_relocs(hdr)[i])) {
+            return 0;
+        }
+    }
+    return got_found;
+}
+
+/*
+ * Create a process from the image at hdr: one instance, if the image has
+ * several. It is made runnable once the copy engine has put its image in
+ * place, which may be after this returns. Returns its PCB, or NULL if the
+ * image is malformed, its XIP segments are not where they were linked, or
+ * there is not enough memory, in which case nothing is left allocated.
+ */
+pcb_t *
+loader_load(const prog_header_t *hdr);
+
+/*
+ * Find every image in flash between start and end, checking each sector
+ * boundary, and load each one, as many times as it has instances. Returns the
+ * number of processes created, without waiting for their images to be copied.
+ */
+uint32_t
+loader_load_all(const void *start, const void *end);
+
+#endif /* __LOADER_H__ */
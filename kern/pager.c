@@ -0,0 +1,406 @@
+#include "pager.h"
+#include "palloc.h"
+#include "process.h"
+#include <stdint.h>
+#include <string.h>
+
+#include "hardware/structs/mpu.h"
+#include "hardware/sync.h"
+#include "pico/platform.h"
+
+/*
+ * MPU register fields (ARMv6-M).
+ */
+#define MPU_CTRL_ENABLE         (1u << 0)
+#define MPU_CTRL_PRIVDEFENA     (1u << 2)   /* Default memory map for privileged code outside the regions. */
+#define MPU_RBAR_VALID          (1u << 4)
+#define MPU_RASR_ENABLE         (1u << 0)
+#define MPU_RASR_SRD_LSB        8
+#define MPU_RASR_B              (1u << 16)
+#define MPU_RASR_C              (1u << 17)
+#define MPU_RASR_S              (1u << 18)
+#define MPU_RASR_AP_PRIV_RW     (1u << 24)  /* Unprivileged: no access. */
+#define MPU_RASR_AP_FULL        (3u << 24)
+#define MPU_RASR_AP_USER_RO     (2u << 24)  /* Privileged read-write, unprivileged read-only. */
+#define MPU_RASR_XN             (1u << 28)
+
+#define MPU_ATTR_NORMAL         (MPU_RASR_S | MPU_RASR_C | MPU_RASR_B)
+#define MPU_ATTR_DEVICE         (MPU_RASR_S | MPU_RASR_B | MPU_RASR_XN)
+
+/*
+ * RASR for an enabled region of 2^shift bytes.
+ */
+#define MPU_RASR(shift, attrs)  ((attrs) | (((shift) - 1) << 1) | MPU_RASR_ENABLE)
+
+#define WINDOW_SHIFT            (PAGER_PAGE_SHIFT + 3)
+
+pager_region_t pager_mpu[SCHED_N_CORES][PAGER_N_REGIONS];
+
+/*
+ * Regions 0-3, the same for every process (see pager.h).
+ */
+static const pager_region_t fixed_regions[] = {
+    { 0x20000000 | MPU_RBAR_VALID | 0, MPU_RASR(18, MPU_RASR_AP_PRIV_RW | MPU_ATTR_NORMAL) },
+    { 0x00000000 | MPU_RBAR_VALID | 1, MPU_RASR(29, MPU_RASR_AP_USER_RO | MPU_ATTR_NORMAL) },
+    { 0x40000000 | MPU_RBAR_VALID | 2, MPU_RASR(29, MPU_RASR_AP_FULL | MPU_ATTR_DEVICE) },
+    { 0xd0000000 | MPU_RBAR_VALID | 3, MPU_RASR(28, MPU_RASR_AP_FULL | MPU_ATTR_DEVICE) },
+};
+
+/*
+ * Program region n of this core's MPU.
+ */
+static void
+__time_critical_func(mpu_set)(uint32_t n, uint32_t rbar, uint32_t rasr)
+{
+    pager_region_t *region = &pager_mpu[get_core_num()][n];
+    region->rbar = rbar;
+    region->rasr = rasr;
+    mpu_hw->rbar = rbar;            /* VALID selects region n. */
+    mpu_hw->rasr = rasr;
+}
+
+/*
+ * Set whether thread mode runs unprivileged once the current exception
+ * returns.
+ */
+static inline void
+set_unprivileged(int unprivileged)
+{
+#ifdef __arm__
+    uint32_t control;
+    asm volatile ("mrs %0, control" : "=r" (control));
+    control = unprivileged ? control | 1u : control & ~1u;
+    asm volatile ("msr control, %0\n\tisb" : : "r" (control) : "memory");
+#else
+    (void)unprivileged;
+#endif
+}
+
+static inline int
+page_filled(const pager_space_t *space, uint32_t index)
+{
+    return (space->filled[index >> 3] >> (index & 7)) & 1;
+}
+
+static uint32_t
+__time_critical_func(window_rasr)(const pager_window_t *window)
+{
+    if (window->mapped == 0) {
+        return 0;
+    }
+    return MPU_RASR(WINDOW_SHIFT, MPU_RASR_AP_FULL | MPU_ATTR_NORMAL) |
+        ((uint32_t)(uint8_t)~window->mapped << MPU_RASR_SRD_LSB);
+}
+
+static void
+__time_critical_func(window_load)(const pager_space_t *space, uint32_t w)
+{
+    uint32_t n = PAGER_REGION_WINDOW + w;
+    mpu_set(n, space->windows[w].base | MPU_RBAR_VALID | n, window_rasr(&space->windows[w]));
+}
+
+/*
+ * Fill a page from the segments' stored bytes, zeroing the rest, writing each
+ * byte once.
+ */
+static void
+page_fill(pager_space_t *space, uint32_t index)
+{
+    const prog_segment_t *seg = prog_segments(space->image);
+    const uint8_t *image = (const uint8_t *)space->image;
+    uint32_t page = space->lo + (index << PAGER_PAGE_SHIFT);
+    uint32_t page_end = page + PAGER_PAGE_SIZE;
+    uint8_t *mem = space->mem + (index << PAGER_PAGE_SHIFT);
+    uint32_t cursor = page;
+
+    for (uint32_t i = 0; i < space->image->n_segments && cursor < page_end; i++) {
+        uint32_t start = seg[i].addr > cursor ? seg[i].addr : cursor;
+        uint32_t end = seg[i].addr + seg[i].file_size;
+        end = end < page_end ? end : page_end;
+        if (start >= end) {
+            continue;
+        }
+        memset(mem + (cursor - page), 0, start - cursor);
+        memcpy(mem + (start - page), image + seg[i].offset + (start - seg[i].addr), end - start);
+        cursor = end;
+    }
+    memset(mem + (cursor - page), 0, page_end - cursor);
+
+    space->filled[index >> 3] |= 1u << (index & 7);
+    space->n_fills++;
+}
+
+/*
+ * Make the filled page at page accessible through a window, replacing the
+ * oldest window not mapped during this fault if none covers it. Returns
+ * non-zero if the MPU changed.
+ */
+static int
+page_map(pager_space_t *space, uint32_t page)
+{
+    uint32_t base = page & ~(PAGER_WINDOW_SIZE - 1);
+    uint8_t bit = 1u << ((page >> PAGER_PAGE_SHIFT) & (PAGER_WINDOW_PAGES - 1));
+
+    for (uint32_t w = 0; w < PAGER_N_WINDOWS; w++) {
+        pager_window_t *window = &space->windows[w];
+        if (window->base != base) {
+            continue;
+        }
+        space->pinned |= 1u << w;
+        if (window->mapped & bit) {
+            return 0;
+        }
+        window->mapped |= bit;
+        window_load(space, w);
+        return 1;
+    }
+
+    uint32_t w = space->next_victim;
+    for (uint32_t tries = 0; (space->pinned >> w) & 1; tries++) {
+        if (tries == PAGER_N_WINDOWS) {
+            return 0;       /* One access never needs more windows than there are. */
+        }
+        w = (w + 1) % PAGER_N_WINDOWS;
+    }
+    space->next_victim = (w + 1) % PAGER_N_WINDOWS;
+    space->pinned |= 1u << w;
+
+    /*
+     * Map every filled page of the window at once.
+     */
+    pager_window_t *window = &space->windows[w];
+    window->base = base;
+    window->mapped = 0;
+    for (uint32_t i = 0; i < PAGER_WINDOW_PAGES; i++) {
+        uint32_t offset = base + i * PAGER_PAGE_SIZE - space->lo;
+        if (base + i * PAGER_PAGE_SIZE >= space->lo && (offset >> PAGER_PAGE_SHIFT) < space->n_pages &&
+            page_filled(space, offset >> PAGER_PAGE_SHIFT)) {
+            window->mapped |= 1u << i;
+        }
+    }
+    window_load(space, w);
+    space->n_maps++;
+    return 1;
+}
+
+/*
+ * Fill and map the pages of [addr, addr + len) that lie in the span. Returns
+ * non-zero if anything changed.
+ */
+static int
+range_resolve(pager_space_t *space, uint32_t addr, uint32_t len)
+{
+    int changed = 0;
+    uint32_t first = addr >> PAGER_PAGE_SHIFT;
+    uint32_t last = (addr + len - 1) >> PAGER_PAGE_SHIFT;
+    for (uint32_t p = first; len != 0 && p <= last; p++) {
+        uint32_t index = p - (space->lo >> PAGER_PAGE_SHIFT);
+        if (p < (space->lo >> PAGER_PAGE_SHIFT) || index >= space->n_pages) {
+            continue;
+        }
+        if (!page_filled(space, index)) {
+            page_fill(space, index);
+            changed = 1;
+        }
+        changed |= page_map(space, p << PAGER_PAGE_SHIFT);
+    }
+    return changed;
+}
+
+void
+pager_fill(pager_space_t *space, uint32_t addr, uint32_t len)
+{
+    uint32_t first = addr >> PAGER_PAGE_SHIFT;
+    uint32_t last = (addr + len - 1) >> PAGER_PAGE_SHIFT;
+    for (uint32_t p = first; len != 0 && p <= last; p++) {
+        uint32_t index = p - (space->lo >> PAGER_PAGE_SHIFT);
+        if (p >= (space->lo >> PAGER_PAGE_SHIFT) && index < space->n_pages &&
+            !page_filled(space, index)) {
+            page_fill(space, index);
+        }
+    }
+}
+
+void
+pager_init(void)
+{
+    mpu_hw->ctrl = 0;
+    for (uint32_t n = 0; n < PAGER_N_REGIONS; n++) {
+        if (n < sizeof(fixed_regions) / sizeof(fixed_regions[0])) {
+            mpu_set(n, fixed_regions[n].rbar, fixed_regions[n].rasr);
+        } else {
+            mpu_set(n, MPU_RBAR_VALID | n, 0);
+        }
+    }
+    mpu_hw->ctrl = MPU_CTRL_PRIVDEFENA | MPU_CTRL_ENABLE;
+    __dsb();
+    __isb();
+}
+
+int
+pager_create(
+    pcb_t                  *pcb,
+    const prog_header_t    *hdr,
+    uint8_t                *mem,
+    uint32_t                lo,
+    uint32_t                n_pages,
+    void                   *stack,
+    uint32_t                stack_size)
+{
+    uint32_t size = sizeof(pager_space_t) + (n_pages + 7) / 8;
+    pager_space_t *space = palloc(size, pcb, PALLOC_FLAGS_ANYWHERE, NULL);
+    if (space == NULL) {
+        return 0;
+    }
+    memset(space, 0, size);
+    space->image = hdr;
+    space->mem = mem;
+    space->lo = lo;
+    space->n_pages = n_pages;
+
+    uint32_t shift = 0;
+    while ((1u << shift) < stack_size) {
+        shift++;
+    }
+    space->stack_rbar = (uint32_t)(uintptr_t)stack | MPU_RBAR_VALID | PAGER_REGION_STACK;
+    space->stack_rasr = MPU_RASR(shift, MPU_RASR_AP_FULL | MPU_ATTR_NORMAL | MPU_RASR_XN);
+
+    pcb->pager = space;
+    return 1;
+}
+
+int
+pager_decode(
+    uint16_t        insn,
+    const uint32_t  regs[16],
+    uint32_t       *addr,
+    uint32_t       *len)
+{
+    /* Access size of LDR/STR (register) by opcode: STR STRH STRB LDRSB LDR LDRH LDRB LDRSH. */
+    static const uint8_t reg_sizes[8] = { 4, 2, 1, 1, 4, 2, 1, 2 };
+    uint32_t rn = (insn >> 3) & 7;
+    uint32_t imm5 = (insn >> 6) & 0x1f;
+
+    if ((insn & 0xf000) == 0x5000) {            /* LDR/STR Rt, [Rn, Rm] */
+        *addr = regs[rn] + regs[(insn >> 6) & 7];
+        *len = reg_sizes[(insn >> 9) & 7];
+    } else if ((insn & 0xe000) == 0x6000) {     /* LDR/STR(B) Rt, [Rn, #imm] */
+        *len = (insn & 0x1000) ? 1 : 4;
+        *addr = regs[rn] + imm5 * *len;
+    } else if ((insn & 0xf000) == 0x8000) {     /* LDRH/STRH Rt, [Rn, #imm] */
+        *len = 2;
+        *addr = regs[rn] + imm5 * 2;
+    } else if ((insn & 0xf000) == 0x9000) {     /* LDR/STR Rt, [SP, #imm] */
+        *len = 4;
+        *addr = regs[13] + (insn & 0xff) * 4;
+    } else if ((insn & 0xf800) == 0x4800) {     /* LDR Rt, [PC, #imm] */
+        *len = 4;
+        *addr = ((regs[15] + 4) & ~3u) + (insn & 0xff) * 4;
+    } else if ((insn & 0xf000) == 0xc000) {     /* LDMIA/STMIA Rn!, {...} */
+        *len = 4 * __builtin_popcount(insn & 0xff);
+        *addr = regs[(insn >> 8) & 7];
+    } else if ((insn & 0xfe00) == 0xb400) {     /* PUSH {..., lr} */
+        *len = 4 * __builtin_popcount(insn & 0x1ff);
+        *addr = regs[13] - *len;
+    } else if ((insn & 0xfe00) == 0xbc00) {     /* POP {..., pc} */
+        *len = 4 * __builtin_popcount(insn & 0x1ff);
+        *addr = regs[13];
+    } else {
+        return 0;
+    }
+    return *len != 0;
+}
+
+int
+pager_handle(
+    pager_space_t  *space,
+    const uint32_t  regs[16])
+{
+    uint32_t pc = regs[15] & ~1u;
+    uint32_t addr, len;
+
+    space->pinned = 0;
+
+    /*
+     * The instruction's own page first, so that it can be read. The windows
+     * mapped for it are kept while mapping what it accesses, or the retry
+     * would fault on the fetch again.
+     */
+    int changed = range_resolve(space, pc, 2);
+    const uint16_t *insn = pc - space->lo < (space->n_pages << PAGER_PAGE_SHIFT) ?
+        (const uint16_t *)(space->mem + (pc - space->lo)) : (const uint16_t *)(uintptr_t)pc;
+
+    if ((*insn & 0xf800) >= 0xe800) {
+        /* 32-bit instructions (BL, MRS, MSR, barriers) do not access memory. */
+        changed |= range_resolve(space, pc + 2, 2);
+    } else if (pager_decode(*insn, regs, &addr, &len)) {
+        changed |= range_resolve(space, addr, len);
+    }
+    if (changed) {
+        space->n_faults++;
+    }
+    return changed;
+}
+
+void
+__time_critical_func(pager_switch)(pcb_t *pcb)
+{
+    pager_space_t *space = pcb->pager;
+    uint32_t core = get_core_num();
+
+    if (space == NULL) {
+        /* Privileged processes see all memory; drop the last paged process's regions. */
+        if (pager_mpu[core][PAGER_REGION_STACK].rasr != 0) {
+            for (uint32_t n = PAGER_REGION_STACK; n < PAGER_N_REGIONS; n++) {
+                mpu_set(n, MPU_RBAR_VALID | n, 0);
+            }
+        }
+        set_unprivileged(0);
+        return;
+    }
+
+    mpu_set(PAGER_REGION_STACK, space->stack_rbar, space->stack_rasr);
+    for (uint32_t w = 0; w < PAGER_N_WINDOWS; w++) {
+        window_load(space, w);
+    }
+    __dsb();
+    __isb();
+    set_unprivileged(1);
+}
+
+void
+pager_fault(
+    uint32_t       *frame,
+    const uint32_t *r4_r7)
+{
+    pcb_t *pcb = pcb_active[get_core_num()];
+
+    if (pcb->pager != NULL) {
+        /*
+         * The hardware stacks r0-r3, r12, lr, pc and xPSR, padding the frame
+         * to 8 bytes if xPSR bit 9 is set. No 16-bit load or store uses
+         * r8-r11.
+         */
+        uint32_t regs[16] = {
+            frame[0], frame[1], frame[2], frame[3],
+            r4_r7[0], r4_r7[1], r4_r7[2], r4_r7[3],
+            0, 0, 0, 0,
+            frame[4],
+            (uint32_t)(uintptr_t)(frame + 8) + ((frame[7] & (1u << 9)) ? 4 : 0),
+            frame[5],
+            frame[6],
+        };
+        if (pager_handle(pcb->pager, regs)) {
+            __dsb();
+            __isb();
+            return;
+        }
+    }
+
+    /*
+     * Not a page the process may use, or not a demand-paged process: it
+     * never runs again. The reschedule this requests is taken as soon as the
+     * fault returns, before the faulting instruction is retried.
+     */
+    process_exit(pcb);
+}
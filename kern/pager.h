@@ -0,0 +1,164 @@
+/*
+ * pager.h:
+ *
+ * Demand paging of program images. A demand-paged process's span of SRAM is
+ * reserved when it is loaded, but nothing is copied into it: each page is
+ * filled from the program's flash image (or zeroed, for .bss and gaps) the
+ * first time the process touches it.
+ *
+ * The RP2040's Cortex-M0+ has no MMU, so pages stay at the addresses the
+ * program was linked for; what paging saves is the time and flash bandwidth
+ * of copying parts of the image a run never uses. The MPU hides the pages
+ * that are not filled yet:
+ *
+ *      region 0        SRAM, privileged access only
+ *      region 1        boot ROM and XIP flash, read-only to processes (the
+ *                      kernel writes the XIP and SSI registers behind it to
+ *                      program flash)
+ *      region 2        peripherals, read-write, never executable
+ *      region 3        SIO, read-write, never executable
+ *      region 4        the running process's stack
+ *      regions 5-7     windows onto the running process's span
+ *
+ * Demand-paged processes run unprivileged, so that they can reach only what
+ * the regions above let them. A window is an MPU region of PAGER_WINDOW_PAGES
+ * pages, one per subregion, with the subregions of pages not yet filled
+ * disabled. With only three windows, they are a software TLB over the span:
+ * touching a page outside them faults, and the fault handler fills the page
+ * if needed and maps its window, replacing the oldest.
+ *
+ * ARMv6-M has no MemManage exception and does not record the faulting
+ * address, so MPU violations arrive as HardFault and the address is found by
+ * decoding the load or store at the stacked PC (see pager_decode).
+ */
+
+#ifndef __PAGER_H__
+#define __PAGER_H__
+
+#include <stdint.h>
+
+#include "loader.h"
+#include "scheduler.h"
+
+#define PAGER_PAGE_SHIFT        8       /* The MPU's smallest subregion. */
+#define PAGER_PAGE_SIZE         (1u << PAGER_PAGE_SHIFT)
+#define PAGER_WINDOW_PAGES      8       /* Subregions per MPU region. */
+#define PAGER_WINDOW_SIZE       (PAGER_WINDOW_PAGES * PAGER_PAGE_SIZE)
+#define PAGER_N_WINDOWS         3
+
+#define PAGER_REGION_STACK      4
+#define PAGER_REGION_WINDOW     5       /* First of the window regions. */
+#define PAGER_N_REGIONS         8
+
+/*
+ * Smallest stack a demand-paged process gets. Its stack is one MPU region, so
+ * it is a power of two in size and aligned to its size.
+ */
+#define PAGER_MIN_STACK         256
+
+/*
+ * A window onto part of a span: an aligned run of PAGER_WINDOW_PAGES pages.
+ */
+typedef struct {
+    uint32_t    base;               /* Address of the first page, or 0 if unused. */
+    uint8_t     mapped;             /* Bit per page: filled, so accessible. */
+} pager_window_t;
+
+/*
+ * Demand-paging state of one process.
+ */
+typedef struct pager_space {
+    const prog_header_t *image;     /* Image the pages are filled from. */
+    uint8_t    *mem;                /* Where the span's memory is; lo itself on the target. */
+    uint32_t    lo;                 /* Address of the span's first page. */
+    uint32_t    n_pages;            /* Pages in the span. */
+    uint32_t    stack_rbar;         /* MPU region for the stack. */
+    uint32_t    stack_rasr;
+    pager_window_t windows[PAGER_N_WINDOWS];
+    uint8_t     next_victim;        /* Window to replace next, oldest first. */
+    uint8_t     pinned;             /* Bit per window mapped while handling this fault. */
+
+    /* Statistics */
+    uint32_t    n_faults;           /* Faults on the span. */
+    uint32_t    n_fills;            /* Pages filled. */
+    uint32_t    n_maps;             /* Windows mapped, including refills after a switch. */
+
+    uint8_t     filled[];           /* Bit per page of the span. */
+} pager_space_t;
+
+/*
+ * An MPU region, as written to the RBAR (with VALID and the region number set)
+ * and RASR registers.
+ */
+typedef struct {
+    uint32_t    rbar;
+    uint32_t    rasr;
+} pager_region_t;
+
+/*
+ * What the MPU regions of each core hold, as last programmed. The hardware
+ * registers are written through from this copy.
+ */
+extern pager_region_t pager_mpu[SCHED_N_CORES][PAGER_N_REGIONS];
+
+/*
+ * Program this core's fixed MPU regions and enable the MPU. Called once on
+ * each core before it starts scheduling.
+ */
+void
+pager_init(void);
+
+/*
+ * Set up demand paging for pcb over the span of n_pages pages from lo, whose
+ * memory is at mem, filled from the image at hdr, with the stack of
+ * stack_size bytes at stack (a power of two, aligned to its size). The state
+ * is allocated from the heap on behalf of pcb, and pcb->pager set. Returns
+ * non-zero on success.
+ */
+int
+pager_create(pcb_t *pcb, const prog_header_t *hdr, uint8_t *mem, uint32_t lo,
+             uint32_t n_pages, void *stack, uint32_t stack_size);
+
+/*
+ * Fill the pages of [addr, addr + len) that lie in the span and are not yet
+ * filled, without mapping them, so that the kernel can access the memory on
+ * the process's behalf.
+ */
+void
+pager_fill(pager_space_t *space, uint32_t addr, uint32_t len);
+
+/*
+ * Find the bytes a 16-bit Thumb instruction loads or stores, given the
+ * registers at the time it executes (regs[13] is SP, regs[15] the address of
+ * the instruction). Returns non-zero, with the range in *addr and *len, if
+ * insn accesses memory.
+ */
+int
+pager_decode(uint16_t insn, const uint32_t regs[16], uint32_t *addr, uint32_t *len);
+
+/*
+ * Handle a fault of the process owning space, which is running on this core
+ * with the registers regs: fill and map the page of the instruction at
+ * regs[15], and of the memory it accesses. Returns non-zero if anything was
+ * made accessible; zero means the fault was not the pager's to handle.
+ */
+int
+pager_handle(pager_space_t *space, const uint32_t regs[16]);
+
+/*
+ * Load the regions of the process switched to into this core's MPU, and set
+ * the privilege it runs at. Called by the scheduler at every switch, so it
+ * runs from RAM.
+ */
+void
+pager_switch(pcb_t *pcb);
+
+/*
+ * HardFault handler for faults of processes, entered from hardfault_handler
+ * in context_switch.s with the stacked registers of the process and its
+ * r4-r7. A fault the pager cannot handle kills the process.
+ */
+void
+pager_fault(uint32_t *frame, const uint32_t *r4_r7);
+
+#endif /* __PAGER_H__ */
@@ -2,86 +2,27 @@
 #include <stdint.h>
 #include <stdio.h>
 
+#include "klock.h"
+#include "ktrace.h"
+#include "palloc_backend.h"
 #include "utils/list.h"
 #include "utils/panic.h"
 #include "resources.h"
 #include <stddef.h>
 
-/*
- * Find and delink any block containing size bytes at any address.
- */
-heap_region_t *
-palloc_find_anywhere(uint32_t size)
-{
-    heap_region_t *out = NULL;
+#ifdef PALLOC_STATS
+palloc_stats_t palloc_stats;
+#endif
 
-    for (out = heap_free_list; out; out = out->next) {
-        if (out->size >= size) {
-            DLL_REMOVE(heap_free_list, out, next, prev);
-            break;
-        }
-    }
-    
-    return out;
-}
-
-/*
- * Find and delink the block containing size bytes at the specified address.
- * Fails and returns NULL if 
- */
-heap_region_t *
-palloc_find_fixed(
-    uint32_t    size,
-    void       *address)
+void
+pinit(
+    void       *start,
+    uint32_t    size)
 {
-    heap_region_t *out = NULL;
-    for (heap_region_t *cur = heap_free_list; cur; cur = cur->next) {
-        /*
-         * Check that the current block contains the entire requested region.
-         */
-        if (cur->data <= (uint8_t*)address &&
-            cur->data + cur->size >= (uint8_t*)address + size) {
-            DLL_REMOVE(heap_free_list, cur, next, prev);
-            out = cur;
-            break;
-        }
-    }
-    if (out == NULL) {
-        return NULL;
-    }
-
-    /*
-     * Trim the beginning and re-link it to simplify things for the caller and
-     * have both the _fixed and _anywhere variants do the same thing. 
-     */
-    if (out->data != address) {
-        /*
-         * Trims OUT into START and OUT', as depicted below, and re-links START,
-         * and updates the backpointer in OUT'.
-         *            [<-HINT->]
-         * [<---------OUT--------->]
-         * [<-START->][<---OUT'--->]
-         */
-        heap_region_t *start = out;
-        out = ((heap_region_t *)address) - 1;
-        assert(out > start);        /* TODO handle this gracefully later by returning an error. */
-
-        out->size = start->size;
-
-        /*
-         * Free the trimmed head.
-         */
-
-        start->size = (uint32_t)((void *)out - (void *)start->data);
-        start->prev = NULL;
-
-        out->size -= start->size + sizeof(heap_region_t);
-        out->prev = start;          /* Make "out" look like it was just popped. */
-
-        DLL_INSERT(heap_free_list, start->prev, start, next, prev);
-    }
-
-    return out;
+    size &= ~(PALLOC_ALIGN - 1);
+    heap_start = start;
+    heap_end = (uint8_t *)start + size;
+    heap_init(start, size);
 }
 
 void *
@@ -91,27 +32,33 @@ palloc(
     int         flags,
     void       *hint)
 {
+    size = (size + PALLOC_ALIGN - 1) & ~(PALLOC_ALIGN - 1);
+    uint32_t saved = klock(KLOCK_HEAP);
+
     /*
      * Find the block we're going to give memory from.
      */
     heap_region_t *out = flags & PALLOC_FLAGS_FIXED ?
-                         palloc_find_fixed(size, hint) :
-                         palloc_find_anywhere(size);
+                         heap_find_fixed(size, hint) :
+                         heap_find_anywhere(size);
     if (out == NULL) {
+        PALLOC_STAT_INC(n_failed);
+        kunlock(KLOCK_HEAP, saved);
+        KTRACE_RECORD(KTRACE_PALLOC, owner->pid, 0, size);
         return NULL;
     }
 
     /*
-     * Assuming we found a block, trim the end and put it back into the free
-     * list if there's sufficient leftover space.
+     * Trim the block down to size and move it to the owner's allocated list.
      */
-    if (out && out->size >= size + sizeof(heap_region_t)) {
-        heap_region_t *leftover = (heap_region_t *)((void *)out->data + size);
-        leftover->size = out->size - size - sizeof(heap_region_t);
-        DLL_INSERT(heap_free_list, out->prev, leftover, next, prev);
-    }
-
-    return out->data;
+    heap_take(out, size);
+    DLL_PUSH(owner->allocated, out, next, prev);
+    PALLOC_STAT_INC(n_palloc);
+    kunlock(KLOCK_HEAP, saved);
+    uint8_t *data = palloc_data(out);
+    KTRACE_RECORD(KTRACE_PALLOC, owner->pid, data, size);
+
+    return data;
 }
 
 void
@@ -120,46 +67,119 @@ pfree(
     pcb_t  *owner)
 {
     /*
-     * Delink from the allocated list. Note that metadata is stored as a prefix
-     * to the heap region.
+     * Delink from the allocated list. Where the metadata is stored depends on
+     * the backend.
      */
-    heap_region_t *region = (heap_region_t *)(ptr - sizeof(heap_region_t));
+    heap_region_t *region = heap_region_of(ptr);
+    KTRACE_RECORD(KTRACE_PFREE, owner->pid, ptr, region->size);
+    uint32_t saved = klock(KLOCK_HEAP);
     DLL_REMOVE(owner->allocated, region, next, prev);
 
+    heap_release(region);
+    PALLOC_STAT_INC(n_pfree);
+    kunlock(KLOCK_HEAP, saved);
+}
+
+/*
+ * Merge sort a NULL-terminated list of regions, linked through next, by
+ * address.
+ */
+static heap_region_t *
+region_sort(heap_region_t *list)
+{
+    if (list == NULL || list->next == NULL) {
+        return list;
+    }
+
     /*
-     * Insert into the free list in order and coalesce adjacent blocks.
+     * Split the list in half and sort each half.
      */
-    heap_region_t *cur;
-    for (cur = heap_free_list; cur; cur = cur->next) {
-        /*
-         * Keep walking until we find a region after the one we want to insert,
-         * or until we've hit the last region in the list.
-         */
-        if (cur > region) {
-            cur = cur->prev;
-            break;
-        }
-        if (cur->next == NULL) {
-            break;
-        }
+    heap_region_t *slow = list;
+    heap_region_t *fast = list->next;
+    while (fast && fast->next) {
+        slow = slow->next;
+        fast = fast->next->next;
     }
+    heap_region_t *back = slow->next;
+    slow->next = NULL;
+    list = region_sort(list);
+    back = region_sort(back);
 
     /*
-     * Now we have the we want to insert after. Before we insert, check if we
-     * are adjacent to, and can coalesce with, that element.
+     * Merge the sorted halves.
      */
-    if (cur + cur->size == region) {
-        cur->size += region->size;
-        region = cur;
-    } else {
-        DLL_INSERT(heap_free_list, cur, region, next, prev);
+    heap_region_t *out = NULL;
+    heap_region_t **tail = &out;
+    while (list && back) {
+        if (list < back) {
+            *tail = list;
+            list = list->next;
+        } else {
+            *tail = back;
+            back = back->next;
+        }
+        tail = &(*tail)->next;
     }
+    *tail = list ? list : back;
+
+    return out;
+}
+
+void
+pfree_all(pcb_t *owner)
+{
+    /*
+     * Forward links of the allocated list are already NULL-terminated, so the
+     * whole list can be detached and sorted as-is.
+     */
+    heap_region_t *list = owner->allocated;
+    owner->allocated = NULL;
 
     /*
-     * Now check if we can coalesce with the following element.
+     * The list belongs to the exiting process alone, so only returning the
+     * sorted regions needs the heap lock.
      */
-    if (cur->next && cur + cur->size == cur->next) {
-        cur->size += cur->next->size;
-        DLL_REMOVE(heap_free_list, cur->next, next, prev);
+    list = region_sort(list);
+#ifdef KTRACE
+    uint32_t n_regions = 0;
+    for (heap_region_t *cur = list; cur; cur = cur->next) {
+        n_regions++;
+    }
+    KTRACE_RECORD(KTRACE_PFREE_ALL, owner->pid, 0, n_regions);
+#endif
+    uint32_t saved = klock(KLOCK_HEAP);
+#ifdef PALLOC_STATS
+    for (heap_region_t *cur = list; cur; cur = cur->next) {
+        PALLOC_STAT_INC(n_pfree);
+    }
+#endif
+    heap_release_batch(list);
+    kunlock(KLOCK_HEAP, saved);
+}
+
+int
+heap_check_tags(uint32_t n_free)
+{
+    uint32_t found = 0;
+    int prev_free = 0;
+    heap_region_t *cur = (heap_region_t *)heap_start;
+
+    for (; cur; cur = heap_next(cur)) {
+        if (heap_data(cur) + cur->size + sizeof(heap_tag_t) > (uint8_t *)heap_end) {
+            return -1;
+        }
+        heap_tag_t tag = *(heap_tag_t *)(heap_data(cur) + cur->size);
+        if ((tag & ~HEAP_TAG_FREE) != cur->size) {
+            return -1;
+        }
+        if (tag & HEAP_TAG_FREE) {
+            if (prev_free) {
+                return -1;      /* Should have been coalesced. */
+            }
+            found++;
+        }
+        prev_free = tag & HEAP_TAG_FREE;
     }
+
+    return found == n_free ? 0 : -1;
 }
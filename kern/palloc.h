@@ -13,6 +13,43 @@
 #define PALLOC_FLAGS_ANYWHERE 0
 #define PALLOC_FLAGS_FIXED 1
 
+/*
+ * Every region size is rounded up to this many bytes so that the metadata of
+ * the region following it (and any stack placed in it) stays aligned.
+ */
+#define PALLOC_ALIGN 8
+
+/*
+ * Summary of the heap's free space, used to measure fragmentation.
+ */
+typedef struct {
+    uint32_t n_free;        /* Number of free regions. */
+    uint32_t free_bytes;    /* Total bytes of data in free regions. */
+    uint32_t largest_free;  /* Data bytes in the largest free region. */
+} palloc_usage_t;
+
+#ifdef PALLOC_STATS
+/*
+ * Allocator counters, maintained only when built with PALLOC_STATS. A "walk"
+ * is the number of free regions visited by a single palloc or pfree call.
+ */
+typedef struct {
+    uint32_t n_palloc;      /* Successful palloc calls. */
+    uint32_t n_failed;      /* palloc calls that returned NULL. */
+    uint32_t n_pfree;       /* pfree calls. */
+    uint32_t walk_max;      /* Longest walk of any call. */
+    uint64_t walk_total;    /* Sum of all walks. */
+} palloc_stats_t;
+
+extern palloc_stats_t palloc_stats;
+#endif /* PALLOC_STATS */
+
+/*
+ * Initialize the heap as a single free region covering size bytes at start.
+ */
+void
+pinit(void *start, uint32_t size);
+
 /*
  * Allocate memory for a userspace process.
  *
@@ -25,9 +62,36 @@ palloc(uint32_t size, pcb_t *owner, int flags, void *hint);
 
 /*
  * Reclaim memory that was allocated to a userspace process. Pointer should be
- * to the data element of heap_region_t.
+ * the region's data, as returned by palloc.
  */
 void
 pfree(void *ptr, pcb_t *owner);
 
+/*
+ * Reclaim every region allocated to a userspace process at once. The regions
+ * are sorted by address and returned to the heap in a single pass, merging
+ * adjacent ones before they reach the free regions.
+ */
+void
+pfree_all(pcb_t *owner);
+
+/*
+ * First byte of a region's data.
+ */
+uint8_t *
+palloc_data(heap_region_t *region);
+
+/*
+ * Fill out with a summary of the heap's current free space.
+ */
+void
+palloc_usage(palloc_usage_t *out);
+
+/*
+ * Check the consistency of the heap's metadata. Returns 0 if consistent, and
+ * -1 otherwise.
+ */
+int
+palloc_check(void);
+
 #endif /* __PALLOC_H__ */
@@ -0,0 +1,190 @@
+/*
+ * palloc_backend.h:
+ *
+ * Interface between the generic heap allocator (palloc.c), which tracks which
+ * process owns each region, and the backend that manages the free regions.
+ * Exactly one backend (palloc_<name>.c) is linked into the kernel, chosen at
+ * build time by the PALLOC_BACKEND CMake variable.
+ */
+
+#ifndef __PALLOC_BACKEND_H__
+#define __PALLOC_BACKEND_H__
+
+#include "palloc.h"
+#include "resources.h"
+
+#include <stddef.h>
+
+#ifdef PALLOC_STATS
+#define PALLOC_STAT_WALK(n)                                                    \
+    do {                                                                       \
+        palloc_stats.walk_total += (n);                                        \
+        if ((n) > palloc_stats.walk_max) {                                     \
+            palloc_stats.walk_max = (n);                                       \
+        }                                                                      \
+    } while (0)
+#define PALLOC_STAT_INC(field) (palloc_stats.field++)
+#else
+#define PALLOC_STAT_WALK(n)
+#define PALLOC_STAT_INC(field)
+#endif /* PALLOC_STATS */
+
+/*
+ * Boundary tags, used by the firstfit and segregated backends. Each region is
+ * immediately followed by a tag repeating its size, with HEAP_TAG_FREE set
+ * while the region is free:
+ *
+ *      [heap_region_t][<--- size bytes of data --->][tag][heap_region_t]...
+ *
+ * The tag of the region before any region sits just below its metadata, so
+ * both neighbours of a region, and whether they are free, are found in O(1).
+ * Region sizes are kept such that every region's metadata stays aligned to
+ * PALLOC_ALIGN.
+ */
+typedef uint32_t heap_tag_t;
+
+#define HEAP_TAG_FREE 1u
+
+/*
+ * First byte of the data of a region whose metadata prefixes it.
+ */
+static inline uint8_t *
+heap_data(heap_region_t *region)
+{
+    return (uint8_t *)(region + 1);
+}
+
+/*
+ * Round a data size up so that a region of that size keeps its successor
+ * aligned.
+ */
+static inline uint32_t
+heap_tag_round(uint32_t size)
+{
+    uint32_t overhead = sizeof(heap_region_t) + sizeof(heap_tag_t);
+    return ((size + overhead + PALLOC_ALIGN - 1) & ~(PALLOC_ALIGN - 1)) - overhead;
+}
+
+static inline void
+heap_set_tag(
+    heap_region_t  *region,
+    uint32_t        free)
+{
+    *(heap_tag_t *)(heap_data(region) + region->size) = region->size | free;
+}
+
+/*
+ * The region physically following region, or NULL if it is the last one.
+ */
+static inline heap_region_t *
+heap_next(heap_region_t *region)
+{
+    uint8_t *next = heap_data(region) + region->size + sizeof(heap_tag_t);
+    return next < (uint8_t *)heap_end ? (heap_region_t *)next : NULL;
+}
+
+/*
+ * The free region physically following region, if there is one.
+ */
+static inline heap_region_t *
+heap_next_free(heap_region_t *region)
+{
+    heap_region_t *next = heap_next(region);
+    if (next && *(heap_tag_t *)(heap_data(next) + next->size) & HEAP_TAG_FREE) {
+        return next;
+    }
+    return NULL;
+}
+
+/*
+ * The free region physically preceding region, if there is one.
+ */
+static inline heap_region_t *
+heap_prev_free(heap_region_t *region)
+{
+    if ((void *)region == heap_start) {
+        return NULL;
+    }
+    heap_tag_t tag = *((heap_tag_t *)region - 1);
+    if (!(tag & HEAP_TAG_FREE)) {
+        return NULL;
+    }
+    return (heap_region_t *)((uint8_t *)region - sizeof(heap_tag_t) -
+                             (tag & ~HEAP_TAG_FREE) - sizeof(heap_region_t));
+}
+
+/*
+ * Grow run, the first region of an address-ordered, NULL-terminated list of
+ * allocated regions, over the regions immediately following it in both the
+ * list and the heap. Returns the first region of the list not absorbed.
+ */
+static inline heap_region_t *
+heap_absorb_run(heap_region_t *run)
+{
+    heap_region_t *next = run->next;
+    while (next && next == heap_next(run)) {
+        run->size += sizeof(heap_region_t) + sizeof(heap_tag_t) + next->size;
+        next = next->next;
+    }
+    return next;
+}
+
+/*
+ * Walk every region in the heap through the boundary tags, checking that each
+ * tag matches its region and that no two free regions are adjacent. Returns 0
+ * if the heap is consistent and holds exactly n_free free regions, and -1
+ * otherwise.
+ */
+int
+heap_check_tags(uint32_t n_free);
+
+/*
+ * The allocated region whose data begins at data.
+ */
+heap_region_t *
+heap_region_of(void *data);
+
+/*
+ * Make the size bytes at start a single free region.
+ */
+void
+heap_init(void *start, uint32_t size);
+
+/*
+ * Find a free region with room for at least size bytes of data at any address.
+ * The region is left linked among the free regions.
+ */
+heap_region_t *
+heap_find_anywhere(uint32_t size);
+
+/*
+ * Find a free region whose data begins at address and has room for at least
+ * size bytes, trimming a free region if necessary. The region is left linked
+ * among the free regions. Returns NULL if no such region exists.
+ */
+heap_region_t *
+heap_find_fixed(uint32_t size, void *address);
+
+/*
+ * Delink a region returned by one of the heap_find_ functions, keeping (at
+ * least) size bytes of data in it and returning any sufficiently large
+ * remainder to the free regions.
+ */
+void
+heap_take(heap_region_t *region, uint32_t size);
+
+/*
+ * Return an allocated region to the free regions, coalescing it with any free
+ * neighbours.
+ */
+void
+heap_release(heap_region_t *region);
+
+/*
+ * Return an address-ordered, NULL-terminated list (linked through next) of
+ * allocated regions to the free regions.
+ */
+void
+heap_release_batch(heap_region_t *sorted);
+
+#endif /* __PALLOC_BACKEND_H__ */
@@ -0,0 +1,333 @@
+/*
+ * palloc_buddy.c:
+ *
+ * Binary buddy heap backend. Every region, free or allocated, is a naturally
+ * aligned block of 2^k bytes, no smaller than the MPU's region granularity,
+ * so that a single MPU region or subregion can cover any allocation exactly.
+ * Splitting and merging both take O(log n) steps.
+ *
+ * No metadata is kept in the blocks themselves: a region's data is its whole
+ * block, so a 4KB stack takes a 4KB block, and an MPU region covering it
+ * exposes nothing of the kernel's. Each minimum-sized block ("granule") of the
+ * heap has a heap_region_t in a table at the end of the heap, which no block
+ * covers, and a tag in a table recording the order and state of the block it
+ * starts. Only a block's first granule is tagged, and only its heap_region_t
+ * is used; all others hold BUDDY_TAG_NONE.
+ *
+ * PALLOC_FLAGS_FIXED succeeds if address is aligned to the size of the block
+ * needed and that block is free.
+ */
+
+#include "palloc_backend.h"
+#include <stdint.h>
+
+#include "utils/bitops.h"
+#include "utils/list.h"
+#include <stddef.h>
+
+#define BUDDY_MIN_SHIFT     8   /* log2 of the MPU region granularity. */
+#define BUDDY_MAX_SHIFT     18  /* log2 of SRAM's size. */
+#define BUDDY_N_ORDERS      (BUDDY_MAX_SHIFT - BUDDY_MIN_SHIFT + 1)
+#define BUDDY_N_GRANULES    (1 << (BUDDY_MAX_SHIFT - BUDDY_MIN_SHIFT))
+
+#define BUDDY_TAG_FREE      0x80    /* Set if the block is free. */
+#define BUDDY_TAG_NONE      0x7f    /* Granule does not start a block. */
+
+/* Size in bytes of a block of order o, where order 0 is a single granule. */
+#define BLOCK_SIZE(o)       (1u << ((o) + BUDDY_MIN_SHIFT))
+
+static heap_region_t   *buddy_free[BUDDY_N_ORDERS]; /* Free blocks, by order. */
+static heap_region_t   *buddy_regions;              /* Metadata of the block starting at each granule. */
+static uint32_t         buddy_free_map;             /* Bit o set iff buddy_free[o] is non-empty. */
+static uint8_t          buddy_tags[BUDDY_N_GRANULES];
+static uintptr_t        buddy_base;                 /* First byte of the heap. */
+static uintptr_t        buddy_end;                  /* First byte after the heap. */
+
+static inline uint8_t *
+tag_of(uintptr_t block)
+{
+    return &buddy_tags[(block - buddy_base) >> BUDDY_MIN_SHIFT];
+}
+
+static inline heap_region_t *
+region_of(uintptr_t block)
+{
+    return &buddy_regions[(block - buddy_base) >> BUDDY_MIN_SHIFT];
+}
+
+static inline uintptr_t
+block_of(heap_region_t *region)
+{
+    return buddy_base + ((uintptr_t)(region - buddy_regions) << BUDDY_MIN_SHIFT);
+}
+
+/*
+ * Smallest order whose blocks can hold size bytes of data.
+ */
+static inline uint32_t
+order_for(uint32_t size)
+{
+    if (size <= BLOCK_SIZE(0)) {
+        return 0;
+    }
+    return fls32(size - 1) + 1 - BUDDY_MIN_SHIFT;
+}
+
+static void
+free_push(
+    uintptr_t   block,
+    uint32_t    order)
+{
+    heap_region_t *region = region_of(block);
+    region->size = BLOCK_SIZE(order);
+    *tag_of(block) = BUDDY_TAG_FREE | order;
+    DLL_PUSH(buddy_free[order], region, next, prev);
+    buddy_free_map |= 1u << order;
+}
+
+static void
+free_remove(
+    uintptr_t   block,
+    uint32_t    order)
+{
+    heap_region_t *region = region_of(block);
+    DLL_REMOVE(buddy_free[order], region, next, prev);
+    if (buddy_free[order] == NULL) {
+        buddy_free_map &= ~(1u << order);
+    }
+}
+
+void
+heap_init(
+    void       *start,
+    uint32_t    size)
+{
+    for (int o = 0; o < BUDDY_N_ORDERS; o++) {
+        buddy_free[o] = NULL;
+    }
+    buddy_free_map = 0;
+    for (int g = 0; g < BUDDY_N_GRANULES; g++) {
+        buddy_tags[g] = BUDDY_TAG_NONE;
+    }
+
+    if (size > BLOCK_SIZE(BUDDY_N_ORDERS - 1)) {
+        size = BLOCK_SIZE(BUDDY_N_ORDERS - 1);
+    }
+    buddy_base = (uintptr_t)start;
+    buddy_end = buddy_base + (size & ~(BLOCK_SIZE(0) - 1));
+
+    /*
+     * Reserve the granules at the end of the heap for the metadata table.
+     */
+    uint32_t n_granules = (buddy_end - buddy_base) >> BUDDY_MIN_SHIFT;
+    uint32_t table = (n_granules * sizeof(heap_region_t) + BLOCK_SIZE(0) - 1) &
+                     ~(BLOCK_SIZE(0) - 1);
+    buddy_end -= table;
+    buddy_regions = (heap_region_t *)buddy_end;
+
+    /*
+     * Carve the heap into the largest naturally aligned blocks that fit.
+     */
+    for (uintptr_t cur = buddy_base; cur < buddy_end; ) {
+        uint32_t order = BUDDY_N_ORDERS - 1;
+        while (cur % BLOCK_SIZE(order) || cur + BLOCK_SIZE(order) > buddy_end) {
+            order--;
+        }
+        free_push(cur, order);
+        cur += BLOCK_SIZE(order);
+    }
+}
+
+heap_region_t *
+heap_find_anywhere(uint32_t size)
+{
+    uint32_t order = order_for(size);
+    if (order >= BUDDY_N_ORDERS) {
+        return NULL;
+    }
+
+    uint32_t map = buddy_free_map & ~((1u << order) - 1);
+    PALLOC_STAT_WALK(1);
+    if (!map) {
+        return NULL;
+    }
+    return buddy_free[ffs32(map)];
+}
+
+heap_region_t *
+heap_find_fixed(
+    uint32_t    size,
+    void       *address)
+{
+    uint32_t order = order_for(size);
+    uintptr_t want = (uintptr_t)address;
+    if (order >= BUDDY_N_ORDERS || want % BLOCK_SIZE(order) ||
+        want < buddy_base || want + BLOCK_SIZE(order) > buddy_end) {
+        return NULL;
+    }
+
+    /*
+     * Find the block containing the wanted one: its first granule is the
+     * closest tagged one at or below want, at an alignment of its own order.
+     */
+    uintptr_t block = 0;
+    uint32_t block_order = 0;
+    uint32_t walk = 0;
+    for (uint32_t o = order; o < BUDDY_N_ORDERS; o++) {
+        walk++;
+        uintptr_t cand = want & ~(uintptr_t)(BLOCK_SIZE(o) - 1);
+        if (cand >= buddy_base && *tag_of(cand) != BUDDY_TAG_NONE) {
+            block = cand;
+            block_order = *tag_of(cand) & ~BUDDY_TAG_FREE;
+            break;
+        }
+    }
+    PALLOC_STAT_WALK(walk);
+    if (!block || !(*tag_of(block) & BUDDY_TAG_FREE) ||
+        block + BLOCK_SIZE(block_order) < want + BLOCK_SIZE(order)) {
+        return NULL;
+    }
+
+    /*
+     * Split the block down to the wanted one, freeing the halves that don't
+     * contain it.
+     */
+    free_remove(block, block_order);
+    while (block_order > order) {
+        block_order--;
+        uintptr_t upper = block + BLOCK_SIZE(block_order);
+        if (want >= upper) {
+            free_push(block, block_order);
+            block = upper;
+        } else {
+            free_push(upper, block_order);
+        }
+    }
+    free_push(block, order);
+
+    return region_of(block);
+}
+
+void
+heap_take(
+    heap_region_t  *region,
+    uint32_t        size)
+{
+    uintptr_t block = block_of(region);
+    uint32_t order = *tag_of(block) & ~BUDDY_TAG_FREE;
+    uint32_t want = order_for(size);
+
+    /*
+     * Split off upper halves until the block is just big enough.
+     */
+    free_remove(block, order);
+    while (order > want) {
+        order--;
+        free_push(block + BLOCK_SIZE(order), order);
+    }
+    region->size = BLOCK_SIZE(order);
+    *tag_of(block) = order;
+}
+
+void
+heap_release(heap_region_t *region)
+{
+    uintptr_t block = block_of(region);
+    uint32_t order = *tag_of(block);
+    uint32_t walk = 0;
+
+    /*
+     * Merge with the buddy for as long as it is free and whole.
+     */
+    while (order < BUDDY_N_ORDERS - 1) {
+        uintptr_t buddy = block ^ BLOCK_SIZE(order);
+        if (buddy < buddy_base || buddy + BLOCK_SIZE(order) > buddy_end ||
+            *tag_of(buddy) != (BUDDY_TAG_FREE | order)) {
+            break;
+        }
+        walk++;
+        free_remove(buddy, order);
+        if (buddy < block) {
+            *tag_of(block) = BUDDY_TAG_NONE;
+            block = buddy;
+        } else {
+            *tag_of(buddy) = BUDDY_TAG_NONE;
+        }
+        order++;
+    }
+    PALLOC_STAT_WALK(walk);
+
+    free_push(block, order);
+}
+
+void
+heap_release_batch(heap_region_t *sorted)
+{
+    /*
+     * Buddies are merged by address alone, so order gives no advantage here.
+     */
+    while (sorted) {
+        heap_region_t *next = sorted->next;
+        heap_release(sorted);
+        sorted = next;
+    }
+}
+
+heap_region_t *
+heap_region_of(void *data)
+{
+    return region_of((uintptr_t)data);
+}
+
+uint8_t *
+palloc_data(heap_region_t *region)
+{
+    return (uint8_t *)block_of(region);
+}
+
+void
+palloc_usage(palloc_usage_t *out)
+{
+    out->n_free = 0;
+    out->free_bytes = 0;
+    out->largest_free = 0;
+    for (uint32_t o = 0; o < BUDDY_N_ORDERS; o++) {
+        for (heap_region_t *cur = buddy_free[o]; cur; cur = cur->next) {
+            out->n_free++;
+            out->free_bytes += cur->size;
+            if (cur->size > out->largest_free) {
+                out->largest_free = cur->size;
+            }
+        }
+    }
+}
+
+int
+palloc_check(void)
+{
+    uint32_t n_free = 0;
+    for (uint32_t o = 0; o < BUDDY_N_ORDERS; o++) {
+        if (!(buddy_free_map & (1u << o)) != !buddy_free[o]) {
+            return -1;
+        }
+        for (heap_region_t *cur = buddy_free[o]; cur; cur = cur->next) {
+            uintptr_t block = block_of(cur);
+            if (block < buddy_base || block + BLOCK_SIZE(o) > buddy_end ||
+                block % BLOCK_SIZE(o) || *tag_of(block) != (BUDDY_TAG_FREE | o) ||
+                cur->size != BLOCK_SIZE(o)) {
+                return -1;
+            }
+            n_free++;
+        }
+    }
+
+    /*
+     * Every block tagged free must be on a free list.
+     */
+    for (uint32_t g = 0; g < BUDDY_N_GRANULES; g++) {
+        if (buddy_tags[g] != BUDDY_TAG_NONE && buddy_tags[g] & BUDDY_TAG_FREE) {
+            n_free--;
+        }
+    }
+    return n_free == 0 ? 0 : -1;
+}
@@ -0,0 +1,202 @@
+/*
+ * palloc_firstfit.c:
+ *
+ * First-fit heap backend. Free regions are kept in a single list
+ * (heap_free_list), and allocations take the first region that fits. Freed
+ * regions are coalesced with their neighbours through boundary tags, so the
+ * list needs no particular order and pfree never walks it. Instead:
+ *
+ *   - freed regions that don't merge into a predecessor go to the front, so
+ *     recently freed holes are reused first,
+ *   - the remainders of split regions go to the back, so large regions (such
+ *     as the untouched end of the heap) are carved up as late as possible.
+ */
+
+#include "palloc_backend.h"
+#include <stdint.h>
+
+#include "utils/list.h"
+#include "resources.h"
+#include <stddef.h>
+
+void
+heap_init(
+    void       *start,
+    uint32_t    size)
+{
+    heap_free_list = (heap_region_t *)start;
+    heap_free_list->next = NULL;
+    heap_free_list->prev = heap_free_list;
+    heap_free_list->size = size - sizeof(heap_region_t) - sizeof(heap_tag_t);
+    heap_set_tag(heap_free_list, HEAP_TAG_FREE);
+}
+
+heap_region_t *
+heap_find_anywhere(uint32_t size)
+{
+    heap_region_t *out = NULL;
+    uint32_t walk = 0;
+
+    for (out = heap_free_list; out; out = out->next) {
+        walk++;
+        if (out->size >= size) {
+            break;
+        }
+    }
+    PALLOC_STAT_WALK(walk);
+
+    return out;
+}
+
+heap_region_t *
+heap_find_fixed(
+    uint32_t    size,
+    void       *address)
+{
+    heap_region_t *out = NULL;
+    uint32_t walk = 0;
+
+    for (heap_region_t *cur = heap_free_list; cur; cur = cur->next) {
+        walk++;
+        /*
+         * Check that the current block contains the entire requested region.
+         */
+        if (heap_data(cur) <= (uint8_t*)address &&
+            heap_data(cur) + cur->size >= (uint8_t*)address + size) {
+            out = cur;
+            break;
+        }
+    }
+    PALLOC_STAT_WALK(walk);
+    if (out == NULL) {
+        return NULL;
+    }
+
+    /*
+     * Trim the beginning so that both the _fixed and _anywhere variants hand
+     * back a block whose data starts at the right place.
+     */
+    if (heap_data(out) != address) {
+        /*
+         * Trims OUT into START and OUT', as depicted below. START keeps its
+         * place in the free list and OUT' is linked directly after it, to be
+         * taken by the caller right away.
+         *            [<-HINT->]
+         * [<---------OUT--------->]
+         * [<-START->][<---OUT'--->]
+         */
+        heap_region_t *start = out;
+        out = ((heap_region_t *)address) - 1;
+        if ((uint8_t *)out < heap_data(start) + sizeof(heap_tag_t) ||
+            (uintptr_t)out % _Alignof(heap_region_t)) {
+            return NULL;    /* No room for START's tag, or OUT misaligned. */
+        }
+
+        out->size = (uint32_t)((heap_data(start) + start->size) - heap_data(out));
+        start->size = (uint32_t)((uint8_t *)out - heap_data(start)) - sizeof(heap_tag_t);
+        heap_set_tag(start, HEAP_TAG_FREE);
+        heap_set_tag(out, HEAP_TAG_FREE);
+        DLL_INSERT(heap_free_list, start, out, next, prev);
+    }
+
+    return out;
+}
+
+void
+heap_take(
+    heap_region_t  *region,
+    uint32_t        size)
+{
+    /*
+     * Trim the end and put it at the back of the free list if there's
+     * sufficient leftover space.
+     */
+    size = heap_tag_round(size);
+    if (region->size >= size + sizeof(heap_region_t) + sizeof(heap_tag_t)) {
+        heap_region_t *leftover = (heap_region_t *)(heap_data(region) + size + sizeof(heap_tag_t));
+        leftover->size = region->size - size - sizeof(heap_region_t) - sizeof(heap_tag_t);
+        region->size = size;
+        heap_set_tag(leftover, HEAP_TAG_FREE);
+        DLL_PUSH(heap_free_list, leftover, next, prev);
+    }
+    heap_set_tag(region, 0);
+    DLL_REMOVE(heap_free_list, region, next, prev);
+}
+
+void
+heap_release(heap_region_t *region)
+{
+    heap_region_t *before = heap_prev_free(region);
+    heap_region_t *after = heap_next_free(region);
+
+    /*
+     * Absorb a free successor, then either grow a free predecessor in place or
+     * link the region into the free list.
+     */
+    if (after) {
+        region->size += sizeof(heap_region_t) + sizeof(heap_tag_t) + after->size;
+        DLL_REMOVE(heap_free_list, after, next, prev);
+    }
+    if (before) {
+        before->size += sizeof(heap_region_t) + sizeof(heap_tag_t) + region->size;
+        region = before;
+    } else {
+        DLL_INSERT(heap_free_list, (heap_region_t *)NULL, region, next, prev);
+    }
+    heap_set_tag(region, HEAP_TAG_FREE);
+}
+
+void
+heap_release_batch(heap_region_t *sorted)
+{
+    /*
+     * Neighbouring regions of the batch are merged with each other first, so
+     * each run touches the free regions only once.
+     */
+    while (sorted) {
+        heap_region_t *run = sorted;
+        sorted = heap_absorb_run(run);
+        heap_release(run);
+    }
+}
+
+heap_region_t *
+heap_region_of(void *data)
+{
+    return (heap_region_t *)data - 1;
+}
+
+uint8_t *
+palloc_data(heap_region_t *region)
+{
+    return heap_data(region);
+}
+
+void
+palloc_usage(palloc_usage_t *out)
+{
+    out->n_free = 0;
+    out->free_bytes = 0;
+    out->largest_free = 0;
+    for (heap_region_t *cur = heap_free_list; cur; cur = cur->next) {
+        out->n_free++;
+        out->free_bytes += cur->size;
+        if (cur->size > out->largest_free) {
+            out->largest_free = cur->size;
+        }
+    }
+}
+
+int
+palloc_check(void)
+{
+    palloc_usage_t usage;
+    palloc_usage(&usage);
+
+    for (heap_region_t *cur = heap_free_list; cur; cur = cur->next) {
+        if (!(*(heap_tag_t *)(heap_data(cur) + cur->size) & HEAP_TAG_FREE)) {
+            return -1;
+        }
+    }
+    return heap_check_tags(usage.n_free);
+}
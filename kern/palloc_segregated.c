@@ -0,0 +1,264 @@
+/*
+ * palloc_segregated.c:
+ *
+ * Segregated-fit heap backend. Free regions are binned by power-of-two size
+ * class, and a bitmap records which bins are non-empty, so that finding a
+ * region for an allocation at any address usually takes constant time:
+ *
+ *   - bin i holds regions of [2^(i + SEG_MIN_SHIFT), 2^(i + SEG_MIN_SHIFT + 1))
+ *     bytes (bin 0 also holds anything smaller, and the last bin anything
+ *     larger),
+ *   - every region in a bin above the request's own bin is large enough, so
+ *     the lowest such non-empty bin is found with a single bit scan.
+ *
+ * Freed regions find their free neighbours through boundary tags, so pfree
+ * also takes constant time.
+ */
+
+#include "palloc_backend.h"
+#include <stdint.h>
+
+#include "utils/bitops.h"
+#include "utils/list.h"
+#include <stddef.h>
+
+#define SEG_MIN_SHIFT   4   /* log2 of the smallest size class. */
+#define SEG_N_BINS      16  /* Number of size classes. */
+
+static heap_region_t   *heap_bins[SEG_N_BINS];  /* Free regions, by size class. */
+static uint32_t         heap_bin_map;           /* Bit i set iff bin i is non-empty. */
+
+/*
+ * Iterate cur over every free region, in no particular order.
+ */
+#define FOR_EACH_FREE(cur, map)                                                \
+    for (uint32_t map = heap_bin_map; map; map &= map - 1)                     \
+        for (heap_region_t *cur = heap_bins[ffs32(map)]; cur; cur = cur->next)
+
+static inline uint32_t
+bin_index(uint32_t size)
+{
+    if (size < (1u << SEG_MIN_SHIFT)) {
+        return 0;
+    }
+    uint32_t i = fls32(size) - SEG_MIN_SHIFT;
+    return i < SEG_N_BINS ? i : SEG_N_BINS - 1;
+}
+
+static void
+bin_insert(heap_region_t *region)
+{
+    uint32_t i = bin_index(region->size);
+    DLL_PUSH(heap_bins[i], region, next, prev);
+    heap_bin_map |= 1u << i;
+}
+
+static void
+bin_remove(heap_region_t *region)
+{
+    uint32_t i = bin_index(region->size);
+    DLL_REMOVE(heap_bins[i], region, next, prev);
+    if (heap_bins[i] == NULL) {
+        heap_bin_map &= ~(1u << i);
+    }
+}
+
+void
+heap_init(
+    void       *start,
+    uint32_t    size)
+{
+    for (int i = 0; i < SEG_N_BINS; i++) {
+        heap_bins[i] = NULL;
+    }
+    heap_bin_map = 0;
+
+    heap_region_t *region = (heap_region_t *)start;
+    region->size = size - sizeof(heap_region_t) - sizeof(heap_tag_t);
+    heap_set_tag(region, HEAP_TAG_FREE);
+    bin_insert(region);
+}
+
+heap_region_t *
+heap_find_anywhere(uint32_t size)
+{
+    uint32_t i = bin_index(size);
+
+    /*
+     * The head of the request's own size class often fits, e.g. when a stack
+     * is allocated after another one was freed.
+     */
+    if (heap_bins[i] && heap_bins[i]->size >= size) {
+        PALLOC_STAT_WALK(1);
+        return heap_bins[i];
+    }
+
+    /*
+     * Otherwise, any region in a larger size class fits.
+     */
+    uint32_t larger = heap_bin_map & ~((2u << i) - 1);
+    if (larger) {
+        PALLOC_STAT_WALK(1);
+        return heap_bins[ffs32(larger)];
+    }
+
+    /*
+     * Finally, fall back to searching the rest of the request's size class.
+     */
+    uint32_t walk = 1;
+    heap_region_t *out = heap_bins[i];
+    while (out && out->size < size) {
+        out = out->next;
+        walk++;
+    }
+    PALLOC_STAT_WALK(walk);
+
+    return out;
+}
+
+heap_region_t *
+heap_find_fixed(
+    uint32_t    size,
+    void       *address)
+{
+    heap_region_t *out = NULL;
+    uint32_t walk = 0;
+
+    FOR_EACH_FREE(cur, map) {
+        walk++;
+        if (heap_data(cur) <= (uint8_t *)address &&
+            heap_data(cur) + cur->size >= (uint8_t *)address + size) {
+            out = cur;
+            goto found;
+        }
+    }
+found:
+    PALLOC_STAT_WALK(walk);
+    if (out == NULL) {
+        return NULL;
+    }
+
+    if (heap_data(out) != address) {
+        /*
+         * Trim OUT into START and OUT', each of which is re-binned by its new
+         * size (see palloc_firstfit.c).
+         */
+        heap_region_t *start = out;
+        out = ((heap_region_t *)address) - 1;
+        if ((uint8_t *)out < heap_data(start) + sizeof(heap_tag_t) ||
+            (uintptr_t)out % _Alignof(heap_region_t)) {
+            return NULL;    /* No room for START's tag, or OUT misaligned. */
+        }
+
+        bin_remove(start);
+        out->size = (uint32_t)((heap_data(start) + start->size) - heap_data(out));
+        start->size = (uint32_t)((uint8_t *)out - heap_data(start)) - sizeof(heap_tag_t);
+        heap_set_tag(start, HEAP_TAG_FREE);
+        heap_set_tag(out, HEAP_TAG_FREE);
+        bin_insert(start);
+        bin_insert(out);
+    }
+
+    return out;
+}
+
+void
+heap_take(
+    heap_region_t  *region,
+    uint32_t        size)
+{
+    bin_remove(region);
+    size = heap_tag_round(size);
+    if (region->size >= size + sizeof(heap_region_t) + sizeof(heap_tag_t)) {
+        heap_region_t *leftover = (heap_region_t *)(heap_data(region) + size + sizeof(heap_tag_t));
+        leftover->size = region->size - size - sizeof(heap_region_t) - sizeof(heap_tag_t);
+        region->size = size;
+        heap_set_tag(leftover, HEAP_TAG_FREE);
+        bin_insert(leftover);
+    }
+    heap_set_tag(region, 0);
+}
+
+void
+heap_release(heap_region_t *region)
+{
+    heap_region_t *before = heap_prev_free(region);
+    heap_region_t *after = heap_next_free(region);
+
+    /*
+     * Merged regions change size class, so every neighbour absorbed is
+     * re-binned.
+     */
+    if (after) {
+        bin_remove(after);
+        region->size += sizeof(heap_region_t) + sizeof(heap_tag_t) + after->size;
+    }
+    if (before) {
+        bin_remove(before);
+        before->size += sizeof(heap_region_t) + sizeof(heap_tag_t) + region->size;
+        region = before;
+    }
+    heap_set_tag(region, HEAP_TAG_FREE);
+    bin_insert(region);
+}
+
+void
+heap_release_batch(heap_region_t *sorted)
+{
+    /*
+     * Neighbouring regions of the batch are merged with each other first, so
+     * each run touches the free regions only once.
+     */
+    while (sorted) {
+        heap_region_t *run = sorted;
+        sorted = heap_absorb_run(run);
+        heap_release(run);
+    }
+}
+
+heap_region_t *
+heap_region_of(void *data)
+{
+    return (heap_region_t *)data - 1;
+}
+
+uint8_t *
+palloc_data(heap_region_t *region)
+{
+    return heap_data(region);
+}
+
+void
+palloc_usage(palloc_usage_t *out)
+{
+    out->n_free = 0;
+    out->free_bytes = 0;
+    out->largest_free = 0;
+    FOR_EACH_FREE(cur, map) {
+        out->n_free++;
+        out->free_bytes += cur->size;
+        if (cur->size > out->largest_free) {
+            out->largest_free = cur->size;
+        }
+    }
+}
+
+int
+palloc_check(void)
+{
+    palloc_usage_t usage;
+    palloc_usage(&usage);
+
+    for (uint32_t i = 0; i < SEG_N_BINS; i++) {
+        if (!(heap_bin_map & (1u << i)) != !heap_bins[i]) {
+            return -1;
+        }
+        for (heap_region_t *cur = heap_bins[i]; cur; cur = cur->next) {
+            if (bin_index(cur->size) != i ||
+                !(*(heap_tag_t *)(heap_data(cur) + cur->size) & HEAP_TAG_FREE)) {
+                return -1;
+            }
+        }
+    }
+    return heap_check_tags(usage.n_free);
+}
@@ -0,0 +1,321 @@
+#include "pcache.h"
+#include "klock.h"
+#include <stdint.h>
+#include <string.h>
+
+#define NO_PAGE     UINT32_MAX
+#define NO_SLOT     UINT16_MAX
+#define N_BUCKETS   (PCACHE_N_PAGES / 2)
+
+/*
+ * A page of the cache.
+ */
+typedef struct {
+    uint32_t    page;           /* Page of the store held, or NO_PAGE. */
+    uint16_t    hash_next;      /* Next slot in the same bucket, or NO_SLOT. */
+    uint8_t     referenced;     /* Used since the clock hand last passed it. */
+    uint8_t     dirty;          /* Written since it was last written back. */
+} slot_t;
+
+pcache_stats_t pcache_stats;
+
+static uint8_t pages[PCACHE_N_PAGES][PCACHE_PAGE_SIZE] __attribute__((aligned(4)));
+static slot_t slots[PCACHE_N_PAGES];
+static uint16_t buckets[N_BUCKETS];     /* Chains of slots, by page. */
+static uint32_t hand;                   /* Next slot the clock looks at. */
+
+/*
+ * A sector being written back, as flash holds it, then as it is to hold.
+ */
+static uint8_t sector_buf[PCACHE_SECTOR_SIZE] __attribute__((aligned(4)));
+
+/*
+ * Set while a core is using the cache. The cache is not guarded by a spinlock
+ * itself, since write-back can take as long as an erase.
+ */
+static uint8_t busy;
+
+static int
+enter(void)
+{
+    uint32_t saved = klock(KLOCK_PCACHE);
+    int entered = !busy;
+    busy = 1;
+    kunlock(KLOCK_PCACHE, saved);
+    return entered;
+}
+
+static void
+leave(void)
+{
+    uint32_t saved = klock(KLOCK_PCACHE);
+    busy = 0;
+    kunlock(KLOCK_PCACHE, saved);
+}
+
+static uint32_t
+lookup(uint32_t page)
+{
+    uint32_t s = buckets[page % N_BUCKETS];
+    while (s != NO_SLOT && slots[s].page != page) {
+        s = slots[s].hash_next;
+    }
+    return s;
+}
+
+static void
+hash_remove(uint32_t s)
+{
+    uint16_t *link = &buckets[slots[s].page % N_BUCKETS];
+    while (*link != s) {
+        link = &slots[*link].hash_next;
+    }
+    *link = slots[s].hash_next;
+}
+
+/*
+ * Return non-zero if programming new over old needs no erase: it only clears
+ * bits.
+ */
+static int
+bits_cleared(const uint8_t *old, const uint8_t *new)
+{
+    for (uint32_t i = 0; i < PCACHE_PAGE_SIZE; i++) {
+        if (new[i] & ~old[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Write back the dirty pages of a sector. Pages that flash already holds are
+ * skipped, and if the rest only clear bits they are programmed in place;
+ * otherwise the sector is erased and programmed whole, its pages that are not
+ * dirty as flash held them. Returns 0, or -1 if flash could not be written, in
+ * which case the pages stay dirty.
+ */
+static int
+sector_write_back(uint32_t sector)
+{
+    uint32_t first = sector * PCACHE_SECTOR_PAGES;
+    uint16_t slot_of[PCACHE_SECTOR_PAGES];
+    uint32_t changed = 0;
+    int erase = 0;
+
+    pcache_flash_read(sector * PCACHE_SECTOR_SIZE, sector_buf, PCACHE_SECTOR_SIZE);
+    for (uint32_t p = 0; p < PCACHE_SECTOR_PAGES; p++) {
+        uint32_t s = lookup(first + p);
+        slot_of[p] = s;
+        if (s == NO_SLOT || !slots[s].dirty ||
+            memcmp(sector_buf + p * PCACHE_PAGE_SIZE, pages[s], PCACHE_PAGE_SIZE) == 0) {
+            continue;
+        }
+        changed |= 1u << p;
+        erase |= !bits_cleared(sector_buf + p * PCACHE_PAGE_SIZE, pages[s]);
+    }
+
+    int result = 0;
+    if (erase) {
+        for (uint32_t p = 0; p < PCACHE_SECTOR_PAGES; p++) {
+            if (changed & (1u << p)) {
+                memcpy(sector_buf + p * PCACHE_PAGE_SIZE, pages[slot_of[p]], PCACHE_PAGE_SIZE);
+            }
+        }
+        result = pcache_flash_program(sector * PCACHE_SECTOR_SIZE, sector_buf, PCACHE_SECTOR_SIZE, 1);
+        if (result == 0) {
+            pcache_stats.n_erases++;
+            pcache_stats.n_programs += PCACHE_SECTOR_PAGES;
+        }
+    } else {
+        for (uint32_t p = 0; p < PCACHE_SECTOR_PAGES && result == 0; p++) {
+            if (changed & (1u << p)) {
+                result = pcache_flash_program((first + p) * PCACHE_PAGE_SIZE, pages[slot_of[p]],
+                                              PCACHE_PAGE_SIZE, 0);
+                pcache_stats.n_programs += result == 0;
+            }
+        }
+    }
+    if (result != 0) {
+        pcache_stats.n_failed++;
+        return -1;
+    }
+
+    pcache_stats.n_write_backs += changed != 0;
+    for (uint32_t p = 0; p < PCACHE_SECTOR_PAGES; p++) {
+        uint32_t s = slot_of[p];
+        if (s != NO_SLOT && slots[s].dirty) {
+            slots[s].dirty = 0;
+            pcache_stats.n_dirty--;
+            pcache_stats.n_pages_written++;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Free a slot by CLOCK. The first sweep takes a page neither referenced nor
+ * dirty, and leaves the referenced bits alone; the next takes any page not
+ * referenced, clearing the referenced bits it passes, and a third sweep is
+ * then sure to find one. A dirty page is written back first. Returns the slot,
+ * or NO_SLOT if write-back failed.
+ */
+static uint32_t
+slot_evict(void)
+{
+    for (uint32_t sweep = 0; sweep < 3; sweep++) {
+        for (uint32_t n = 0; n < PCACHE_N_PAGES; n++) {
+            uint32_t s = hand;
+            slot_t *slot = &slots[s];
+            hand = (hand + 1) % PCACHE_N_PAGES;
+            if (slot->page == NO_PAGE) {
+                return s;
+            }
+            if (!slot->referenced && (!slot->dirty || sweep > 0)) {
+                if (slot->dirty && sector_write_back(slot->page / PCACHE_SECTOR_PAGES) != 0) {
+                    return NO_SLOT;
+                }
+                hash_remove(s);
+                slot->page = NO_PAGE;
+                pcache_stats.n_evictions++;
+                return s;
+            }
+            if (sweep > 0) {
+                slot->referenced = 0;
+            }
+        }
+    }
+    return NO_SLOT;
+}
+
+/*
+ * Return the slot holding a page of the store, caching it if need be: read
+ * from flash if fill is set, or left for the caller to overwrite whole.
+ * Returns NO_SLOT if no slot could be freed.
+ */
+static uint32_t
+slot_get(uint32_t page, int fill)
+{
+    uint32_t s = lookup(page);
+    if (s != NO_SLOT) {
+        pcache_stats.n_hits++;
+        slots[s].referenced = 1;
+        return s;
+    }
+
+    pcache_stats.n_misses++;
+    s = slot_evict();
+    if (s == NO_SLOT) {
+        return NO_SLOT;
+    }
+    if (fill) {
+        pcache_flash_read(page * PCACHE_PAGE_SIZE, pages[s], PCACHE_PAGE_SIZE);
+    }
+    slots[s].page = page;
+    slots[s].referenced = 1;
+    slots[s].dirty = 0;
+    slots[s].hash_next = buckets[page % N_BUCKETS];
+    buckets[page % N_BUCKETS] = s;
+    return s;
+}
+
+void
+pcache_init(void)
+{
+    memset(&pcache_stats, 0, sizeof(pcache_stats));
+    for (uint32_t s = 0; s < PCACHE_N_PAGES; s++) {
+        slots[s].page = NO_PAGE;
+        slots[s].hash_next = NO_SLOT;
+        slots[s].referenced = 0;
+        slots[s].dirty = 0;
+    }
+    for (uint32_t b = 0; b < N_BUCKETS; b++) {
+        buckets[b] = NO_SLOT;
+    }
+    hand = 0;
+    busy = 0;
+}
+
+int
+pcache_read(
+    uint32_t    offset,
+    void       *buf,
+    uint32_t    len)
+{
+    if (offset > PCACHE_STORE_SIZE || len > PCACHE_STORE_SIZE - offset) {
+        return -1;
+    }
+    if (!enter()) {
+        return PCACHE_BUSY;
+    }
+
+    uint8_t *out = buf;
+    int result = 0;
+    while (len != 0) {
+        uint32_t in_page = offset % PCACHE_PAGE_SIZE;
+        uint32_t n = PCACHE_PAGE_SIZE - in_page < len ? PCACHE_PAGE_SIZE - in_page : len;
+        uint32_t s = slot_get(offset / PCACHE_PAGE_SIZE, 1);
+        if (s == NO_SLOT) {
+            result = -1;
+            break;
+        }
+        memcpy(out, pages[s] + in_page, n);
+        out += n;
+        offset += n;
+        len -= n;
+    }
+    leave();
+    return result;
+}
+
+int
+pcache_write(
+    uint32_t    offset,
+    const void *buf,
+    uint32_t    len)
+{
+    if (offset > PCACHE_STORE_SIZE || len > PCACHE_STORE_SIZE - offset) {
+        return -1;
+    }
+    if (!enter()) {
+        return PCACHE_BUSY;
+    }
+
+    const uint8_t *in = buf;
+    int result = 0;
+    while (len != 0) {
+        uint32_t in_page = offset % PCACHE_PAGE_SIZE;
+        uint32_t n = PCACHE_PAGE_SIZE - in_page < len ? PCACHE_PAGE_SIZE - in_page : len;
+        uint32_t s = slot_get(offset / PCACHE_PAGE_SIZE, n != PCACHE_PAGE_SIZE);
+        if (s == NO_SLOT) {
+            result = -1;
+            break;
+        }
+        memcpy(pages[s] + in_page, in, n);
+        if (!slots[s].dirty) {
+            slots[s].dirty = 1;
+            pcache_stats.n_dirty++;
+        }
+        in += n;
+        offset += n;
+        len -= n;
+    }
+    leave();
+    return result;
+}
+
+int
+pcache_sync(void)
+{
+    if (!enter()) {
+        return PCACHE_BUSY;
+    }
+    int result = 0;
+    for (uint32_t s = 0; s < PCACHE_N_PAGES; s++) {
+        if (slots[s].dirty && sector_write_back(slots[s].page / PCACHE_SECTOR_PAGES) != 0) {
+            result = -1;
+        }
+    }
+    leave();
+    return result;
+}
@@ -0,0 +1,110 @@
+/*
+ * pcache.h:
+ *
+ * Write-back page cache over the store: an area at the end of flash that
+ * holds the persistent state of processes. Flash must be erased a whole
+ * sector at a time before it can be rewritten, an erase stalls the system for
+ * tens of milliseconds, and each sector survives only so many erases, so
+ * writes are kept in SRAM for as long as possible.
+ *
+ * The cache holds PCACHE_N_PAGES pages of the store, each the size of a flash
+ * program page. Pages are replaced by CLOCK, preferring pages that are clean
+ * to those that are dirty, so that the most frequently written pages stay in
+ * SRAM. A dirty page chosen for replacement is written back with every other
+ * dirty page of its sector, in one erase. Write-back skips the erase when the
+ * new contents only clear bits of what flash holds, and skips pages that have
+ * not changed.
+ *
+ * Processes reach the store through system calls (see syscall.h). The flash
+ * itself is behind two functions, implemented on the target by
+ * pcache_flash.c and for the host by a simulated flash that counts erases.
+ */
+
+#ifndef __PCACHE_H__
+#define __PCACHE_H__
+
+#include <stdint.h>
+
+#define PCACHE_PAGE_SIZE        256     /* Flash program page. */
+#define PCACHE_SECTOR_SIZE      4096    /* Flash erase sector. */
+#define PCACHE_SECTOR_PAGES     (PCACHE_SECTOR_SIZE / PCACHE_PAGE_SIZE)
+
+/*
+ * Size of the cache, and of the store, which is the last PCACHE_STORE_KB of
+ * flash. Program images must not extend into it.
+ */
+#ifndef PCACHE_KB
+#define PCACHE_KB               64
+#endif
+#ifndef PCACHE_STORE_KB
+#define PCACHE_STORE_KB         256
+#endif
+#define PCACHE_N_PAGES          (PCACHE_KB * 1024 / PCACHE_PAGE_SIZE)
+#define PCACHE_STORE_SIZE       (PCACHE_STORE_KB * 1024)
+
+/*
+ * Returned when the other core is using the cache.
+ */
+#define PCACHE_BUSY             (-2)
+
+/*
+ * Cache counters.
+ */
+typedef struct {
+    uint32_t    n_hits;             /* Page lookups that found the page cached. */
+    uint32_t    n_misses;           /* Page lookups that read the page from flash. */
+    uint32_t    n_evictions;        /* Cached pages replaced. */
+    uint32_t    n_write_backs;      /* Sectors written back. */
+    uint32_t    n_pages_written;    /* Dirty pages written back. */
+    uint32_t    n_erases;           /* Sectors erased. */
+    uint32_t    n_programs;         /* Pages programmed. */
+    uint32_t    n_failed;           /* Write-backs that could not reach flash. */
+    uint16_t    n_dirty;            /* Pages now dirty. */
+} pcache_stats_t;
+
+extern pcache_stats_t pcache_stats;
+
+/*
+ * Empty the cache. Called once at boot.
+ */
+void
+pcache_init(void);
+
+/*
+ * Read len bytes of the store from offset into buf. Returns 0, -1 if the range
+ * is outside the store or a page could not be made room for, or PCACHE_BUSY.
+ */
+int
+pcache_read(uint32_t offset, void *buf, uint32_t len);
+
+/*
+ * Write len bytes from buf to the store at offset, in the cache. Returns as
+ * pcache_read.
+ */
+int
+pcache_write(uint32_t offset, const void *buf, uint32_t len);
+
+/*
+ * Write back every dirty page. Returns 0, -1 if a sector could not be written,
+ * or PCACHE_BUSY.
+ */
+int
+pcache_sync(void);
+
+/*
+ * The flash under the store. Offsets are from the start of the store.
+ *
+ * pcache_flash_read copies len bytes of flash at offset into buf.
+ *
+ * pcache_flash_program programs len bytes, whole pages, at offset from data,
+ * which can only clear bits; if erase is set, the sector at offset is erased
+ * first, and len is a sector. Returns 0, or -1 if flash could not be written
+ * now.
+ */
+void
+pcache_flash_read(uint32_t offset, void *buf, uint32_t len);
+
+int
+pcache_flash_program(uint32_t offset, const void *data, uint32_t len, int erase);
+
+#endif /* __PCACHE_H__ */
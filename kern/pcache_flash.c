@@ -0,0 +1,72 @@
+#include "pcache.h"
+#include <stdint.h>
+#include <string.h>
+
+#include "hardware/flash.h"
+#include "hardware/regs/addressmap.h"
+#include "pico/flash.h"
+#include "pico/multicore.h"
+
+#include "utils/panic.h"
+
+/*
+ * Flash offset of the store: the end of flash.
+ */
+#define STORE_BASE          (PICO_FLASH_SIZE_BYTES - PCACHE_STORE_SIZE)
+
+/*
+ * How long to wait for the other core to stop executing from flash. It does
+ * so from an interrupt, which cannot be taken while it has interrupts
+ * disabled.
+ */
+#define LOCKOUT_TIMEOUT_MS  10
+
+typedef struct {
+    uint32_t        offset;
+    const void     *data;
+    uint32_t        len;
+    int             erase;
+} program_args_t;
+
+/*
+ * Runs with XIP unavailable: interrupts off on this core, the other core
+ * parked.
+ */
+static void
+program(void *param)
+{
+    const program_args_t *args = param;
+    if (args->erase) {
+        flash_range_erase(STORE_BASE + args->offset, PCACHE_SECTOR_SIZE);
+    }
+    flash_range_program(STORE_BASE + args->offset, args->data, args->len);
+}
+
+void
+pcache_flash_read(
+    uint32_t    offset,
+    void       *buf,
+    uint32_t    len)
+{
+    /* Around the XIP cache, which may still hold what the store held before. */
+    memcpy(buf, (const void *)(XIP_NOCACHE_NOALLOC_BASE + STORE_BASE + offset), len);
+}
+
+int
+pcache_flash_program(
+    uint32_t    offset,
+    const void *data,
+    uint32_t    len,
+    int         erase)
+{
+    /*
+     * Processes run on both cores, so both are set up at boot to be parked
+     * by the other; without that, every write-back from this core would fail.
+     */
+    if (!multicore_lockout_victim_is_initialized(get_core_num() ^ 1)) {
+        halt();
+    }
+
+    program_args_t args = { offset, data, len, erase };
+    return flash_safe_execute(program, &args, LOCKOUT_TIMEOUT_MS) == PICO_OK ? 0 : -1;
+}
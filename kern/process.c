@@ -0,0 +1,211 @@
+#include "process.h"
+#include "console.h"
+#include "context_switch.h"
+#include "klock.h"
+#include "ksync.h"
+#include "ktrace.h"
+#include "palloc.h"
+#include "resources.h"
+#include "zalloc.h"
+#include "utils/list.h"
+#include <string.h>
+
+#include "pico/platform.h"
+#include "hardware/sync.h"
+
+/*
+ * Stand-in PCBs, by core, for a process that exited while running. The context
+ * switch away from it saves the dead process's stack pointer here instead of
+ * into its PCB.
+ */
+static pcb_t exited_pcb[SCHED_N_CORES];
+
+/*
+ * Processes that exited while running on each core, linked through next. Their
+ * memory is released only once the switch away from them has finished saving
+ * registers to their stacks, since the other core could otherwise allocate a
+ * stack in the meantime. That is certain once the core runs anything else, so
+ * they are released by the core's idle process, or by the next process to
+ * exit there, which keeps the allocators out of the switch path.
+ */
+static pcb_t *exited[SCHED_N_CORES];
+
+/*
+ * ID given to the next process created.
+ */
+static uint16_t next_pid = 1;
+
+/*
+ * Where process_init_context puts a new process's saved registers: just below
+ * the (8-byte aligned) top of its stack.
+ */
+static stack_registers_t *
+initial_registers(pcb_t *pcb)
+{
+    uint8_t *stack_top = pcb->stack_base + pcb->stack_size;
+    return (stack_registers_t *)(((uintptr_t)stack_top & ~(0b111)) - sizeof(stack_registers_t));
+}
+
+void
+process_init_context(
+    pcb_t      *pcb,
+    void       *stack,
+    uint32_t    stack_size,
+    void       *entry)
+{
+    /* IDs are handed out under the zone lock, as are the PCBs themselves. */
+    uint32_t saved = klock(KLOCK_ZONES);
+    pcb->pid = next_pid++;
+    kunlock(KLOCK_ZONES, saved);
+    memset(&pcb->acct, 0, sizeof(pcb->acct));
+    pcb->acct_since = 0;
+
+    /*
+     * Fill the stack with a pattern, so that how much of it gets used can be
+     * measured.
+     */
+    pcb->stack_base = stack;
+    pcb->stack_size = stack_size & ~3u;
+    for (uint32_t *word = stack; word < (uint32_t *)(pcb->stack_base + pcb->stack_size); word++) {
+        *word = PROCESS_STACK_FILL;
+    }
+
+    /*
+     * Start at the (8-byte aligned) top of the stack, then make room for the
+     * initial saved registers that the context switch pops.
+     */
+    stack_registers_t *stack_registers = initial_registers(pcb);
+    pcb->saved_sp = (register_t)(uintptr_t)stack_registers;
+
+    /* Set some stack register values for easy recognition. */
+    memset(stack_registers, 0xeeeeeeee, sizeof(stack_registers_t));
+    stack_registers->r8 = (register_t)(0x88888888);
+    stack_registers->r5 = (register_t)(0x55555555);
+
+    stack_registers->pc = (register_t)(uintptr_t)entry | 1;
+    stack_registers->r0 = 0x00000000;
+    stack_registers->r1 = 0x11111111;
+    stack_registers->r2 = 0x22222222;
+    stack_registers->r3 = 0x33333333;
+
+    stack_registers->r12 = 0x12121212;
+    stack_registers->lr = (register_t)(uintptr_t)process_return | 1;  /* Returning exits. */
+
+    /* TODO: figure out a (more) correct value for PSR for userprograms. */
+    stack_registers->psr = 0x61000000;
+
+    /* Set up, so it can be found among the live processes. */
+    pcb->state = PROC_NEW;
+    saved = klock(KLOCK_PROCS);
+    DLL_PUSH(live_pcbs, pcb, live_next, live_prev);
+    kunlock(KLOCK_PROCS, saved);
+}
+
+void
+process_init_static_base(
+    pcb_t      *pcb,
+    uint32_t    base)
+{
+    initial_registers(pcb)->r9 = base;
+}
+
+uint32_t
+process_stack_used(pcb_t *pcb)
+{
+    uint32_t *word = (uint32_t *)pcb->stack_base;
+    uint32_t *top = (uint32_t *)(pcb->stack_base + pcb->stack_size);
+    while (word < top && *word == PROCESS_STACK_FILL) {
+        word++;
+    }
+    return (uint32_t)((uint8_t *)top - (uint8_t *)word);
+}
+
+int
+__time_critical_func(process_stack_overflowed)(pcb_t *pcb)
+{
+    /*
+     * The saved registers sit at the saved stack pointer, so it must stay above
+     * the red zone. Addresses are compared as registers, which on the host
+     * keeps only their low 32 bits.
+     */
+    uint8_t *guard = pcb->stack_base + PROCESS_STACK_GUARD;
+    return pcb->stack_size != 0 &&
+           (pcb->saved_sp < (register_t)(uintptr_t)guard ||
+            *((uint32_t *)guard - 1) != PROCESS_STACK_FILL);
+}
+
+/*
+ * Take a process off the list of live processes, if it is on it.
+ */
+static void
+live_remove(pcb_t *pcb)
+{
+    uint32_t saved = klock(KLOCK_PROCS);
+    if (pcb->live_prev != NULL) {
+        DLL_REMOVE(live_pcbs, pcb, live_next, live_prev);
+        pcb->live_prev = NULL;
+    }
+    kunlock(KLOCK_PROCS, saved);
+}
+
+void
+process_release(pcb_t *pcb)
+{
+    live_remove(pcb);
+    pfree_all(pcb);
+    zfree(pcb, KZONE_PCB);
+}
+
+/*
+ * Leave a dead process to be released by process_reap_exited on this core.
+ */
+static void
+exited_push(
+    uint32_t    core,
+    pcb_t      *pcb)
+{
+    uint32_t saved = save_and_disable_interrupts();
+    SLL_STACK_PUSH(exited[core], pcb, next);
+    restore_interrupts(saved);
+}
+
+void
+process_exit(pcb_t *pcb)
+{
+    KTRACE_RECORD(KTRACE_EXIT, pcb->pid, 0, 0);
+    ksync_abandon(pcb);
+    console_release(pcb);
+    sched_detach(pcb);
+    live_remove(pcb);
+
+    uint32_t core = get_core_num();
+    if (pcb == pcb_active[core]) {
+        process_reap_exited();
+        exited_push(core, pcb);
+        pcb_active[core] = &exited_pcb[core];
+        sched_reschedule();
+        return;
+    }
+    if (pcb->on_core == core + 1) {
+        /* This core is still switching away from it: keep the allocators out. */
+        exited_push(core, pcb);
+        return;
+    }
+    process_release(pcb);
+}
+
+void
+process_reap_exited(void)
+{
+    uint32_t core = get_core_num();
+    uint32_t saved = save_and_disable_interrupts();
+    pcb_t *pcb = exited[core];
+    exited[core] = NULL;
+    restore_interrupts(saved);
+
+    while (pcb != NULL) {
+        pcb_t *next = pcb->next;
+        process_release(pcb);
+        pcb = next;
+    }
+}
@@ -0,0 +1,89 @@
+/*
+ * process.h:
+ *
+ * Process lifecycle management.
+ */
+
+#ifndef __PROCESS_H__
+#define __PROCESS_H__
+
+#include "scheduler.h"
+
+/*
+ * Word that unused stack is filled with, so that the deepest use of a stack
+ * can be found later.
+ */
+#define PROCESS_STACK_FILL 0xa5a5a5a5
+
+/*
+ * Bytes at the bottom of every stack kept as a red zone: room for one more
+ * saved context (the registers the hardware stacks, and those the switch
+ * saves). A process that reaches into it counts as overflowed while the
+ * allocator's region header and boundary tag below the stack are still
+ * intact, so its memory can be released safely.
+ */
+#define PROCESS_STACK_GUARD 64
+
+/*
+ * Set up a new process's saved context so that the first context switch to it
+ * begins executing entry on the stack of stack_size bytes at stack, and assign
+ * the process its ID. The stack is filled with PROCESS_STACK_FILL first. If
+ * entry returns, the process exits (see process_return in context_switch.s).
+ * The process joins live_pcbs (see resources.h), in state PROC_NEW until it is
+ * first made ready, and stays there until it exits or is released.
+ */
+void
+process_init_context(pcb_t *pcb, void *stack, uint32_t stack_size, void *entry);
+
+/*
+ * Set the r9 a process set up by process_init_context starts with: the static
+ * base through which position-independent programs reach their data.
+ */
+void
+process_init_static_base(pcb_t *pcb, uint32_t base);
+
+/*
+ * Return the most bytes of its stack that a process has ever used, found by
+ * scanning up from the bottom of the stack for the first word that is no
+ * longer PROCESS_STACK_FILL. Takes time in proportion to the unused stack, so
+ * is meant for diagnostics rather than the scheduler.
+ */
+uint32_t
+process_stack_used(pcb_t *pcb);
+
+/*
+ * Return non-zero if a process's stack has overflowed into its red zone (see
+ * PROCESS_STACK_GUARD): its saved registers reach into it, or the zone's top
+ * word has been overwritten. Only meaningful while the process is not running.
+ * Called at every switch with SCHED_STACK_CHECK, so it runs from RAM.
+ */
+int
+process_stack_overflowed(pcb_t *pcb);
+
+/*
+ * Destroy a process: deschedule it, release all of its memory in one batch,
+ * and return its PCB to the zone allocator. If the process is the one running
+ * on this core, a reschedule is requested, the process never runs again once
+ * the current exception returns, and its memory is released once the switch
+ * away from it completes. A process this core is still switching away from
+ * (see sched_switch_done) is likewise released later, off the switch path.
+ */
+void
+process_exit(pcb_t *pcb);
+
+/*
+ * Release all of a process's memory and its PCB, for a process that is in no
+ * scheduler queue, such as one that could not be fully created.
+ */
+void
+process_release(pcb_t *pcb);
+
+/*
+ * Release the processes that exited while running on this core, if any.
+ * Called by the core's idle process, and by process_exit before a process
+ * exits in their place: either way, the switches away from them are done.
+ */
+void
+process_reap_exited(void);
+
+#endif /* __PROCESS_H__ */
@@ -1,12 +1,39 @@
 #include "resources.h"
 
+#include "pico/platform.h"
+
 /*
  * Reservation of global kernel variables.
+ *
+ * The scheduler's state is read on every context switch, so it lives in the
+ * scratch Y bank (alongside core 0's stack) rather than in main SRAM. Shared
+ * parts are guarded by the spinlocks in klock.h.
+ */
+pcb_t           *pcb_active[SCHED_N_CORES] __scratch_y("sched");   /* PCB of the current process, by core. */
+pcb_t           *ready_queues[SCHED_N_CORES][SCHED_N_PRIORITIES] __scratch_y("sched"); /* Scheduler's ready queues, by core and priority. */
+uint32_t         ready_map[SCHED_N_CORES] __scratch_y("sched");    /* Bit p set iff ready_queues[core][p] is non-empty. */
+uint16_t         ready_count[SCHED_N_CORES][SCHED_N_PRIORITIES] __scratch_y("sched"); /* Number of PCBs in each ready queue. */
+pcb_t           *sleep_heap[SCHED_MAX_SLEEPERS] __scratch_y("sched"); /* Sleeping PCBs, a min-heap by wake_time. */
+uint32_t         sleep_count __scratch_y("sched");    /* Number of PCBs in sleep_heap. */
+pcb_t           *idle_pcb[SCHED_N_CORES] __scratch_y("sched");     /* Runs when no other process is ready, by core. */
+
+/*
+ * Core 0's stack takes the top PICO_STACK_SIZE bytes of the 4 KiB bank, and
+ * exception handlers run on it once scheduling starts. The linker only
+ * notices the two meeting once the bank is full, so keep the scheduler's
+ * share to half of what the stack leaves (252 bytes of 1 KiB by default).
  */
-pcb_t           *pcb_active;     /* PCB of the current process. */
-pcb_t           *ready_queue;    /* Scheduler's ready queue. */
+#ifndef PICO_STACK_SIZE
+#define PICO_STACK_SIZE 0x800u          /* The SDK's default (see crt0.S). */
+#endif
+_Static_assert(sizeof(pcb_active) + sizeof(ready_queues) + sizeof(ready_map) +
+               sizeof(ready_count) + sizeof(sleep_heap) + sizeof(sleep_count) + sizeof(idle_pcb) <=
+               (4096 - PICO_STACK_SIZE) / 2,
+               "scheduler state crowds core 0's stack in scratch Y");
+pcb_t           *live_pcbs;      /* Every live process, linked through live_next (see process.h). */
 heap_region_t   *heap_free_list; /* Free regions in the heap. */
 void            *heap_start;     /* Starting address of the heap. */
+void            *heap_end;       /* First address after the heap. */
 
 /*
  * Reservation of all memory (zones) belonging to the zone allocator.
@@ -18,10 +18,17 @@
 /*
  * Reservation of global kernel variables.
  */
-extern pcb_t           *pcb_active;     /* PCB of the current process. */
-extern pcb_t           *ready_queue;    /* Scheduler's ready queue. */
+extern pcb_t           *pcb_active[SCHED_N_CORES];   /* PCB of the current process, by core. */
+extern pcb_t           *ready_queues[SCHED_N_CORES][SCHED_N_PRIORITIES]; /* Scheduler's ready queues, by core and priority. */
+extern uint32_t         ready_map[SCHED_N_CORES];    /* Bit p set iff ready_queues[core][p] is non-empty. */
+extern uint16_t         ready_count[SCHED_N_CORES][SCHED_N_PRIORITIES]; /* Number of PCBs in each ready queue. */
+extern pcb_t           *sleep_heap[SCHED_MAX_SLEEPERS]; /* Sleeping PCBs, a min-heap by wake_time. */
+extern uint32_t         sleep_count;    /* Number of PCBs in sleep_heap. */
+extern pcb_t           *idle_pcb[SCHED_N_CORES];     /* Runs when no other process is ready, by core. */
+extern pcb_t           *live_pcbs;      /* Every live process, linked through live_next (see process.h). */
 extern heap_region_t   *heap_free_list; /* Free regions in the heap. */
 extern void            *heap_start;     /* Starting address of the heap. */
+extern void            *heap_end;       /* First address after the heap. */
 
 extern void *exc_return;
 
@@ -1,15 +1,691 @@
 #include "scheduler.h"
+#include "klock.h"
+#include "ktrace.h"
+#include "pager.h"
+#include "palloc.h"
+#include "process.h"
 #include "resources.h"
+#include "zalloc.h"
+#include "utils/bitops.h"
 #include "utils/list.h"
+#include "utils/panic.h"
 #include <stdio.h>
 
+#include "pico/platform.h"
+#include "hardware/clocks.h"
+#include "hardware/structs/scb.h"
+#include "hardware/structs/systick.h"
+#include "hardware/sync.h"
+#include "hardware/timer.h"
+
+/*
+ * Size of the idle process's stack. It only ever holds the initial exception
+ * frame and the registers saved by context_switch, unless it also zeroes freed
+ * zone elements, which can return slabs to the heap.
+ */
+#ifdef ZALLOC_ZERO_IDLE
+#define IDLE_STACK_SIZE 512
+#else
+#define IDLE_STACK_SIZE 256
+#endif
+
+/* SysTick control: enable the counter and its interrupt on the processor clock. */
+#define SYSTICK_CSR_RUN 0x7
+#define SYSTICK_CSR_COUNT 0x5   /* As above, without the interrupt. */
+
+/* Exception number of SVCall, as found in ICSR's VECTACTIVE field. */
+#define EXC_NUM_SVCALL 11
+
+static uint32_t cycles_per_us;
+
+/*
+ * Process each core is switching away from, until its registers are saved.
+ */
+static pcb_t *switch_prev[SCHED_N_CORES];
+
+#ifdef SCHED_SWITCH_STATS
+sched_switch_stats_t sched_switch_stats[SCHED_N_CORES] = {
+    [0 ... SCHED_N_CORES - 1] = { .cycles_min = UINT32_MAX },
+};
+
+static uint32_t switch_start[SCHED_N_CORES];    /* SysTick count when the switch began. */
+static uint32_t switch_spent[SCHED_N_CORES];    /* Cycles spent before SysTick was reprogrammed. */
+#endif
+
+/*
+ * True if time a is strictly before time b, allowing for time_us_32()
+ * wrapping around (every ~71 minutes).
+ */
+#define TIME_BEFORE(a, b) ((int32_t)((a) - (b)) < 0)
+
+/*
+Ready queues: each core has one queue per priority level, guarded by that
+core's KLOCK_READY lock. A process stays in its queue while it runs.
+*/
 /*
-Choose the next process to be scheduled in a round-robin fashion. Places the
-next process's PCB back on the end of the ready queue.
+Take up a priority lent while the process was in no ready queue (see
+sched_set_priority), as it goes into one.
 */
-pcb_t *sched_get_next(void) {
-    pcb_t *next_pcb;
-    DLL_POP(ready_queue, next_pcb, next, prev);
-    DLL_PUSH(ready_queue, next_pcb, next, prev);
+static inline void take_lent(pcb_t *pcb) {
+    if (pcb->lent != 0) {
+        pcb->priority = pcb->lent - 1;
+        pcb->lent = 0;
+    }
+}
+
+static void __time_critical_func(ready_push)(pcb_t *pcb, uint32_t core) {
+    take_lent(pcb);
+    pcb->state = PROC_READY;
+    pcb->core = core;
+    DLL_PUSH(ready_queues[core][pcb->priority], pcb, next, prev);
+    ready_map[core] |= 1u << pcb->priority;
+    ready_count[core][pcb->priority]++;
+}
+
+/* As ready_push, but at the head of the queue, so the process runs next. */
+static void __time_critical_func(ready_push_head)(pcb_t *pcb, uint32_t core) {
+    take_lent(pcb);
+    pcb->state = PROC_READY;
+    pcb->core = core;
+    DLL_INSERT(ready_queues[core][pcb->priority], (pcb_t *)NULL, pcb, next, prev);
+    ready_map[core] |= 1u << pcb->priority;
+    ready_count[core][pcb->priority]++;
+}
+
+static void __time_critical_func(ready_remove)(pcb_t *pcb) {
+    DLL_REMOVE(ready_queues[pcb->core][pcb->priority], pcb, next, prev);
+    ready_count[pcb->core][pcb->priority]--;
+    if (ready_queues[pcb->core][pcb->priority] == NULL) {
+        ready_map[pcb->core] &= ~(1u << pcb->priority);
+    }
+}
+
+/*
+True if the process may be run by the given core: no other core is running it,
+or still saving its registers.
+*/
+static inline int runnable_on(pcb_t *pcb, uint32_t core) {
+    return pcb->on_core == 0 || pcb->on_core == core + 1;
+}
+
+/*
+Choose the next process from a core's ready queues: the first runnable process
+of the highest-priority non-empty queue, found with a single bit scan. Places
+the process back on the end of its queue, so processes of equal priority are
+scheduled in a round-robin fashion. The first process is almost always
+runnable; one is only skipped while another core finishes switching away from
+it.
+*/
+static pcb_t *__time_critical_func(ready_pick)(uint32_t core) {
+    uint32_t map = ready_map[core];
+    while (map != 0) {
+        pcb_t **queue = &ready_queues[core][ffs32(map)];
+        for (pcb_t *pcb = *queue; pcb; pcb = pcb->next) {
+            if (runnable_on(pcb, core)) {
+                DLL_REMOVE(*queue, pcb, next, prev);
+                DLL_PUSH(*queue, pcb, next, prev);
+                return pcb;
+            }
+        }
+        map &= map - 1;
+    }
+    return NULL;
+}
+
+/*
+Number of processes in a core's ready queues of the given priority or higher.
+*/
+static inline uint32_t ready_load(uint32_t core, uint32_t priority) {
+    uint32_t n = 0;
+    for (uint32_t map = ready_map[core] & ((2u << priority) - 1); map != 0; map &= map - 1) {
+        n += ready_count[core][ffs32(map)];
+    }
+    return n;
+}
+
+/*
+True if another core has more processes of the given priority or higher than
+this core has (own) of its highest priority, which is no higher. At least one
+of them is then waiting, and moving it here evens out the share of the
+processor each gets. Read without the other core's lock, as a hint.
+*/
+static inline int ready_busier(uint32_t core, uint32_t priority, uint32_t own) {
+    for (uint32_t other = 0; other < SCHED_N_CORES; other++) {
+        if (other != core && ready_load(other, priority) > own) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+Take the highest-priority process that is not running, of the given priority
+or higher, from a core busier than this one (see ready_busier). Only one ready
+queue lock is held at a time; the stolen process is in no queue until the
+caller pushes it onto its own.
+*/
+static pcb_t *__time_critical_func(ready_steal)(uint32_t core, uint32_t priority, uint32_t own) {
+    for (uint32_t victim = 0; victim < SCHED_N_CORES; victim++) {
+        if (victim == core || ready_load(victim, priority) <= own) {
+            continue;
+        }
+
+        pcb_t *stolen = NULL;
+        uint32_t saved = klock(KLOCK_READY(victim));
+        /* Count again, now that the victim's queues cannot change. */
+        uint32_t map = ready_load(victim, priority) > own ?
+                       ready_map[victim] & ((2u << priority) - 1) : 0;
+        while (map != 0 && stolen == NULL) {
+            for (pcb_t *pcb = ready_queues[victim][ffs32(map)]; pcb; pcb = pcb->next) {
+                if (pcb->on_core == 0) {
+                    stolen = pcb;
+                    break;
+                }
+            }
+            map &= map - 1;
+        }
+        if (stolen != NULL) {
+            ready_remove(stolen);
+        }
+        kunlock(KLOCK_READY(victim), saved);
+
+        if (stolen != NULL) {
+            return stolen;
+        }
+    }
+    return NULL;
+}
+
+void sched_enqueue(pcb_t *pcb) {
+    uint32_t core = get_core_num();
+    pcb->acct_since = time_us_32();
+    uint32_t saved = klock(KLOCK_READY(core));
+    ready_push(pcb, core);
+    kunlock(KLOCK_READY(core), saved);
+
+    /*
+    Pass through the scheduler if the process ties with or outranks the one
+    running here: to preempt it, or to start the time slice they now share,
+    which nothing else arms once SysTick has stopped for a process running
+    alone. Until this core has an idle process, it is not scheduling yet.
+    */
+    if (idle_pcb[core] != NULL && pcb->priority <= pcb_active[core]->priority) {
+        sched_reschedule();
+    }
+
+    /* Wake the other core, in case it is idle and can take this process. */
+    __sev();
+}
+
+void sched_dequeue(pcb_t *pcb) {
+    uint32_t core = pcb->core;
+    uint32_t saved = klock(KLOCK_READY(core));
+    ready_remove(pcb);
+    kunlock(KLOCK_READY(core), saved);
+}
+
+/*
+Sleep queue: a binary min-heap of PCBs ordered by wake_time, shared by both
+cores and guarded by KLOCK_SLEEP. Each PCB records its own slot so it can be
+removed from the middle of the heap in O(log n).
+*/
+static void __time_critical_func(sleep_place)(pcb_t *pcb, uint32_t slot) {
+    sleep_heap[slot] = pcb;
+    pcb->sleep_slot = slot;
+}
+
+static void __time_critical_func(sleep_sift_up)(uint32_t slot) {
+    pcb_t *pcb = sleep_heap[slot];
+    while (slot > 0) {
+        uint32_t parent = (slot - 1) / 2;
+        if (!TIME_BEFORE(pcb->wake_time, sleep_heap[parent]->wake_time)) {
+            break;
+        }
+        sleep_place(sleep_heap[parent], slot);
+        slot = parent;
+    }
+    sleep_place(pcb, slot);
+}
+
+static void __time_critical_func(sleep_sift_down)(uint32_t slot) {
+    pcb_t *pcb = sleep_heap[slot];
+    while (1) {
+        uint32_t child = 2 * slot + 1;
+        if (child >= sleep_count) {
+            break;
+        }
+        if (child + 1 < sleep_count &&
+            TIME_BEFORE(sleep_heap[child + 1]->wake_time, sleep_heap[child]->wake_time)) {
+            child++;
+        }
+        if (!TIME_BEFORE(sleep_heap[child]->wake_time, pcb->wake_time)) {
+            break;
+        }
+        sleep_place(sleep_heap[child], slot);
+        slot = child;
+    }
+    sleep_place(pcb, slot);
+}
+
+static void __time_critical_func(sleep_remove)(pcb_t *pcb) {
+    uint32_t slot = pcb->sleep_slot;
+    sleep_count--;
+    if (slot == sleep_count) {
+        return;
+    }
+
+    /* Fill the hole with the last sleeper, then restore the heap order. */
+    sleep_place(sleep_heap[sleep_count], slot);
+    sleep_sift_up(slot);
+    sleep_sift_down(sleep_heap[slot]->sleep_slot);
+}
+
+int sched_sleep(pcb_t *pcb, uint32_t us) {
+    uint32_t saved = klock(KLOCK_SLEEP);
+    if (sleep_count == SCHED_MAX_SLEEPERS) {
+        kunlock(KLOCK_SLEEP, saved);
+        return -1;
+    }
+
+    sched_dequeue(pcb);
+    pcb->state = PROC_SLEEPING;
+    pcb->wake_time = time_us_32() + us;
+    sleep_place(pcb, sleep_count++);
+    sleep_sift_up(pcb->sleep_slot);
+    int earliest = pcb->sleep_slot == 0;
+    kunlock(KLOCK_SLEEP, saved);
+
+    /*
+    Reprogram SysTick for the new deadline if it is the earliest, and switch
+    away if the sleeper is the process that was running.
+    */
+    if (pcb == pcb_active[get_core_num()] || earliest) {
+        sched_reschedule();
+    }
+    return 0;
+}
+
+/*
+Wait queues belong to whatever the processes in them wait for, and are guarded
+by its lock, which is taken before a ready queue lock.
+*/
+void sched_block(pcb_t *pcb, pcb_t **queue, uint32_t lock) {
+    sched_dequeue(pcb);
+    pcb->state = PROC_BLOCKED;
+    pcb->wait_lock = lock;
+    pcb->wait_queue = queue;
+    pcb_t *after = NULL;
+    for (pcb_t *waiter = *queue; waiter != NULL && waiter->priority <= pcb->priority;
+         waiter = waiter->next) {
+        after = waiter;
+    }
+    DLL_INSERT(*queue, after, pcb, next, prev);
+    if (pcb == pcb_active[get_core_num()]) {
+        sched_reschedule();
+    }
+}
+
+pcb_t *sched_wake(pcb_t **queue) {
+    pcb_t *pcb;
+    DLL_POP(*queue, pcb, next, prev);
+    if (pcb == NULL) {
+        return NULL;
+    }
+    pcb->wait_queue = NULL;
+    sched_enqueue(pcb);
+    return pcb;
+}
+
+/*
+A process is only moved while found in the queue of its priority, under its
+core's lock, so never while another core is stealing it.
+*/
+int sched_set_priority(pcb_t *pcb, uint8_t priority) {
+    /*
+    Lend the priority first: whoever puts the process in a ready queue after
+    the search below misses it takes it up then.
+    */
+    pcb->lent = priority + 1;
+    __dmb();
+
+    uint32_t core = pcb->core;
+    uint32_t saved = klock(KLOCK_READY(core));
+    pcb_t *queued = ready_queues[core][pcb->priority];
+    while (queued != NULL && queued != pcb) {
+        queued = queued->next;
+    }
+    if (queued == NULL || pcb->state != PROC_READY || pcb->core != core) {
+        kunlock(KLOCK_READY(core), saved);
+        return 1;
+    }
+    ready_remove(pcb);
+    ready_push(pcb, core);
+    kunlock(KLOCK_READY(core), saved);
+
+    if (core == get_core_num()) {
+        sched_reschedule();
+    }
+    return 0;
+}
+
+void sched_detach(pcb_t *pcb) {
+    if (pcb->state == PROC_NEW) {
+        return;
+    }
+
+    uint32_t saved = klock(KLOCK_SLEEP);
+    if (pcb->state == PROC_SLEEPING) {
+        sleep_remove(pcb);
+        kunlock(KLOCK_SLEEP, saved);
+        return;
+    }
+    kunlock(KLOCK_SLEEP, saved);
+
+    if (pcb->state == PROC_BLOCKED) {
+        uint32_t lock = pcb->wait_lock;
+        saved = klock(lock);
+        if (pcb->state == PROC_BLOCKED) {
+            DLL_REMOVE(*pcb->wait_queue, pcb, next, prev);
+            pcb->wait_queue = NULL;
+            kunlock(lock, saved);
+            return;
+        }
+        kunlock(lock, saved);
+    }
+    sched_dequeue(pcb);
+}
+
+/*
+Body of the idle process. SysTick is only running if a sleeper is due, so the
+core stays halted until then, until a device interrupt, or until the other
+core signals an event because a process became ready that this core could
+take. Any of these triggers a pass through the scheduler. Before halting, the
+processes that exited on this core are released, and freed zone elements are
+zeroed, so that zalloc need not.
+*/
+static void idle_loop(void) {
+    while (1) {
+        process_reap_exited();
+#ifdef ZALLOC_ZERO_IDLE
+        while (zscrub()) {
+        }
+#endif
+        __wfe();
+        sched_reschedule();
+    }
+}
+
+void sched_init(void) {
+    uint32_t core = get_core_num();
+    cycles_per_us = clock_get_hz(clk_sys) / 1000000;
+
+    pcb_t *idle = (pcb_t *)zalloc(KZONE_PCB);
+    assert(idle != NULL);
+    idle->allocated = NULL;
+    idle->priority = SCHED_N_PRIORITIES - 1;
+    idle->core = core;
+
+    void *stack = palloc(IDLE_STACK_SIZE, idle, PALLOC_FLAGS_ANYWHERE, NULL);
+    assert(stack != NULL);
+    process_init_context(idle, stack, IDLE_STACK_SIZE, idle_loop);
+    idle->state = PROC_READY;
+    idle->acct_since = time_us_32();
+    idle_pcb[core] = idle;
+}
+
+/*
+Program this core's SysTick to fire after the given number of cycles, or stop
+it if there is nothing to wake up for (cycles == 0).
+*/
+static void __time_critical_func(tick_program)(uint32_t core, uint32_t cycles) {
+#ifdef SCHED_SWITCH_STATS
+    /*
+    Reloading the counter loses the time spent so far, so bank it. With nothing
+    to wake up for, the counter keeps running without raising the interrupt
+    so that sched_switch_done can still read it.
+    */
+    switch_spent[core] = (switch_start[core] - systick_hw->cvr) & (SYSTICK_MAX_CYCLES - 1);
+    systick_hw->csr = 0;
+    if (cycles == 0) {
+        systick_hw->rvr = SYSTICK_MAX_CYCLES - 1;
+        systick_hw->cvr = 0;
+        systick_hw->csr = SYSTICK_CSR_COUNT;
+        return;
+    }
+#else
+    (void)core;
+    systick_hw->csr = 0;
+    if (cycles == 0) {
+        return;
+    }
+#endif
+    systick_hw->rvr = cycles - 1;
+    systick_hw->cvr = 0;
+    systick_hw->csr = SYSTICK_CSR_RUN;
+}
+
+/*
+Charge the time since the last switch to the process being switched away from
+as running time, and to the process being switched to as waiting time. A
+switch made from SVCall is the outgoing process's own doing (it yielded, slept
+or exited); any other, at the end of its time slice or because a process of
+higher priority became ready, preempts it.
+*/
+static void __time_critical_func(sched_account)(pcb_t *prev, pcb_t *next, uint32_t now) {
+    prev->acct.run_us += now - prev->acct_since;
+    prev->acct_since = now;
+    if ((scb_hw->icsr & M0PLUS_ICSR_VECTACTIVE_BITS) == EXC_NUM_SVCALL) {
+        prev->acct.n_voluntary++;
+    } else {
+        prev->acct.n_preempted++;
+    }
+
+    next->acct.wait_us += now - next->acct_since;
+    next->acct_since = now;
+    next->acct.n_scheduled++;
+}
+
+/*
+Choose the next process to be scheduled on this core, from its own ready
+queues, or else from the other core's.
+
+Sleepers whose wake time has passed are made ready on this core first. The
+scheduler is tickless: SysTick is programmed for the next event only, which is
+the end of the time slice if the chosen process shares its priority with
+another ready process, or another core is busier (see ready_busier), or the
+earliest wake time, whichever comes first. With nothing ready, the idle
+process runs.
+
+A core with nothing to run takes a process from another. So does a core whose
+ready queues hold fewer processes than another's, counting only those that
+would run here: otherwise a process alone on one core keeps it while the
+processes queued on the other share theirs, until it sleeps or blocks. The
+process taken runs next, so that while the load cannot be evened out, as with
+three processes on two cores, the cores trade processes at every time slice.
+*/
+pcb_t *__time_critical_func(sched_get_next)(void) {
+    uint32_t core = get_core_num();
+    uint32_t now = time_us_32();
+    uint32_t saved;
+
+    KTRACE_RECORD(KTRACE_SCHED, pcb_active[core]->pid, 0, 0);
+
+    /*
+    Collect expired sleepers on a temporary list, linked through next, so the
+    sleep and ready queue locks are not held together.
+    */
+    pcb_t *woken = NULL;
+    uint32_t cycles = 0;
+    saved = klock(KLOCK_SLEEP);
+    while (sleep_count > 0 && !TIME_BEFORE(now, sleep_heap[0]->wake_time)) {
+        pcb_t *pcb = sleep_heap[0];
+        sleep_remove(pcb);
+        pcb->state = PROC_READY;
+        pcb->acct_since = pcb->wake_time;
+        pcb->next = woken;
+        woken = pcb;
+    }
+    if (sleep_count > 0) {
+        uint32_t us = sleep_heap[0]->wake_time - now;
+        cycles = us < SYSTICK_MAX_CYCLES / cycles_per_us ?
+                 us * cycles_per_us : SYSTICK_MAX_CYCLES;
+        if (cycles == 0) {
+            cycles = 1;
+        }
+    }
+    kunlock(KLOCK_SLEEP, saved);
+
+    saved = klock(KLOCK_READY(core));
+    if (woken != NULL) {
+        while (woken != NULL) {
+            pcb_t *pcb = woken;
+            woken = pcb->next;
+            ready_push(pcb, core);
+        }
+        __sev();
+    }
+
+    uint32_t top = ready_map[core] != 0 ? ffs32(ready_map[core]) : SCHED_N_PRIORITIES - 1;
+    uint32_t own = ready_count[core][top];
+    if (ready_busier(core, top, own)) {
+        kunlock(KLOCK_READY(core), saved);
+        pcb_t *stolen = ready_steal(core, top, own);
+        saved = klock(KLOCK_READY(core));
+        if (stolen != NULL) {
+            ready_push_head(stolen, core);
+        }
+    }
+
+    pcb_t *next_pcb = ready_pick(core);
+    if (next_pcb == NULL) {
+        next_pcb = idle_pcb[core];
+    } else {
+        /* Nobody else may run it until this core switches away from it. */
+        next_pcb->on_core = core + 1;
+        uint32_t priority = next_pcb->priority;
+        if ((ready_count[core][priority] > 1 ||
+             ready_busier(core, priority, ready_count[core][priority])) &&
+            (cycles == 0 || cycles > SCHED_QUANTUM_CYCLES)) {
+            cycles = SCHED_QUANTUM_CYCLES;
+        }
+    }
+    switch_prev[core] = pcb_active[core];
+    if (next_pcb != switch_prev[core]) {
+        sched_account(switch_prev[core], next_pcb, now);
+    }
+    kunlock(KLOCK_READY(core), saved);
+
+    tick_program(core, cycles);
     return next_pcb;
-}
\ No newline at end of file
+}
+
+/*
+The previous process's registers are now saved on its stack, so it may run on
+another core. Built with SCHED_STACK_CHECK, its stack is checked for overflow
+first, and the process killed if it has. Everything else called from here runs
+from RAM; a process that exited is released later (see process_reap_exited).
+*/
+void __time_critical_func(sched_switch_done)(void) {
+    uint32_t core = get_core_num();
+    pcb_t *prev = switch_prev[core];
+
+#ifdef SCHED_SWITCH_STATS
+    sched_switch_stats_t *stats = &sched_switch_stats[core];
+    uint32_t cycles = switch_spent[core] + (systick_hw->rvr - systick_hw->cvr);
+
+    stats->n_switches++;
+    stats->cycles_total += cycles;
+    if (cycles < stats->cycles_min) {
+        stats->cycles_min = cycles;
+    }
+    if (cycles > stats->cycles_max) {
+        stats->cycles_max = cycles;
+    }
+#endif
+
+    KTRACE_RECORD(KTRACE_SWITCH, pcb_active[core]->pid, prev->pid, 0);
+
+#ifdef DEMAND_PAGING
+    pager_switch(pcb_active[core]);
+#endif
+
+#ifdef SCHED_STACK_CHECK
+    /*
+    The registers just saved are the deepest the stack goes at a switch, so
+    this is when an overflow is checked for. The process is killed before it
+    can run again on whatever it overwrote; it is still marked as running
+    here, so no other core takes it meanwhile, and process_exit leaves its
+    memory to be released by this core's idle process. An idle process has
+    nothing to be killed in favour of, so its overflow halts the core.
+    */
+    if (process_stack_overflowed(prev)) {
+        KTRACE_RECORD(KTRACE_STACK, prev->pid, prev->saved_sp, prev->stack_base);
+        if (prev == idle_pcb[core]) {
+            halt();
+        }
+        process_exit(prev);
+        return;
+    }
+#endif
+
+    __dmb();
+    prev->on_core = 0;
+}
+
+#ifdef SCHED_SWITCH_STATS
+/*
+Called by schedule_handler before choosing the next process. SysTick counts
+down, and is reloaded before the switch completes by tick_program.
+*/
+void __time_critical_func(sched_switch_begin)(void) {
+    switch_start[get_core_num()] = systick_hw->cvr;
+}
+#endif /* SCHED_SWITCH_STATS */
+
+/*
+Copy one process's accounting, adding the interval in progress: running time if
+a core is running it, waiting time if it is ready, nothing if it sleeps. Idle
+processes are never marked as running on a core, so are checked directly.
+*/
+static void acct_copy(sched_acct_snapshot_t *out, pcb_t *pcb, uint32_t now, uint8_t idle) {
+    int running = idle ? pcb == pcb_active[pcb->core] : pcb->on_core != 0;
+
+    out->pid = pcb->pid;
+    out->priority = pcb->priority;
+    out->state = pcb->state;
+    out->core = pcb->core;
+    out->on_core = pcb->on_core;
+    out->idle = idle;
+    out->stack_size = pcb->stack_size;
+    out->stack_used = process_stack_used(pcb);
+    out->acct = pcb->acct;
+    if (running) {
+        out->acct.run_us += now - pcb->acct_since;
+    } else if (pcb->state == PROC_READY) {
+        out->acct.wait_us += now - pcb->acct_since;
+    }
+}
+
+/*
+The list of live processes finds those in no scheduler queue too: blocked, or
+not yet made ready.
+*/
+uint32_t sched_acct_snapshot(sched_acct_snapshot_t *out, uint32_t max) {
+    uint32_t n = 0;
+    uint32_t now = time_us_32();
+
+    uint32_t saved = klock(KLOCK_PROCS);
+    for (pcb_t *pcb = live_pcbs; pcb && n < max; pcb = pcb->live_next) {
+        uint32_t core = pcb->core;
+        uint32_t saved_ready = klock(KLOCK_READY(core));
+        acct_copy(&out[n++], pcb, now, pcb == idle_pcb[core]);
+        kunlock(KLOCK_READY(core), saved_ready);
+    }
+    kunlock(KLOCK_PROCS, saved);
+    return n;
+}
+
+void sched_reschedule(void) {
+    /* schedule_handler is the SysTick handler, so pend a SysTick exception. */
+    scb_hw->icsr = M0PLUS_ICSR_PENDSTSET_BITS;
+}
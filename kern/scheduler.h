@@ -7,6 +7,84 @@
 #define __SCHED_H__
 #include <stdint.h>
 
+/*
+ * Number of fixed scheduling priority levels. Each level has its own ready
+ * queue, and at most 32 levels fit in the bitmap of non-empty queues.
+ */
+#define SCHED_N_PRIORITIES      8
+#define SCHED_PRIORITY_DEFAULT  (SCHED_N_PRIORITIES / 2)
+
+/*
+ * Number of processor cores, each with its own ready queues and SysTick.
+ */
+#define SCHED_N_CORES           2
+
+/*
+ * Time slice given to a process while others of the same priority are ready,
+ * in processor cycles. SysTick can count at most 2^24 cycles.
+ */
+#define SCHED_QUANTUM_CYCLES    0x10000
+#define SYSTICK_MAX_CYCLES      0x1000000
+
+/*
+ * Capacity of the sleep queue.
+ */
+#define SCHED_MAX_SLEEPERS      32
+
+#ifdef SCHED_SWITCH_STATS
+/*
+ * Context switch latency, maintained per core only when built with
+ * SCHED_SWITCH_STATS. A switch is measured in processor cycles by SysTick,
+ * from schedule_handler choosing the next process until the previous one's
+ * registers are saved and the next one's restored.
+ */
+typedef struct {
+    uint32_t n_switches;    /* Switches measured. */
+    uint32_t cycles_min;    /* Fastest switch. */
+    uint32_t cycles_max;    /* Slowest switch. */
+    uint64_t cycles_total;  /* Sum of all switches; divide by n_switches for the average. */
+} sched_switch_stats_t;
+
+extern sched_switch_stats_t sched_switch_stats[SCHED_N_CORES];
+#endif /* SCHED_SWITCH_STATS */
+
+/*
+ * Scheduling states of a process.
+ */
+#define PROC_READY      0   /* In a ready queue (including while running). */
+#define PROC_SLEEPING   1   /* In the sleep queue until wake_time. */
+#define PROC_BLOCKED    2   /* In a wait queue until woken (see sched_block). */
+#define PROC_NEW        3   /* Created, and not yet made ready (see process_init_context). */
+
+/*
+ * Scheduling accounting kept in every PCB. Times are in microseconds from the
+ * system timer: the Cortex-M0+ has no cycle counter, and SysTick is stopped or
+ * reloaded at every switch. An idle process's waiting time is the time its core
+ * spent running other processes.
+ */
+typedef struct {
+    uint64_t run_us;        /* Time spent running. */
+    uint64_t wait_us;       /* Time spent in a ready queue while not running. */
+    uint32_t n_scheduled;   /* Times switched to. */
+    uint32_t n_voluntary;   /* Switches away from it by its own system call. */
+    uint32_t n_preempted;   /* Switches away from it for any other reason. */
+} sched_acct_t;
+
+/*
+ * One process's entry in a snapshot taken by sched_acct_snapshot.
+ */
+typedef struct {
+    uint16_t        pid;
+    uint8_t         priority;
+    uint8_t         state;      /* PROC_* scheduling state. */
+    uint8_t         core;       /* Core whose ready queues hold the process. */
+    uint8_t         on_core;    /* 1 + core running the process, or 0. */
+    uint8_t         idle;       /* The process is a core's idle process. */
+    uint32_t        stack_size;
+    uint32_t        stack_used; /* Most bytes of its stack ever used (see process_stack_used). */
+    sched_acct_t    acct;
+} sched_acct_snapshot_t;
+
 /*
  * 32-bit register value.
  */
@@ -14,7 +92,9 @@ typedef uint32_t register_t;
 
 /*
  * Represents a single region of memory that has been allocated to, or could
- * be allocated to a process, by the kernel.
+ * be allocated to a process, by the kernel. Where the region's data lies
+ * depends on the heap backend, so it is found through palloc_data (see
+ * palloc.h).
  */
 typedef struct heap_region {
     uint32_t size;   /* Size of region in bytes. */
@@ -26,8 +106,6 @@ typedef struct heap_region {
      */
     struct heap_region     *next;
     struct heap_region     *prev;
-
-    uint8_t data[];     /* Beginning of region's user data. */
 } heap_region_t;
 
 /*
@@ -67,12 +145,143 @@ typedef struct stack_registers stack_registers_t;
 typedef struct process_control_block {
     register_t      saved_sp;       /* Saved stack pointer to recover other registers. */
     heap_region_t  *allocated;      /* List of allocated heap regions. */
+    uint16_t        pid;            /* Process ID, assigned at creation. */
+    uint8_t         priority;       /* Scheduling priority; 0 is the highest. */
+    uint8_t         state;          /* PROC_* scheduling state. */
+    uint8_t         sleep_slot;     /* Index in sleep_heap while sleeping. */
+    uint8_t         core;           /* Core whose ready queues hold this process. */
+    uint8_t         on_core;        /* 1 + core running this process (until its registers are saved), or 0. */
+    uint8_t         wait_lock;      /* Spinlock guarding wait_queue, while blocked. */
+    uint8_t         lent;           /* 1 + priority to take up when next made ready (see sched_set_priority), or 0. */
+    uint32_t        wake_time;      /* time_us_32() at which to wake, while sleeping. */
+    struct process_control_block **wait_queue; /* Wait queue it is in, while blocked. */
+    uint8_t        *stack_base;     /* Lowest address of the process's stack. */
+    uint32_t        stack_size;     /* Size of the stack in bytes, or 0 for stand-in PCBs without one. */
+    uint32_t        acct_since;     /* time_us_32() of the last switch to or from it, or of its waking. */
+    sched_acct_t    acct;           /* Scheduling accounting. */
+    const struct prog_header *image; /* Image the process was loaded from (see loader.h), or NULL. */
+    uint8_t        *span;           /* Where the image's SRAM segments were placed, or NULL. */
+    struct ksync   *held;           /* Mutexes it holds, most recently taken first (see ksync.h). */
+    struct console_ring *console;   /* Its console output ring (see console.h), or NULL. */
+#ifdef DEMAND_PAGING
+    struct pager_space *pager;      /* Demand-paging state (see pager.h), or NULL if not paged. */
+#endif
 
     /*
      * Queue management fields.
      */
     struct process_control_block *next;
     struct process_control_block *prev;
+
+    /*
+     * Links in live_pcbs, the list of every process created and not yet
+     * released (see resources.h).
+     */
+    struct process_control_block *live_next;
+    struct process_control_block *live_prev;
 } pcb_t;
 
+/*
+ * Make a process runnable by appending it to the calling core's ready queue of
+ * its priority. Another core takes it from there if it is idle, or has fewer
+ * processes to share its time between (see sched_get_next). A
+ * reschedule is requested if the process has the same or a higher priority
+ * than the one running on this core.
+ */
+void
+sched_enqueue(pcb_t *pcb);
+
+/*
+ * Remove a runnable process from its ready queue.
+ */
+void
+sched_dequeue(pcb_t *pcb);
+
+/*
+ * Remove a process from whichever scheduler queue it is in, if any.
+ */
+void
+sched_detach(pcb_t *pcb);
+
+/*
+ * Put a runnable process to sleep for at least us microseconds. Returns 0 on
+ * success, or -1 if the sleep queue is full. A reschedule is requested if the
+ * process is running.
+ */
+int
+sched_sleep(pcb_t *pcb, uint32_t us);
+
+/*
+ * Block a runnable process on a wait queue: a list of PCBs linked through next
+ * and prev, guarded by the spinlock lock, which the caller holds. The process
+ * joins the queue behind every process of the same or higher priority, and
+ * stays there until sched_wake takes it off. A reschedule is requested if the
+ * process is running.
+ */
+void
+sched_block(pcb_t *pcb, pcb_t **queue, uint32_t lock);
+
+/*
+ * Make the first process of a wait queue runnable, with the queue's lock held
+ * by the caller, as sched_enqueue does. Returns the process, or NULL if the
+ * queue was empty.
+ */
+pcb_t *
+sched_wake(pcb_t **queue);
+
+/*
+ * Change the priority of a process. One in a ready queue is moved to the queue
+ * of its new priority at once, and 0 returned; a reschedule is requested if it
+ * is in this core's queues. One in no ready queue (new, sleeping, blocked, or
+ * being moved between cores) is lent the priority, to take up when it is next
+ * made ready, and 1 returned; a blocked process keeps its place in its wait
+ * queue meanwhile.
+ */
+int
+sched_set_priority(pcb_t *pcb, uint8_t priority);
+
+/*
+ * Create the calling core's idle process and prepare the scheduler to run on
+ * it. Called once on each core, after the heap and zone allocator are
+ * initialized.
+ */
+void
+sched_init(void);
+
+/*
+ * Choose the next process to run on the calling core, waking any sleepers whose
+ * time has come, taking a process from the other core if this one has nothing
+ * to run, and programming SysTick for the next event. Called from
+ * schedule_handler.
+ */
+pcb_t *
+sched_get_next(void);
+
+/*
+ * Called from schedule_handler once the registers of the process switched away
+ * from are saved, after which another core may run it.
+ */
+void
+sched_switch_done(void);
+
+/*
+ * Copy the accounting of up to max live processes (see live_pcbs in
+ * resources.h), each core's idle process and blocked processes included, to
+ * out, and return the number copied. The time a process has spent running or
+ * waiting since it was last switched is included. Each process is copied
+ * under the lock of the ready queues holding, or last holding, it, so one
+ * waking during the call may be copied as it was before. Finding each
+ * process's stack use scans its stack, so this is for diagnostics only.
+ */
+uint32_t
+sched_acct_snapshot(sched_acct_snapshot_t *out, uint32_t max);
+
+/*
+ * Request that schedule_handler run as soon as no other exception is active.
+ * Code outside the scheduler that makes a process runnable calls this if the
+ * process should be considered before the current time slice ends.
+ */
+void
+sched_reschedule(void);
+
 #endif /* __SCHED_H__ */
@@ -0,0 +1,296 @@
+#include "syscall.h"
+#include "console.h"
+#include "ipc.h"
+#include "ksync.h"
+#include "loader.h"
+#include "pager.h"
+#include "palloc.h"
+#include "pcache.h"
+#include "process.h"
+#include "resources.h"
+#include <stddef.h>
+
+#include "pico/platform.h"
+#include "hardware/structs/scb.h"
+
+static int __time_critical_func(sys_yield)(stack_registers_t *regs) {
+    regs->r0 = 0;
+    return 1;
+}
+
+static int sys_sleep(stack_registers_t *regs) {
+    if (sched_sleep(pcb_active[get_core_num()], regs->r0) != 0) {
+        regs->r0 = (register_t)-1;
+        return 0;
+    }
+    regs->r0 = 0;
+    return 1;
+}
+
+static int sys_getpid(stack_registers_t *regs) {
+    regs->r0 = pcb_active[get_core_num()]->pid;
+    return 0;
+}
+
+static int sys_exit(stack_registers_t *regs) {
+    (void)regs;
+    process_exit(pcb_active[get_core_num()]);
+    return 1;
+}
+
+/*
+Return non-zero if [addr, addr + len) lies in memory allocated to pcb, so that
+the kernel can access it for the process. The pages of a demand-paged process
+are filled first.
+*/
+static int user_range(pcb_t *pcb, register_t addr, register_t len) {
+    for (heap_region_t *region = pcb->allocated; region != NULL; region = region->next) {
+        register_t start = (register_t)(uintptr_t)palloc_data(region);
+        if (addr - start <= region->size && len <= region->size - (addr - start)) {
+#ifdef DEMAND_PAGING
+            if (pcb->pager != NULL) {
+                pager_fill(pcb->pager, addr, len);
+            }
+#endif
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+As user_range, but for a buffer the kernel only reads: it may also lie in one of
+the segments the process executes in place from its image in flash (.rodata,
+say, which holds the string literals the SDK's stdio writes straight out).
+*/
+static int user_range_ro(pcb_t *pcb, register_t addr, register_t len) {
+    if (user_range(pcb, addr, len)) {
+        return 1;
+    }
+    if (pcb->image == NULL) {
+        return 0;
+    }
+    const prog_segment_t *seg = prog_segments(pcb->image);
+    for (uint32_t i = 0; i < pcb->image->n_segments; i++) {
+        if (prog_segment_xip(&seg[i]) && addr - seg[i].addr <= seg[i].file_size &&
+            len <= seg[i].file_size - (addr - seg[i].addr)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int sys_msg_alloc(stack_registers_t *regs) {
+    regs->r0 = (register_t)(uintptr_t)ipc_alloc(pcb_active[get_core_num()], regs->r0);
+    return 0;
+}
+
+static int sys_msg_free(stack_registers_t *regs) {
+    regs->r0 = (register_t)ipc_free(pcb_active[get_core_num()], (void *)(uintptr_t)regs->r0);
+    return 0;
+}
+
+static int sys_send(stack_registers_t *regs) {
+    pcb_t *pcb = pcb_active[get_core_num()];
+    if (!user_range_ro(pcb, regs->r1, regs->r2)) {
+        regs->r0 = (register_t)-1;
+        return 0;
+    }
+    regs->r0 = (register_t)ipc_send(pcb, regs->r0, (const void *)(uintptr_t)regs->r1, regs->r2);
+    return 0;
+}
+
+static int sys_send_region(stack_registers_t *regs) {
+    pcb_t *pcb = pcb_active[get_core_num()];
+    regs->r0 = (register_t)ipc_send_region(pcb, regs->r0, (void *)(uintptr_t)regs->r1, regs->r2);
+    return 0;
+}
+
+/*
+A receiver that blocks is rewound to the svc instruction, so that it receives
+again once woken.
+*/
+static int sys_recv(stack_registers_t *regs) {
+    pcb_t *pcb = pcb_active[get_core_num()];
+    if (!user_range(pcb, regs->r1, regs->r2)) {
+        regs->r0 = (register_t)-1;
+        return 0;
+    }
+    void *data;
+    int result = ipc_recv(pcb, regs->r0, (void *)(uintptr_t)regs->r1, regs->r2, &data, regs->r3 == 0);
+    if (result == IPC_BLOCKED) {
+        regs->pc -= 2;
+        return 1;
+    }
+    regs->r0 = (register_t)result;
+    if (result >= 0) {
+        regs->r1 = (register_t)(uintptr_t)data;
+    }
+    return 0;
+}
+
+static int sys_mutex_create(stack_registers_t *regs) {
+    regs->r0 = (register_t)ksync_mutex_create(regs->r0);
+    return 0;
+}
+
+static int sys_sem_create(stack_registers_t *regs) {
+    regs->r0 = (register_t)ksync_sem_create(regs->r0);
+    return 0;
+}
+
+static int sys_sync_destroy(stack_registers_t *regs) {
+    regs->r0 = (register_t)ksync_destroy(regs->r0);
+    return 0;
+}
+
+/*
+Finish a call that takes a mutex or semaphore. A caller that blocked is handed
+it before being woken, so it returns 0 without making the call again.
+*/
+static int sync_result(stack_registers_t *regs, int result) {
+    if (result == KSYNC_BLOCKED) {
+        regs->r0 = 0;
+        return 1;
+    }
+    regs->r0 = (register_t)result;
+    return 0;
+}
+
+static int sys_lock(stack_registers_t *regs) {
+    return sync_result(regs, ksync_lock(pcb_active[get_core_num()], regs->r0));
+}
+
+static int sys_unlock(stack_registers_t *regs) {
+    regs->r0 = (register_t)ksync_unlock(pcb_active[get_core_num()], regs->r0);
+    return 0;
+}
+
+static int sys_sem_wait(stack_registers_t *regs) {
+    return sync_result(regs, ksync_wait(pcb_active[get_core_num()], regs->r0));
+}
+
+static int sys_sem_post(stack_registers_t *regs) {
+    regs->r0 = (register_t)ksync_post(regs->r0);
+    return 0;
+}
+
+/*
+A writer whose ring is full, or a reader of an empty console, is rewound to the
+svc instruction, so that it makes the call again once woken.
+*/
+static int sys_console_write(stack_registers_t *regs) {
+    pcb_t *pcb = pcb_active[get_core_num()];
+    if (!user_range_ro(pcb, regs->r0, regs->r1)) {
+        regs->r0 = (register_t)-1;
+        return 0;
+    }
+    int result = console_write(pcb, (const void *)(uintptr_t)regs->r0, regs->r1);
+    if (result == CONSOLE_BLOCKED) {
+        regs->pc -= 2;
+        return 1;
+    }
+    regs->r0 = (register_t)result;
+    return 0;
+}
+
+static int sys_console_read(stack_registers_t *regs) {
+    pcb_t *pcb = pcb_active[get_core_num()];
+    if (!user_range(pcb, regs->r0, regs->r1)) {
+        regs->r0 = (register_t)-1;
+        return 0;
+    }
+    int result = console_read(pcb, (void *)(uintptr_t)regs->r0, regs->r1, regs->r2 == 0);
+    if (result == CONSOLE_BLOCKED) {
+        regs->pc -= 2;
+        return 1;
+    }
+    regs->r0 = (register_t)result;
+    return 0;
+}
+
+#ifdef PCACHE
+/*
+Finish a store call with its result. If the other core was using the cache,
+rewind to the svc instruction and yield, so that the call is made again.
+*/
+static int store_result(stack_registers_t *regs, int result) {
+    if (result == PCACHE_BUSY) {
+        regs->pc -= 2;
+        return 1;
+    }
+    regs->r0 = (register_t)result;
+    return 0;
+}
+
+static int sys_store_read(stack_registers_t *regs) {
+    if (!user_range(pcb_active[get_core_num()], regs->r1, regs->r2)) {
+        return store_result(regs, -1);
+    }
+    return store_result(regs, pcache_read(regs->r0, (void *)(uintptr_t)regs->r1, regs->r2));
+}
+
+static int sys_store_write(stack_registers_t *regs) {
+    if (!user_range_ro(pcb_active[get_core_num()], regs->r1, regs->r2)) {
+        return store_result(regs, -1);
+    }
+    return store_result(regs, pcache_write(regs->r0, (const void *)(uintptr_t)regs->r1, regs->r2));
+}
+
+static int sys_store_sync(stack_registers_t *regs) {
+    return store_result(regs, pcache_sync());
+}
+#endif /* PCACHE */
+
+static const syscall_fn_t syscall_table[SYS_N_CALLS] __not_in_flash("syscall_table") = {
+    [SYS_YIELD]     = sys_yield,
+    [SYS_SLEEP]     = sys_sleep,
+    [SYS_GETPID]    = sys_getpid,
+    [SYS_EXIT]      = sys_exit,
+#ifdef PCACHE
+    [SYS_STORE_READ]    = sys_store_read,
+    [SYS_STORE_WRITE]   = sys_store_write,
+    [SYS_STORE_SYNC]    = sys_store_sync,
+#endif
+    [SYS_MSG_ALLOC]     = sys_msg_alloc,
+    [SYS_MSG_FREE]      = sys_msg_free,
+    [SYS_SEND]          = sys_send,
+    [SYS_SEND_REGION]   = sys_send_region,
+    [SYS_RECV]          = sys_recv,
+    [SYS_MUTEX_CREATE]  = sys_mutex_create,
+    [SYS_SEM_CREATE]    = sys_sem_create,
+    [SYS_SYNC_DESTROY]  = sys_sync_destroy,
+    [SYS_LOCK]          = sys_lock,
+    [SYS_UNLOCK]        = sys_unlock,
+    [SYS_SEM_WAIT]      = sys_sem_wait,
+    [SYS_SEM_POST]      = sys_sem_post,
+    [SYS_CONSOLE_WRITE] = sys_console_write,
+    [SYS_CONSOLE_READ]  = sys_console_read,
+};
+
+int __time_critical_func(syscall_dispatch)(register_t psp) {
+    /*
+    Only the hardware-stacked half of stack_registers_t is present at this
+    point; r4-r11 are still live in the processor.
+    */
+    stack_registers_t *regs =
+        (stack_registers_t *)(psp - offsetof(stack_registers_t, r0));
+
+    /* The svc instruction is the halfword before the return address. */
+    uint8_t number = *(uint8_t *)(regs->pc - 2);
+    if (number >= SYS_N_CALLS || syscall_table[number] == NULL) {
+        regs->r0 = (register_t)-1;
+        return 0;
+    }
+
+    if (!syscall_table[number](regs)) {
+        return 0;
+    }
+
+    /*
+    The switch happens right away, so a reschedule pended while handling the
+    call (e.g. by sched_sleep or process_exit) would only cost a second pass.
+    */
+    scb_hw->icsr = M0PLUS_ICSR_PENDSTCLR_BITS;
+    return 1;
+}
@@ -0,0 +1,111 @@
+/*
+ * syscall.h:
+ *
+ * System calls made by userspace processes with the svc instruction.
+ *
+ * The system call number is the immediate operand of the svc instruction.
+ * Arguments are passed in r0-r3, and the result is returned in r0; both are
+ * read and written through the registers stacked on exception entry. Calls
+ * that give up the CPU switch to the next process without returning first.
+ *
+ *      svc #SYS_SLEEP      @ r0 = microseconds; returns 0, or -1 on failure
+ *
+ * Kernels built with PCACHE give processes the store, flash for persistent
+ * state behind a write-back cache (see pcache.h). The buffer must lie in memory
+ * the process was given, or, for a write, in its image's flash segments; the
+ * offset is from the start of the store. A call
+ * made while the other core is using the cache yields, and is made again when
+ * the process next runs.
+ *
+ *      svc #SYS_STORE_READ     @ r0 = offset, r1 = buffer, r2 = bytes; returns 0 or -1
+ *      svc #SYS_STORE_WRITE    @ r0 = offset, r1 = buffer, r2 = bytes; returns 0 or -1
+ *      svc #SYS_STORE_SYNC     @ write everything back to flash; returns 0 or -1
+ *
+ * Without PCACHE they return -1.
+ *
+ * Processes pass messages over channels (see ipc.h), either copied, or moved
+ * by handing over a region of memory allocated for the purpose, which is
+ * never copied. Buffers must lie in memory the process was given, or, for a
+ * send, in its image's flash segments. A receive
+ * from an empty channel blocks unless r3 is non-zero, and is made again when
+ * the process is woken.
+ *
+ *      svc #SYS_MSG_ALLOC      @ r0 = bytes; returns the region, or 0
+ *      svc #SYS_MSG_FREE       @ r0 = region; returns 0 or -1
+ *      svc #SYS_SEND           @ r0 = channel, r1 = buffer, r2 = bytes (at most
+ *                              @ IPC_INLINE_MAX); returns 0, or -1 if full
+ *      svc #SYS_SEND_REGION    @ r0 = channel, r1 = region, r2 = bytes; returns
+ *                              @ 0, or -1 if full, the region kept
+ *      svc #SYS_RECV           @ r0 = channel, r1 = buffer, r2 = its bytes,
+ *                              @ r3 = don't wait; returns the message's bytes,
+ *                              @ or -1, with r1 = where they are: the buffer,
+ *                              @ or a region that is now the caller's
+ *
+ * Processes share mutexes and counting semaphores by handle (see ksync.h). A
+ * process that cannot take one blocks, and returns 0 once it has been handed
+ * it.
+ *
+ *      svc #SYS_MUTEX_CREATE   @ r0 = KSYNC_* flags; returns a handle, or -1
+ *      svc #SYS_SEM_CREATE     @ r0 = units; returns a handle, or -1
+ *      svc #SYS_SYNC_DESTROY   @ r0 = handle; returns 0, or -1 if in use
+ *      svc #SYS_LOCK           @ r0 = mutex; returns 0, or -1 if already held
+ *      svc #SYS_UNLOCK         @ r0 = mutex; returns 0, or -1 if not held
+ *      svc #SYS_SEM_WAIT       @ r0 = semaphore; returns 0 or -1
+ *      svc #SYS_SEM_POST       @ r0 = semaphore; returns 0 or -1
+ *
+ * The console (see console.h) is the kernel's UART. A write returns once the
+ * bytes are in the process's output ring, blocking only while the ring is
+ * full; a read from an empty console blocks unless r2 is non-zero. Both are
+ * made again when the process is woken. Buffers must lie in memory the
+ * process was given, or, for a write, in its image's flash segments.
+ *
+ *      svc #SYS_CONSOLE_WRITE  @ r0 = buffer, r1 = bytes; returns the bytes
+ *                              @ taken, or -1 if no output ring is free
+ *      svc #SYS_CONSOLE_READ   @ r0 = buffer, r1 = its bytes, r2 = don't wait;
+ *                              @ returns the bytes read, or 0
+ */
+
+#ifndef __SYSCALL_H__
+#define __SYSCALL_H__
+
+#include "scheduler.h"
+
+#define SYS_YIELD   0   /* Let other ready processes of the same priority run. */
+#define SYS_SLEEP   1   /* Sleep for at least r0 microseconds. */
+#define SYS_GETPID  2   /* Return the caller's process ID. */
+#define SYS_EXIT    3   /* Terminate the caller, releasing all of its memory. */
+#define SYS_STORE_READ  4   /* Read from the store. */
+#define SYS_STORE_WRITE 5   /* Write to the store. */
+#define SYS_STORE_SYNC  6   /* Write the store's cached changes to flash. */
+#define SYS_MSG_ALLOC   7   /* Allocate a region to send as a message. */
+#define SYS_MSG_FREE    8   /* Free a region allocated or received. */
+#define SYS_SEND        9   /* Send a copied message. */
+#define SYS_SEND_REGION 10  /* Send a region, giving it up. */
+#define SYS_RECV        11  /* Receive a message. */
+#define SYS_MUTEX_CREATE 12 /* Create a mutex. */
+#define SYS_SEM_CREATE  13  /* Create a semaphore. */
+#define SYS_SYNC_DESTROY 14 /* Destroy a mutex or semaphore. */
+#define SYS_LOCK        15  /* Take a mutex. */
+#define SYS_UNLOCK      16  /* Release a mutex. */
+#define SYS_SEM_WAIT    17  /* Take a unit of a semaphore. */
+#define SYS_SEM_POST    18  /* Give a unit of a semaphore. */
+#define SYS_CONSOLE_WRITE 19 /* Write to the console. */
+#define SYS_CONSOLE_READ 20 /* Read from the console. */
+
+#define SYS_N_CALLS 21
+
+/*
+ * Handler for a single system call, given the caller's saved registers.
+ * Returns non-zero if the caller should be descheduled.
+ */
+typedef int (*syscall_fn_t)(stack_registers_t *regs);
+
+/*
+ * Run the system call requested by the active process. psp is the process's
+ * stack pointer at exception entry, pointing at its stacked r0. Called from
+ * svc_handler; returns non-zero if a context switch should follow.
+ */
+int
+syscall_dispatch(register_t psp);
+
+#endif /* __SYSCALL_H__ */
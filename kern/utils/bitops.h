@@ -0,0 +1,50 @@
+/*
+ * bitops.h:
+ *
+ * Bit scanning helpers. The Cortex-M0+ has no CLZ instruction, so these use
+ * de Bruijn multiplication, which costs a handful of cycles on the RP2040's
+ * single-cycle multiplier.
+ *
+ * The helpers are always inlined and their tables kept out of flash, as the
+ * scheduler uses them on the context switch path.
+ */
+
+#ifndef __BITOPS_H__
+#define __BITOPS_H__
+#include <stdint.h>
+
+#include "pico/platform.h"
+
+/*
+ * Index of the least significant set bit of x. x must be non-zero.
+ */
+__attribute__((always_inline)) static inline uint32_t
+ffs32(uint32_t x)
+{
+    static const uint8_t table[32] __not_in_flash("bitops") = {
+        0,  1,  28, 2,  29, 14, 24, 3,  30, 22, 20, 15, 25, 17, 4,  8,
+        31, 27, 13, 23, 21, 19, 16, 7,  26, 12, 18, 6,  11, 5,  10, 9,
+    };
+    return table[((x & -x) * 0x077CB531u) >> 27];
+}
+
+/*
+ * Index of the most significant set bit of x, i.e. floor(log2(x)). x must be
+ * non-zero.
+ */
+__attribute__((always_inline)) static inline uint32_t
+fls32(uint32_t x)
+{
+    static const uint8_t table[32] __not_in_flash("bitops") = {
+        0,  9,  1,  10, 13, 21, 2,  29, 11, 14, 16, 18, 22, 25, 3,  30,
+        8,  12, 20, 28, 15, 17, 24, 7,  19, 27, 23, 6,  26, 5,  4,  31,
+    };
+    x |= x >> 1;
+    x |= x >> 2;
+    x |= x >> 4;
+    x |= x >> 8;
+    x |= x >> 16;
+    return table[(x * 0x07C4ACDDu) >> 27];
+}
+
+#endif /* __BITOPS_H__ */
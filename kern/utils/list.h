@@ -50,6 +50,35 @@
         (tail) = (elem);                                                       \
     } while (0)
 
+/*
+ * Pop the most recently pushed element from a single link list used as a stack
+ * (LIFO). Sets out to NULL if the list is empty.
+ *
+ * - head:  points to first element in the list.
+ * - out:   will be pointed to the popped element.
+ * - next:  name of "next" field in the list struct.
+ */
+#define SLL_STACK_POP(head, out, next)                                         \
+    do {                                                                       \
+        (out) = (head);                                                        \
+        if ((head) != NULL) {                                                  \
+            (head) = (head)->next;                                             \
+        }                                                                      \
+    } while (0)
+
+/*
+ * Push an element onto the head of a single link list used as a stack (LIFO).
+ *
+ * - head:  points to first element in the list.
+ * - elem:  pointer to element to be pushed onto list.
+ * - next:  name of "next" field in the list struct.
+ */
+#define SLL_STACK_PUSH(head, elem, next)                                       \
+    do {                                                                       \
+        (elem)->next = (head);                                                 \
+        (head) = (elem);                                                       \
+    } while (0)
+
 /*
  * Pop an element from the head of a double link list (FIFO). Sets out to NULL
  * if the list is empty. Note that forward ("next") pointers are non-circular,
@@ -21,6 +21,22 @@
         /* asm("bkpt #0");             Put us in debug mode. */                \
     } while (0)
 
+/*
+ * Stop this core for good, whatever panic() does, for faults that must never
+ * be carried past. Without a debugger attached, the breakpoint escalates to a
+ * HardFault, which also hangs when taken by the kernel.
+ */
+#ifdef __arm__
+#define halt()                                                                 \
+    do {                                                                       \
+        asm volatile ("bkpt #0");                                              \
+        while (1) {                                                            \
+        }                                                                      \
+    } while (0)
+#else
+#define halt() __builtin_trap()
+#endif
+
 #undef assert
 #define assert(condition)                                                      \
     do {                                                                       \
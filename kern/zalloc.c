@@ -1,4 +1,8 @@
 #include "zalloc.h"
+#include "klock.h"
+#include "ksync.h"
+#include "ktrace.h"
+#include "palloc.h"
 #include "scheduler.h"
 #include "utils/list.h"
 #include "utils/panic.h"
@@ -10,11 +14,55 @@
 kzone_desc_t zone_table[N_KZONES]; //__attribute__((section("kernel_private_state")));
 
 /*
- * Create each zone.
+ * Create each zone. The static slab of the PCB zone holds the kernel's own
+ * PCB, the boot PCB of core 1, both idle processes and the first few
+ * processes; further PCBs come from slabs grown from the heap.
  */
-#define PCB_ZONE_ELEMS 32
+#define PCB_ZONE_ELEMS 8
+#define PCB_ZONE_SLAB_ELEMS 8
 pcb_t zone_pcbs[PCB_ZONE_ELEMS];
 
+/*
+ * Mutexes and semaphores are created by processes, a few each; the static
+ * slab holds what a handful of processes need.
+ */
+#define SYNC_ZONE_ELEMS 8
+#define SYNC_ZONE_SLAB_ELEMS 16
+ksync_t zone_syncs[SYNC_ZONE_ELEMS];
+
+/*
+ * Owner of the slabs grown from the heap, which are kept on its allocated
+ * list.
+ */
+static pcb_t slab_owner;
+
+/*
+ * Bytes at the start of a grown slab's heap region taken by its header,
+ * rounded so that the elements that follow stay 8-byte aligned.
+ */
+#define SLAB_HEADER_SIZE ((sizeof(kzone_slab_t) + 7) & ~7u)
+
+/*
+ * Zero a slab's elements and push them all onto its free list, in reverse, so
+ * that the first allocation is the first element.
+ */
+static void
+slab_init(
+    kzone_desc_t   *desc,
+    kzone_slab_t   *slab,
+    void           *start,
+    uint16_t        n_elems)
+{
+    slab->start = start;
+    slab->n_elems = n_elems;
+    slab->n_free = n_elems;
+    slab->free_head = NULL;
+    memset(start, 0, (uint32_t)n_elems * desc->elem_size);
+    for (int i = n_elems - 1; i >= 0; i--) {
+        kzone_elem_t *elem = (kzone_elem_t *)(slab->start + i * desc->elem_size);
+        SLL_STACK_PUSH(slab->free_head, elem, next);
+    }
+}
 
 /*
  * Initializes an individual zone.
@@ -23,17 +71,17 @@ static void
 initialize_zone(
     kzone_id_t  id,
     uint16_t    n_elems,
+    uint16_t    slab_elems,
     uint16_t    elem_size,
     void       *start)
 {
     kzone_desc_t *desc = &zone_table[id];
     desc->n_elems = n_elems;
     desc->elem_size = elem_size;
-    desc->zone_start = (kzone_elem_t *)start;
-    for (int i = 0; i < desc->n_elems; i++) {
-        kzone_elem_t *elem = (kzone_elem_t *)(desc->zone_start + i * desc->elem_size);
-        SLL_PUSH(desc->free_head, desc->free_tail, elem, next);
-    }
+    desc->slab_elems = slab_elems;
+    desc->slabs = NULL;
+    slab_init(desc, &desc->first_slab, start, n_elems);
+    DLL_PUSH(desc->slabs, &desc->first_slab, next, prev);
 }
 
 /*
@@ -43,31 +91,161 @@ initialize_zone(
 void
 zinit(void)
 {
-    kzone_desc_t *desc;
-
-    initialize_zone(KZONE_PCB, PCB_ZONE_ELEMS, sizeof(pcb_t), zone_pcbs);
+    initialize_zone(KZONE_PCB, PCB_ZONE_ELEMS, PCB_ZONE_SLAB_ELEMS, sizeof(pcb_t), zone_pcbs);
+    initialize_zone(KZONE_SYNC, SYNC_ZONE_ELEMS, SYNC_ZONE_SLAB_ELEMS, sizeof(ksync_t), zone_syncs);
     /*
      * Register the next zone here.
      */
 }
 
+/*
+ * Carve a new slab out of the heap and make it the zone's first. Called
+ * without the zone lock, which must not be held with the heap lock. Returns 0
+ * on success, or -1 if the heap is exhausted.
+ */
+static int
+zone_grow(kzone_desc_t *desc)
+{
+    uint32_t size = SLAB_HEADER_SIZE + (uint32_t)desc->slab_elems * desc->elem_size;
+    kzone_slab_t *slab = palloc(size, &slab_owner, PALLOC_FLAGS_ANYWHERE, NULL);
+    if (slab == NULL) {
+        return -1;
+    }
+    slab_init(desc, slab, (uint8_t *)slab + SLAB_HEADER_SIZE, desc->slab_elems);
+
+    uint32_t saved = klock(KLOCK_ZONES);
+    DLL_INSERT(desc->slabs, (kzone_slab_t *)NULL, slab, next, prev);
+    desc->n_elems += slab->n_elems;
+    desc->n_grows++;
+    kunlock(KLOCK_ZONES, saved);
+    return 0;
+}
+
+/*
+ * Find the slab holding an element, or return NULL if the element is in none
+ * of the zone's slabs, or, built with ZALLOC_DEBUG, is not at an element
+ * boundary. The slab freed to last is checked first. Called with the zone lock
+ * held.
+ *
+ * This walks the slabs, so zfree costs O(slabs) rather than a push onto one
+ * zone-wide free list: the price of counting free elements per slab, which
+ * lets an entirely free slab go back to the heap. Zones grow a slab at a time,
+ * so they hold a handful.
+ */
+static kzone_slab_t *
+slab_find(
+    kzone_desc_t   *desc,
+    void           *elem)
+{
+    for (kzone_slab_t *slab = desc->slabs; slab; slab = slab->next) {
+        uint32_t offset = (uint32_t)((uint8_t *)elem - slab->start);
+        if ((uint8_t *)elem < slab->start ||
+            offset >= (uint32_t)slab->n_elems * desc->elem_size) {
+            continue;
+        }
+#ifdef ZALLOC_DEBUG
+        if (offset % desc->elem_size != 0) {
+            return NULL;
+        }
+#endif
+        return slab;
+    }
+    return NULL;
+}
+
+/*
+ * Push a zeroed element onto its slab's free list and make the slab the zone's
+ * first. Returns the slab, detached from the zone, if it should go back to the
+ * heap: it is entirely free, it was grown from the heap, and the zone has free
+ * elements in another slab, so that a zone hovering at a slab boundary does
+ * not take and return a slab on every call. Called with the zone lock held.
+ */
+static kzone_slab_t *
+slab_return(
+    kzone_desc_t   *desc,
+    kzone_slab_t   *slab,
+    kzone_elem_t   *elem)
+{
+    SLL_STACK_PUSH(slab->free_head, elem, next);
+    slab->n_free++;
+    if (slab != desc->slabs) {
+        DLL_REMOVE(desc->slabs, slab, next, prev);
+        DLL_INSERT(desc->slabs, (kzone_slab_t *)NULL, slab, next, prev);
+    }
+
+    if (slab->n_free < slab->n_elems || slab == &desc->first_slab ||
+        slab->next == NULL || slab->next->free_head == NULL) {
+        return NULL;
+    }
+    DLL_REMOVE(desc->slabs, slab, next, prev);
+    desc->n_elems -= slab->n_elems;
+    desc->n_shrinks++;
+    return slab;
+}
+
 void *
 zalloc(kzone_id_t zone)
 {
     /*
-     * Find the zone and check that it's not exhausted.
+     * Find the zone and pop the most recently freed element from its first
+     * slab. Slabs with free elements are kept ahead of full ones, so if the
+     * first has none, the zone must grow.
      */
     kzone_desc_t *zone_desc = &zone_table[zone];
-    if (!zone_desc->free_head) {
-        return NULL;
+    kzone_elem_t *elem;
+#ifdef ZALLOC_ZERO_IDLE
+    int dirty = 0;
+#endif
+    uint32_t saved = klock(KLOCK_ZONES);
+    while (1) {
+        kzone_slab_t *slab = zone_desc->slabs;
+        if (slab->free_head != NULL) {
+            SLL_STACK_POP(slab->free_head, elem, next);
+            slab->n_free--;
+            if (slab->free_head == NULL && slab->next != NULL) {
+                DLL_REMOVE(zone_desc->slabs, slab, next, prev);
+                DLL_PUSH(zone_desc->slabs, slab, next, prev);
+            }
+            break;
+        }
+#ifdef ZALLOC_ZERO_IDLE
+        /*
+         * The idle process has not caught up: zero a dirty element here
+         * instead.
+         */
+        if (zone_desc->dirty_head != NULL) {
+            SLL_STACK_POP(zone_desc->dirty_head, elem, next);
+            dirty = 1;
+            break;
+        }
+#endif
+
+        kunlock(KLOCK_ZONES, saved);
+        int grown = zone_grow(zone_desc);
+        saved = klock(KLOCK_ZONES);
+        if (grown < 0) {
+            zone_desc->n_failed++;
+            kunlock(KLOCK_ZONES, saved);
+            KTRACE_RECORD(KTRACE_ZALLOC, 0, 0, zone);
+            return NULL;
+        }
+    }
+    zone_desc->n_allocs++;
+    if (++zone_desc->n_used > zone_desc->high_water) {
+        zone_desc->high_water = zone_desc->n_used;
     }
+    kunlock(KLOCK_ZONES, saved);
+    KTRACE_RECORD(KTRACE_ZALLOC, 0, elem, zone);
 
     /*
-     * Pop an element from the free list, zero it, and return it.
+     * Free elements are zeroed already, except for the link.
      */
-    kzone_elem_t *elem;
-    SLL_POP(zone_desc->free_head, zone_desc->free_tail, elem, next);
-    memset(elem, 0, zone_desc->elem_size);
+#ifdef ZALLOC_ZERO_IDLE
+    if (dirty) {
+        memset(elem, 0, zone_desc->elem_size);
+    }
+#endif
+    elem->next = NULL;
 
     return (void *)elem;
 }
@@ -78,15 +256,107 @@ zfree(
     kzone_id_t zone)
 {
     /*
-     * Find the zone and sanity-check that this element is valid.
+     * Find the zone and the element's slab, which also checks that this
+     * element is valid.
      */
     kzone_desc_t *zone_desc = &zone_table[zone];
-    // assert(elem >= zone_desc->zone_start &&
-    //        elem <= zone_desc->zone_start + zone_desc->elem_size * (zone_desc->n_elems - 1), "tried to free out-of-range element at %p from zone %d (%hu elements of size %hu bytes at %p).\n", elem, zone, zone_desc->n_elems, zone_desc->elem_size, zone_desc->zone_start);
-    // assert((uint32_t)elem - (uint32_t)zone_desc->zone_start % zone_desc->elem_size == 0, "tried to free unaligned element at %p from zone %d (%hu elements of size %hu bytes at %p).\n", elem, zone, zone_desc->n_elems, zone_desc->elem_size, zone_desc->zone_start);
+    KTRACE_RECORD(KTRACE_ZFREE, 0, elem, zone);
+    uint32_t saved = klock(KLOCK_ZONES);
+    kzone_slab_t *slab = slab_find(zone_desc, elem);
+    if (slab == NULL) {
+        kunlock(KLOCK_ZONES, saved);
+#ifdef ZALLOC_DEBUG
+        /*
+         * Whatever does own the memory would be corrupted by carrying on, so
+         * stop with the culprit traced.
+         */
+        KTRACE_RECORD(KTRACE_ZFREE_BAD, 0, elem, zone);
+        halt();
+#endif
+        return;
+    }
+    zone_desc->n_frees++;
+    zone_desc->n_used--;
 
     /*
-     * Return the element to free list.
+     * Return the element to its slab, zeroed, unless the idle process does
+     * that.
      */
-    SLL_PUSH(zone_desc->free_head, zone_desc->free_tail, (kzone_elem_t *)elem, next);
+#ifdef ZALLOC_ZERO_IDLE
+    SLL_STACK_PUSH(zone_desc->dirty_head, (kzone_elem_t *)elem, next);
+    kunlock(KLOCK_ZONES, saved);
+#else
+    memset(elem, 0, zone_desc->elem_size);
+    kzone_slab_t *unused = slab_return(zone_desc, slab, elem);
+    kunlock(KLOCK_ZONES, saved);
+    if (unused != NULL) {
+        pfree(unused, &slab_owner);
+    }
+#endif
+}
+
+void
+ztrim(void)
+{
+    for (int zone = 0; zone < N_KZONES; zone++) {
+        kzone_desc_t *zone_desc = &zone_table[zone];
+
+        /*
+         * One slab at a time, since the heap lock cannot be taken under the
+         * zone lock.
+         */
+        while (1) {
+            kzone_slab_t *unused = NULL;
+            uint32_t saved = klock(KLOCK_ZONES);
+            for (kzone_slab_t *slab = zone_desc->slabs; slab; slab = slab->next) {
+                if (slab != &zone_desc->first_slab && slab->n_free == slab->n_elems) {
+                    unused = slab;
+                    break;
+                }
+            }
+            if (unused != NULL) {
+                DLL_REMOVE(zone_desc->slabs, unused, next, prev);
+                zone_desc->n_elems -= unused->n_elems;
+                zone_desc->n_shrinks++;
+            }
+            kunlock(KLOCK_ZONES, saved);
+
+            if (unused == NULL) {
+                break;
+            }
+            pfree(unused, &slab_owner);
+        }
+    }
+}
+
+#ifdef ZALLOC_ZERO_IDLE
+int
+zscrub(void)
+{
+    for (int zone = 0; zone < N_KZONES; zone++) {
+        kzone_desc_t *zone_desc = &zone_table[zone];
+        if (zone_desc->dirty_head == NULL) {
+            continue;
+        }
+
+        /*
+         * Zero under the lock, so that zalloc never finds the zone empty
+         * while an element is in neither list. Elements are small.
+         */
+        kzone_elem_t *elem;
+        kzone_slab_t *unused = NULL;
+        uint32_t saved = klock(KLOCK_ZONES);
+        SLL_STACK_POP(zone_desc->dirty_head, elem, next);
+        if (elem != NULL) {
+            memset(elem, 0, zone_desc->elem_size);
+            unused = slab_return(zone_desc, slab_find(zone_desc, elem), elem);
+        }
+        kunlock(KLOCK_ZONES, saved);
+        if (unused != NULL) {
+            pfree(unused, &slab_owner);
+        }
+        return 1;
+    }
+    return 0;
 }
+#endif /* ZALLOC_ZERO_IDLE */
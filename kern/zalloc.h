@@ -14,6 +14,7 @@
  */
 typedef enum {
    KZONE_PCB,       /* pcb_t */
+   KZONE_SYNC,      /* ksync_t */
    N_KZONES
 } kzone_id_t;
 
@@ -26,15 +27,51 @@ typedef struct kzone_element {
     struct kzone_element *next;     /* Next free element, if not allocated. */
 } kzone_elem_t;
 
+/*
+ * A contiguous run of elements belonging to one zone. Every zone has a static
+ * slab, sized for what the kernel needs at boot, and grows by further slabs
+ * carved out of the palloc heap when it runs out. Those slabs are returned to
+ * the heap once all of their elements are free again.
+ */
+typedef struct kzone_slab {
+    struct kzone_slab  *next;       /* Zone's slabs; those with free elements first. */
+    struct kzone_slab  *prev;
+    kzone_elem_t       *free_head;  /* Stack of zeroed free elements. */
+    uint8_t            *start;      /* First element. */
+    uint16_t            n_elems;    /* Number of elements in the slab. */
+    uint16_t            n_free;     /* Number of elements on free_head. */
+} kzone_slab_t;
+
 /*
  * Describes the contents and state of the zone for use by the allocator.
+ *
+ * Free elements are kept on a stack in each slab, and the slab freed to most
+ * recently is allocated from first, so the element freed most recently, and
+ * most likely still in cache, is the next one allocated. Elements on the free
+ * lists are already zero apart from their link. With ZALLOC_ZERO_IDLE, freed
+ * elements instead wait on the dirty list until the idle process zeroes them
+ * (see zscrub); until then they count as used by their slab.
  */
 typedef struct {
-    uint16_t        n_elems;        /* Number of elements in this zone. */
+    uint16_t        n_elems;        /* Number of elements in this zone's slabs. */
     uint16_t        elem_size;      /* sizeof(type). */
-    void           *zone_start;     /* First byte in the zone. */
-    kzone_elem_t   *free_head;      /* First element in the free list (to pop). */
-    kzone_elem_t   *free_tail;      /* Last element in the free list (to push). */
+    uint16_t        slab_elems;     /* Number of elements in each slab grown from the heap. */
+    kzone_slab_t   *slabs;          /* Slabs, the static one included. */
+    kzone_slab_t    first_slab;     /* The static slab. */
+#ifdef ZALLOC_ZERO_IDLE
+    kzone_elem_t   *dirty_head;     /* Stack of free elements still to be zeroed. */
+#endif
+
+    /*
+     * Usage counters.
+     */
+    uint32_t        n_allocs;       /* Successful allocations. */
+    uint32_t        n_frees;        /* Elements freed. */
+    uint32_t        n_failed;       /* Allocations that found the zone exhausted. */
+    uint32_t        n_grows;        /* Slabs taken from the heap. */
+    uint32_t        n_shrinks;      /* Slabs returned to the heap. */
+    uint16_t        n_used;         /* Elements currently allocated. */
+    uint16_t        high_water;     /* Most elements ever allocated at once. */
 } kzone_desc_t;
 
 /*
@@ -49,16 +86,37 @@ void
 zinit(void);
 
 /*
- * Allocate a zeroed element from the specified zone. Returns NULL if zone is
- * exhausted.
+ * Allocate a zeroed element from the specified zone, growing the zone from the
+ * heap if it is exhausted. Returns NULL if the heap is exhausted too.
  */
 void *
 zalloc(kzone_id_t zone);
 
 /*
- * Returns the given element to the free list of the specified zone.
+ * Returns the given element to the free list of the specified zone, and the
+ * element's slab to the heap if the slab is then unused and the zone has free
+ * elements elsewhere. Built with ZALLOC_DEBUG, elements outside the zone's
+ * slabs or not at an element boundary are caught: traced (see ktrace.h), and
+ * the core halted. Otherwise they are ignored.
  */
 void
 zfree(void *elem, kzone_id_t zone);
 
+/*
+ * Return every entirely free slab grown from the heap to the heap, whether or
+ * not its zone has free elements elsewhere.
+ */
+void
+ztrim(void);
+
+#ifdef ZALLOC_ZERO_IDLE
+/*
+ * Zero one element waiting on a dirty list and return it to its slab, as
+ * zfree would. Returns 0 once there was nothing left to zero. Called by the idle
+ * process.
+ */
+int
+zscrub(void);
+#endif
+
 #endif /* __ZALLOC_H__ */
@@ -0,0 +1,77 @@
+/*
+ * console_stdio.c:
+ *
+ * An SDK stdio driver that writes and reads through the kernel's console (see
+ * kern/console.h), so that printf returns once the text is in the process's
+ * output ring instead of driving the UART itself. The program registers it
+ * first thing in main (see console_stdio.h): the kernel starts a process at
+ * main, so constructors never run.
+ *
+ * Reads do not wait, as stdio polls its drivers, so getchar spins until bytes
+ * arrive; a process that would rather block can make SYS_CONSOLE_READ with
+ * r2 = 0 itself.
+ */
+
+#include "console_stdio.h"
+
+#include "pico/stdio.h"
+#include "pico/stdio/driver.h"
+
+#include "kern/syscall.h"
+
+static int
+console_svc_write(const char *buf, int len)
+{
+    register const char *r0 asm("r0") = buf;
+    register int r1 asm("r1") = len;
+    asm volatile("svc %[n]" : "+r"(r0) : "r"(r1), [n] "i"(SYS_CONSOLE_WRITE) : "memory");
+    return (int)r0;
+}
+
+static int
+console_svc_read(char *buf, int len)
+{
+    register char *r0 asm("r0") = buf;
+    register int r1 asm("r1") = len;
+    register int r2 asm("r2") = 1;
+    asm volatile("svc %[n]" : "+r"(r0) : "r"(r1), "r"(r2), [n] "i"(SYS_CONSOLE_READ) : "memory");
+    return (int)r0;
+}
+
+/*
+ * The kernel takes as much as the ring has room for, and blocks the process
+ * while it is full, so this only loops on a long write.
+ */
+static void
+console_out_chars(const char *buf, int len)
+{
+    while (len > 0) {
+        int n = console_svc_write(buf, len);
+        if (n <= 0) {
+            return;
+        }
+        buf += n;
+        len -= n;
+    }
+}
+
+static int
+console_in_chars(char *buf, int len)
+{
+    int n = console_svc_read(buf, len);
+    return n > 0 ? n : PICO_ERROR_NO_DATA;
+}
+
+static stdio_driver_t console_driver = {
+    .out_chars = console_out_chars,
+    .in_chars = console_in_chars,
+#if PICO_STDIO_ENABLE_CRLF_SUPPORT
+    .crlf_enabled = PICO_STDIO_DEFAULT_CRLF,
+#endif
+};
+
+void
+console_stdio_init(void)
+{
+    stdio_set_driver_enabled(&console_driver, true);
+}
@@ -0,0 +1,17 @@
+/*
+ * console_stdio.h:
+ *
+ * Stdio through the kernel's console (see console_stdio.c).
+ */
+
+#ifndef __CONSOLE_STDIO_H__
+#define __CONSOLE_STDIO_H__
+
+/*
+ * Send stdio to the kernel's console. Call before the first printf; nothing
+ * runs before main in a process the kernel has loaded.
+ */
+void
+console_stdio_init(void);
+
+#endif /* __CONSOLE_STDIO_H__ */
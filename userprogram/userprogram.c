@@ -2,6 +2,10 @@
 
 #include "pico/stdlib.h"
 
+#ifdef USERPROGRAM_CONSOLE
+#include "console_stdio.h"
+#endif
+
 // int main() {
 //   int delay = 1000;
 //   // Initialise I/O
@@ -24,12 +28,19 @@
 int main() {
   int delay = 1000;
   // Initialise I/O
+#ifdef USERPROGRAM_CONSOLE
+  // The kernel starts the program here, without running constructors, so
+  // the console's stdio driver is registered by hand
+  console_stdio_init();
+#else
   // stdio_init_all();
+#endif
   timer_hw->dbgpause = 0;
 
   // initialise GPIO (Green LED connected to pin 2)
   gpio_init(2);
   gpio_set_dir(2, GPIO_OUT);
+  printf("userprogram: blinking GPIO 2\n");
 
   // Main Loop
   while (1) {